@@ -141,7 +141,7 @@ DtcwtTemps::DtcwtTemps(cl::Context& context,
 
 
 
-DtcwtOutput DtcwtTemps::createOutputs()
+DtcwtOutput DtcwtTemps::createOutputs(bool interleaved)
 {
     // Construct an output structure, using the sizes we already know
 
@@ -150,15 +150,31 @@ DtcwtOutput DtcwtTemps::createOutputs()
     output.startLevel_ = startLevel_;
     output.numLevels_ = numLevels_;
 
+    // All the levels live in the one buffer, one after the other, so
+    // that kernels can work across several levels at once
+    size_t totalSize = 0;
+    for (const auto& levelTemp: levelTemps_)
+        if (levelTemp.producesOutputs_)
+            totalSize += Subbands::size(levelTemp.outputWidth_ / 2,
+                                        levelTemp.outputHeight_ / 2,
+                                        0, 1, 6, interleaved);
+
+    cl::Buffer buffer {
+        context_, CL_MEM_READ_WRITE,
+        totalSize * ImageElementTraits<Complex<cl_float>>::size
+    };
+
+    size_t offset = 0;
     for (const auto& levelTemp: levelTemps_)
         if (levelTemp.producesOutputs_) {
 
-            output.levels_.emplace_back(context_, 
-                    CL_MEM_READ_WRITE,
+            output.levels_.emplace_back(buffer, offset,
                     levelTemp.outputWidth_ / 2,
                     levelTemp.outputHeight_ / 2,
                     0, 1,
-                    6);
+                    6, interleaved);
+
+            offset += output.levels_.back().numElements();
 
             // Add a three-long vector to the list of wait events
             output.doneEvents_.emplace_back(3);
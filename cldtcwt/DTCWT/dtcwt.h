@@ -78,7 +78,10 @@ private:
     std::vector<LevelTemps> levelTemps_;
 
 public:
-    DtcwtOutput createOutputs();
+    DtcwtOutput createOutputs(bool interleaved = false);
+    // The output levels are all laid out in the same buffer.  interleaved
+    // stores the six subbands' values for each pixel together (see 
+    // ImageBuffer), which suits kernels sampling all of them at a point.
 
     DtcwtTemps(cl::Context& context,
                size_t imageWidth, size_t imageHeight, 
@@ -59,6 +59,7 @@ void AbsToRGBA::operator() (cl::CommandQueue& cq,
     kernel_.setArg(3, cl_uint(input.stride()));
     kernel_.setArg(4, sizeof(output), &output);
     kernel_.setArg(5, cl_float(gain));
+    kernel_.setArg(6, cl_uint(input.step()));
 
     // Execute
     cq.enqueueNDRangeKernel(kernel_, cl::NullRange,
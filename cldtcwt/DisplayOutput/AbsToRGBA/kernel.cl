@@ -5,7 +5,8 @@ void absToRGBA(const __global float2* input,
                unsigned int padding,
                unsigned int stride,
                __write_only image2d_t output,
-               float gain)
+               float gain,
+               unsigned int step)
 {
     int2 pos = (int2) (get_global_id(0), get_global_id(1));
 
@@ -13,7 +14,7 @@ void absToRGBA(const __global float2* input,
     if (all(pos < get_image_dim(output))) {
 
         float v = gain * 
-            fast_length(input[start + pos.x + stride * pos.y]);
+            fast_length(input[start + pos.x * step + stride * pos.y]);
         write_imagef(output, pos, (float4) (v, v, v, 1.0f));
 
     }
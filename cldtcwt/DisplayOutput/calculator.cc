@@ -1,19 +1,55 @@
 // Copyright (C) 2013 Timothy Gale
 #include "calculator.h"
 #include "util/clUtil.h"
+#include <atomic>
+#include <stdexcept>
+
+
+
+struct KeypointReadback {
+
+    // State for reading back the keypoints, shared with the event callbacks
+    // so it outlives them
+
+    cl::CommandQueue cq;
+
+    // Where to read from on the device
+    cl::Buffer cumCounts, locations, descriptors;
+    size_t cumCountsTotalPos;
+    size_t numFloatsPerLocation, numFloatsPerDescriptor;
+    std::vector<cl::Event> descriptorsReady;
+
+    // Pinned host memory, and the pointers it is permanently mapped to
+    cl::Buffer countHost, locationsHost, descriptorsHost;
+    cl_uint* count;
+    float* locationsPtr;
+    float* descriptorsPtr;
+
+    // Done when the readback has finished with the device buffers
+    cl::UserEvent done;
+
+    std::atomic<bool> pending;
+    std::function<void (const KeypointData&)> callback;
+
+};
 
 
 Calculator::Calculator(cl::Context& context,
                        const cl::Device& device,
                        int width, int height,
                        int maxNumKeypoints)
- :  commandQueue(context, device),
+ :  context(context),
+    commandQueue(context, device),
     dtcwt(context, {device}, 0.5f),
     abs(context, {device}),
     energyMap(context, {device}),
     peakDetector(context, {device}),
-    descriptorExtracter_(context, {device}, peakDetector.getPosLength()),
-    maxNumKeypoints_(maxNumKeypoints)
+    descriptorExtracter_(context, {device}, peakDetector.getPosLength(),
+                         false, DescriptorFormat::Float,
+                         KeypointOrientation::Estimate),
+    maxNumKeypoints_(maxNumKeypoints),
+    readbackQueue_(context, device),
+    readback_(std::make_shared<KeypointReadback>())
 {
     const int numLevels = 3;
     const int startLevel = 2;
@@ -48,8 +84,7 @@ Calculator::Calculator(cl::Context& context,
     // i.e. allow the maximum number to appear in any given level, but
     // cap overall too to prevent getting more than we can store.
     
-    descriptorsDone_ = std::vector<cl::Event>(energyMaps.size() * 2);
-    // Enough for coarse and fine parts of descriptors being done
+    descriptorsDone_ = std::vector<cl::Event>(1);
 
     // Set up the scales (used in peak detection)
     float s = 4.0f;
@@ -58,6 +93,39 @@ Calculator::Calculator(cl::Context& context,
         s *= 2.0f;
     }
 
+    // Pinned memory to read the keypoints back into, mapped once and for
+    // all so it can be read into directly
+    KeypointReadback& r = *readback_;
+    r.cq = readbackQueue_;
+    r.pending = false;
+
+    r.cumCounts = peakDetectorResults.cumCounts();
+    r.cumCountsTotalPos = r.cumCounts.getInfo<CL_MEM_SIZE>() 
+                            - sizeof(cl_uint);
+    r.locations = peakDetectorResults.list();
+    r.descriptors = descriptors_;
+    r.numFloatsPerLocation = numFloatsPerKPLocation();
+    r.numFloatsPerDescriptor = numFloatsPerDescriptor();
+
+    const cl_mem_flags pinnedFlags = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    const cl_map_flags mapFlags = CL_MAP_READ | CL_MAP_WRITE;
+
+    r.countHost = cl::Buffer(context, pinnedFlags, sizeof(cl_uint));
+    r.count = static_cast<cl_uint*>(readbackQueue_.enqueueMapBuffer(
+                    r.countHost, CL_TRUE, mapFlags, 0, sizeof(cl_uint)));
+
+    r.locationsHost = cl::Buffer(context, pinnedFlags, 
+                                 r.locations.getInfo<CL_MEM_SIZE>());
+    r.locationsPtr = static_cast<float*>(readbackQueue_.enqueueMapBuffer(
+                    r.locationsHost, CL_TRUE, mapFlags, 
+                    0, r.locations.getInfo<CL_MEM_SIZE>()));
+
+    r.descriptorsHost = cl::Buffer(context, pinnedFlags, 
+                                   descriptors_.getInfo<CL_MEM_SIZE>());
+    r.descriptorsPtr = static_cast<float*>(readbackQueue_.enqueueMapBuffer(
+                    r.descriptorsHost, CL_TRUE, mapFlags, 
+                    0, descriptors_.getInfo<CL_MEM_SIZE>()));
+
 
 }
 
@@ -83,29 +151,29 @@ void Calculator::operator() (ImageBuffer<cl_float>& input,
     for (auto& e: energyMaps)
         emPointers.push_back(&e);
 
-    // Look for peaks
+    // Look for peaks, once any readback of the last keypoints is done
+    std::vector<cl::Event> peakWaitEvents = energyMapsDone;
+    if (readback_->done() != nullptr)
+        peakWaitEvents.push_back(readback_->done);
+
     peakDetector(commandQueue, emPointers, scales, 0.04, 0.f,
                                peakDetectorResults,
-                               energyMapsDone);
-
-    // Extract the descriptors
-    for (size_t l = 0; l < (energyMaps.size() - 1); ++l) {
-        descriptorExtracter_(commandQueue, 
-                dtcwtOut[l], scales[l],      // Subband
-                dtcwtOut[l+1], scales[l+1],  // Parent subband
-                peakDetectorResults.list(),         // Locations of keypoints
-                peakDetectorResults.cumCounts(), l, maxNumKeypoints_, 
-                        // Start indices within list of the different 
-                        // levels; which level to extract; what the maximum
-                        // number of keypoints we could be asking for is.
-                descriptors_,
-                peakDetectorResults.listDone(),
-                        // The cumulative counts rely on everything else
-                        // in the peak detector being done
-                &descriptorsDone_[l], &descriptorsDone_[l + energyMaps.size()]
-                        // Wait for both coarse and fine to be done
-                );
-    }
+                               peakWaitEvents);
+
+    // Extract the descriptors, for all the levels at once
+    descriptorExtracter_(commandQueue, 
+            dtcwtOut, scales,                   // Subbands of each level
+            peakDetectorResults.list(),         // Locations of keypoints
+            peakDetectorResults.cumCounts(), 0, energyMaps.size() - 1,
+            maxNumKeypoints_, 
+                    // Start indices within list of the different 
+                    // levels; which levels to extract; what the maximum
+                    // number of keypoints we could be asking for is.
+            descriptors_, nullptr,
+            peakDetectorResults.listDone(),
+                    // The cumulative counts rely on everything else
+                    // in the peak detector being done
+            &descriptorsDone_[0]);
     
 
 
@@ -205,9 +273,150 @@ cl::Buffer Calculator::keypointCumCounts(void)
 
 std::vector<cl::Event> Calculator::keypointLocationEvents(void)
 {
-    return peakDetectorResults.listDone();
+    std::vector<cl::Event> events = peakDetectorResults.listDone();
+
+    // The descriptor extraction fills in the orientations
+    if (descriptorExtracter_.orientation() != KeypointOrientation::Ignore
+            && descriptorsDone_[0]() != nullptr)
+        events.push_back(descriptorsDone_[0]);
+
+    return events;
+}
+
+
+
+
+
+
+
+size_t Calculator::numFloatsPerDescriptor(void)
+{
+    return descriptorExtracter_.getNumFloatsInDescriptor();
 }
 
 
+std::vector<cl::Event> Calculator::keypointDescriptorEvents(void)
+{
+    return descriptorsDone_;
+}
 
 
+
+static void finishReadback(std::shared_ptr<KeypointReadback> r,
+                           cl_int status, size_t numKeypoints)
+{
+    // Let the device carry on, then hand the results over
+    r->done.setStatus(CL_COMPLETE);
+
+    KeypointData data = {status, numKeypoints, 
+                         r->locationsPtr, r->descriptorsPtr};
+
+    auto callback = std::move(r->callback);
+    r->pending = false;
+
+    callback(data);
+}
+
+
+static void CL_CALLBACK keypointsRead(cl_event, cl_int status, void* rPtr)
+{
+    // Both the locations and descriptors have arrived
+    std::unique_ptr<std::shared_ptr<KeypointReadback>> 
+        r {static_cast<std::shared_ptr<KeypointReadback>*>(rPtr)};
+
+    finishReadback(*r, status, (status == CL_COMPLETE)? *(*r)->count : 0);
+}
+
+
+static void CL_CALLBACK countRead(cl_event, cl_int status, void* rPtr)
+{
+    // Now we know how many there are, read exactly that many
+    std::unique_ptr<std::shared_ptr<KeypointReadback>> 
+        r {static_cast<std::shared_ptr<KeypointReadback>*>(rPtr)};
+    KeypointReadback& rb = **r;
+
+    if (status != CL_COMPLETE) {
+        finishReadback(*r, status, 0);
+        return;
+    }
+
+    const size_t numKeypoints = *rb.count;
+
+    if (numKeypoints == 0) {
+        finishReadback(*r, CL_SUCCESS, 0);
+        return;
+    }
+
+    try {
+        cl::Event locationsDone, descriptorsDone;
+
+        // The locations include the orientations, which are written
+        // with the descriptors
+        rb.cq.enqueueReadBuffer(rb.locations, CL_FALSE, 0,
+                    numKeypoints * rb.numFloatsPerLocation * sizeof(float),
+                    rb.locationsPtr, &rb.descriptorsReady, &locationsDone);
+
+        std::vector<cl::Event> descriptorWaitEvents = {locationsDone};
+
+        rb.cq.enqueueReadBuffer(rb.descriptors, CL_FALSE, 0,
+                    numKeypoints * rb.numFloatsPerDescriptor * sizeof(float),
+                    rb.descriptorsPtr, &descriptorWaitEvents, 
+                    &descriptorsDone);
+
+        descriptorsDone.setCallback(CL_COMPLETE, keypointsRead, r.get());
+        r.release();
+
+        rb.cq.flush();
+
+    } catch (cl::Error err) {
+        if (r)
+            finishReadback(*r, err.err(), 0);
+    }
+}
+
+
+void Calculator::readKeypoints
+    (std::function<void (const KeypointData&)> callback)
+{
+    if (readback_->pending.exchange(true))
+        throw std::logic_error("Calculator: keypoint readback already "
+                               "in progress");
+
+    KeypointReadback& r = *readback_;
+
+    r.callback = callback;
+    r.done = cl::UserEvent(context);
+    r.descriptorsReady = keypointDescriptorEvents();
+
+    // Everything from the peak detector has to be done before the total
+    std::vector<cl::Event> countWaitEvents = keypointLocationEvents();
+    countWaitEvents.push_back(peakDetectorResults.cumCountsDone());
+
+    cl::Event countDone;
+    readbackQueue_.enqueueReadBuffer(r.cumCounts, CL_FALSE, 
+                                     r.cumCountsTotalPos, sizeof(cl_uint),
+                                     r.count, &countWaitEvents, &countDone);
+
+    // The callback owns a reference to the readback state, which it frees
+    countDone.setCallback(CL_COMPLETE, countRead, 
+                          new std::shared_ptr<KeypointReadback>(readback_));
+
+    // Make sure it actually gets submitted
+    readbackQueue_.flush();
+}
+
+
+std::future<KeypointData> Calculator::readKeypoints(void)
+{
+    auto promise = std::make_shared<std::promise<KeypointData>>();
+
+    readKeypoints([promise] (const KeypointData& data) {
+        if (data.status == CL_SUCCESS)
+            promise->set_value(data);
+        else
+            promise->set_exception(std::make_exception_ptr(
+                cl::Error(data.status, "Calculator::readKeypoints")));
+    });
+
+    return promise->get_future();
+}
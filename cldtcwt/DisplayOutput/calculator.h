@@ -3,6 +3,9 @@
 #define CALCULATOR_H
 
 #include <vector>
+#include <functional>
+#include <future>
+#include <memory>
 
 #define __CL_ENABLE_EXCEPTIONS
 #include "CL/cl.hpp"
@@ -19,6 +22,25 @@
 #include "KeypointDescriptor/extractDescriptors.h"
 
 
+struct KeypointData {
+
+    // Result of reading back the keypoints from a Calculator.  The pointers
+    // are into memory owned by the Calculator, and stay valid until the
+    // next readback is started.
+
+    cl_int status; // CL_SUCCESS, or the error that stopped the readback
+
+    size_t numKeypoints;
+    const float* locations;   // numKeypoints * numFloatsPerKPLocation()
+    const float* descriptors; // numKeypoints * numFloatsPerDescriptor()
+
+};
+
+
+struct KeypointReadback;
+// Internal state of a readback in progress
+
+
 class Calculator {
 
     // Takes an input image, and produces subbands and keypoint locations
@@ -57,6 +79,10 @@ private:
 
     DescriptorExtracter descriptorExtracter_;
 
+    // For reading the keypoints back asynchronously
+    cl::CommandQueue readbackQueue_;
+    std::shared_ptr<KeypointReadback> readback_;
+
 public:
 
     Calculator(const Calculator&) = default;
@@ -79,6 +105,23 @@ public:
     size_t numFloatsPerKPLocation(void);
     cl::Buffer keypointCumCounts(void);
     std::vector<cl::Event> keypointLocationEvents(void);
+    // Done when the locations are complete, including the orientations
+    // written by the descriptor extraction
+    size_t numFloatsPerDescriptor(void);
+    std::vector<cl::Event> keypointDescriptorEvents(void);
+
+    void readKeypoints(std::function<void (const KeypointData&)> callback);
+    // Start reading the keypoints found by the last operator() back to the
+    // host, without blocking.  The count is read first, and then only that
+    // many locations and descriptors, into pinned memory that is reused
+    // each time.  callback is then run from an OpenCL runtime thread, so 
+    // should be quick and not call blocking OpenCL functions.  The next
+    // operator() will not overwrite the keypoints on the device until the
+    // readback has finished.  Only one readback may be in progress at once.
+
+    std::future<KeypointData> readKeypoints(void);
+    // As above, but delivering the result through a future.  Throws 
+    // cl::Error from get() if the readback failed.
 
 };
 
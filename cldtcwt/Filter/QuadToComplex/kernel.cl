@@ -10,7 +10,8 @@ __kernel void quadToComplex(__global const float* input,
                             unsigned int outputStart1,
                             unsigned int outputStride,
                             unsigned int outWidth,
-                            unsigned int outHeight)
+                            unsigned int outHeight,
+                            unsigned int outputStep)
 {
     const int2 g = (int2) (get_global_id(0), get_global_id(1));
     const int2 l = (int2) (get_local_id(0), get_local_id(1));
@@ -38,7 +39,7 @@ __kernel void quadToComplex(__global const float* input,
         const float factor = 1.0f / sqrt(2.0f);
 
         // Combine into complex pairs
-        const size_t loc = outPos.y * outputStride + outPos.x;
+        const size_t loc = outPos.y * outputStride + outPos.x * outputStep;
         output[loc + outputStart0] = factor * (float2) (ul - lr, ur + ll);
         output[loc + outputStart1] = factor * (float2) (ul + lr, ur - ll);
 
@@ -73,6 +73,7 @@ void QuadToComplex::operator() (cl::CommandQueue& cq,
 
     kernel_.setArg(7, cl_uint(output.width()));
     kernel_.setArg(8, cl_uint(output.height()));
+    kernel_.setArg(9, cl_uint(output.step()));
 
     // Execute
     cq.enqueueNDRangeKernel(kernel_, {0, 0},
@@ -81,7 +81,8 @@ void decimateFilterY(__global const float* input,
                      unsigned int outputStride,
                      unsigned int outputWidth,
                      unsigned int outputHeight,
-                     __constant float* filter)
+                     __constant float* filter,
+                     unsigned int outputStep)
 {
     const int2 g = (int2) (get_global_id(0), get_global_id(1));
     const int2 l = (int2) (get_local_id(0), get_local_id(1));
@@ -159,7 +160,7 @@ void decimateFilterY(__global const float* input,
         unsigned int outputStart = (l.y & 1)? outputStart1 : outputStart0;
         
         // Add or subtract, and place in appropriate output
-        output[2 * (outputStart + outPos.x + outPos.y*outputStride) 
+        output[2 * (outputStart + outPos.x*outputStep + outPos.y*outputStride) 
                + (l.x & 1)]
             = factor * (((l.x & 1) ^ (l.y & 1))? rplus : rminus);
 
@@ -118,6 +118,7 @@ void QuadToComplexDecimateFilterY::operator() (cl::CommandQueue& cq,
     kernel_.setArg(6, cl_uint(output.stride()));
     kernel_.setArg(7, cl_uint(output.width()));
     kernel_.setArg(8, cl_uint(output.height()));
+    kernel_.setArg(10, cl_uint(output.step()));
 
     // Execute
     cq.enqueueNDRangeKernel(kernel_, {0, 0},
@@ -97,7 +97,8 @@ void decimateFilterY(__global const float* input,
                      unsigned int outputStride,
                      unsigned int outputWidth,
                      unsigned int outputHeight,
-                     __constant float* filter)
+                     __constant float* filter,
+                     unsigned int outputStep)
 {
     const int2 g = (int2) (get_global_id(0), get_global_id(1));
     const int2 l = (int2) (get_local_id(0), get_local_id(1));
@@ -206,7 +207,7 @@ void decimateFilterY(__global const float* input,
                     * select(get_group_id(2), 5 - get_group_id(2), l.y & 1);
         
         // Add or subtract, and place in appropriate output
-        output[2 * (start + outPos.x + outPos.y*outputStride) 
+        output[2 * (start + outPos.x*outputStep + outPos.y*outputStride) 
                + (l.x & 1)]
             = factor * (((l.x & 1) ^ (l.y & 1))? rplus : rminus);
 
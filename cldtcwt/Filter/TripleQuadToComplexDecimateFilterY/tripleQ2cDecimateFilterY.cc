@@ -140,6 +140,7 @@ void TripleQuadToComplexDecimateFilterY::operator() (cl::CommandQueue& cq,
     kernel_.setArg(7, cl_uint(output.stride()));
     kernel_.setArg(8, cl_uint(output.width()));
     kernel_.setArg(9, cl_uint(output.height()));
+    kernel_.setArg(11, cl_uint(output.step()));
 
     // Execute
     cq.enqueueNDRangeKernel(kernel_, {0, 0, 0},
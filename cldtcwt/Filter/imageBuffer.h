@@ -40,11 +40,29 @@ public:
                 cl_mem_flags flags,
                 size_t width, size_t height,
                 size_t padding, size_t alignment,
-                size_t numSlices = 1);
+                size_t numSlices = 1,
+                bool interleaved = false);
+    // interleaved - store the slices' values for each pixel next to each
+    // other, rather than each slice as a separate image
+
+    ImageBuffer(cl::Buffer buffer, size_t offset,
+                size_t width, size_t height,
+                size_t padding, size_t alignment,
+                size_t numSlices = 1,
+                bool interleaved = false);
+    // Lay the image out within an existing buffer, starting offset
+    // elements in, so several images can share one buffer.  The buffer
+    // must be at least offset + size(...) elements long.
 
     ImageBuffer(ImageBuffer& image, int slice);
     // Create a reference to a slice of the original image.
 
+    static size_t size(size_t width, size_t height,
+                       size_t padding, size_t alignment,
+                       size_t numSlices = 1,
+                       bool interleaved = false);
+    // Number of elements an image with this layout takes up
+
 
     cl::Buffer buffer() const;
 
@@ -56,10 +74,18 @@ public:
     size_t padding() const;
     size_t stride() const;
 
+    size_t step() const;
+    // Number of elements from one pixel to the next along a row: 1, or
+    // the number of slices when interleaved
+
     size_t pitch() const;
     // Number of elements from the start of the one slice to the start
     // of the next
 
+    size_t numElements() const;
+    // Number of elements of the buffer the image covers, including 
+    // padding
+
     size_t numSlices() const;
     // Total number of image slices
 
@@ -87,9 +113,18 @@ private:
     size_t stride_;
     size_t height_;
 
+    size_t step_ = 1;
     size_t pitch_;
     size_t numSlices_;
 
+    size_t offset_ = 0;
+    size_t numElements_;
+    // Where the image's area of the buffer begins, and how long it is
+
+    void layout(size_t offset, size_t alignment, bool interleaved);
+    // Work out the strides, pitch and start for an image beginning offset
+    // elements into the buffer
+
 };
 
 
@@ -100,13 +135,48 @@ ImageBuffer<MemType>::ImageBuffer(cl::Context context,
                          cl_mem_flags flags,
                          size_t width, size_t height,
                          size_t padding, size_t alignment,
-                         size_t numSlices)
+                         size_t numSlices,
+                         bool interleaved)
     : width_(width),
       height_(height),
       padding_(padding),
-      stride_(width + 2*padding),
       numSlices_(numSlices)
 {
+    layout(0, alignment, interleaved);
+
+    buffer_ = cl::Buffer {
+        context, flags,
+        numElements_ * ImageElementTraits<MemType>::size
+    };
+}
+
+
+
+template <typename MemType>
+ImageBuffer<MemType>::ImageBuffer(cl::Buffer buffer, size_t offset,
+                         size_t width, size_t height,
+                         size_t padding, size_t alignment,
+                         size_t numSlices,
+                         bool interleaved)
+    : buffer_(buffer),
+      width_(width),
+      height_(height),
+      padding_(padding),
+      numSlices_(numSlices)
+{
+    layout(offset, alignment, interleaved);
+}
+
+
+
+template <typename MemType>
+void ImageBuffer<MemType>::layout(size_t offset, size_t alignment,
+                                  bool interleaved)
+{
+    step_ = interleaved? numSlices_ : 1;
+
+    stride_ = (width_ + 2*padding_) * step_;
+
     // Stride might need extending to respect alignment
     size_t overshoot = stride_ % alignment;
     if (overshoot != 0)
@@ -121,13 +191,31 @@ ImageBuffer<MemType>::ImageBuffer(cl::Context context,
 
     // Record the location of the upper left pixel, linear index
     // into the buffer
-    start_ = stride_ * padding_ + padding_; 
-    pitch_ = fullHeight * stride_;
+    offset_ = offset;
+    start_ = offset + stride_ * padding_ + padding_ * step_; 
 
-    buffer_ = cl::Buffer {
-        context, flags,
-        numSlices_ * pitch_ * ImageElementTraits<MemType>::size
-    };
+    // Slices are either next to each other within a pixel, or one 
+    // after another
+    pitch_ = interleaved? 1 : fullHeight * stride_;
+    numElements_ = fullHeight * stride_ * (interleaved? 1 : numSlices_);
+}
+
+
+
+template <typename MemType>
+size_t ImageBuffer<MemType>::size(size_t width, size_t height,
+                                  size_t padding, size_t alignment,
+                                  size_t numSlices,
+                                  bool interleaved)
+{
+    ImageBuffer<MemType> image;
+    image.width_ = width;
+    image.height_ = height;
+    image.padding_ = padding;
+    image.numSlices_ = numSlices;
+    image.layout(0, alignment, interleaved);
+
+    return image.numElements_;
 }
 
 
@@ -140,9 +228,18 @@ ImageBuffer<MemType>::ImageBuffer(ImageBuffer& image, int slice)
       height_(image.height_),
       padding_(image.padding_),
       stride_(image.stride_),
+      step_(image.step_),
       pitch_(image.pitch_),
       numSlices_(1)
 {
+    // The slice's own area, unless it is interleaved with the others
+    if (step_ == 1) {
+        offset_ = image.offset_ + image.pitch_ * slice;
+        numElements_ = image.numElements_ / image.numSlices_;
+    } else {
+        offset_ = image.offset_;
+        numElements_ = image.numElements_;
+    }
 }
 
 
@@ -156,25 +253,34 @@ void ImageBuffer<MemType>::write(cl::CommandQueue& cq,
                 const std::vector<cl::Event> events,
                 cl::Event* done) const
 {
-    const size_t numElements = buffer_.getInfo<CL_MEM_SIZE>() 
-                            / ImageElementTraits<MemType>::size;
+    // Only write over this image's own part of the buffer, which might
+    // be shared with others
+    const size_t elementSize = ImageElementTraits<MemType>::size;
 
-    std::vector<MemType> bufferContents(numElements);
+    std::vector<MemType> bufferContents(numElements_);
 
-    // Copy into the output buffer row by row
+    // A slice interleaved with others has to leave them as they were
+    if (step_ > numSlices_)
+        cq.enqueueReadBuffer(buffer_, CL_TRUE,
+                             offset_ * elementSize, 
+                             numElements_ * elementSize,
+                             &bufferContents[0],
+                             &events);
+
+    // Copy into the output buffer pixel by pixel
     for (int s = 0; s < numSlices_; ++s) {
 
-        auto writePos = bufferContents.begin() + start_
-                            + s * pitch_;;
-        for (int n = 0; n < height_; ++n, writePos += stride_,
-                                     input += width_) 
-            std::copy(input, input + width_, writePos);
+        auto writePos = bufferContents.begin() + (start(s) - offset_);
+        for (int n = 0; n < height_; ++n, writePos += stride_) 
+            for (int x = 0; x < width_; ++x)
+                writePos[x * step_] = *input++;
 
     }
 
     // Read the internal contents of the buffer
     cq.enqueueWriteBuffer(buffer_, CL_TRUE, 
-                         0, buffer_.getInfo<CL_MEM_SIZE>(),
+                         offset_ * elementSize, 
+                         numElements_ * elementSize,
                          &bufferContents[0],
                          &events, done);
 #if 0
@@ -198,22 +304,21 @@ void ImageBuffer<MemType>::read(cl::CommandQueue& cq,
         const std::vector<cl::Event> events,
         int slice) const
 {
-    const size_t numElements = buffer_.getInfo<CL_MEM_SIZE>() 
-                            / ImageElementTraits<MemType>::size;
+    const size_t elementSize = ImageElementTraits<MemType>::size;
 
-    std::vector<MemType> bufferContents(numElements);
+    std::vector<MemType> bufferContents(numElements_);
     
-    // Read the internal contents of the buffer
+    // Read the internal contents of the image's area of the buffer
     cq.enqueueReadBuffer(buffer_, CL_TRUE, 
-                         0, buffer_.getInfo<CL_MEM_SIZE>(),
+                         offset_ * elementSize, numElements_ * elementSize,
                          &bufferContents[0],
                          &events, nullptr);
 
-    // Copy into the results row by row
-    auto readPos = bufferContents.begin() + start(slice);
-    for (int n = 0; n < height_; ++n, readPos += stride_,
-                                 output += width_) 
-        std::copy(readPos, readPos + width_, output);
+    // Copy into the results pixel by pixel
+    auto readPos = bufferContents.begin() + (start(slice) - offset_);
+    for (int n = 0; n < height_; ++n, readPos += stride_) 
+        for (int x = 0; x < width_; ++x)
+            *output++ = readPos[x * step_];
 
 #if 0
     // This should work, but doesn't at the moment due to an AMD
@@ -282,6 +387,14 @@ size_t ImageBuffer<MemType>::stride() const
 
 
 
+template <typename MemType>
+size_t ImageBuffer<MemType>::step() const
+{
+    return step_;
+}
+
+
+
 template <typename MemType>
 size_t ImageBuffer<MemType>::pitch() const
 {
@@ -289,6 +402,13 @@ size_t ImageBuffer<MemType>::pitch() const
 }
 
 
+template <typename MemType>
+size_t ImageBuffer<MemType>::numElements() const
+{
+    return numElements_;
+}
+
+
 template <typename MemType>
 size_t ImageBuffer<MemType>::numSlices() const
 {
@@ -0,0 +1,334 @@
+// Copyright (C) 2013 Timothy Gale
+#include "flatFile.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static const char flatMagic[8] = {'C', 'D', 'T', 'F', 'L', 'A', 'T', '\0'};
+static const uint32_t flatVersion = 1;
+
+// Whole blocks for O_DIRECT (and the header's size), and where arrays
+// start within them
+static const size_t blockSize = 4096, arrayAlignment = 64;
+
+
+static size_t roundUp(size_t n, size_t multiple)
+{
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+
+static std::runtime_error systemError(const std::string& what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+
+FlatWriter::FlatWriter(const std::string& filename, size_t descriptorLength,
+                       size_t keypointLength, bool direct,
+                       size_t bufferBytes)
+ : direct_(direct), buffer_(nullptr),
+   bufferBytes_(roundUp(std::max(bufferBytes, blockSize), blockSize)),
+   bufferUsed_(0), fileOffset_(blockSize)
+{
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    fd_ = -1;
+#ifdef O_DIRECT
+    if (direct_)
+        fd_ = ::open(filename.c_str(), flags | O_DIRECT, 0644);
+#endif
+
+    // Not every filesystem takes O_DIRECT
+    if (fd_ < 0) {
+        direct_ = false;
+        fd_ = ::open(filename.c_str(), flags, 0644);
+    }
+
+    if (fd_ < 0)
+        throw systemError("FlatWriter: can't open " + filename);
+
+    void* buffer;
+    if (posix_memalign(&buffer, blockSize, bufferBytes_) != 0) {
+        ::close(fd_);
+        throw std::runtime_error("FlatWriter: can't allocate buffer");
+    }
+    buffer_ = static_cast<char*>(buffer);
+
+    std::memset(&header_, 0, sizeof(header_));
+    std::copy(flatMagic, flatMagic + sizeof(flatMagic), header_.magic);
+    header_.version = flatVersion;
+    header_.keypointLength = keypointLength;
+    header_.descriptorLength = descriptorLength;
+
+    // Header now (marked unfinished, with no index), so the frames go
+    // after it; it is written again on closing
+    writeAt(&header_, sizeof(header_), 0);
+}
+
+
+FlatWriter::~FlatWriter()
+{
+    try {
+        close();
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+    }
+
+    std::free(buffer_);
+}
+
+
+void FlatWriter::writeAt(const void* data, size_t numBytes, uint64_t offset)
+{
+    // Write numBytes (whole blocks, padded out with zeros) at offset
+    const size_t paddedBytes = roundUp(numBytes, blockSize);
+
+    // Use the free end of the buffer if there is room, since it is
+    // aligned for O_DIRECT
+    char* block;
+    void* aligned = nullptr;
+    if (bufferBytes_ - roundUp(bufferUsed_, blockSize) < paddedBytes) {
+        if (posix_memalign(&aligned, blockSize, paddedBytes) != 0)
+            throw std::runtime_error("FlatWriter: can't allocate buffer");
+        block = static_cast<char*>(aligned);
+    }
+    else
+        block = buffer_ + roundUp(bufferUsed_, blockSize);
+
+    std::memset(block, 0, paddedBytes);
+    std::memcpy(block, data, numBytes);
+
+    const ssize_t written = ::pwrite(fd_, block, paddedBytes, offset);
+    std::free(aligned);
+
+    if (written != ssize_t(paddedBytes))
+        throw systemError("FlatWriter: write failed");
+}
+
+
+void FlatWriter::writeBuffer(bool all)
+{
+    // Write out the whole blocks in the buffer (or everything, padded to
+    // a whole block), keeping any part block for next time
+    const size_t numBytes = all? roundUp(bufferUsed_, blockSize)
+                               : bufferUsed_ / blockSize * blockSize;
+
+    if (numBytes == 0)
+        return;
+
+    std::memset(buffer_ + bufferUsed_, 0, numBytes - std::min(numBytes,
+                                                              bufferUsed_));
+
+    if (::pwrite(fd_, buffer_, numBytes, fileOffset_) != ssize_t(numBytes))
+        throw systemError("FlatWriter: write failed");
+
+    fileOffset_ += numBytes;
+
+    const size_t remaining = bufferUsed_ - std::min(numBytes, bufferUsed_);
+    std::memmove(buffer_, buffer_ + numBytes, remaining);
+    bufferUsed_ = remaining;
+}
+
+
+void FlatWriter::add(const void* data, size_t numBytes, size_t alignment)
+{
+    // Pad to the alignment, then copy in (writing out full buffers as
+    // they fill)
+    const size_t padding = roundUp(bufferUsed_, alignment) - bufferUsed_;
+    std::memset(buffer_ + bufferUsed_, 0, padding);
+    bufferUsed_ += padding;
+
+    const char* bytes = static_cast<const char*>(data);
+
+    while (numBytes > 0) {
+        const size_t n = std::min(numBytes, bufferBytes_ - bufferUsed_);
+        std::memcpy(buffer_ + bufferUsed_, bytes, n);
+
+        bufferUsed_ += n;
+        bytes += n;
+        numBytes -= n;
+
+        if (bufferUsed_ == bufferBytes_)
+            writeBuffer(false);
+    }
+}
+
+
+void FlatWriter::append(size_t numKeypoints, const float* keypoints,
+                        const float* descriptors)
+{
+    if (fd_ < 0)
+        throw std::logic_error("FlatWriter: already closed");
+
+    FlatFrame frame;
+    frame.firstKeypoint = header_.numKeypoints;
+    frame.numKeypoints = numKeypoints;
+
+    // Where the arrays will land, given the padding add puts before them
+    frame.keypointsOffset = fileOffset_ + roundUp(bufferUsed_,
+                                                  arrayAlignment);
+    add(keypoints, numKeypoints * header_.keypointLength * sizeof(float),
+        arrayAlignment);
+
+    frame.descriptorsOffset = fileOffset_ + roundUp(bufferUsed_,
+                                                    arrayAlignment);
+    add(descriptors,
+        numKeypoints * header_.descriptorLength * sizeof(float),
+        arrayAlignment);
+
+    index_.push_back(frame);
+    ++header_.numFrames;
+    header_.numKeypoints += numKeypoints;
+}
+
+
+void FlatWriter::close()
+{
+    if (fd_ < 0)
+        return;
+
+    try {
+        // The rest of the frames, then the index from the next block
+        writeBuffer(true);
+
+        header_.indexOffset = fileOffset_;
+        if (!index_.empty())
+            writeAt(&index_[0], index_.size() * sizeof(FlatFrame),
+                    fileOffset_);
+
+        // Only now does the header say the file is complete
+        writeAt(&header_, sizeof(header_), 0);
+    }
+    catch (...) {
+        ::close(fd_);
+        fd_ = -1;
+        throw;
+    }
+
+    const int result = ::close(fd_);
+    fd_ = -1;
+
+    if (result != 0)
+        throw systemError("FlatWriter: close failed");
+}
+
+
+// Reading
+
+FlatReader::FlatReader(const std::string& filename)
+{
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw systemError("FlatReader: can't open " + filename);
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw systemError("FlatReader: can't read " + filename);
+    }
+    size_ = status.st_size;
+
+    if (size_ < sizeof(FlatHeader)) {
+        ::close(fd);
+        throw std::runtime_error("FlatReader: " + filename
+                                 + " is too short");
+    }
+
+    void* map = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED)
+        throw systemError("FlatReader: can't map " + filename);
+
+    data_ = static_cast<const char*>(map);
+    header_ = reinterpret_cast<const FlatHeader*>(data_);
+
+    std::string problem;
+    if (!std::equal(flatMagic, flatMagic + sizeof(flatMagic),
+                    header_->magic))
+        problem = " is not a flat file";
+    else if (header_->version != flatVersion)
+        problem = " is an unknown version";
+    else if (header_->indexOffset == 0)
+        problem = " was not closed properly";
+    else if (header_->indexOffset
+                + header_->numFrames * sizeof(FlatFrame) > size_)
+        problem = " is truncated";
+
+    if (!problem.empty()) {
+        ::munmap(const_cast<char*>(data_), size_);
+        throw std::runtime_error("FlatReader: " + filename + problem);
+    }
+
+    index_ = reinterpret_cast<const FlatFrame*>(data_ + header_->indexOffset);
+}
+
+
+FlatReader::~FlatReader()
+{
+    ::munmap(const_cast<char*>(data_), size_);
+}
+
+
+size_t FlatReader::numFrames() const
+{
+    return header_->numFrames;
+}
+
+
+size_t FlatReader::numKeypoints() const
+{
+    return header_->numKeypoints;
+}
+
+
+size_t FlatReader::keypointLength() const
+{
+    return header_->keypointLength;
+}
+
+
+size_t FlatReader::descriptorLength() const
+{
+    return header_->descriptorLength;
+}
+
+
+size_t FlatReader::numKeypoints(size_t frame) const
+{
+    return index_[frame].numKeypoints;
+}
+
+
+size_t FlatReader::firstKeypoint(size_t frame) const
+{
+    return index_[frame].firstKeypoint;
+}
+
+
+const float* FlatReader::keypoints(size_t frame) const
+{
+    return reinterpret_cast<const float*>(data_
+                                          + index_[frame].keypointsOffset);
+}
+
+
+const float* FlatReader::descriptors(size_t frame) const
+{
+    return reinterpret_cast<const float*>(data_
+                                          + index_[frame].descriptorsOffset);
+}
+
@@ -0,0 +1,129 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef FLAT_FILE_H
+#define FLAT_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// A flat file of keypoints and descriptors, as a quicker alternative to
+// HDFWriter's files for readers that map it straight into memory.  All
+// little-endian, as written on x86:
+//
+//   Header (FlatHeader, padded to 4096 bytes)
+//   Frame data: for each frame, its keypoints then its descriptors
+//      (floats), each starting on a multiple of 64 bytes
+//   Index (FlatFrame for each frame), starting on a multiple of 4096
+//
+// The header gives the index's position once the writer has closed the
+// file; before then, it is zero.
+
+
+struct FlatHeader {
+    char magic[8];                  // "CDTFLAT\0"
+    uint32_t version;               // 1
+    uint32_t keypointLength;        // Floats per keypoint
+    uint32_t descriptorLength;      // Floats per descriptor
+    uint32_t reserved;
+    uint64_t numFrames;
+    uint64_t numKeypoints;
+    uint64_t indexOffset;           // Bytes from the start of the file
+};
+
+
+struct FlatFrame {
+    uint64_t keypointsOffset;       // Bytes from the start of the file
+    uint64_t descriptorsOffset;
+    uint64_t firstKeypoint;         // Counting through all the frames
+    uint64_t numKeypoints;
+};
+
+
+
+class FlatWriter {
+    // Writes flat files, a frame at a time.  Frames are collected into a
+    // big buffer, which is written out in one go when full, optionally
+    // bypassing the page cache (O_DIRECT, where the filesystem allows).
+
+public:
+
+    FlatWriter(const std::string& filename, size_t descriptorLength,
+               size_t keypointLength = 4, bool direct = false,
+               size_t bufferBytes = 8 << 20);
+    // Clears any existing contents.  Throws std::runtime_error if the file
+    // can't be written.
+
+    ~FlatWriter();
+
+    FlatWriter(const FlatWriter&) = delete;
+    FlatWriter& operator = (const FlatWriter&) = delete;
+
+    void append(size_t numKeypoints, const float* keypoints,
+                const float* descriptors);
+    // Adds an extra frame with its keypoints, as HDFWriter::append
+
+    void close();
+    // Write out the rest, the index and the final header.  Done by the
+    // destructor if not before, but then errors go unreported.
+
+private:
+
+    int fd_;
+    bool direct_;
+
+    FlatHeader header_;
+    std::vector<FlatFrame> index_;
+
+    // Aligned for O_DIRECT; data not yet written starts at buffer_ and
+    // belongs at fileOffset_ in the file
+    char* buffer_;
+    size_t bufferBytes_, bufferUsed_;
+    uint64_t fileOffset_;
+
+    void add(const void* data, size_t numBytes, size_t alignment);
+    void writeBuffer(bool all);
+    void writeAt(const void* data, size_t numBytes, uint64_t offset);
+
+};
+
+
+
+class FlatReader {
+    // Maps a flat file into memory, so frames can be read with no copying
+
+public:
+
+    FlatReader(const std::string& filename);
+    // Throws std::runtime_error if the file can't be read, isn't a flat
+    // file or wasn't closed properly.
+
+    ~FlatReader();
+
+    FlatReader(const FlatReader&) = delete;
+    FlatReader& operator = (const FlatReader&) = delete;
+
+    size_t numFrames() const;
+    size_t numKeypoints() const;
+    size_t keypointLength() const;
+    size_t descriptorLength() const;
+
+    size_t numKeypoints(size_t frame) const;
+    size_t firstKeypoint(size_t frame) const;
+    const float* keypoints(size_t frame) const;
+    const float* descriptors(size_t frame) const;
+    // Valid for as long as the reader
+
+private:
+
+    const char* data_;
+    size_t size_;
+
+    const FlatHeader* header_;
+    const FlatFrame* index_;
+
+};
+
+
+#endif
+
@@ -0,0 +1,243 @@
+// Copyright (C) 2013 Timothy Gale
+#include "descriptorPCA.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+
+
+static void normalise(const float* descriptor, size_t length, double* output)
+{
+    double sumSquares = 0;
+    for (size_t i = 0; i < length; ++i)
+        sumSquares += double(descriptor[i]) * descriptor[i];
+
+    // All zeros stay that way
+    const double scale = sumSquares > 0? 1 / std::sqrt(sumSquares) : 0;
+
+    for (size_t i = 0; i < length; ++i)
+        output[i] = scale * descriptor[i];
+}
+
+
+static void symmetricEigen(std::vector<double>& a, size_t n,
+                           std::vector<double>& vectors)
+{
+    // Cyclic Jacobi: rotate pairs of rows and columns until a is diagonal,
+    // leaving the eigenvalues on the diagonal and the eigenvectors in the
+    // columns of vectors.  Slow, but the matrices are small.
+    vectors.assign(n * n, 0.);
+    for (size_t i = 0; i < n; ++i)
+        vectors[i * n + i] = 1.;
+
+    double total = 0;
+    for (double v: a)
+        total += v * v;
+
+    for (int sweep = 0; sweep < 100; ++sweep) {
+
+        double offDiagonal = 0;
+        for (size_t p = 0; p < n; ++p)
+            for (size_t q = p + 1; q < n; ++q)
+                offDiagonal += a[p * n + q] * a[p * n + q];
+
+        if (offDiagonal <= 1.e-24 * total)
+            return;
+
+        for (size_t p = 0; p < n; ++p)
+            for (size_t q = p + 1; q < n; ++q) {
+
+                const double apq = a[p * n + q];
+                if (apq == 0)
+                    continue;
+
+                const double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                const double t = (theta >= 0? 1 : -1)
+                               / (std::abs(theta) + std::sqrt(theta * theta
+                                                              + 1));
+                const double c = 1 / std::sqrt(t * t + 1), s = t * c;
+
+                for (size_t k = 0; k < n; ++k) {
+                    const double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+
+                for (size_t k = 0; k < n; ++k) {
+                    const double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+
+                for (size_t k = 0; k < n; ++k) {
+                    const double vkp = vectors[k * n + p],
+                                 vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - s * vkq;
+                    vectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+    }
+}
+
+
+
+DescriptorPCA DescriptorPCA::train(const float* descriptors, size_t num,
+                                   size_t inputLength, size_t outputLength,
+                                   bool whiten)
+{
+    if (outputLength > inputLength)
+        throw std::logic_error("DescriptorPCA: can't project to more "
+                               "dimensions than there are");
+
+    if (num < 2)
+        throw std::logic_error("DescriptorPCA: too few descriptors to "
+                               "train on");
+
+    const size_t n = inputLength;
+    std::vector<double> v(n), sum(n, 0.), covariance(n * n, 0.);
+
+    for (size_t d = 0; d < num; ++d) {
+        normalise(descriptors + d * n, n, &v[0]);
+
+        for (size_t i = 0; i < n; ++i) {
+            sum[i] += v[i];
+            for (size_t j = i; j < n; ++j)
+                covariance[i * n + j] += v[i] * v[j];
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = i; j < n; ++j) {
+            covariance[i * n + j] = (covariance[i * n + j]
+                                      - sum[i] * sum[j] / num) / (num - 1);
+            covariance[j * n + i] = covariance[i * n + j];
+        }
+
+    std::vector<double> vectors;
+    symmetricEigen(covariance, n, vectors);
+
+    // Largest eigenvalues first
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+        return covariance[a * n + a] > covariance[b * n + b];
+    });
+
+    DescriptorPCA pca;
+    pca.inputLength = inputLength;
+    pca.outputLength = outputLength;
+
+    for (size_t i = 0; i < n; ++i)
+        pca.mean.push_back(sum[i] / num);
+
+    for (size_t k = 0; k < outputLength; ++k) {
+        const size_t e = order[k];
+
+        // Guard against dividing by (almost) nothing
+        const double scale = whiten? 1 / std::sqrt(std::max(
+                                             covariance[e * n + e], 1.e-12))
+                                   : 1;
+
+        for (size_t i = 0; i < n; ++i)
+            pca.basis.push_back(scale * vectors[i * n + e]);
+    }
+
+    return pca;
+}
+
+
+std::vector<float> DescriptorPCA::project(const float* descriptors,
+                                          size_t num) const
+{
+    std::vector<float> result(num * outputLength);
+    std::vector<double> v(inputLength);
+
+    for (size_t d = 0; d < num; ++d) {
+        normalise(descriptors + d * inputLength, inputLength, &v[0]);
+
+        for (size_t k = 0; k < outputLength; ++k) {
+            double total = 0;
+            for (size_t i = 0; i < inputLength; ++i)
+                total += basis[k * inputLength + i] * (v[i] - mean[i]);
+
+            result[d * outputLength + k] = total;
+        }
+    }
+
+    return result;
+}
+
+
+
+// File format: a header, then the sizes and contents, all in native byte
+// order
+static const char fileMagic[8] = {'C', 'D', 'T', 'P', 'C', 'A', '\0', '\0'};
+static const uint32_t fileVersion = 1;
+
+
+void DescriptorPCA::save(const std::string& filename) const
+{
+    std::ofstream output(filename, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("DescriptorPCA: could not open " + filename);
+
+    const uint64_t lengths[2] = {inputLength, outputLength};
+
+    output.write(fileMagic, sizeof(fileMagic));
+    output.write(reinterpret_cast<const char*>(&fileVersion),
+                 sizeof(fileVersion));
+    output.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+    output.write(reinterpret_cast<const char*>(mean.data()),
+                 mean.size() * sizeof(float));
+    output.write(reinterpret_cast<const char*>(basis.data()),
+                 basis.size() * sizeof(float));
+
+    if (!output)
+        throw std::runtime_error("DescriptorPCA: could not write "
+                                 + filename);
+}
+
+
+DescriptorPCA DescriptorPCA::load(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("DescriptorPCA: could not open " + filename);
+
+    char magic[sizeof(fileMagic)];
+    uint32_t version = 0;
+    uint64_t lengths[2] = {0, 0};
+
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char*>(&version), sizeof(version));
+    input.read(reinterpret_cast<char*>(lengths), sizeof(lengths));
+
+    if (!input || !std::equal(magic, magic + sizeof(magic), fileMagic)
+               || version != fileVersion
+               || lengths[1] > lengths[0])
+        throw std::runtime_error("DescriptorPCA: " + filename
+                                  + " is not a projection file this version "
+                                    "can read");
+
+    DescriptorPCA pca;
+    pca.inputLength = lengths[0];
+    pca.outputLength = lengths[1];
+    pca.mean.resize(pca.inputLength);
+    pca.basis.resize(pca.outputLength * pca.inputLength);
+
+    input.read(reinterpret_cast<char*>(pca.mean.data()),
+               pca.mean.size() * sizeof(float));
+    input.read(reinterpret_cast<char*>(pca.basis.data()),
+               pca.basis.size() * sizeof(float));
+
+    if (!input)
+        throw std::runtime_error("DescriptorPCA: " + filename
+                                  + " is truncated");
+
+    return pca;
+}
+
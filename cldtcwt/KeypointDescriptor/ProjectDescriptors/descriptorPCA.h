@@ -0,0 +1,40 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef DESCRIPTOR_PCA_H
+#define DESCRIPTOR_PCA_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+
+
+struct DescriptorPCA {
+// A linear projection of descriptors down to fewer dimensions.  Each
+// descriptor is first scaled to unit length, then has mean taken off and
+// is multiplied by basis.  Projected descriptors are compared by plain
+// Euclidean distance: they no longer have the structure that lets
+// PolarMatcher try rotations.
+
+    size_t inputLength = 0, outputLength = 0;
+
+    std::vector<float> mean;    // inputLength
+    std::vector<float> basis;   // outputLength x inputLength, by rows
+
+    static DescriptorPCA train(const float* descriptors, size_t num,
+                               size_t inputLength, size_t outputLength,
+                               bool whiten = false);
+    // Principal components of some (unit length) descriptors, largest
+    // first.  whiten scales each so the projections have unit variance.
+
+    std::vector<float> project(const float* descriptors, size_t num) const;
+    // The same calculation as ProjectDescriptors, on the host
+
+    void save(const std::string& filename) const;
+    static DescriptorPCA load(const std::string& filename);
+    // Throw std::runtime_error if the file can't be used
+
+};
+
+
+#endif
+
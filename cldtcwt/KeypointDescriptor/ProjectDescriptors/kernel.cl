@@ -0,0 +1,65 @@
+// Copyright (C) 2013 Timothy Gale
+// Scale descriptors to unit length and project them, as DescriptorPCA.
+// Defined by the host ahead of this:
+//
+// IN_LENGTH: number of floats in each input descriptor.
+// OUT_LENGTH: number of floats in each output descriptor.
+// WG_SIZE: workgroup size, a power of two.
+
+
+__kernel
+__attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void projectDescriptors(const __global float* input,
+                        __global float* output,
+                        const __global unsigned int* kpOffsets,
+                        unsigned int beginIdx, unsigned int endIdx,
+                        const __global float* basisT,
+                        const __global float* projectedMean)
+{
+    // Descriptors from kpOffsets[beginIdx] up to kpOffsets[endIdx], or
+    // beginIdx up to endIdx if there are no offsets.  basisT is the basis
+    // transposed (IN_LENGTH x OUT_LENGTH), so neighbouring items read
+    // neighbouring values; projectedMean is the basis times the mean.
+    const int lid = get_local_id(0);
+
+    const unsigned int begin = kpOffsets? kpOffsets[beginIdx] : beginIdx;
+    const unsigned int end = kpOffsets? kpOffsets[endIdx] : endIdx;
+
+    __local float descriptor[IN_LENGTH];
+    __local float sumSquares[WG_SIZE];
+
+    for (unsigned int n = begin + get_group_id(0); n < end;
+         n += get_num_groups(0)) {
+
+        float partialSum = 0.f;
+        for (int i = lid; i < IN_LENGTH; i += WG_SIZE) {
+            const float v = input[n * IN_LENGTH + i];
+            descriptor[i] = v;
+            partialSum += v * v;
+        }
+
+        sumSquares[lid] = partialSum;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int step = WG_SIZE / 2; step > 0; step /= 2) {
+            if (lid < step)
+                sumSquares[lid] += sumSquares[lid + step];
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Scaling can wait until after projecting
+        const float scale = sumSquares[0] > 0.f? rsqrt(sumSquares[0]) : 0.f;
+
+        for (int k = lid; k < OUT_LENGTH; k += WG_SIZE) {
+            float total = 0.f;
+            for (int i = 0; i < IN_LENGTH; ++i)
+                total = mad(basisT[i * OUT_LENGTH + k], descriptor[i], total);
+
+            output[n * OUT_LENGTH + k] = scale * total - projectedMean[k];
+        }
+
+        // Finished with this descriptor before the next overwrites it
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
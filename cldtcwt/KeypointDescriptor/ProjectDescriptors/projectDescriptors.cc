@@ -0,0 +1,158 @@
+// Copyright (C) 2013 Timothy Gale
+#include "projectDescriptors.h"
+#include "kernel.h"
+using namespace ProjectDescriptorsNS;
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+
+
+ProjectDescriptors::ProjectDescriptors(cl::Context& context,
+                                       const std::vector<cl::Device>& devices,
+                                       const DescriptorPCA& pca)
+ : context_(context),
+   inputLength_(pca.inputLength), outputLength_(pca.outputLength)
+{
+    if (pca.mean.size() != inputLength_
+            || pca.basis.size() != inputLength_ * outputLength_
+            || outputLength_ == 0)
+        throw std::logic_error("ProjectDescriptors: malformed projection");
+
+    // The OpenCL kernel:
+    std::ostringstream kernelInput;
+
+    kernelInput << "#define IN_LENGTH (" << inputLength_ << ")\n"
+                   "#define OUT_LENGTH (" << outputLength_ << ")\n"
+                   "#define WG_SIZE (" << wgSize_ << ")\n";
+
+    // Get input from the source file
+    const char* fileText = reinterpret_cast<const char*> (kernel_cl);
+    size_t fileTextLength = kernel_cl_len;
+
+    std::copy(fileText, fileText + fileTextLength,
+              std::ostream_iterator<char>(kernelInput));
+
+    // Convert to string
+    const std::string sourceCode = kernelInput.str();
+
+    // Bundle the code up
+    cl::Program::Sources source;
+    source.push_back(std::make_pair(sourceCode.c_str(), sourceCode.length()));
+
+    // Compile it...
+    cl::Program program(context, source);
+    try {
+        program.build(devices);
+    } catch(cl::Error err) {
+	    std::cerr
+		    << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+		    << std::endl;
+	    throw;
+    }
+
+    // ...and extract the useful part, i.e. the kernel
+    kernel_ = cl::Kernel(program, "projectDescriptors");
+
+    // Transpose the basis, and take the mean off after projecting rather
+    // than before
+    std::vector<float> basisT(inputLength_ * outputLength_),
+                       projectedMean(outputLength_, 0.f);
+
+    for (size_t k = 0; k < outputLength_; ++k)
+        for (size_t i = 0; i < inputLength_; ++i) {
+            const float b = pca.basis[k * inputLength_ + i];
+            basisT[i * outputLength_ + k] = b;
+            projectedMean[k] += b * pca.mean[i];
+        }
+
+    basisT_ = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         basisT.size() * sizeof(float), &basisT[0]);
+    projectedMean_ = cl::Buffer(context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                projectedMean.size() * sizeof(float),
+                                &projectedMean[0]);
+
+    // Enough workgroups to keep the device busy; each works through
+    // descriptors until there are none left
+    numWorkgroups_ = 8 * devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+}
+
+
+void ProjectDescriptors::operator() (cl::CommandQueue& cq,
+                                     const cl::Buffer& input,
+                                     const cl::Buffer& kpOffsets,
+                                     int beginIdx, int endIdx,
+                                     int maxNumKPs,
+                                     cl::Buffer& output,
+                                     const std::vector<cl::Event>& waitEvents,
+                                     cl::Event* doneEvent)
+{
+    project(cq, input, &kpOffsets, beginIdx, endIdx, maxNumKPs, output,
+            waitEvents, doneEvent);
+}
+
+
+void ProjectDescriptors::operator() (cl::CommandQueue& cq,
+                                     const cl::Buffer& input,
+                                     size_t numDescriptors,
+                                     cl::Buffer& output,
+                                     const std::vector<cl::Event>& waitEvents,
+                                     cl::Event* doneEvent)
+{
+    project(cq, input, nullptr, 0, numDescriptors, numDescriptors, output,
+            waitEvents, doneEvent);
+}
+
+
+void ProjectDescriptors::project(cl::CommandQueue& cq,
+                                 const cl::Buffer& input,
+                                 const cl::Buffer* kpOffsets,
+                                 int beginIdx, int endIdx,
+                                 size_t maxNumDescriptors,
+                                 cl::Buffer& output,
+                                 const std::vector<cl::Event>& waitEvents,
+                                 cl::Event* doneEvent)
+{
+    kernel_.setArg(0, input);
+    kernel_.setArg(1, output);
+
+    // No offsets means the indices are the range itself
+    if (kpOffsets != nullptr)
+        kernel_.setArg(2, *kpOffsets);
+    else
+        kernel_.setArg(2, sizeof(cl_mem), nullptr);
+
+    kernel_.setArg(3, cl_uint(beginIdx));
+    kernel_.setArg(4, cl_uint(endIdx));
+    kernel_.setArg(5, basisT_);
+    kernel_.setArg(6, projectedMean_);
+
+    // No need for more workgroups than descriptors
+    const size_t numWorkgroups
+        = std::max<size_t>(1, std::min(numWorkgroups_, maxNumDescriptors));
+
+    cl::NDRange workgroupSize = {wgSize_};
+    cl::NDRange globalSize = {numWorkgroups * wgSize_};
+
+    cq.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                            globalSize, workgroupSize,
+                            &waitEvents, doneEvent);
+}
+
+
+size_t ProjectDescriptors::getInputLength() const
+{
+    return inputLength_;
+}
+
+
+size_t ProjectDescriptors::getOutputLength() const
+{
+    return outputLength_;
+}
+
@@ -0,0 +1,80 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef PROJECT_DESCRIPTORS_H
+#define PROJECT_DESCRIPTORS_H
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#include "CL/cl.hpp"
+#include <vector>
+
+#include "KeypointDescriptor/ProjectDescriptors/descriptorPCA.h"
+
+
+
+class ProjectDescriptors {
+// Normalises and projects float descriptors (as made by
+// DescriptorExtracter) to fewer dimensions on the device, in one pass.
+
+public:
+
+    ProjectDescriptors() = default;
+    ProjectDescriptors(const ProjectDescriptors&) = default;
+    ProjectDescriptors(cl::Context& context,
+                       const std::vector<cl::Device>& devices,
+                       const DescriptorPCA& pca);
+
+    void operator() (cl::CommandQueue& cq,
+                     const cl::Buffer& input,
+                     const cl::Buffer& kpOffsets,
+                     int beginIdx, int endIdx,
+                     int maxNumKPs,
+                     cl::Buffer& output,
+                     const std::vector<cl::Event>& waitEvents
+                        = std::vector<cl::Event>(),
+                     cl::Event* doneEvent = nullptr);
+    // Project the descriptors from kpOffsets[beginIdx] up to
+    // kpOffsets[endIdx], of which there are at most maxNumKPs (as for
+    // DescriptorExtracter).
+
+    void operator() (cl::CommandQueue& cq,
+                     const cl::Buffer& input,
+                     size_t numDescriptors,
+                     cl::Buffer& output,
+                     const std::vector<cl::Event>& waitEvents
+                        = std::vector<cl::Event>(),
+                     cl::Event* doneEvent = nullptr);
+    // Project the first numDescriptors descriptors.
+    //
+    // For both, descriptor n is read from input from element
+    // n * getInputLength() and written to output from element
+    // n * getOutputLength().
+
+    size_t getInputLength() const;
+    size_t getOutputLength() const;
+
+private:
+    cl::Context context_;
+    cl::Kernel kernel_;
+
+    size_t inputLength_, outputLength_;
+    size_t numWorkgroups_;
+
+    cl::Buffer basisT_, projectedMean_;
+
+    static const int wgSize_ = 64;
+
+    void project(cl::CommandQueue& cq,
+                 const cl::Buffer& input,
+                 const cl::Buffer* kpOffsets,
+                 int beginIdx, int endIdx,
+                 size_t maxNumDescriptors,
+                 cl::Buffer& output,
+                 const std::vector<cl::Event>& waitEvents,
+                 cl::Event* doneEvent);
+};
+
+
+
+#endif
+
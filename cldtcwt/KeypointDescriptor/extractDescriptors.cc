@@ -9,27 +9,330 @@
 #include <iterator>
 #include <string>
 #include <algorithm>
+#include <complex>
+#include <iomanip>
+#include <cmath>
+#include <stdexcept>
 
 
 #include "kernel.h"
 using namespace ExtractDescriptorsNS;
 
+#include "util/clUtil.h"
+#include "Matcher/polarMatcher.h"
 
-Interpolator::Interpolator(cl::Context& context,
-                const std::vector<cl::Device>& devices,
-                std::vector<Coord> samplingPattern,
-                int outputStride, int outputOffset,
-                int diameter,
-                int numFloatsPerPos)
- : context_(context), diameter_(diameter)
+
+
+// Subband centre frequencies, in units of pi / 2.15, and the phase offsets
+// the subbands are multiplied by to give them consistent phase behaviour
+// relative to the sampling point
+static const double angularFreqs[6][2] = {
+    {-1, -3}, {-std::sqrt(5.), -std::sqrt(5.)}, {-3, -1},
+    {-3,  1}, {-std::sqrt(5.),  std::sqrt(5.)}, {-1,  3}
+};
+
+static const double sbOffsets[6][2] = {
+    { 0,  1}, { 0, -1}, { 0,  1},
+    {-1,  0}, { 1,  0}, {-1,  0}
+};
+
+
+static void writeTable(std::ostream& output, const std::string& name,
+                       const std::vector<std::vector<std::complex<double>>>&
+                            values)
+{
+    // Write out a table of complex numbers as a 3D constant array in
+    // OpenCL, values[n][i] becoming name[n][i][0] + j name[n][i][1]
+    output << "__constant float " << name 
+           << "[" << values.size() << "][" << values[0].size() << "][2]"
+           << " = {\n";
+
+    output << std::scientific << std::setprecision(9);
+
+    for (auto& row: values) {
+        output << "    {";
+        for (auto& v: row)
+            output << "{" << v.real() << "f, " << v.imag() << "f}, ";
+        output << "},\n";
+    }
+
+    output << "};\n";
+}
+
+
+static void writeTable(std::ostream& output, const std::string& name,
+                       const std::vector<std::complex<double>>& values)
+{
+    // The same for a 2D table, values[n] becoming name[n][0] + j name[n][1]
+    output << "__constant float " << name 
+           << "[" << values.size() << "][2] = {";
+
+    output << std::scientific << std::setprecision(9);
+
+    for (auto& v: values)
+        output << "{" << v.real() << "f, " << v.imag() << "f}, ";
+
+    output << "};\n";
+}
+
+
+static void writeDerotationTables(std::ostream& output,
+                                  const std::vector<Coord>& samplingPattern,
+                                  int diameter)
+{
+    // Tabulate the phasors for extractDescriptors to derotate and rerotate
+    // by (see the kernel for a description)
+    const double pi = 4 * std::atan(1.);
+    const std::complex<double> j(0, 1);
+
+    std::vector<std::vector<std::complex<double>>>
+        derotX(6), derotY(6), sampleRot(6);
+    std::vector<std::complex<double>> angularFreq(6);
+
+    for (int n = 0; n < 6; ++n) {
+
+        const double wx = angularFreqs[n][0] * pi / 2.15,
+                     wy = angularFreqs[n][1] * pi / 2.15;
+
+        for (int i = 0; i < diameter + 4; ++i) {
+            const int pos = i - diameter / 2 - 1;
+            derotX[n].push_back(std::complex<double>(sbOffsets[n][0],
+                                                     sbOffsets[n][1])
+                                * std::exp(-j * wx * double(pos)));
+            derotY[n].push_back(std::exp(-j * wy * double(pos)));
+        }
+
+        for (const Coord& s: samplingPattern)
+            sampleRot[n].push_back(std::exp(j * (wx * s.x + wy * s.y)));
+
+        angularFreq[n] = std::complex<double>(wx, wy);
+    }
+
+    writeTable(output, "DEROT_X", derotX);
+    writeTable(output, "DEROT_Y", derotY);
+    writeTable(output, "SAMPLE_ROT", sampleRot);
+    writeTable(output, "ANGULAR_FREQ", angularFreq);
+}
+
+
+
+static std::vector<DescriptorExtracter::LevelInfo>
+    levelInfo(const std::vector<const Subbands*>& subbands,
+              const std::vector<float>& scales)
+{
+    std::vector<DescriptorExtracter::LevelInfo> levels;
+
+    for (size_t l = 0; l < subbands.size(); ++l)
+        levels.push_back({
+            cl_uint(subbands[l]->start()), cl_uint(subbands[l]->pitch()),
+            cl_uint(subbands[l]->stride()), cl_uint(subbands[l]->step()),
+            cl_uint(subbands[l]->width()), cl_uint(subbands[l]->height()),
+            cl_float(scales[l])
+        });
+
+    return levels;
+}
+
+
+
+// Sampling patterns
+
+DescriptorPattern::DescriptorPattern(const std::vector<SamplingRing>& rings)
+ : rings_(rings)
+{
+    if (rings.empty())
+        throw std::logic_error("DescriptorPattern: no rings");
+
+    for (const SamplingRing& ring: rings) {
+        if (ring.level != 0 && ring.level != 1)
+            throw std::logic_error("DescriptorPattern: rings must be on "
+                                   "level 0 or 1");
+
+        if (ring.numSamples < 1 || ring.radius < 0
+                || (ring.radius == 0 && ring.numSamples != 1))
+            throw std::logic_error("DescriptorPattern: rings need a "
+                                   "sample, and centres only one");
+    }
+}
+
+
+DescriptorPattern DescriptorPattern::standard()
+{
+    return DescriptorPattern({{0, 0, 1}, {0, 1, 12}, {1, 0, 1}});
+}
+
+
+const std::vector<SamplingRing>& DescriptorPattern::rings() const
+{
+    return rings_;
+}
+
+
+std::vector<Coord> DescriptorPattern::samplingPattern() const
+{
+    const double pi = 4 * std::atan(1.);
+    std::vector<Coord> pattern;
+
+    for (const SamplingRing& ring: rings_)
+        for (int n = 0; n < ring.numSamples; ++n) {
+            const double angle = -pi + 2 * pi * n / ring.numSamples;
+            pattern.push_back({float(ring.radius * std::cos(angle)),
+                               float(ring.radius * std::sin(angle))});
+        }
+
+    return pattern;
+}
+
+
+std::vector<int> DescriptorPattern::samplingLevels() const
+{
+    std::vector<int> levels;
+
+    for (const SamplingRing& ring: rings_)
+        levels.insert(levels.end(), ring.numSamples, ring.level);
+
+    return levels;
+}
+
+
+size_t DescriptorPattern::numSamples() const
+{
+    size_t num = 0;
+    for (const SamplingRing& ring: rings_)
+        num += ring.numSamples;
+
+    return num;
+}
+
+
+size_t DescriptorPattern::getNumFloatsInDescriptor() const
 {
-    // Define the diameter (total width/height of sampling pattern)
-    // to begin with
+    return numSamples() * 6 * 2;
+}
+
+
+float DescriptorPattern::maxRadius() const
+{
+    float radius = 0;
+    for (const SamplingRing& ring: rings_)
+        radius = std::max(radius, ring.radius);
+
+    return radius;
+}
+
+
+bool DescriptorPattern::polarLayout(size_t& ringBegin,
+                                    size_t& ringLength) const
+{
+    size_t numRings = 0, begin = 0;
+
+    for (const SamplingRing& ring: rings_) {
+        if (ring.radius > 0) {
+            ++numRings;
+            ringBegin = begin;
+            ringLength = ring.numSamples;
+        }
+
+        begin += ring.numSamples;
+    }
+
+    return numRings == 1;
+}
+
+
+
+// Keypoint extracter class
+
+DescriptorExtracter::DescriptorExtracter
+    (cl::Context& context, 
+     const std::vector<cl::Device>& devices,
+     int numFloatsPerPos,
+     bool soaLayout,
+     DescriptorFormat format,
+     KeypointOrientation orientation,
+     const DescriptorPattern& pattern)
+ : context_(context), numFloatsPerPos_(numFloatsPerPos),
+   format_(format), orientation_(orientation), pattern_(pattern)
+{
+    const int orientationIdx = 4;
+
+    if (orientation != KeypointOrientation::Ignore
+            && numFloatsPerPos <= orientationIdx)
+        throw std::logic_error("DescriptorExtracter: positions have no "
+                               "room for an orientation");
+
+    size_t ringBegin = 0, ringLength = 0;
+    if (orientation == KeypointOrientation::Derotate
+            && !(pattern.polarLayout(ringBegin, ringLength)
+                 && pattern.samplingLevels()[ringBegin] == 0))
+        throw std::logic_error("DescriptorExtracter: can only derotate "
+                               "patterns with one ring, on the keypoint's "
+                               "level");
+
+    const float pi = 4 * atan(1);
+
+    // Pattern of locations to sample at, compiled into the kernel
+    const std::vector<Coord> samplingPattern = pattern.samplingPattern();
+    const std::vector<int> samplingLevels = pattern.samplingLevels();
+
+    // The diameter (total width/height of sampling pattern) must reach
+    // the furthest sample, and there must be a work item per sample
+    diameter_ = 2 * std::max(1, int(std::ceil(pattern.maxRadius())));
+    while (size_t((diameter_ + 4) * (diameter_ + 4)) 
+            < samplingPattern.size())
+        diameter_ += 2;
+
     std::ostringstream kernelInput;
 
     kernelInput 
-        << "#define DIAMETER (" << diameter << ")\n"
-        << "#define NUM_FLOATS_PER_POS (" << numFloatsPerPos << ")\n";
+        << "#define DIAMETER (" << diameter_ << ")\n"
+        << "#define NUM_SAMPLES (" << samplingPattern.size() << ")\n"
+        << "#define NUM_FLOATS_PER_POS (" << numFloatsPerPos << ")\n"
+        << positionIndexDefine(soaLayout);
+
+    if (format == DescriptorFormat::Half)
+        kernelInput << "#define OUTPUT_HALF\n";
+    else if (format == DescriptorFormat::Char)
+        kernelInput << "#define OUTPUT_CHAR\n";
+
+    std::vector<std::complex<double>> sampleLocs;
+    for (const Coord& c: samplingPattern)
+        sampleLocs.push_back({c.x, c.y});
+    writeTable(kernelInput, "SAMPLE_LOCS", sampleLocs);
+
+    kernelInput << "__constant int SAMPLE_LEVEL[" << samplingLevels.size() 
+                << "] = {";
+    for (int l: samplingLevels)
+        kernelInput << l << ", ";
+    kernelInput << "};\n";
+
+    writeDerotationTables(kernelInput, samplingPattern, diameter_);
+
+    if (orientation != KeypointOrientation::Ignore) {
+        kernelInput << "#define ESTIMATE_ORIENTATION\n"
+                    << "#define ORIENTATION_IDX (" << orientationIdx 
+                    << ")\n";
+
+        // The subbands respond most at (near enough) 75, 45, 15, -15, -45
+        // and -75 degrees.  Taking them as exactly evenly spaced makes
+        // the estimate move by exactly a step when the descriptor does.
+        std::vector<std::complex<double>> subbandDirections;
+        for (int n = 0; n < 6; ++n)
+            subbandDirections.push_back(std::polar(1., 
+                                            2 * (75 - 30 * n) * double(pi) / 180));
+        writeTable(kernelInput, "SUBBAND_DIR", subbandDirections);
+    }
+
+    if (orientation == KeypointOrientation::Derotate) {
+        // Only whole numbers of steps round the ring that are also whole
+        // numbers of 30 degrees, which are evenly spaced
+        const std::vector<PolarRotation> rotations
+            = polarRotations(samplingPattern.size(), ringBegin, ringLength);
+
+        kernelInput << "#define DEROTATE\n"
+                    << "#define NUM_ROTATIONS (" << rotations.size() << ")\n"
+                    << rotationTablesSource(rotations);
+    }
 
     // Get input from the source file
     const char* fileText = reinterpret_cast<const char*>
@@ -58,130 +361,231 @@ Interpolator::Interpolator(cl::Context& context,
 	    throw;
     } 
 
-    // Upload the sampling pattern
-    const size_t samplingPatternSize 
-        = samplingPattern.size() * 2 * sizeof(float);
-
-    samplingPattern_ = cl::Buffer(context_, 
-                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                  samplingPatternSize,
-                                  &samplingPattern[0]);
-
     // ...and extract the useful part, viz the kernel
-    kernel_ = cl::Kernel(program, "extractDescriptor");
+    kernel_ = cl::Kernel(program, "extractDescriptors");
 
-    // Set arguments we already know
-    kernel_.setArg(4, samplingPattern_);
-    kernel_.setArg(5, int(samplingPattern.size()));
-    kernel_.setArg(6, int(outputStride));
-    kernel_.setArg(7, int(outputOffset));
+    // Enough workgroups to keep the device busy; each works through
+    // keypoints until there are none left
+    numWorkgroups_ = 8 * devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
 }
 
 
-
-void Interpolator::operator() 
+void DescriptorExtracter::operator() 
                (cl::CommandQueue& cq,
-                const Subbands& subbands,
+                const Subbands& fineSubbands,   
+                float fineScale,
+                const Subbands& coarseSubbands,
+                float coarseScale,
                 const cl::Buffer& locations,
-                float scale,
                 const cl::Buffer& kpOffsets,
                 int kpOffsetsIdx,
                 int maxNumKPs,
                 cl::Buffer& output,
+                cl::Buffer* descriptorScales,
                 std::vector<cl::Event> waitEvents,
                 cl::Event* doneEvent)
 {
-    // Set subband arguments
-    kernel_.setArg(9,  subbands.buffer());
-    kernel_.setArg(10, cl_uint(subbands.start()));
-    kernel_.setArg(11, cl_uint(subbands.pitch()));
-    kernel_.setArg(12, cl_uint(subbands.padding()));
-    kernel_.setArg(13, cl_uint(subbands.stride()));
-    kernel_.setArg(14, cl_uint(subbands.width()));
-    kernel_.setArg(15, cl_uint(subbands.height()));
-
-    // Set descriptor location arguments relative to the centre of the 
-    // image.  scale should be the number of original image pixels per 
-    // pixel at the subband level.  locations must be of format 
-    // (x, y, ...), with each record being of length numFloatsPerPos
-    // (set at creation).  
-    kernel_.setArg(0, locations);
-    kernel_.setArg(1, cl_float(scale));
-    kernel_.setArg(2, kpOffsets);
-    kernel_.setArg(3, cl_int(kpOffsetsIdx));
+    extract(cq, fineSubbands.buffer(), coarseSubbands.buffer(),
+            levelInfo({&fineSubbands, &coarseSubbands}, 
+                      {fineScale, coarseScale}),
+            locations, &kpOffsets, kpOffsetsIdx, 1, -1, maxNumKPs,
+            output, descriptorScales, waitEvents, doneEvent);
+}
 
-    // Set output argument
-    kernel_.setArg(8, output);
 
-    // Enqueue the kernel
-    cl::NDRange workgroupSize = {1, diameter_+4, diameter_+4};
-    cl::NDRange globalSize = {maxNumKPs, diameter_+4, diameter_+4};
+void DescriptorExtracter::operator() 
+               (cl::CommandQueue& cq,
+                const DtcwtOutput& subbands,
+                const std::vector<float>& scales,
+                const cl::Buffer& locations,
+                const cl::Buffer& kpOffsets,
+                int firstLevel,
+                int numLevels,
+                int maxNumKPs,
+                cl::Buffer& output,
+                cl::Buffer* descriptorScales,
+                std::vector<cl::Event> waitEvents,
+                cl::Event* doneEvent)
+{
+    // The levels used, including the coarser one above the last
+    std::vector<const Subbands*> levels;
+    std::vector<float> levelScales;
+    for (int l = firstLevel; l <= (firstLevel + numLevels); ++l) {
+        levels.push_back(&subbands[l]);
+        levelScales.push_back(scales[l]);
+
+        if (subbands[l].buffer()() != subbands[firstLevel].buffer()())
+            throw std::logic_error("DescriptorExtracter: levels must all "
+                                   "be in the same buffer");
+    }
 
-    cq.enqueueNDRangeKernel(kernel_, cl::NullRange,
-                            globalSize, workgroupSize,
-                            &waitEvents, doneEvent);    
+    extract(cq, subbands[firstLevel].buffer(), subbands[firstLevel].buffer(),
+            levelInfo(levels, levelScales),
+            locations, &kpOffsets, firstLevel, numLevels, -1, maxNumKPs,
+            output, descriptorScales, waitEvents, doneEvent);
 }
 
 
-// Keypoint extracter class
-
-DescriptorExtracter::DescriptorExtracter
-    (cl::Context& context, 
-     const std::vector<cl::Device>& devices,
-     int numFloatsPerPos)
+void DescriptorExtracter::describePoints
+               (cl::CommandQueue& cq,
+                const DtcwtOutput& subbands,
+                const std::vector<float>& scales,
+                const cl::Buffer& points,
+                int numPoints,
+                cl::Buffer& output,
+                cl::Buffer* descriptorScales,
+                std::vector<cl::Event> waitEvents,
+                cl::Event* doneEvent)
 {
-    const float pi = 4 * atan(1);
+    const int levelIdx = 2;
+
+    if (numFloatsPerPos_ <= levelIdx)
+        throw std::logic_error("DescriptorExtracter: points have no "
+                               "room for a level");
 
-    // Pattern of locations to sample at
-    // Set up the centre
-    std::vector<Coord> finePattern= {{0, 0}};
+    if (subbands.numLevels() < 2 || scales.size() < subbands.numLevels())
+        throw std::logic_error("DescriptorExtracter: need at least two "
+                               "levels, with scales");
 
-    // Set up the circle
-    for (int n = 0; n < 12; ++n) {
-        finePattern.push_back({float(sin(float(9-n) / 12.f * 2.f * pi)),
-                               float(cos(float(9-n) / 12.f * 2.f * pi))});
+    // All the levels, so a point's level indexes the table directly
+    std::vector<const Subbands*> levels;
+    for (const Subbands& sb: subbands) {
+        levels.push_back(&sb);
+
+        if (sb.buffer()() != subbands[0].buffer()())
+            throw std::logic_error("DescriptorExtracter: levels must all "
+                                   "be in the same buffer");
     }
 
-    std::vector<Coord> coarsePattern = {{0, 0}};
+    extract(cq, subbands[0].buffer(), subbands[0].buffer(),
+            levelInfo(levels, scales),
+            points, nullptr, 0, subbands.numLevels() - 1, levelIdx,
+            numPoints,
+            output, descriptorScales, waitEvents, doneEvent);
+}
+
 
-    // Set up the kernels
-    fineInterpolator_ = Interpolator(context, devices,
-                                     finePattern, 14, 0, 2, numFloatsPerPos);
-    coarseInterpolator_ = Interpolator(context, devices,
-                                     coarsePattern, 14, 13, 0, numFloatsPerPos);
+static bool operator == (const DescriptorExtracter::LevelInfo& a,
+                         const DescriptorExtracter::LevelInfo& b)
+{
+    return a.start == b.start && a.pitch == b.pitch && a.stride == b.stride
+        && a.step == b.step
+        && a.width == b.width && a.height == b.height && a.scale == b.scale;
 }
 
 
-void DescriptorExtracter::operator() 
+cl::Buffer DescriptorExtracter::levelTable
+    (const std::vector<LevelInfo>& levels)
+{
+    // Look for one already uploaded
+    for (auto& table: levelTables_)
+        if (table.first == levels)
+            return table.second;
+
+    cl::Buffer table {
+        context_, 
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        levels.size() * sizeof(LevelInfo),
+        const_cast<LevelInfo*>(&levels[0])
+    };
+
+    levelTables_.push_back(std::make_pair(levels, table));
+
+    return table;
+}
+
+
+void DescriptorExtracter::extract
                (cl::CommandQueue& cq,
-                const Subbands& fineSubbands,   
-                float fineScale,
-                const Subbands& coarseSubbands,
-                float coarseScale,
+                const cl::Buffer& fineBuffer,
+                const cl::Buffer& coarseBuffer,
+                const std::vector<LevelInfo>& levels,
                 const cl::Buffer& locations,
-                const cl::Buffer& kpOffsets,
-                int kpOffsetsIdx,
-                int maxNumKPs,
+                const cl::Buffer* kpOffsets,
+                int firstLevel, int numLevels,
+                int levelIdx, int maxNumKPs,
                 cl::Buffer& output,
-                std::vector<cl::Event> waitEvents,
-                cl::Event* doneEventFine, cl::Event* doneEventCoarse)
+                cl::Buffer* descriptorScales,
+                const std::vector<cl::Event>& waitEvents,
+                cl::Event* doneEvent)
 {
-    // Call the fine and coarse levels
-    fineInterpolator_(cq, fineSubbands, locations, fineScale,
-                          kpOffsets, kpOffsetsIdx, maxNumKPs, 
-                          output,
-                          waitEvents, doneEventFine);
+    if (format_ != DescriptorFormat::Float && descriptorScales == nullptr)
+        throw std::logic_error("DescriptorExtracter: quantised descriptors "
+                               "need a buffer for their scales");
+
+    kernel_.setArg(0, locations);
+
+    // Room in the locations list, for finding components in it
+    kernel_.setArg(1, cl_uint(locations.getInfo<CL_MEM_SIZE>() 
+                                / (numFloatsPerPos_ * sizeof(float))));
+    if (kpOffsets != nullptr)
+        kernel_.setArg(2, *kpOffsets);
+    else
+        kernel_.setArg(2, sizeof(cl_mem), nullptr);
+
+    kernel_.setArg(3, cl_int(firstLevel));
+    kernel_.setArg(4, cl_int(numLevels));
+    kernel_.setArg(5, levelTable(levels));
+    kernel_.setArg(6, fineBuffer);
+    kernel_.setArg(7, coarseBuffer);
+    kernel_.setArg(8, output);
+
+    if (descriptorScales != nullptr)
+        kernel_.setArg(9, *descriptorScales);
+    else
+        kernel_.setArg(9, sizeof(cl_mem), nullptr);
 
-    coarseInterpolator_(cq, coarseSubbands, locations, coarseScale,
-                            kpOffsets, kpOffsetsIdx, maxNumKPs, 
-                            output,
-                            waitEvents, doneEventCoarse);
+    // Without a list, the level of each point is in its position, and
+    // there are maxNumKPs of them
+    kernel_.setArg(10, cl_int(levelIdx));
+    kernel_.setArg(11, cl_uint((levelIdx < 0)? 0 : maxNumKPs));
+
+    // No need for more workgroups than keypoints
+    const size_t numWorkgroups = std::max(1, std::min(int(numWorkgroups_), 
+                                                      maxNumKPs));
+
+    cl::NDRange workgroupSize = {1, diameter_+4, diameter_+4};
+    cl::NDRange globalSize = {numWorkgroups, diameter_+4, diameter_+4};
+
+    cq.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                            globalSize, workgroupSize,
+                            &waitEvents, doneEvent);    
 }
 
 
 size_t DescriptorExtracter::getNumFloatsInDescriptor() const
 {
-    return 14*6*2;
+    return pattern_.getNumFloatsInDescriptor();
+}
+
+
+const DescriptorPattern& DescriptorExtracter::pattern() const
+{
+    return pattern_;
 }
 
 
+size_t DescriptorExtracter::getNumBytesPerElement() const
+{
+    switch (format_) {
+        case DescriptorFormat::Half:
+            return sizeof(cl_half);
+        case DescriptorFormat::Char:
+            return sizeof(cl_char);
+        default:
+            return sizeof(cl_float);
+    }
+}
+
+
+DescriptorFormat DescriptorExtracter::format() const
+{
+    return format_;
+}
+
+
+KeypointOrientation DescriptorExtracter::orientation() const
+{
+    return orientation_;
+}
+
@@ -7,6 +7,7 @@
 #endif
 #include "CL/cl.hpp"
 #include <vector>
+#include <utility>
 
 
 #include "DTCWT/dtcwt.h"
@@ -16,66 +17,111 @@ struct Coord {
     float x, y;
 };
 
-class Interpolator {
-// Class that can extract a ring of keypoints from a particular level
+
+enum class DescriptorFormat {
+    // How descriptor components are stored.  Half and Char are quantised:
+    // each descriptor is divided by its own scale, so that its largest
+    // component is 1 (Half) or 127 (Char).
+    Float, Half, Char
+};
+
+
+struct SamplingRing {
+    // numSamples points evenly spaced on a circle of radius pixels (of the
+    // level sampled), in order of increasing angle atan2(y, x) starting
+    // from -180 degrees.  A radius of zero with one sample is the centre.
+    // level 0 is the keypoint's own level, 1 the next coarser.
+    int level;
+    float radius;
+    int numSamples;
+};
+
+
+class DescriptorPattern {
+// Where descriptors sample the subbands around each keypoint: rings of
+// points, one after another in the descriptor.  Each DescriptorExtracter
+// compiles its pattern into its kernel, so smaller patterns make for
+// shorter descriptors and quicker extraction.
 
 public:
 
-    Interpolator() = default;
-    Interpolator(const Interpolator&) = default;
+    DescriptorPattern(const std::vector<SamplingRing>& rings);
 
-    Interpolator(cl::Context& context,
-                        const std::vector<cl::Device>& devices,
-                        std::vector<Coord> samplingPattern,
-                        int outputStride, int outputOffset,
-                        int diameter,
-                        int numFloatsPerPos);
-    // numFloatsPerPos - The number of floating points taken to describe
-    // each position. The first two of these are x and y relative to the
-    // centre of the image at the untransformed image scale.
+    static DescriptorPattern standard();
+    // The centre and a ring of 12 at radius 1 from the keypoint's own
+    // level, and the centre of the next coarser.
 
-    void
-    operator() (cl::CommandQueue& cq,
-                const Subbands& subbands,
-                const cl::Buffer& locations,
-                float scale,
-                const cl::Buffer& kpOffsets,
-                int kpOffsetsIdx,
-                int maxNumKPs,
-                cl::Buffer& output,
-                std::vector<cl::Event> waitEvents = std::vector<cl::Event>(),
-                cl::Event* doneEvent = nullptr);
-    // scale - the number of original image pixels per pixel at this level 
-    // of transform.
+    const std::vector<SamplingRing>& rings() const;
 
+    std::vector<Coord> samplingPattern() const;
+    std::vector<int> samplingLevels() const;
+    // Location and level of each sample, in order
+
+    size_t numSamples() const;
+    size_t getNumFloatsInDescriptor() const;
+    // Each sample has a complex value for each of six subbands
+
+    float maxRadius() const;
+
+    bool polarLayout(size_t& ringBegin, size_t& ringLength) const;
+    // Whether descriptors can be rotated by stepping round a ring (see
+    // polarRotations): there must be exactly one ring with a radius,
+    // which is then at samples ringBegin up to ringBegin+ringLength.
 
 private:
 
-    cl::Context context_;
-    cl::Kernel kernel_;
+    std::vector<SamplingRing> rings_;
+
+};
 
-    cl::Buffer samplingPattern_;
-    int diameter_;
 
+enum class KeypointOrientation {
+    // What to do with each keypoint's dominant orientation, estimated from
+    // the energy in the subbands around it.  Estimate writes it (radians,
+    // as atan2(y, x)) to component 4 of the keypoint's position.  Derotate
+    // does that and also rotates the descriptor by the valid rotation (see
+    // polarRotations) that best cancels it, so rotated copies of a feature
+    // give (nearly) the same descriptor.
+    Ignore, Estimate, Derotate
 };
 
 
 class DescriptorExtracter {
-// Extract descriptors from two consecutive levels, the lower one a ring
-// with a central point (unit radius) and the upper one a circle.  The
-// coordinates are for the finer scale and relative to its centre
+// Extract descriptors from two consecutive levels, sampled as the pattern
+// says (by default a ring of unit radius with a central point on the lower
+// one, and a central point on the upper).  The coordinates are for the
+// finer scale and relative to its centre.  Both
+// levels are sampled in the same kernel launch, which walks the keypoint
+// list rather than being sized for the most keypoints there could be.
 
 public:
     DescriptorExtracter() = default;
     DescriptorExtracter(const DescriptorExtracter&) = default;
 
-    DescriptorExtracter(cl::Context& context, 
+    DescriptorExtracter(cl::Context& context,
                         const std::vector<cl::Device>& devices,
-                        int numFloatsPerPos);
+                        int numFloatsPerPos,
+                        bool soaLayout = false,
+                        DescriptorFormat format = DescriptorFormat::Float,
+                        KeypointOrientation orientation
+                            = KeypointOrientation::Ignore,
+                        const DescriptorPattern& pattern
+                            = DescriptorPattern::standard());
+    // numFloatsPerPos - The number of floating points taken to describe
+    // each position. The first two of these are x and y relative to the
+    // centre of the image at the untransformed image scale.
+    // soaLayout - positions are separate arrays for each component, each
+    // as long as the locations buffer has room for, rather than records
+    // (as for PeakDetectorResults).
+    // format - how to store the descriptors.
+    // orientation - whether to estimate orientations, and use them.  Other
+    // than Ignore, positions must have at least five components, and
+    // Derotate needs a pattern with a polarLayout.
+    // pattern - where to sample.
 
     void
     operator() (cl::CommandQueue& cq,
-                const Subbands& fineSubbands,   
+                const Subbands& fineSubbands,
                 float fineScale,
                 const Subbands& coarseSubbands,
                 float coarseScale,
@@ -84,16 +130,109 @@ public:
                 int kpOffsetsIdx,
                 int maxNumKPs,
                 cl::Buffer& output,
+                cl::Buffer* descriptorScales = nullptr,
                 std::vector<cl::Event> waitEvents = std::vector<cl::Event>(),
-                cl::Event* doneEventFine = nullptr,
-                cl::Event* doneEventCoarse = nullptr);
+                cl::Event* doneEvent = nullptr);
+    // Extract the keypoints from kpOffsets[kpOffsetsIdx] up to
+    // kpOffsets[kpOffsetsIdx+1].  The scales are the number of original
+    // image pixels per pixel at each level.
+
+    void
+    operator() (cl::CommandQueue& cq,
+                const DtcwtOutput& subbands,
+                const std::vector<float>& scales,
+                const cl::Buffer& locations,
+                const cl::Buffer& kpOffsets,
+                int firstLevel,
+                int numLevels,
+                int maxNumKPs,
+                cl::Buffer& output,
+                cl::Buffer* descriptorScales = nullptr,
+                std::vector<cl::Event> waitEvents = std::vector<cl::Event>(),
+                cl::Event* doneEvent = nullptr);
+    // Extract the keypoints of list levels firstLevel up to
+    // firstLevel+numLevels all at once, list level l being sampled from
+    // subbands[l] and subbands[l+1] at scales[l] and scales[l+1].  The
+    // levels must share a buffer, as they do when made by DtcwtTemps.
+    // maxNumKPs is the most there could be over all these levels.
+    //
+    // For both, descriptor n is written to output from element
+    // n * getNumFloatsInDescriptor(), each element being the size given by
+    // getNumBytesPerElement().  For quantised formats, descriptorScales
+    // must be a float buffer, and descriptorScales[n] is what to multiply
+    // descriptor n by to recover its values.
+
+    void
+    describePoints(cl::CommandQueue& cq,
+                   const DtcwtOutput& subbands,
+                   const std::vector<float>& scales,
+                   const cl::Buffer& points,
+                   int numPoints,
+                   cl::Buffer& output,
+                   cl::Buffer* descriptorScales = nullptr,
+                   std::vector<cl::Event> waitEvents 
+                        = std::vector<cl::Event>(),
+                   cl::Event* doneEvent = nullptr);
+    // Extract descriptors at the first numPoints of points, in any order
+    // and at any level, with no detection pass (e.g. to resample tracked
+    // points).  points is laid out as positions are, but component 2 is
+    // the level l to sample (as a float), rather than the scale: point n
+    // is sampled from subbands[l] and subbands[l+1], so l must be below
+    // subbands.numLevels()-1.  Points with l out of range are not sampled
+    // at all: their descriptors (and scales) are all zero.  Output is as
+    // above.  In the Float format, the descriptors are just the
+    // interpolated subband samples, in pattern order.
 
     size_t getNumFloatsInDescriptor() const;
+    // Number of components in each descriptor, whatever the format
+
+    const DescriptorPattern& pattern() const;
+    // Where the descriptors were sampled, in order
+
+    size_t getNumBytesPerElement() const;
+    // Size of each component as stored
+
+    DescriptorFormat format() const;
+
+    KeypointOrientation orientation() const;
+    // Whether the extraction also writes orientations to the positions
+
+
+    struct LevelInfo {
+        // Layout and scale of a level, as the kernel reads it
+        cl_uint start, pitch, stride, step, width, height;
+        cl_float scale;
+    };
 
 private:
 
-    // Different interpolators for the ring vs. the single point
-    Interpolator fineInterpolator_, coarseInterpolator_;
+    cl::Context context_;
+    cl::Kernel kernel_;
+
+    int diameter_;
+    int numFloatsPerPos_;
+    DescriptorFormat format_;
+    KeypointOrientation orientation_;
+    DescriptorPattern pattern_ = DescriptorPattern::standard();
+    size_t numWorkgroups_;
+
+    // Level tables uploaded so far, so each is only made once
+    std::vector<std::pair<std::vector<LevelInfo>, cl::Buffer>> levelTables_;
+
+    cl::Buffer levelTable(const std::vector<LevelInfo>& levels);
+
+    void extract(cl::CommandQueue& cq,
+                 const cl::Buffer& fineBuffer,
+                 const cl::Buffer& coarseBuffer,
+                 const std::vector<LevelInfo>& levels,
+                 const cl::Buffer& locations,
+                 const cl::Buffer* kpOffsets,
+                 int firstLevel, int numLevels,
+                 int levelIdx, int maxNumKPs,
+                 cl::Buffer& output,
+                 cl::Buffer* descriptorScales,
+                 const std::vector<cl::Event>& waitEvents,
+                 cl::Event* doneEvent);
 
 };
 
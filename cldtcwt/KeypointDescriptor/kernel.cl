@@ -3,35 +3,74 @@
 // Cubic Convolution Interpolation for Digital Image Processing).
 
 
+// Tables, which should be defined ahead of this by the host:
+//
+// SAMPLE_LOCS[k][2]: sampling location k, relative to the keypoint, in
+// pixels of the level it is sampled from.
+//
+// SAMPLE_LEVEL[k]: 0 if sampling location k is taken from the keypoint's
+// own level, or 1 if it is taken from the next (coarser) level.
+//
+// DEROT_X[n][i][2], DEROT_Y[n][i][2]: the complex phasors to derotate 
+// subband n by, for a sample i - DIAMETER/2 - 1 pixels from the keypoint's 
+// integer position in x and in y.  The subband's phase offset is included
+// in DEROT_X.
+//
+// SAMPLE_ROT[n][k][2]: the phasor exp(j w_n . s_k) to rerotate sampling
+// location k of subband n, where w_n is the centre frequency.
+//
+// ANGULAR_FREQ[n][2]: the centre frequency of subband n.
+//
+// With ESTIMATE_ORIENTATION defined, also:
+//
+// ORIENTATION_IDX: the component of the position to write the orientation
+// to.
+//
+// SUBBAND_DIR[n][2]: the phasor exp(2j psi_n), where psi_n is the angle
+// subband n responds most to (only defined up to 180 degrees, hence the
+// doubling).
+//
+// and with DEROTATE as well:
+//
+// ROT_SOURCE[k][c], ROT_CONJ[k][c]: value c of the descriptor rotated by k
+// of NUM_ROTATIONS equal steps round a full turn is value ROT_SOURCE[k][c]
+// of the original, conjugated if ROT_CONJ[k][c] (see Matcher/polarMatcher.h).
+//
+// Since the derotation is relative to the keypoint, and the rerotation to
+// the same point, the absolute position cancels out.  That leaves only the
+// keypoint's fractional position needing trigonometry, once per subband.
+
+
+float2 cmul(float2 a, float2 b)
+{
+    // Complex multiplication
+    return (float2) (a.x * b.x - a.y * b.y,
+                     a.x * b.y + a.y * b.x);
+}
+
+
+float2 tableEntry(__constant const float* entry)
+{
+    return (float2) (entry[0], entry[1]);
+}
+
+
+
 float2 readSBAndDerotate(const __global float2* sb, int2 pos,
-                        float2 angFreq, float2 offset,
-                        unsigned int padding, unsigned int stride,
+                        float2 derotation,
+                        unsigned int stride, unsigned int step,
                         uint2 sbSize)
 {
-    // Read pos, apply offset and derotate by angFreq
+    // Read pos, and derotate (including any offset) by the derotation 
+    // phasor
 
     // Check in image; otherwise, return zero (to avoid reading garbage)
     bool inSB = all((int2) (0,0) <= pos) & all(pos < convert_int2(sbSize));
 
-    float2 val = inSB? sb[pos.x + pos.y * stride]
+    float2 val = inSB? sb[pos.x * step + pos.y * stride]
                      : (float2) (0.f, 0.f);
 
-    // Apply offset to give consistent phase behaviour relative to sampling
-    // point between subbands
-    val = (float2) (val.x * offset.x - val.y * offset.y,
-                    val.x * offset.y + val.y * offset.x);
-
-    // Find phase in each direction
-    float phase = pos.x * angFreq.x + pos.y * angFreq.y;
-
-    // Find coefficients to multiply by
-    float cosComp;
-    float sinComp = sincos(-phase, &cosComp);
-
-    // Multiply and return
-    return (float2) (cosComp * val.x - sinComp * val.y,
-                     cosComp * val.y + sinComp * val.x);
-
+    return cmul(val, derotation);
 }
 
 
@@ -77,23 +116,6 @@ float2 interp(const __local float2* values, unsigned int stride,
 
 
 
-float2 rerotate(float2 dcValue, float2 pos, float2 angFreq)
-{
-    // Given location pos (relative to whereever the dcValue was derotated
-    // from originally) and angular frequencies.
-
-    // Calculate the complex phasor
-    float c;
-    float s = sincos(dot(pos, angFreq), &c);
-
-    // Rotate by that phasor
-    return (float2) (dcValue.x * c - dcValue.y * s,
-                     dcValue.x * s + dcValue.y * c);
-}
-
-
-
-
 int2 ifract(float2 num, __private float2* fraction)
 {
     // Convert a float2 to the integer part (returned)
@@ -109,127 +131,355 @@ int2 ifract(float2 num, __private float2* fraction)
 
 
 
-__kernel void extractDescriptor(const __global float* pos,
-                                float scale,
-                                const __global int* kpOffsets,
-                                int kpOffsetsIdx,
-                                const __global float2* sampleLocs,
-                                const int numSampleLocs,
-                                int stride, int offset,
-                                __global float2* output,
-                                const __global float2* sb,
-                                unsigned int sbStart,
-                                unsigned int sbPitch,
-                                unsigned int sbPadding,
-                                unsigned int sbStride,
-                                unsigned int sbWidth,
-                                unsigned int sbHeight)
+// The descriptor format: floats, unless OUTPUT_HALF or OUTPUT_CHAR is
+// defined.  These are quantised, each descriptor being divided by a scale
+// (written separately) that brings its largest component to 1 or 127 
+// respectively.
+
+#if defined(OUTPUT_HALF)
+    #define QUANTISE
+    #define QUANTISED_MAX (1.f)
+    typedef half OutputType;
+#elif defined(OUTPUT_CHAR)
+    #define QUANTISE
+    #define QUANTISED_MAX (127.f)
+    typedef char OutputType;
+#else
+    typedef float OutputType;
+#endif
+
+
+
+#if defined(QUANTISE) || defined(ESTIMATE_ORIENTATION)
+    // The descriptor has to be complete before it can be written
+    #define BUFFER_DESCRIPTOR
+#endif
+
+
+
+#ifdef ESTIMATE_ORIENTATION
+
+float estimateOrientation(const __local float2* descriptor)
 {
+    // Dominant orientation, as an angle atan2(y, x), from the samples at
+    // the keypoint's own level.  The subbands' energies give it up to 180
+    // degrees; which way round is the side of the ring with more energy.
+    // Rotating the descriptor by a step round the ring adds exactly one
+    // step to this.
+    float2 axis = (float2) (0.f, 0.f), ring = (float2) (0.f, 0.f);
+
+    for (int k = 0; k < NUM_SAMPLES; ++k) {
+
+        if (SAMPLE_LEVEL[k] != 0)
+            continue;
+
+        float energy = 0.f;
+        for (int n = 0; n < 6; ++n) {
+            const float2 v = descriptor[k * 6 + n];
+            const float e = dot(v, v);
 
-    // Complex numbers to subbands multiply by
-    const float2 offsets[6] = {
-        (float2) ( 0, 1), (float2) ( 0,-1), (float2) ( 0, 1), 
-        (float2) (-1, 0), (float2) ( 1, 0), (float2) (-1, 0)
-    };
+            axis += e * tableEntry(SUBBAND_DIR[n]);
+            energy += e;
+        }
 
-    // Subband centre frequencies
-    const float2 angularFreq[6] = {
-        (float2) (-1,-3) * M_PI_F / 2.15f, 
-        (float2) (-sqrt(5.f), -sqrt(5.f)) * M_PI_F / 2.15f, 
-        (float2) (-3, -1) * M_PI_F / 2.15f, 
-        (float2) (-3,  1) * M_PI_F / 2.15f, 
-        (float2) (-sqrt(5.f), sqrt(5.f)) * M_PI_F / 2.15f, 
-        (float2) (-1, 3) * M_PI_F / 2.15f 
-    };
+        // The centre, at zero, counts for nothing
+        ring += energy * tableEntry(SAMPLE_LOCS[k]);
+    }
 
+    float angle = 0.5f * atan2(axis.y, axis.x);
 
+    float c;
+    const float s = sincos(angle, &c);
+    if (dot(ring, (float2) (c, s)) < 0.f)
+        angle += (angle > 0.f)? -M_PI_F : M_PI_F;
 
+    return angle;
+}
 
-    size_t kpIdxsBegin = kpOffsets[kpOffsetsIdx],
-           kpIdxsEnd = kpOffsets[kpOffsetsIdx+1];
+#endif
 
-    // Work out which input/output index we're working with
-    const size_t kpIdx = kpIdxsBegin + get_global_id(0);
 
-    // See whether we need to do anything
-    if (kpIdx >= kpIdxsEnd)
-        return;
 
-    const int2 idx = (int2) (get_global_id(1), get_global_id(2));
-    const int wgWidth = get_local_size(1);
+#ifdef QUANTISE
 
-    // Work out which sampling location we should take (if any)
-    // (i.e. does this worker produce an output?)
-    const int samplerIdx = idx.x + idx.y * wgWidth;
-    const bool isSampler = samplerIdx < numSampleLocs;
+void storeQuantised(__global OutputType* output, __global float* scales,
+                    unsigned int kpIdx, const __local float* values,
+                    __local float* partialMax)
+{
+    // Find the largest magnitude component of the descriptor in values,
+    // and write the descriptor out scaled by it.  Used by the whole 
+    // workgroup, with values complete.
+    const int numValues = NUM_SAMPLES * 6 * 2;
+    const int id = get_local_id(1) + get_local_id(2) * get_local_size(1);
+    const int numItems = get_local_size(1) * get_local_size(2);
+
+    float m = 0.f;
+    for (int i = id; i < numValues; i += numItems)
+        m = fmax(m, fabs(values[i]));
+
+    partialMax[id] = m;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (id == 0) {
+        for (int i = 1; i < numItems; ++i)
+            m = fmax(m, partialMax[i]);
+
+        partialMax[0] = m / QUANTISED_MAX;
+        scales[kpIdx] = m / QUANTISED_MAX;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Avoid dividing by zero for an all-zero descriptor
+    const float invScale = (partialMax[0] > 0.f)? 1.f / partialMax[0] : 0.f;
+
+    for (int i = id; i < numValues; i += numItems) {
+#if defined(OUTPUT_HALF)
+        vstore_half_rte(values[i] * invScale, kpIdx * numValues + i, output);
+#else
+        output[kpIdx * numValues + i] 
+            = convert_char_sat_rte(values[i] * invScale);
+#endif
+    }
 
+    // Everyone must be done with partialMax before it is reused
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
 
+#endif
 
-    // Read coordinates from the input matrix
-    float2 kpPos = (float2) (pos[NUM_FLOATS_PER_POS * kpIdx],
-                             pos[NUM_FLOATS_PER_POS * kpIdx + 1])
-                            / (float2) scale
-                  + (float2) (sbWidth-1, sbHeight-1) / 2.f;
 
-    
-    // Calculate how far the keypoint is from the upper-left nearest pixel,
-    // and the nearest lower integer location
-    float2 kpRemPos;
-    int2 kpIntPos = ifract(kpPos, &kpRemPos);
 
+typedef struct {
 
+    // Where a level's subbands are within its buffer, and its size and
+    // scale (original image pixels per pixel at the level)
+    unsigned int start, pitch, stride, step, width, height;
+    float scale;
+
+} LevelInfo;
 
-    // Calculate where this worker should be reading from.  The -1 at the 
-    // end is to include enough area to do the interpolation properly.
-    int2 readPos = kpIntPos + idx - (DIAMETER / 2) - 1;
 
-    
-    // The place where this worker picks its sample
-    float2 sampleRemPosLocal;     
-    int2 sampleIntPosLocal = ifract(1.0 + DIAMETER / 2.0
-                               + kpRemPos + sampleLocs[samplerIdx],
-                               &sampleRemPosLocal);
 
+__kernel 
+__attribute__((reqd_work_group_size(1, DIAMETER+4, DIAMETER+4)))
+void extractDescriptors(__global float* pos,
+                        unsigned int posLength,
+                        const __global unsigned int* kpOffsets,
+                        int firstLevel, int numLevels,
+                        __constant LevelInfo* levels,
+                        const __global float2* sbFine,
+                        const __global float2* sbCoarse,
+                        __global OutputType* output,
+                        __global float* scales,
+                        int levelIdx,
+                        unsigned int numPoints)
+{
+    // Each workgroup produces descriptors for keypoints in turn, striding
+    // through the list from kpOffsets[firstLevel] to 
+    // kpOffsets[firstLevel+numLevels].  Keypoint list level l is sampled
+    // from levels[l-firstLevel] in sbFine and levels[l-firstLevel+1] in 
+    // sbCoarse (which can be the same buffer).  scales is only used for
+    // quantised formats.  pos is only written to when estimating 
+    // orientation.
+    //
+    // Alternatively, with levelIdx not negative, describe the first
+    // numPoints positions without reading kpOffsets, each at the list
+    // level in its component levelIdx.  Points at levels outside
+    // [0, numLevels) get an all-zero descriptor (and scale).
+
+    const int2 idx = (int2) (get_local_id(1), get_local_id(2));
 
-    // Work out interpolation coefficient for current work item
-    float interpCoeffsX[4];
-    cubicCoefficients(sampleRemPosLocal.x, interpCoeffsX);
-    float interpCoeffsY[4];
-    cubicCoefficients(sampleRemPosLocal.y, interpCoeffsY);
-        
+    // Work out which sampling location we should take (if any)
+    // (i.e. does this worker produce an output?)
+    const int samplerIdx = idx.x + idx.y * (DIAMETER+4);
+    const bool isSampler = samplerIdx < NUM_SAMPLES;
+    const int sampleIdx = min(samplerIdx, NUM_SAMPLES-1);
 
     // Storage for the subband values
     __local float2 sbVals[DIAMETER+4][DIAMETER+4];
 
+    // Phasors for the keypoint's fractional position, one per subband.
+    __local float2 kpRot[6];
 
-    // For each subband
-    for (int n = 0; n < 6; ++n) {
+    const int id = samplerIdx;
+    const int numItems = (DIAMETER+4) * (DIAMETER+4);
 
-        sbVals[idx.y][idx.x]
-                   = readSBAndDerotate(sb + sbStart + n * sbPitch, 
-                                       readPos, 
-                                       angularFreq[n], offsets[n],
-                                       sbPadding, sbStride,
-                                       (uint2) (sbWidth, sbHeight));
+#ifdef BUFFER_DESCRIPTOR
+    // The whole descriptor, before quantising or rotating
+    __local float2 descriptor[NUM_SAMPLES * 6];
+#endif
 
-        // Make sure all items have got here
-        barrier(CLK_LOCAL_MEM_FENCE);
+#ifdef DEROTATE
+    __local float2 rotated[NUM_SAMPLES * 6];
+    __local int rotationSteps;
+#endif
+
+#ifdef QUANTISE
+    __local float partialMax[(DIAMETER+4) * (DIAMETER+4)];
+#endif
+
+    const bool listed = levelIdx < 0;
+
+    const unsigned int kpIdxsBegin = listed? kpOffsets[firstLevel] : 0,
+                       kpIdxsEnd = listed? kpOffsets[firstLevel+numLevels]
+                                         : numPoints;
+
+    int l = firstLevel;
+
+    for (unsigned int kpIdx = kpIdxsBegin + get_group_id(0);
+         kpIdx < kpIdxsEnd; kpIdx += get_num_groups(0)) {
+
+        // Whether the point has levels to sample from; the same for the
+        // whole workgroup, which still goes through the motions (at some
+        // level there is) so the barriers match
+        bool inRange = true;
+
+        // Find which level of the list we are in; kpIdx only increases
+        if (listed)
+            while (kpIdx >= kpOffsets[l+1])
+                ++l;
+        else {
+            const int pointLevel 
+                = (int) floor(pos[POS_IDX(kpIdx, levelIdx, posLength, 
+                                          NUM_FLOATS_PER_POS)]);
+            inRange = pointLevel >= 0 && pointLevel < numLevels;
+            l = firstLevel + clamp(pointLevel, 0, numLevels-1);
+        }
 
-        // If we are one of sampling points, sample
-        if (isSampler) {
+        // Read coordinates from the input matrix
+        const float2 kpPosOrig = 
+            (float2) (pos[POS_IDX(kpIdx, 0, posLength, NUM_FLOATS_PER_POS)],
+                      pos[POS_IDX(kpIdx, 1, posLength, NUM_FLOATS_PER_POS)]);
+
+        // Sample from the keypoint's own level, then the coarser one
+        for (int stage = 0; stage < 2; ++stage) {
+
+            const LevelInfo level = levels[l - firstLevel + stage];
+            const __global float2* sb = (stage == 0)? sbFine : sbCoarse;
+
+            const float2 kpPos = kpPosOrig / (float2) level.scale
+                      + (float2) (level.width-1, level.height-1) / 2.f;
+
+            // Calculate how far the keypoint is from the upper-left nearest
+            // pixel, and the nearest lower integer location
+            float2 kpRemPos;
+            int2 kpIntPos = ifract(kpPos, &kpRemPos);
+
+            // Calculate where this worker should be reading from.  The -1
+            // at the end is to include enough area to do the interpolation
+            // properly.
+            int2 readPos = kpIntPos + idx - (DIAMETER / 2) - 1;
+
+            // The place where this worker picks its sample
+            float2 sampleRemPosLocal;     
+            int2 sampleIntPosLocal = ifract(1.0 + DIAMETER / 2.0
+                                     + kpRemPos 
+                                     + tableEntry(SAMPLE_LOCS[sampleIdx]),
+                                     &sampleRemPosLocal);
+
+            const bool samples = isSampler 
+                                  && (SAMPLE_LEVEL[sampleIdx] == stage);
+
+            // Work out interpolation coefficient for current work item
+            float interpCoeffsX[4];
+            cubicCoefficients(sampleRemPosLocal.x, interpCoeffsX);
+            float interpCoeffsY[4];
+            cubicCoefficients(sampleRemPosLocal.y, interpCoeffsY);
+
+            // Ready after the first barrier below; the last barrier of the
+            // previous stage makes sure nobody is still using them
+            if (samplerIdx < 6) {
+                float c;
+                float s = sincos(dot(kpRemPos, 
+                                     tableEntry(ANGULAR_FREQ[samplerIdx])), 
+                                 &c);
+                kpRot[samplerIdx] = (float2) (c, s);
+            }
+
+            // For each subband
+            for (int n = 0; n < 6; ++n) {
+
+                sbVals[idx.y][idx.x]
+                   = readSBAndDerotate(sb + level.start + n * level.pitch, 
+                                       readPos, 
+                                       cmul(tableEntry(DEROT_X[n][idx.x]),
+                                            tableEntry(DEROT_Y[n][idx.y])),
+                                       level.stride, level.step,
+                                       (uint2) (level.width, level.height));
+
+                // Make sure all items have got here
+                barrier(CLK_LOCAL_MEM_FENCE);
+
+                // If we are one of sampling points, sample
+                if (samples) {
+
+                    // Interpolate and rerotate
+                    float2 v = cmul(interp(&sbVals[0][0], DIAMETER+4, 
+                                           sampleIntPosLocal - 1,
+                                           interpCoeffsX, interpCoeffsY),
+                                    cmul(tableEntry(
+                                            SAMPLE_ROT[n][samplerIdx]), 
+                                         kpRot[n]));
+                    if (!inRange)
+                        v = (float2) (0.f, 0.f);
+
+#ifdef BUFFER_DESCRIPTOR
+                    descriptor[n + samplerIdx * 6] = v;
+#else
+                    vstore2(v, n + samplerIdx * 6 + kpIdx * NUM_SAMPLES * 6,
+                            output);
+#endif
+                }
+
+                // Only move on when all local memory values are done 
+                // being used
+                barrier(CLK_LOCAL_MEM_FENCE);
+
+            }
+        }
 
-            // Interpolate and rerotate
-            output[n + samplerIdx * 6 + kpIdx * stride * 6 + offset * 6]
-              = rerotate(interp(&sbVals[0][0], wgWidth, 
-                                sampleIntPosLocal - 1,
-                                interpCoeffsX, interpCoeffsY),
-                         kpPos + sampleLocs[samplerIdx],
-                         angularFreq[n]);
+#ifdef BUFFER_DESCRIPTOR
+        const __local float2* values = descriptor;
+#endif
+
+#ifdef ESTIMATE_ORIENTATION
+        if (id == 0) {
+            const float angle = estimateOrientation(descriptor);
+            pos[POS_IDX(kpIdx, ORIENTATION_IDX, posLength, NUM_FLOATS_PER_POS)]
+                = angle;
+
+#ifdef DEROTATE
+            // The nearest whole number of steps that brings the
+            // orientation back to zero
+            const int steps = (int) round(-angle * (NUM_ROTATIONS / 2.f)
+                                                 / M_PI_F);
+            rotationSteps = (steps + NUM_ROTATIONS) % NUM_ROTATIONS;
+#endif
         }
 
-        // Only move on when all local memory values are done being used
+#ifdef DEROTATE
         barrier(CLK_LOCAL_MEM_FENCE);
 
+        for (int c = id; c < NUM_SAMPLES * 6; c += numItems) {
+            const float2 v = descriptor[ROT_SOURCE[rotationSteps][c]];
+            rotated[c] = ROT_CONJ[rotationSteps][c]? (float2) (v.x, -v.y) 
+                                                   : v;
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+        values = rotated;
+#endif
+#endif
+
+#if defined(QUANTISE)
+        storeQuantised(output, scales, kpIdx, 
+                       (const __local float*) values, partialMax);
+#elif defined(BUFFER_DESCRIPTOR)
+        for (int c = id; c < NUM_SAMPLES * 6; c += numItems)
+            vstore2(values[c], c + kpIdx * NUM_SAMPLES * 6, output);
+
+        // Everyone must be done with the descriptor before it is reused
+        barrier(CLK_LOCAL_MEM_FENCE);
+#endif
     }
 }
-
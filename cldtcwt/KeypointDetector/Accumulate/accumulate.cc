@@ -28,6 +28,7 @@ Accumulate::Accumulate(cl::Context& context,
         
     // ...and extract the useful part, viz the kernel
     kernel_ = cl::Kernel(program, "accumulate");
+    kernelWithStats_ = cl::Kernel(program, "accumulateWithStats");
 }
 
 
@@ -52,3 +53,32 @@ void Accumulate::operator() (cl::CommandQueue& cq, cl::Buffer& input,
 }
 
 
+
+void Accumulate::operator() (cl::CommandQueue& cq, cl::Buffer& rawCounts,
+                                                   cl::Buffer& counts,
+                                                   cl::Buffer& maxCounts,
+                                                   cl::Buffer& cumSum,
+                                                   cl_uint maxSum,
+                                                   cl::Buffer& stats,
+                      const std::vector<cl::Event>& waitEvents,
+                      cl::Event* doneEvent)
+{
+    // All buffers should contain cl_uint's.  counts and maxCounts should be
+    // the same length as rawCounts; cumSum one longer, and stats three times
+    // as long.
+
+    const cl_uint numInputs 
+        = rawCounts.getInfo<CL_MEM_SIZE>() / sizeof(cl_uint);
+
+    // Set all the arguments
+    kernelWithStats_.setArg(0, rawCounts);
+    kernelWithStats_.setArg(1, counts);
+    kernelWithStats_.setArg(2, maxCounts);
+    kernelWithStats_.setArg(3, numInputs);
+    kernelWithStats_.setArg(4, cumSum);
+    kernelWithStats_.setArg(5, cl_uint(maxSum));
+    kernelWithStats_.setArg(6, stats);
+    
+    cq.enqueueTask(kernelWithStats_, &waitEvents, doneEvent);
+}
+
@@ -28,10 +28,27 @@ public:
                         = std::vector<cl::Event>(),
                      cl::Event* doneEvent = nullptr);
 
+    void operator() (cl::CommandQueue& cq, cl::Buffer& rawCounts,
+                                           cl::Buffer& counts,
+                                           cl::Buffer& maxCounts,
+                                           cl::Buffer& cumSum,
+                                           cl_uint maxSum,
+                                           cl::Buffer& stats,
+                     const std::vector<cl::Event>& waitEvents
+                        = std::vector<cl::Event>(),
+                     cl::Event* doneEvent = nullptr);
+    // Version for counts from lists that may have overflowed.  rawCounts
+    // holds how many items were found for each list, which may be more 
+    // than its entry in maxCounts, the room the list had.  counts is how
+    // many remain after any thinning, and can be rawCounts itself.  stats
+    // is filled with (found, output, dropped for lack of room) triples for
+    // each list.
+
 private:
 
     cl::Context context_;
     cl::Kernel kernel_;
+    cl::Kernel kernelWithStats_;
 
 };
 
@@ -24,3 +24,46 @@ void accumulate(__global __read_only unsigned int* inputs,
     cumSum[numInputs] = sum;
 }
 
+
+
+
+__kernel
+void accumulateWithStats(__global __read_only unsigned int* rawCounts,
+                         __global __read_only unsigned int* counts,
+                         __global __read_only unsigned int* maxCounts,
+                         unsigned int numInputs,
+                         __global __write_only unsigned int* cumSum,
+                         unsigned int maxSum,
+                         __global __write_only unsigned int* stats)
+{
+    // As accumulate, but for lists that may have overflowed.  rawCounts are
+    // the numbers of items that were found, maxCounts how many there was
+    // room to keep, and counts how many survived any later thinning (may
+    // be the same buffer as rawCounts).  stats receives, for each input,
+    // the raw count, the number that made it into the output and the 
+    // number dropped for lack of space.
+
+    unsigned int sum = 0;
+
+    for (int n = 0; n < numInputs; ++n) {
+
+        unsigned int raw = rawCounts[n];
+        unsigned int stored = min(raw, maxCounts[n]);
+        unsigned int kept = min(counts[n], stored);
+
+        // Make sure the output never exceeds the maximum output
+        unsigned int accepted = min(kept, maxSum - sum);
+        
+        // Record the sum so far
+        cumSum[n] = sum;
+        sum += accepted;
+
+        stats[3*n + 0] = raw;
+        stats[3*n + 1] = accepted;
+        stats[3*n + 2] = (raw - stored) + (kept - accepted);
+    }
+
+    // Record the last position
+    cumSum[numInputs] = sum;
+}
+
@@ -0,0 +1,109 @@
+// Copyright (C) 2013 Timothy Gale
+#include "bucket.h"
+#include "kernel.h"
+using namespace BucketNS;
+
+#include "util/clUtil.h"
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+#include <stdexcept>
+Bucket::Bucket(cl::Context& context,
+               const std::vector<cl::Device>& devices,
+               size_t numFloatsPerPos,
+               bool soaLayout)
+   : context_(context), posLen_(numFloatsPerPos)
+{
+    // The OpenCL kernel:
+    std::ostringstream kernelInput;
+
+    // Define some constants
+    kernelInput << "#define POS_LEN (" << posLen_ << ")\n"
+                << positionIndexDefine(soaLayout);
+   
+    // Get input from the source file
+    const char* fileText = reinterpret_cast<const char*> (kernel_cl);
+    size_t fileTextLength = kernel_cl_len;
+
+    std::copy(fileText, fileText + fileTextLength,
+              std::ostream_iterator<char>(kernelInput));
+
+    // Convert to string
+    const std::string sourceCode = kernelInput.str();
+
+    // Bundle the code up
+    cl::Program::Sources source;
+    source.push_back(std::make_pair(sourceCode.c_str(), sourceCode.length()));
+
+    // Compile it...
+    cl::Program program(context, source);
+    try {
+        program.build(devices);
+    } catch(cl::Error err) {
+	    std::cerr 
+		    << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+		    << std::endl;
+	    throw;
+    } 
+        
+    // ...and extract the useful part, i.e. the kernel
+    kernel_ = cl::Kernel(program, "bucket");
+}
+
+void Bucket::operator() 
+      (cl::CommandQueue& commandQueue,
+       cl::Buffer& input, cl::Buffer& inputCounts, int inputCountIdx,
+       cl::Buffer& finer, int finerCountIdx,
+       cl::Buffer& coarser, int coarserCountIdx,
+       size_t maxPerCell, float cellSize, float radius,
+       cl::Buffer& output, cl::Buffer& outputCounts, int outputCountIdx,
+       const std::vector<cl::Event>& waitEvents,
+       cl::Event* doneEvent)
+{
+    // inputCounts[inputCountIdx] holds the number of peaks in input;
+    // likewise for finer and coarser, whose counts are in the same buffer.
+    // The surviving peaks are appended to output, incrementing
+    // outputCounts[outputCountIdx], which needs to have been zeroed.
+    //
+    // The command will not start until all of waitEvents have completed, and
+    // once done will flag doneEvent.
+
+    const size_t bytesPerPos = posLen_ * sizeof(float);
+    const int maxNumInputs = input.getInfo<CL_MEM_SIZE>() / bytesPerPos;
+
+    if (output.getInfo<CL_MEM_SIZE>() != input.getInfo<CL_MEM_SIZE>())
+        throw std::logic_error("Bucket: output not the same size as input");
+
+    if (maxPerCell > 0 && !(cellSize > 0.f))
+        throw std::logic_error("Bucket: cell size must be positive");
+
+    // Set all the arguments
+    kernel_.setArg(0, input);
+    kernel_.setArg(1, inputCounts);
+    kernel_.setArg(2, inputCountIdx);
+    kernel_.setArg(3, maxNumInputs);
+    kernel_.setArg(4, finer);
+    kernel_.setArg(5, finerCountIdx);
+    kernel_.setArg(6, int(finer.getInfo<CL_MEM_SIZE>() / bytesPerPos));
+    kernel_.setArg(7, coarser);
+    kernel_.setArg(8, coarserCountIdx);
+    kernel_.setArg(9, int(coarser.getInfo<CL_MEM_SIZE>() / bytesPerPos));
+    kernel_.setArg(10, cl_uint(maxPerCell));
+    kernel_.setArg(11, cellSize);
+    kernel_.setArg(12, radius);
+    kernel_.setArg(13, output);
+    kernel_.setArg(14, outputCounts);
+    kernel_.setArg(15, outputCountIdx);
+
+    // Execute, one work item per possible input
+    commandQueue.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                                      {size_t(roundWGs(maxNumInputs, 
+                                                       wgSize_))},
+                                      {size_t(wgSize_)},
+                                      &waitEvents, doneEvent);
+}
+
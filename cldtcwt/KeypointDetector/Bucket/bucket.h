@@ -0,0 +1,57 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#include "CL/cl.hpp"
+#include <vector>
+
+
+
+class Bucket {
+// Thins out a list of peaks from FindMax so they are spread more evenly over
+// the image.  Keeps at most maxPerCell of the strongest peaks in each square
+// cell of side cellSize (in original image units), and optionally drops any
+// peak that has a stronger one within radius (in units of keypoint scale)
+// in the same list or in the lists for the neighbouring finer and coarser
+// scales.  All decisions are made against the unthinned lists, so the result
+// does not depend on the order the work items run in.
+
+public:
+
+    Bucket() = default;
+    Bucket(const Bucket&) = default;
+    Bucket(cl::Context& context,
+           const std::vector<cl::Device>& devices,
+           size_t numFloatsPerPos,
+           bool soaLayout = false);
+    // soaLayout - lists are separate arrays for each component (see
+    // FindMax), rather than interleaved records.
+
+    // The kernel operation.  The finer and coarser lists are ignored if
+    // their count index is negative.  output should be the same size as
+    // input.
+    void operator() (cl::CommandQueue& commandQueue,
+       cl::Buffer& input, cl::Buffer& inputCounts, int inputCountIdx,
+       cl::Buffer& finer, int finerCountIdx,
+       cl::Buffer& coarser, int coarserCountIdx,
+       size_t maxPerCell, float cellSize, float radius,
+       cl::Buffer& output, cl::Buffer& outputCounts, int outputCountIdx,
+       const std::vector<cl::Event>& waitEvents = std::vector<cl::Event>(),
+       cl::Event* doneEvent = nullptr);
+
+private:
+    cl::Context context_;
+    cl::Kernel kernel_;
+
+    size_t posLen_;
+
+    static const int wgSize_ = 64;
+};
+
+
+
+#endif
+
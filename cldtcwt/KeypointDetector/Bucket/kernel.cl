@@ -0,0 +1,148 @@
+// Copyright (C) 2013 Timothy Gale
+
+
+// Parameters: POS_LEN should be the number of floats in each position; the
+// components are (x, y, scale, strength, ...), with POS_IDX(i, c, n, len)
+// giving where component c of item i is.
+
+float4 readPos(__global const float* list, int i, int maxLen)
+{
+    // Read (x, y, scale, strength) for item i of a list with room for maxLen
+    return (float4) (list[POS_IDX(i, 0, maxLen, POS_LEN)],
+                     list[POS_IDX(i, 1, maxLen, POS_LEN)],
+                     list[POS_IDX(i, 2, maxLen, POS_LEN)],
+                     list[POS_IDX(i, 3, maxLen, POS_LEN)]);
+}
+
+
+bool beats(float4 other, int otherRank,
+           float4 us, int ourRank)
+{
+    // Total order on the candidates: stronger first, then ties are broken
+    // by rank (list first, then position within the list) so that exactly
+    // one of any pair wins.
+    if (other.w != us.w)
+        return other.w > us.w;
+
+    return otherRank < ourRank;
+}
+
+
+int suppressedByList(float4 us, int ourRank,
+                     __global const float* list, int listLen, int maxLen,
+                     int listRank, float radius)
+{
+    // Returns non-zero if any member of the list is stronger than us and
+    // closer than radius times the larger of the two scales.
+    for (int n = 0; n < listLen; ++n) {
+
+        float4 other = readPos(list, n, maxLen);
+
+        float2 diff = other.xy - us.xy;
+        float r = radius * max(other.z, us.z);
+
+        if (dot(diff, diff) < r * r
+         && beats(other, listRank + n, us, ourRank))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+__kernel
+void bucket(__global const float* input,
+            __global const unsigned int* inputCounts,
+            int inputCountIdx,
+            int maxNumInputs,
+
+            __global const float* finer,
+            int finerCountIdx,
+            int maxNumFiner,
+
+            __global const float* coarser,
+            int coarserCountIdx,
+            int maxNumCoarser,
+
+            unsigned int maxPerCell,
+            float cellSize,
+            float radius,
+
+            __global float* output,
+            volatile __global unsigned int* outputCounts,
+            int outputCountIdx)
+{
+    // One work item per candidate in input.  The candidate survives if
+    // fewer than maxPerCell stronger candidates share its cellSize x cellSize
+    // cell of the same list (cells are aligned to the image centre), and if
+    // no stronger candidate in the input, finer or coarser lists lies within
+    // radius of it (radius is in units of keypoint scale).  A count index of
+    // -1 means that list is absent; maxPerCell of zero or radius of zero
+    // disable the respective test.
+
+    const int numInputs = min(inputCounts[inputCountIdx],
+                              (unsigned int) maxNumInputs);
+
+    const int i = get_global_id(0);
+
+    if (i >= numInputs)
+        return;
+
+    const float4 us = readPos(input, i, maxNumInputs);
+
+    // Lists are ranked finer, then input, then coarser, for tie breaking
+    int numFiner = 0;
+    if (finerCountIdx >= 0)
+        numFiner = min(inputCounts[finerCountIdx],
+                       (unsigned int) maxNumFiner);
+
+    int numCoarser = 0;
+    if (coarserCountIdx >= 0)
+        numCoarser = min(inputCounts[coarserCountIdx],
+                         (unsigned int) maxNumCoarser);
+
+    const int ourRank = numFiner + i;
+
+    if (maxPerCell > 0) {
+
+        const float2 cell = floor(us.xy / cellSize);
+
+        unsigned int numStronger = 0;
+
+        for (int n = 0; n < numInputs && numStronger < maxPerCell; ++n) {
+
+            float4 other = readPos(input, n, maxNumInputs);
+
+            if (all(floor(other.xy / cellSize) == cell)
+             && beats(other, numFiner + n, us, ourRank))
+                ++numStronger;
+        }
+
+        if (numStronger >= maxPerCell)
+            return;
+    }
+
+    if (radius > 0.f) {
+
+        if (suppressedByList(us, ourRank, input, numInputs, maxNumInputs,
+                             numFiner, radius))
+            return;
+
+        if (suppressedByList(us, ourRank, finer, numFiner, maxNumFiner,
+                             0, radius))
+            return;
+
+        if (suppressedByList(us, ourRank, coarser, numCoarser, maxNumCoarser,
+                             numFiner + numInputs, radius))
+            return;
+    }
+
+    // Survived: append to the output list.  The output has the same room
+    // as the input so cannot overflow.
+    int ourOutputPos = atomic_inc(&outputCounts[outputCountIdx]);
+
+    for (int c = 0; c < POS_LEN; ++c)
+        output[POS_IDX(ourOutputPos, c, maxNumInputs, POS_LEN)]
+            = input[POS_IDX(i, c, maxNumInputs, POS_LEN)];
+}
+
@@ -4,6 +4,8 @@
 
 using namespace ConcatNS;
 
+#include "util/clUtil.h"
+
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -12,21 +14,29 @@ using namespace ConcatNS;
 
 #include <stdexcept>
 Concat::Concat(cl::Context& context,
-               const std::vector<cl::Device>& devices)
+               const std::vector<cl::Device>& devices,
+               bool soaLayout)
    : context_(context)
 {
     // The OpenCL kernel:
     std::ostringstream kernelInput;
 
     // Define some constants
+    kernelInput << positionIndexDefine(soaLayout);
    
     // Get input from the source file
     const char* fileText = reinterpret_cast<const char*> (kernel_cl);
     size_t fileTextLength = kernel_cl_len;
 
+    std::copy(fileText, fileText + fileTextLength,
+              std::ostream_iterator<char>(kernelInput));
+
+    // Convert to string
+    const std::string sourceCode = kernelInput.str();
+
     // Bundle the code up
     cl::Program::Sources source;
-    source.push_back(std::make_pair(fileText, fileTextLength));
+    source.push_back(std::make_pair(sourceCode.c_str(), sourceCode.length()));
 
     // Compile it...
     cl::Program program(context, source);
@@ -69,6 +79,12 @@ void Concat::operator()
     kernel_.setArg(3, cl_uint(cumCountsIndex));
     kernel_.setArg(4, cl_uint(numFloatsPerItem));
 
+    const size_t bytesPerItem = numFloatsPerItem * sizeof(float);
+    kernel_.setArg(5, cl_uint(inputArray.getInfo<CL_MEM_SIZE>() 
+                                / bytesPerItem));
+    kernel_.setArg(6, cl_uint(outputArray.getInfo<CL_MEM_SIZE>() 
+                                / bytesPerItem));
+
     // Execute
     commandQueue.enqueueNDRangeKernel(kernel_, cl::NullRange,
                                       {1024, 1},
@@ -11,14 +11,17 @@
 
 
 class Concat {
-// Class that finds the local maxima above a threshold in an image
+// Class that copies a list of items into its place in a longer list
 
 public:
 
     Concat() = default;
     Concat(const Concat&) = default;
     Concat(cl::Context& context,
-           const std::vector<cl::Device>& devices);
+           const std::vector<cl::Device>& devices,
+           bool soaLayout = false);
+    // soaLayout - lists are separate arrays for each component, each as
+    // long as the list has room for, rather than interleaved records.
 
     // The kernel operation
     void operator() (cl::CommandQueue& commandQueue,
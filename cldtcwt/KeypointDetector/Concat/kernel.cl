@@ -1,26 +1,41 @@
 // Copyright (C) 2013 Timothy Gale
+// Parameters: POS_IDX(i, c, n, len) gives the index of component c of 
+// item i, in a list with room for n items of len floats each.
 __kernel
 void concat(__read_only global float* inputArray,
             __write_only global float* outputArray,
             __read_only global unsigned int* cumCounts,
             unsigned int cumCountsIndex,
-            unsigned int numFloatsPerItem)
+            unsigned int numFloatsPerItem,
+            unsigned int inputLength,
+            unsigned int outputLength)
 {
     // cumCounts[cumCountsIndex] contains the item number to start outputting
     // to; cumCounts[cumCountsIndex+1] one beyond the end of number of items.
     // Copies from inputArray to this outputArray.  numFloats is the number
-    // of floats per item
+    // of floats per item; inputLength and outputLength the number of items
+    // there is room for in each.
 
     size_t c0 = cumCounts[cumCountsIndex],
            c1 = cumCounts[cumCountsIndex+1];
 
-    size_t startOutputPos = numFloatsPerItem * c0;
-    size_t numFloatsToCopy = numFloatsPerItem * (c1 - c0);
+    size_t numItemsToCopy = c1 - c0;
+    size_t numFloatsToCopy = numFloatsPerItem * numItemsToCopy;
 
     for (int n = get_global_id(0); 
              n < numFloatsToCopy; 
-             n += get_global_size(0)) 
-        outputArray[startOutputPos+n] = inputArray[n];
+             n += get_global_size(0)) {
+
+        // Work through memory in order, whatever the layout
+#ifdef SOA_LAYOUT
+        size_t i = n % numItemsToCopy, c = n / numItemsToCopy;
+#else
+        size_t i = n / numFloatsPerItem, c = n % numFloatsPerItem;
+#endif
+
+        outputArray[POS_IDX(c0 + i, c, outputLength, numFloatsPerItem)]
+            = inputArray[POS_IDX(i, c, inputLength, numFloatsPerItem)];
+    }
 
 }
 
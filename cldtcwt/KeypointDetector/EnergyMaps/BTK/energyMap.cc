@@ -52,6 +52,7 @@ void EnergyMapBTK::operator() (cl::CommandQueue& commandQueue,
     kernel_.setArg(6, cl_uint(levelOutput.height()));
 
     kernel_.setArg(7, energyMap);
+    kernel_.setArg(8, cl_uint(levelOutput.step()));
 
     const size_t wgSize = 16;
 
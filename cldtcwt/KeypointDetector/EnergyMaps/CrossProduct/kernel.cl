@@ -30,7 +30,7 @@ Complex complexConj(Complex v1);
 // Load a rectangular region from a floating-point image
 void readImageRegionToShared(const __global float2* input,
                 unsigned int stride,
-                unsigned int padding,
+                unsigned int step,
                 uint2 inSize,
                 int2 regionStart,
                 int2 regionSize, 
@@ -52,7 +52,8 @@ void interpMap(const __global float2* sb,
                const unsigned int sbPadding,
                const unsigned int sbWidth,
                const unsigned int sbHeight,
-               __write_only image2d_t output)
+               __write_only image2d_t output,
+               const unsigned int sbStep)
 {
     //  Angles (radians) of the subband orientations
     const float subbandDirections[6] = {
@@ -119,7 +120,7 @@ void interpMap(const __global float2* sb,
     for (int n = 0; n < 6; ++n) {
 
         readImageRegionToShared(sb + sbStart + n * sbPitch, 
-                                sbStride, sbPadding, 
+                                sbStride, sbStep, 
                                 (uint2) (sbWidth, sbHeight),
                                 regionStart, regionSize, 
                                 &sbVals[0][0]);
@@ -206,7 +207,7 @@ void interpMap(const __global float2* sb,
 
 void readImageRegionToShared(const __global float2* input,
                 unsigned int stride,
-                unsigned int padding,
+                unsigned int step,
                 uint2 inSize,
                 int2 regionStart,
                 int2 regionSize, 
@@ -239,7 +240,7 @@ void readImageRegionToShared(const __global float2* input,
 
                 output[readPosOffset.y * regionSize.x + readPosOffset.x]
                     = inImage? 
-                        input[pos.x + pos.y * stride]
+                        input[pos.x * step + pos.y * stride]
                       : (float2) (0.f, 0.f);
             }
 
@@ -6,13 +6,14 @@ __kernel void energyMap(const __global float2* sb,
                         const unsigned int sbPadding,
                         const unsigned int sbWidth,
                         const unsigned int sbHeight,
-                        __write_only image2d_t out)
+                        __write_only image2d_t out,
+                        const unsigned int sbStep)
 {
     int2 pos = (int2) (get_global_id(0), get_global_id(1));
 
     if (all(pos < (int2)(sbWidth, sbHeight))) {
     
-        size_t idx = sbStart + pos.x + pos.y * sbStride;
+        size_t idx = sbStart + pos.x * sbStep + pos.y * sbStride;
 
         // Sample each subband
         float abs_h_2[6];
@@ -6,7 +6,8 @@ __kernel void energyMap(const __global float2* sb,
                         const unsigned int sbPadding,
                         const unsigned int sbWidth,
                         const unsigned int sbHeight,
-                        __write_only image2d_t out
+                        __write_only image2d_t out,
+                        const unsigned int sbStep
                         /*__global float* out,
                         const unsigned int outStride,
                         const unsigned int outPadding,
@@ -17,7 +18,7 @@ __kernel void energyMap(const __global float2* sb,
 
     if (all(pos < (int2)(sbWidth, sbHeight))) {
     
-        size_t idx = sbStart + pos.x + pos.y * sbStride;
+        size_t idx = sbStart + pos.x * sbStep + pos.y * sbStride;
 
         float abs_h_2[6];
 
@@ -4,7 +4,7 @@ typedef float2 Complex;
 // Load a rectangular region from a floating-point image
 void readImageRegionToShared(const __global float2* input,
                 unsigned int stride,
-                unsigned int padding,
+                unsigned int step,
                 uint2 inSize,
                 int2 regionStart,
                 int2 regionSize, 
@@ -37,7 +37,7 @@ void readImageRegionToShared(const __global float2* input,
 
                 output[readPosOffset.y * regionSize.x + readPosOffset.x]
                     = inImage? 
-                        input[pos.x + pos.y * stride]
+                        input[pos.x * step + pos.y * stride]
                       : (float2) (0.f, 0.f);
             }
 
@@ -127,7 +127,8 @@ void interpMap(const __global float2* sb,
                const unsigned int sbPadding,
                const unsigned int sbWidth,
                const unsigned int sbHeight,
-               __write_only image2d_t output)
+               __write_only image2d_t output,
+               const unsigned int sbStep)
 {
 
     // Angular frequency for each subband, x and y
@@ -195,7 +196,7 @@ void interpMap(const __global float2* sb,
     for (int n = 0; n < 6; ++n) {
 
         readImageRegionToShared(sb + sbStart + n * sbPitch, 
-                                sbStride, sbPadding, 
+                                sbStride, sbStep, 
                                 (uint2) (sbWidth, sbHeight),
                                 regionStart, regionSize, 
                                 &sbVals[0][0]);
@@ -81,6 +81,7 @@ void InterpPhaseMap::operator() (cl::CommandQueue& commandQueue,
     kernel_.setArg(6, cl_uint(subbands.height()));
 
     kernel_.setArg(7, energyMap);
+    kernel_.setArg(8, cl_uint(subbands.step()));
 
     const size_t wgSize = 16;
 
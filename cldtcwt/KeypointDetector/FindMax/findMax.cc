@@ -3,6 +3,8 @@
 #include "kernel.h"
 using namespace FindMaxNS;
 
+#include "util/clUtil.h"
+
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -11,7 +13,9 @@ using namespace FindMaxNS;
 
 #include <stdexcept>
 FindMax::FindMax(cl::Context& context,
-               const std::vector<cl::Device>& devices)
+               const std::vector<cl::Device>& devices,
+               bool checkScaleMax,
+               bool soaLayout)
    : context_(context)
 {
     // The OpenCL kernel:
@@ -21,6 +25,11 @@ FindMax::FindMax(cl::Context& context,
     kernelInput << "#define WG_SIZE_X (16)\n"
                    "#define WG_SIZE_Y (16)\n"
                    "#define POS_LEN (" << posLen_ << ")\n";
+
+    if (checkScaleMax)
+        kernelInput << "#define CHECK_SCALE_MAX\n";
+
+    kernelInput << positionIndexDefine(soaLayout);
    
     // Get input from the source file
     const char* fileText = reinterpret_cast<const char*> (kernel_cl);
@@ -51,11 +60,6 @@ FindMax::FindMax(cl::Context& context,
     kernel_ = cl::Kernel(program, "findMax");
 }
 
-static int roundWGs(int l, int lWG)
-{
-    return lWG * (l / lWG + ((l % lWG) ? 1 : 0)); 
-}
-
 void FindMax::operator() 
       (cl::CommandQueue& commandQueue,
        cl::Image& input,        float inputScale,
@@ -76,7 +80,8 @@ void FindMax::operator()
     // No more outputs are produced than will fit into the buffer output, and the
     // values placed there are floats in (x, y) format relative to the centre of the
     // image, in real distance units.  The total number of maxima found is placed in
-    // numOutputs[numOutputsOffset] as an integer.
+    // numOutputs[numOutputsOffset] as an integer; this can be more than fit
+    // into output, in which case the extra ones are dropped.
     //
     // The command will not start until all of waitEvents have completed, and
     // once done will flag doneEvent.
@@ -18,7 +18,15 @@ public:
     FindMax() = default;
     FindMax(const FindMax&) = default;
     FindMax(cl::Context& context,
-           const std::vector<cl::Device>& devices);
+           const std::vector<cl::Device>& devices,
+           bool checkScaleMax = false,
+           bool soaLayout = false);
+    // If checkScaleMax is set, peaks also have to be greater than the 3x3
+    // neighbourhood around the same position in the finer and coarser
+    // images; otherwise those are ignored.  soaLayout makes the output
+    // separate arrays of x, y, scale, strength and orientation, each as
+    // long as the maximum number of outputs, rather than interleaved
+    // records.
 
     // The filter operation
     void operator() (cl::CommandQueue& commandQueue,
@@ -34,7 +42,7 @@ public:
 
     size_t getPosLength() const;
     // Returns the number of floats included in each output.  At the moment, that
-    // is (x, y, scale, --), so 4.
+    // is (x, y, scale, strength, orientation), so 5.
 
 private:
     cl::Context context_;
@@ -44,8 +52,9 @@ private:
     static const int wgSizeY_ = 16;
 
     // Number of floats long to make each output position.  Comes in format
-    // x, y, scale.
-    const size_t posLen_ = 4;
+    // x, y, scale, strength (the height of the fitted peak), orientation
+    // (zero here; see DescriptorExtracter).
+    const size_t posLen_ = 5;
 };
 
 
@@ -99,8 +99,31 @@ void solveQuadraticCoefficients(__private QuadraticCoeffs* coeffs,
 
 
 
+float neighbourhoodMax(__read_only image2d_t input,
+                       sampler_t sampler,
+                       float2 coords)
+{
+    // Maximum of the (linearly interpolated) values at coords and the eight
+    // points one pixel away from it
+    float result = -INFINITY;
+
+    for (int y = -1; y <= 1; ++y)
+        for (int x = -1; x <= 1; ++x)
+            result = max(result, 
+                         read_imagef(input, sampler, 
+                                     coords + (float2) (x + 0.5f, 
+                                                        y + 0.5f)).s0);
+
+    return result;
+}
+
+
+
 // Parameters: WG_SIZE_X, WG_SIZE_Y need to be set for the work group size.
-// POS_LEN should be the number of floats to make the output structure.
+// POS_LEN should be the number of floats to make the output structure, and
+// POS_IDX(i, c, n, len) give where component c of output i goes.
+// CHECK_SCALE_MAX, if defined, makes peaks also have to be maxima with
+// respect to inFiner and inCoarser.
 __kernel __attribute__((reqd_work_group_size(WG_SIZE_X, WG_SIZE_Y, 1)))
 void findMax(__read_only image2d_t input,
              const float inputScale,
@@ -201,6 +224,9 @@ void findMax(__read_only image2d_t input,
 
         inputCoords += move;
 
+        // Height of the fitted surface at its peak, used as the strength
+        float peakVal = c.a0 + 0.5f * dot(grad, move);
+
         // Check the eigenvalues of the Hessian of this fit to check that it
         // enough of a dot, rather than a line
 #if 0
@@ -226,11 +252,12 @@ void findMax(__read_only image2d_t input,
 
 
 #ifdef CHECK_SCALE_MAX
-        // Check levels up and level down.  Convenientl.y (in a way)
+        // Check levels up and level down.  Conveniently (in a way)
         // the centres of the images remain the centre from level to
-        // level.
+        // level.  The peak has to beat the 3x3 neighbourhood (in that
+        // level's pixels) around the corresponding point in both, which
+        // makes it a maximum over scale space as well as position.
 
-        // Check the level coarser
         float2 finerCoords = 
             outPos / finerScale 
             + (float2) 0.5f 
@@ -241,24 +268,27 @@ void findMax(__read_only image2d_t input,
             + (float2) 0.5f
               * convert_float2(get_image_dim(inCoarser) - (int2) 1);
 
-        float inputVal   = read_imagef(input, sampler, 
-                                       inputCoords + (float2) 0.5f).s0;
-        float finerVal   = read_imagef(inFiner, sampler, 
-                                       finerCoords + (float2) 0.5f).s0;
-        float coarserVal = read_imagef(inCoarser, sampler, 
-                                       coarserCoords + (float2) 0.5f).s0;
+        float finerVal   = neighbourhoodMax(inFiner, sampler, finerCoords);
+        float coarserVal = neighbourhoodMax(inCoarser, sampler,
+                                            coarserCoords);
 
-        if ((inputVal > coarserVal) && (inputVal > finerVal)) {
+        if ((peakVal > coarserVal) && (peakVal > finerVal)) {
 #endif
             int ourOutputPos = atomic_inc(&numOutputs[numOutputsOffset]);
 
-            // Write it out (if there's enough space)
+            // Write it out (if there's enough space).  The count carries
+            // on going up regardless, so overflows can be seen.
             if (ourOutputPos < maxNumOutputs) {
-                maxCoords[ourOutputPos*POS_LEN + 0] = outPos.x;
-                maxCoords[ourOutputPos*POS_LEN + 1] = outPos.y;
-                maxCoords[ourOutputPos*POS_LEN + 2] = inputScale;
-            } else
-                numOutputs[numOutputsOffset] = maxNumOutputs;
+#define OUT_IDX(c) POS_IDX(ourOutputPos, c, maxNumOutputs, POS_LEN)
+                maxCoords[OUT_IDX(0)] = outPos.x;
+                maxCoords[OUT_IDX(1)] = outPos.y;
+                maxCoords[OUT_IDX(2)] = inputScale;
+                maxCoords[OUT_IDX(3)] = peakVal;
+
+                // Orientation isn't known until the descriptors are
+                maxCoords[OUT_IDX(4)] = 0.f;
+#undef OUT_IDX
+            }
 
 #ifdef CHECK_SCALE_MAX
         }
@@ -1,6 +1,7 @@
 // Copyright (C) 2013 Timothy Gale
 #include "peakDetector.h"
 #include <stdexcept>
+#include <algorithm>
 
 
 
@@ -23,6 +24,19 @@ cl::Event PeakDetectorResults::cumCountsDone() const
 
 
 
+cl::Buffer PeakDetectorResults::stats() const
+{
+    return stats_;
+}
+
+
+cl::Event PeakDetectorResults::statsDone() const
+{
+    return cumCountsDone_;
+}
+
+
+
 cl::Buffer PeakDetectorResults::list() const
 {
     return list_;
@@ -41,16 +55,32 @@ size_t PeakDetectorResults::numLevels() const
 }
 
 
+bool PeakDetectorResults::soaLayout() const
+{
+    return soaLayout_;
+}
+
+
+size_t PeakDetectorResults::maxListLength() const
+{
+    return maxListLength_;
+}
+
+
 
 
 
 
 PeakDetector::PeakDetector(cl::Context& context,
-                           const std::vector<cl::Device>& devices)
+                           const std::vector<cl::Device>& devices,
+                           bool scaleSpaceMax,
+                           bool soaLayout)
  : context_(context),
-   findMax_(context, devices),
+   soaLayout_(soaLayout),
+   findMax_(context, devices, scaleSpaceMax, soaLayout),
    accumulate_(context, devices),
-   concat_(context, devices)
+   concat_(context, devices, soaLayout),
+   bucket_(context, devices, findMax_.getPosLength(), soaLayout)
 {
     float zerof = 0.0f;
 
@@ -71,6 +101,7 @@ PeakDetectorResults PeakDetector::createResultsStructure
     PeakDetectorResults results;
 
     results.numFloatsPerPosition_ = findMax_.getPosLength();
+    results.soaLayout_ = soaLayout_;
 
     // Per-level counts
     results.counts_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
@@ -89,12 +120,36 @@ PeakDetectorResults PeakDetector::createResultsStructure
                     maxCount * results.numFloatsPerPosition_ * sizeof(float));
 
     results.maxLevelCounts_ = maxLevelCounts;
+
+    // The same on the device, to catch overflows
+    std::vector<cl_uint> maxLevelCountsUint(maxLevelCounts.begin(),
+                                            maxLevelCounts.end());
+    results.maxLevelCountsBuffer_ 
+        = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                     maxLevelCountsUint.size() * sizeof(cl_uint),
+                     &maxLevelCountsUint[0]);
     results.levelListsDone_.resize(maxLevelCounts.size());
 
+    // Bucketed versions of the same
+    results.bucketCounts_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
+                                maxLevelCounts.size() * sizeof(cl_uint));
+
+    for (size_t maxCount: maxLevelCounts) 
+        results.bucketLists_.emplace_back(context_, CL_MEM_READ_WRITE,
+                    maxCount * results.numFloatsPerPosition_ * sizeof(float));
+
+    results.bucketListsDone_.resize(maxLevelCounts.size());
+
     // Cumulative counts
     results.cumCounts_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
                                (maxLevelCounts.size() + 1) * sizeof(cl_uint));
 
+    // Statistics
+    results.stats_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
+                                maxLevelCounts.size() 
+                                  * PeakDetectorResults::numStatsPerLevel
+                                  * sizeof(cl_uint));
+
     // Concatenated list
     results.list_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
                 maxTotalCount * results.numFloatsPerPosition_ * sizeof(float));
@@ -133,22 +188,35 @@ void PeakDetector::operator() (cl::CommandQueue& cq,
     std::vector<cl::Event> findWaitEvents = waitEvents;
     findWaitEvents.push_back(results.countsCleared_);
 
-    for (int n = 0; n < energyMaps.size(); ++n) {
+    // Put the maps in order of scale, so the neighbours in scale can be
+    // found even when interleaved from several trees
+    std::vector<int> order(energyMaps.size());
+    for (int n = 0; n < order.size(); ++n)
+        order[n] = n;
+
+    std::stable_sort(order.begin(), order.end(),
+                     [&scales] (int a, int b) {
+                         return scales[a] < scales[b];
+                     });
+
+    for (int i = 0; i < order.size(); ++i) {
+
+        const int n = order[i];
 
         // Work out what the finer image is (zero if none)
         cl::Image* finerImage = &zeroImage_;
         float finerScale = 1.f;
-        if (n > 0) {
-            finerImage = energyMaps[n-1];
-            finerScale = scales[n-1];
+        if (i > 0) {
+            finerImage = energyMaps[order[i-1]];
+            finerScale = scales[order[i-1]];
         }
 
         // Work out what the coarser image is (zero if none)
         cl::Image* coarserImage = &zeroImage_;
         float coarserScale = 1.f;
-        if (n < (energyMaps.size() - 1)) {
-            coarserImage = energyMaps[n+1];
-            coarserScale = scales[n+1];
+        if (i < (order.size() - 1)) {
+            coarserImage = energyMaps[order[i+1]];
+            coarserScale = scales[order[i+1]];
         } 
 
         // Execute the kernel
@@ -161,15 +229,57 @@ void PeakDetector::operator() (cl::CommandQueue& cq,
                      findWaitEvents, &results.levelListsDone_[n]);
     }
 
-    // Accumulate the counts
-    accumulate_(cq, results.counts_, results.cumCounts_,
+    // Which lists and counts go forward to be concatenated
+    cl::Buffer* counts = &results.counts_;
+    std::vector<cl::Buffer>* lists = &results.levelLists_;
+    std::vector<cl::Event>* listsDone = &results.levelListsDone_;
+
+    if (maxPerCell_ > 0 || radius_ > 0.f) {
+
+        cq.enqueueWriteBuffer(results.bucketCounts_, CL_FALSE, 
+                              0, results.zeroCounts_.size() * sizeof(cl_uint), 
+                              &results.zeroCounts_[0],
+                              nullptr, &results.bucketCountsCleared_);
+
+        // Needs all the lists, since neighbouring levels are looked at
+        std::vector<cl::Event> bucketWaitEvents = results.levelListsDone_;
+        bucketWaitEvents.push_back(results.bucketCountsCleared_);
+
+        for (int i = 0; i < order.size(); ++i) {
+
+            const int n = order[i];
+
+            // Neighbours in scale, as for finding the maxima
+            int finerIdx = (i > 0) ? order[i-1] : -1;
+            int coarserIdx = (i < (order.size() - 1)) ? order[i+1] : -1;
+
+            bucket_(cq, results.levelLists_[n], results.counts_, n,
+                        results.levelLists_[std::max(finerIdx, 0)],
+                        finerIdx,
+                        results.levelLists_[std::max(coarserIdx, 0)],
+                        coarserIdx,
+                        maxPerCell_, cellSize_, radius_,
+                        results.bucketLists_[n], results.bucketCounts_, n,
+                        bucketWaitEvents, &results.bucketListsDone_[n]);
+        }
+
+        counts = &results.bucketCounts_;
+        lists = &results.bucketLists_;
+        listsDone = &results.bucketListsDone_;
+    }
+
+    // Accumulate the counts, clamping any that overflowed
+    accumulate_(cq, results.counts_, *counts,
+                    results.maxLevelCountsBuffer_,
+                    results.cumCounts_,
                     results.maxListLength_,
-                    results.levelListsDone_, 
+                    results.stats_,
+                    *listsDone, 
                     &results.cumCountsDone_);
 
     // Concatenate the maximum positions
-    for (int n = 0; n < results.levelLists_.size(); ++n) 
-        concat_(cq, results.levelLists_[n], results.list_,
+    for (int n = 0; n < lists->size(); ++n) 
+        concat_(cq, (*lists)[n], results.list_,
                     results.cumCounts_, n,
                     results.numFloatsPerPosition_,
                     {results.cumCountsDone_},
@@ -179,6 +289,19 @@ void PeakDetector::operator() (cl::CommandQueue& cq,
 
 
 
+void PeakDetector::setBucketing(size_t maxPerCell, float cellSize,
+                                float radius)
+{
+    if (maxPerCell > 0 && !(cellSize > 0.f))
+        throw std::logic_error("PeakDetector: cell size must be positive");
+
+    maxPerCell_ = maxPerCell;
+    cellSize_ = cellSize;
+    radius_ = radius;
+}
+
+
+
 size_t PeakDetector::getPosLength()
 {
     return findMax_.getPosLength();
@@ -11,6 +11,7 @@
 #include "Concat/concat.h"
 #include "FindMax/findMax.h"
 #include "Accumulate/accumulate.h"
+#include "Bucket/bucket.h"
 
 class PeakDetector;
 
@@ -21,17 +22,29 @@ private:
     // Number of floats used for each position detected
     size_t numFloatsPerPosition_;
 
+    // Whether the lists are separate arrays per component
+    bool soaLayout_;
+
     // Intermediates: the per-level lists (as opposed to the full one)
     std::vector<cl_uint> zeroCounts_; // For zeroing the counts
     cl::Buffer counts_;
     cl::Event countsCleared_;
     std::vector<cl::Buffer> levelLists_;
     std::vector<size_t> maxLevelCounts_;
+    cl::Buffer maxLevelCountsBuffer_;
     std::vector<cl::Event> levelListsDone_;
 
-    // Counts from each level
+    // The per-level lists after bucketing (only used if enabled)
+    cl::Buffer bucketCounts_;
+    cl::Event bucketCountsCleared_;
+    std::vector<cl::Buffer> bucketLists_;
+    std::vector<cl::Event> bucketListsDone_;
+
+    // Counts from each level, and statistics on what was dropped (which
+    // are done at the same time)
     cl::Buffer cumCounts_;
     cl::Event cumCountsDone_;
+    cl::Buffer stats_;
 
     // List of positions relative to the image centre with scales
     cl::Buffer list_;
@@ -45,13 +58,28 @@ public:
     size_t numLevels() const;
     // Number of levels analysed
 
+    bool soaLayout() const;
+    size_t maxListLength() const;
+    // If soaLayout is true, the list is laid out as maxListLength x 
+    // values, then maxListLength y values, and so on for each component.
+    // Otherwise each position is a record of numFloatsPerPosition floats.
+
     cl::Buffer cumCounts() const;
     cl::Event cumCountsDone() const;
     // Array of cumulative counts, starting with zero
 
+    cl::Buffer stats() const;
+    cl::Event statsDone() const;
+    static const size_t numStatsPerLevel = 3;
+    // Per-level statistics from the last run, as cl_uints: for each level,
+    // the number of peaks found, the number that made it into the list, and
+    // the number dropped because the level's list or the overall list was
+    // full.  Any difference is those removed by bucketing.
+
     cl::Buffer list() const;
     std::vector<cl::Event> listDone() const;
-    // List of peak locations.
+    // List of peak locations: x, y, scale, strength and orientation (zero
+    // unless DescriptorExtracter fills it in).
 
     friend PeakDetector;
 
@@ -70,17 +98,33 @@ private:
 
     cl::Image2D zeroImage_;
 
+    bool soaLayout_ = false;
+
     // Kernels to use
     FindMax findMax_;
     Accumulate accumulate_;
     Concat concat_;
+    Bucket bucket_;
+
+    // Bucketing settings; zero disables the corresponding test
+    size_t maxPerCell_ = 0;
+    float cellSize_ = 0.f;
+    float radius_ = 0.f;
 
 public:
 
     PeakDetector() = default;
     PeakDetector(const PeakDetector&) = default;
     PeakDetector(cl::Context& context,
-                 const std::vector<cl::Device>& devices);
+                 const std::vector<cl::Device>& devices,
+                 bool scaleSpaceMax = false,
+                 bool soaLayout = false);
+    // With scaleSpaceMax set, a peak must also beat the maps at the next
+    // finer and next coarser scale.  Neighbours are chosen by sorting the 
+    // scales, so the maps from several interleaved trees (e.g. IntDtcwt)
+    // are compared with each other rather than just within a tree, and
+    // the same feature is not reported once per tree.  soaLayout selects
+    // separate arrays for each component of the results' lists.
 
     PeakDetectorResults createResultsStructure
         (const std::vector<size_t>& maxLevelCounts,
@@ -97,6 +141,13 @@ public:
                      PeakDetectorResults& results,
                      const std::vector<cl::Event>& waitEvents = {});
 
+    void setBucketing(size_t maxPerCell, float cellSize, float radius = 0.f);
+    // After finding the peaks, keep at most maxPerCell of the strongest in
+    // each cellSize by cellSize square of the original image.  If radius is
+    // non-zero, also drop peaks that have a stronger one within radius times
+    // the keypoint scale in the same map or the maps at the adjacent
+    // scales.  Both zero turns it off, which is the default.
+
     size_t getPosLength();
     // Returns the number of floats in the position vector
 
@@ -0,0 +1,130 @@
+// Copyright (C) 2013 Timothy Gale
+// Brute force matching of descriptors under rotation: see Matcher/
+// polarMatcher.h.  Defined by the host ahead of this:
+//
+// NUM_COMPLEX: number of complex values in each descriptor.
+// NUM_ROTATIONS: number of rotations to try.
+// WG_SIZE: workgroup size, a power of two.
+// ROT_SOURCE[r][c], ROT_CONJ[r][c]: value c of query rotation r is value
+// ROT_SOURCE[r][c] of the query, conjugated if ROT_CONJ[r][c].
+
+
+typedef struct {
+
+    // Same layout as NearestNeighbours on the host
+    unsigned int trainIdx;
+    int rotation;
+    float distance, secondDistance;
+
+} NearestNeighbours;
+
+
+
+__kernel
+__attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void matchDescriptors(const __global float2* query, unsigned int numQuery,
+                      const __global float2* train, unsigned int numTrain,
+                      __global NearestNeighbours* output)
+{
+    // Each workgroup takes queries in turn.  Its items share out the 
+    // training descriptors, each keeping its nearest two, then these are
+    // combined.
+    const int lid = get_local_id(0);
+
+    __local float2 rotated[NUM_ROTATIONS][NUM_COMPLEX];
+
+    __local float bestDists[WG_SIZE], secondDists[WG_SIZE];
+    __local unsigned int bestIdxs[WG_SIZE];
+    __local int bestRotations[WG_SIZE];
+
+    for (unsigned int q = get_group_id(0); q < numQuery; 
+         q += get_num_groups(0)) {
+
+        // Ready all rotations of the query
+        for (int i = lid; i < NUM_ROTATIONS * NUM_COMPLEX; i += WG_SIZE) {
+            const int r = i / NUM_COMPLEX, c = i % NUM_COMPLEX;
+            const float2 v = query[q * NUM_COMPLEX + ROT_SOURCE[r][c]];
+            rotated[r][c] = ROT_CONJ[r][c]? (float2) (v.x, -v.y) : v;
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        float queryNorm = 0.f;
+        for (int c = 0; c < NUM_COMPLEX; ++c)
+            queryNorm += dot(rotated[0][c], rotated[0][c]);
+
+        float best = INFINITY, second = INFINITY;
+        unsigned int bestIdx = 0;
+        int bestRotation = 0;
+
+        for (unsigned int t = lid; t < numTrain; t += WG_SIZE) {
+
+            // Rotations only permute, so the distance is smallest for the 
+            // biggest dot product
+            float dots[NUM_ROTATIONS];
+            for (int r = 0; r < NUM_ROTATIONS; ++r)
+                dots[r] = 0.f;
+
+            float trainNorm = 0.f;
+
+            for (int c = 0; c < NUM_COMPLEX; ++c) {
+                const float2 v = train[t * NUM_COMPLEX + c];
+                trainNorm += dot(v, v);
+
+                for (int r = 0; r < NUM_ROTATIONS; ++r)
+                    dots[r] += dot(rotated[r][c], v);
+            }
+
+            int rotation = 0;
+            for (int r = 1; r < NUM_ROTATIONS; ++r)
+                if (dots[r] > dots[rotation])
+                    rotation = r;
+
+            const float d = fmax(queryNorm + trainNorm - 2.f * dots[rotation],
+                                 0.f);
+
+            if (d < best) {
+                second = best;
+                best = d;
+                bestIdx = t;
+                bestRotation = rotation;
+            } else if (d < second)
+                second = d;
+        }
+
+        bestDists[lid] = best;
+        secondDists[lid] = second;
+        bestIdxs[lid] = bestIdx;
+        bestRotations[lid] = bestRotation;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Combine pairs of nearest two until there is one left
+        for (int s = WG_SIZE / 2; s > 0; s /= 2) {
+
+            if (lid < s) {
+                const float b1 = bestDists[lid], b2 = bestDists[lid + s];
+
+                if (b2 < b1) {
+                    bestDists[lid] = b2;
+                    secondDists[lid] = fmin(b1, secondDists[lid + s]);
+                    bestIdxs[lid] = bestIdxs[lid + s];
+                    bestRotations[lid] = bestRotations[lid + s];
+                } else
+                    secondDists[lid] = fmin(secondDists[lid], b2);
+            }
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (lid == 0) {
+            NearestNeighbours result;
+            result.trainIdx = bestIdxs[0];
+            result.rotation = bestRotations[0];
+            result.distance = sqrt(bestDists[0]);
+            result.secondDistance = sqrt(secondDists[0]);
+            output[q] = result;
+        }
+    }
+}
+
@@ -0,0 +1,97 @@
+// Copyright (C) 2013 Timothy Gale
+#include "matchDescriptors.h"
+#include "kernel.h"
+using namespace MatchDescriptorsNS;
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+
+
+MatchDescriptors::MatchDescriptors(cl::Context& context,
+                                   const std::vector<cl::Device>& devices,
+                                   size_t numSamples,
+                                   size_t ringBegin,
+                                   size_t ringLength)
+ : context_(context), numFloats_(numSamples * 6 * 2)
+{
+    const std::vector<PolarRotation> rotations
+        = polarRotations(numSamples, ringBegin, ringLength);
+
+    // The OpenCL kernel:
+    std::ostringstream kernelInput;
+
+    kernelInput << "#define NUM_COMPLEX (" << numFloats_ / 2 << ")\n"
+                   "#define NUM_ROTATIONS (" << rotations.size() << ")\n"
+                   "#define WG_SIZE (" << wgSize_ << ")\n";
+
+    kernelInput << rotationTablesSource(rotations);
+
+    // Get input from the source file
+    const char* fileText = reinterpret_cast<const char*> (kernel_cl);
+    size_t fileTextLength = kernel_cl_len;
+
+    std::copy(fileText, fileText + fileTextLength,
+              std::ostream_iterator<char>(kernelInput));
+
+    // Convert to string
+    const std::string sourceCode = kernelInput.str();
+
+    // Bundle the code up
+    cl::Program::Sources source;
+    source.push_back(std::make_pair(sourceCode.c_str(), sourceCode.length()));
+
+    // Compile it...
+    cl::Program program(context, source);
+    try {
+        program.build(devices);
+    } catch(cl::Error err) {
+	    std::cerr 
+		    << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+		    << std::endl;
+	    throw;
+    } 
+        
+    // ...and extract the useful part, i.e. the kernel
+    kernel_ = cl::Kernel(program, "matchDescriptors");
+
+    // Enough workgroups to keep the device busy; each works through
+    // queries until there are none left
+    numWorkgroups_ = 8 * devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+}
+
+
+void MatchDescriptors::operator() (cl::CommandQueue& cq,
+                                   const cl::Buffer& query, size_t numQuery,
+                                   const cl::Buffer& train, size_t numTrain,
+                                   cl::Buffer& output,
+                                   const std::vector<cl::Event>& waitEvents,
+                                   cl::Event* doneEvent)
+{
+    kernel_.setArg(0, query);
+    kernel_.setArg(1, cl_uint(numQuery));
+    kernel_.setArg(2, train);
+    kernel_.setArg(3, cl_uint(numTrain));
+    kernel_.setArg(4, output);
+
+    // No need for more workgroups than queries
+    const size_t numWorkgroups = std::max<size_t>(1, std::min(numWorkgroups_,
+                                                              numQuery));
+
+    cl::NDRange workgroupSize = {wgSize_};
+    cl::NDRange globalSize = {numWorkgroups * wgSize_};
+
+    cq.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                            globalSize, workgroupSize,
+                            &waitEvents, doneEvent);
+}
+
+
+size_t MatchDescriptors::getNumFloatsInDescriptor() const
+{
+    return numFloats_;
+}
+
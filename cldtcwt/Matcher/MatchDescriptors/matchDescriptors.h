@@ -0,0 +1,56 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef MATCH_DESCRIPTORS_H
+#define MATCH_DESCRIPTORS_H
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#include "CL/cl.hpp"
+#include <vector>
+
+#include "Matcher/polarMatcher.h"
+
+
+
+class MatchDescriptors {
+// Brute force matching under rotation, as PolarMatcher, on the device.
+// Worth it for large sets, or when the descriptors are already there.
+
+public:
+
+    MatchDescriptors() = default;
+    MatchDescriptors(const MatchDescriptors&) = default;
+    MatchDescriptors(cl::Context& context,
+                     const std::vector<cl::Device>& devices,
+                     size_t numSamples = 14,
+                     size_t ringBegin = 1,
+                     size_t ringLength = 12);
+    // The descriptor layout, as for polarRotations
+
+    void operator() (cl::CommandQueue& cq,
+                     const cl::Buffer& query, size_t numQuery,
+                     const cl::Buffer& train, size_t numTrain,
+                     cl::Buffer& output,
+                     const std::vector<cl::Event>& waitEvents 
+                        = std::vector<cl::Event>(),
+                     cl::Event* doneEvent = nullptr);
+    // Find the nearest neighbours in train (float descriptors) for each of
+    // query, output having room for numQuery NearestNeighbours.  Pass
+    // these, read back, to ratioTest for the matches.
+
+    size_t getNumFloatsInDescriptor() const;
+
+private:
+    cl::Context context_;
+    cl::Kernel kernel_;
+
+    size_t numFloats_;
+    size_t numWorkgroups_;
+
+    static const int wgSize_ = 64;
+};
+
+
+
+#endif
+
@@ -0,0 +1,627 @@
+// Copyright (C) 2013 Timothy Gale
+#include "descriptorIndex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+
+
+template <typename Function>
+static void parallelFor(size_t num, unsigned int numThreads, Function f)
+{
+    // Run f(begin, end) over [0, num) in chunks, shared between threads
+    const size_t chunkSize = 64;
+    const size_t numChunks = (num + chunkSize - 1) / chunkSize;
+
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::atomic<size_t> nextChunk(0);
+
+    auto work = [&] () {
+        for (size_t c = nextChunk++; c < numChunks; c = nextChunk++)
+            f(c * chunkSize, std::min(num, (c + 1) * chunkSize));
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < std::min<size_t>(numThreads, numChunks); ++n)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread& thread: threads)
+        thread.join();
+}
+
+
+static float squaredDistance(const float* a, const float* b, size_t length)
+{
+    // Separate sums so they can go in parallel
+    float sums[8] = {};
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+        for (int k = 0; k < 8; ++k) {
+            const float d = a[i+k] - b[i+k];
+            sums[k] += d * d;
+        }
+
+    for (; i < length; ++i)
+        sums[0] += (a[i] - b[i]) * (a[i] - b[i]);
+
+    return std::accumulate(sums, sums + 8, 0.f);
+}
+
+
+static size_t nearestCentroid(const float* v, const float* centroids,
+                              size_t numCentroids, size_t length)
+{
+    size_t best = 0;
+    float bestDistance = std::numeric_limits<float>::infinity();
+
+    for (size_t c = 0; c < numCentroids; ++c) {
+        const float d = squaredDistance(v, centroids + c * length, length);
+        if (d < bestDistance) {
+            bestDistance = d;
+            best = c;
+        }
+    }
+
+    return best;
+}
+
+
+static std::vector<float> kMeans(const float* data, size_t num,
+                                 size_t length, size_t numCentroids,
+                                 unsigned int numIterations,
+                                 unsigned int numThreads,
+                                 std::mt19937& rng)
+{
+    // Lloyd's algorithm, starting from distinct random points of data
+    if (num < numCentroids)
+        throw std::logic_error("DescriptorIndex: too few descriptors to "
+                               "train on");
+
+    std::vector<size_t> order(num);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::vector<float> centroids(numCentroids * length);
+    for (size_t c = 0; c < numCentroids; ++c)
+        std::copy(data + order[c] * length, data + (order[c] + 1) * length,
+                  &centroids[c * length]);
+
+    std::vector<size_t> assignment(num);
+    std::uniform_int_distribution<size_t> randomPoint(0, num - 1);
+
+    for (unsigned int it = 0; it < numIterations; ++it) {
+
+        parallelFor(num, numThreads, [&] (size_t begin, size_t end) {
+            for (size_t n = begin; n < end; ++n)
+                assignment[n] = nearestCentroid(data + n * length,
+                                                &centroids[0], numCentroids,
+                                                length);
+        });
+
+        std::vector<double> sums(numCentroids * length, 0.);
+        std::vector<size_t> counts(numCentroids, 0);
+
+        for (size_t n = 0; n < num; ++n) {
+            ++counts[assignment[n]];
+            for (size_t i = 0; i < length; ++i)
+                sums[assignment[n] * length + i] += data[n * length + i];
+        }
+
+        for (size_t c = 0; c < numCentroids; ++c) {
+
+            // Restart empty clusters from anywhere
+            if (counts[c] == 0) {
+                const size_t n = randomPoint(rng);
+                std::copy(data + n * length, data + (n + 1) * length,
+                          &centroids[c * length]);
+                continue;
+            }
+
+            for (size_t i = 0; i < length; ++i)
+                centroids[c * length + i] = sums[c * length + i] / counts[c];
+        }
+    }
+
+    return centroids;
+}
+
+
+
+const size_t DescriptorIndex::numSubcentroids_;
+
+
+DescriptorIndex::DescriptorIndex(size_t numSamples,
+                                 size_t ringBegin,
+                                 size_t ringLength,
+                                 size_t numLists,
+                                 size_t numSubquantisers)
+ : numSamples_(numSamples), ringBegin_(ringBegin), ringLength_(ringLength),
+   numFloats_(numSamples * 6 * 2),
+   numLists_(numLists), numSubquantisers_(numSubquantisers),
+   subLength_(numFloats_ / numSubquantisers),
+   rotations_(polarRotations(numSamples, ringBegin, ringLength)),
+   listIds_(numLists), listCodes_(numLists), listRotations_(numLists)
+{
+    if (numSubquantisers == 0 || numFloats_ % numSubquantisers != 0)
+        throw std::logic_error("DescriptorIndex: number of subquantisers "
+                               "must divide the descriptor length");
+
+    if (numLists == 0)
+        throw std::logic_error("DescriptorIndex: need at least one list");
+}
+
+
+std::vector<int>
+DescriptorIndex::rotationsByScore(const float* descriptor) const
+{
+    // Energy in each ring sample and each subband
+    std::vector<double> ringEnergy(ringLength_, 0.), subbandEnergy(6, 0.);
+
+    for (size_t s = 0; s < numSamples_; ++s)
+        for (size_t n = 0; n < 6; ++n) {
+            const float* v = descriptor + (s * 6 + n) * 2;
+            const double energy = v[0] * v[0] + v[1] * v[1];
+
+            subbandEnergy[n] += energy;
+            if (s >= ringBegin_ && s < ringBegin_ + ringLength_)
+                ringEnergy[s - ringBegin_] += energy;
+        }
+
+    // Score each rotation by how much it turns the energy towards the first
+    // ring sample and the first subband.  Rotations permute the energies
+    // the same way as the components, so look up where each lands.
+    const double pi = 4 * std::atan(1.);
+    std::vector<double> scores(rotations_.size());
+
+    for (size_t r = 0; r < rotations_.size(); ++r) {
+        double score = 0;
+
+        for (size_t i = 0; i < ringLength_; ++i) {
+            const size_t source = rotations_[r].source[(ringBegin_ + i) * 6]
+                                    / 6 - ringBegin_;
+            score += ringEnergy[source] * std::cos(2 * pi * i / ringLength_);
+        }
+
+        for (size_t n = 0; n < 6; ++n)
+            score += subbandEnergy[rotations_[r].source[n] % 6]
+                      * std::cos(2 * pi * n / 6);
+
+        scores[r] = score;
+    }
+
+    std::vector<int> order(rotations_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&] (int a, int b) {
+        return scores[a] > scores[b];
+    });
+
+    return order;
+}
+
+
+int DescriptorIndex::canonicalRotation(const float* descriptor) const
+{
+    return rotationsByScore(descriptor)[0];
+}
+
+
+std::vector<float> DescriptorIndex::rotate(const float* descriptor,
+                                           int rotation) const
+{
+    const PolarRotation& r = rotations_[rotation];
+    std::vector<float> result(numFloats_);
+
+    for (size_t c = 0; c < numFloats_ / 2; ++c) {
+        const float* v = descriptor + 2 * r.source[c];
+        result[2*c] = v[0];
+        result[2*c+1] = r.conjugate[c]? -v[1] : v[1];
+    }
+
+    return result;
+}
+
+
+size_t DescriptorIndex::nearestList(const float* descriptor) const
+{
+    return nearestCentroid(descriptor, &coarseCentroids_[0], numLists_,
+                           numFloats_);
+}
+
+
+void DescriptorIndex::encode(const float* residual, uint8_t* code) const
+{
+    for (size_t m = 0; m < numSubquantisers_; ++m)
+        code[m] = nearestCentroid(residual + m * subLength_,
+                                  &subCentroids_[m * numSubcentroids_
+                                                   * subLength_],
+                                  numSubcentroids_, subLength_);
+}
+
+
+void DescriptorIndex::train(const float* descriptors, size_t num,
+                            unsigned int numIterations,
+                            unsigned int numThreads,
+                            unsigned int seed)
+{
+    std::mt19937 rng(seed);
+
+    // Canonical versions to train on
+    std::vector<float> canonical(num * numFloats_);
+
+    parallelFor(num, numThreads, [&] (size_t begin, size_t end) {
+        for (size_t n = begin; n < end; ++n) {
+            const float* d = descriptors + n * numFloats_;
+            std::vector<float> v = rotate(d, canonicalRotation(d));
+            std::copy(v.begin(), v.end(), &canonical[n * numFloats_]);
+        }
+    });
+
+    coarseCentroids_ = kMeans(&canonical[0], num, numFloats_, numLists_,
+                              numIterations, numThreads, rng);
+
+    // Each part of the residuals from the coarse centroids is quantised
+    // separately
+    std::vector<float> residuals(num * numFloats_);
+
+    parallelFor(num, numThreads, [&] (size_t begin, size_t end) {
+        for (size_t n = begin; n < end; ++n) {
+            const float* v = &canonical[n * numFloats_];
+            const float* c = &coarseCentroids_[nearestList(v) * numFloats_];
+
+            for (size_t i = 0; i < numFloats_; ++i)
+                residuals[n * numFloats_ + i] = v[i] - c[i];
+        }
+    });
+
+    subCentroids_.resize(numSubquantisers_ * numSubcentroids_ * subLength_);
+    std::vector<float> part(num * subLength_);
+
+    for (size_t m = 0; m < numSubquantisers_; ++m) {
+
+        for (size_t n = 0; n < num; ++n)
+            std::copy(&residuals[n * numFloats_ + m * subLength_],
+                      &residuals[n * numFloats_ + (m + 1) * subLength_],
+                      &part[n * subLength_]);
+
+        std::vector<float> centroids = kMeans(&part[0], num, subLength_,
+                                              numSubcentroids_,
+                                              numIterations, numThreads,
+                                              rng);
+
+        std::copy(centroids.begin(), centroids.end(),
+                  &subCentroids_[m * numSubcentroids_ * subLength_]);
+    }
+
+    trained_ = true;
+}
+
+
+void DescriptorIndex::add(const float* descriptors, size_t num,
+                          unsigned int numThreads)
+{
+    if (!trained_)
+        throw std::logic_error("DescriptorIndex: must be trained before "
+                               "adding");
+
+    if (size_ + num > std::numeric_limits<uint32_t>::max())
+        throw std::logic_error("DescriptorIndex: too many descriptors");
+
+    // Encode in parallel, then add to the lists in order
+    std::vector<uint32_t> lists(num);
+    std::vector<uint8_t> rotations(num);
+    std::vector<uint8_t> codes(num * numSubquantisers_);
+
+    parallelFor(num, numThreads, [&] (size_t begin, size_t end) {
+        std::vector<float> residual(numFloats_);
+
+        for (size_t n = begin; n < end; ++n) {
+            const float* d = descriptors + n * numFloats_;
+
+            rotations[n] = canonicalRotation(d);
+            std::vector<float> v = rotate(d, rotations[n]);
+
+            lists[n] = nearestList(&v[0]);
+            const float* c = &coarseCentroids_[lists[n] * numFloats_];
+
+            for (size_t i = 0; i < numFloats_; ++i)
+                residual[i] = v[i] - c[i];
+
+            encode(&residual[0], &codes[n * numSubquantisers_]);
+        }
+    });
+
+    for (size_t n = 0; n < num; ++n) {
+        const uint32_t l = lists[n];
+        listIds_[l].push_back(size_ + n);
+        listRotations_[l].push_back(rotations[n]);
+        listCodes_[l].insert(listCodes_[l].end(),
+                             &codes[n * numSubquantisers_],
+                             &codes[(n + 1) * numSubquantisers_]);
+    }
+
+    size_ += num;
+}
+
+
+
+struct DescriptorIndex::Candidates {
+    // Squared distances; the second is always a different entry
+    float distance[2];
+    uint32_t id[2];
+    int rotation;
+
+    Candidates()
+     : distance {std::numeric_limits<float>::infinity(),
+                 std::numeric_limits<float>::infinity()},
+       id {0, 0}, rotation(0)
+    {}
+
+    void consider(float d, uint32_t i, int r)
+    {
+        if (d < distance[0]) {
+            // Only keep the same entry once
+            if (i != id[0]) {
+                distance[1] = distance[0];
+                id[1] = id[0];
+            }
+            distance[0] = d;
+            id[0] = i;
+            rotation = r;
+        } else if (i != id[0] && d < distance[1]) {
+            distance[1] = d;
+            id[1] = i;
+        }
+    }
+};
+
+
+void DescriptorIndex::search(const float* query, int queryRotation,
+                             size_t numProbes,
+                             std::vector<float>& distanceTable,
+                             Candidates& candidates) const
+{
+    const std::vector<float> v = rotate(query, queryRotation);
+
+    // The lists with the nearest centroids
+    std::vector<std::pair<float, size_t>> listDistances(numLists_);
+    for (size_t l = 0; l < numLists_; ++l)
+        listDistances[l] = {squaredDistance(&v[0],
+                                            &coarseCentroids_[l * numFloats_],
+                                            numFloats_), l};
+
+    numProbes = std::min(numProbes, numLists_);
+    std::partial_sort(listDistances.begin(),
+                      listDistances.begin() + numProbes,
+                      listDistances.end());
+
+    std::vector<float> residual(numFloats_);
+    distanceTable.resize(numSubquantisers_ * numSubcentroids_);
+
+    for (size_t p = 0; p < numProbes; ++p) {
+
+        const size_t l = listDistances[p].second;
+        const float* c = &coarseCentroids_[l * numFloats_];
+
+        for (size_t i = 0; i < numFloats_; ++i)
+            residual[i] = v[i] - c[i];
+
+        // Distance from each part of the residual to each of its centroids;
+        // an entry's distance is then a sum of one from each part
+        for (size_t m = 0; m < numSubquantisers_; ++m)
+            for (size_t k = 0; k < numSubcentroids_; ++k)
+                distanceTable[m * numSubcentroids_ + k]
+                    = squaredDistance(&residual[m * subLength_],
+                                      &subCentroids_[(m * numSubcentroids_
+                                                        + k) * subLength_],
+                                      subLength_);
+
+        const std::vector<uint32_t>& ids = listIds_[l];
+        const uint8_t* codes = listCodes_[l].data();
+
+        for (size_t e = 0; e < ids.size(); ++e) {
+
+            const uint8_t* code = codes + e * numSubquantisers_;
+
+            float d = 0.f;
+            for (size_t m = 0; m < numSubquantisers_; ++m)
+                d += distanceTable[m * numSubcentroids_ + code[m]];
+
+            if (d < candidates.distance[1]) {
+                // The query went through queryRotation, the entry through
+                // its own; the rotation between them undoes the latter
+                const int steps = (rotations_[queryRotation].steps
+                                    - rotations_[listRotations_[l][e]].steps
+                                    + ringLength_) % std::max<size_t>(
+                                                        ringLength_, 1);
+                int rotation = 0;
+                for (size_t r = 0; r < rotations_.size(); ++r)
+                    if (rotations_[r].steps == steps)
+                        rotation = r;
+
+                candidates.consider(d, ids[e], rotation);
+            }
+        }
+    }
+}
+
+
+std::vector<NearestNeighbours>
+DescriptorIndex::nearestNeighbours(const float* queries, size_t numQueries,
+                                   size_t numProbes,
+                                   size_t numRotationProbes,
+                                   unsigned int numThreads) const
+{
+    if (!trained_)
+        throw std::logic_error("DescriptorIndex: must be trained before "
+                               "searching");
+
+    std::vector<NearestNeighbours> result(numQueries);
+
+    parallelFor(numQueries, numThreads, [&] (size_t begin, size_t end) {
+        std::vector<float> distanceTable;
+
+        for (size_t q = begin; q < end; ++q) {
+
+            const float* query = queries + q * numFloats_;
+            // Rotations to try, most likely to be canonical first
+            const std::vector<int> order = rotationsByScore(query);
+
+            Candidates candidates;
+            for (size_t r = 0; r < std::min(numRotationProbes, order.size());
+                 ++r)
+                search(query, order[r], numProbes, distanceTable,
+                       candidates);
+
+            result[q] = {candidates.id[0], candidates.rotation,
+                         std::sqrt(candidates.distance[0]),
+                         std::sqrt(candidates.distance[1])};
+        }
+    });
+
+    return result;
+}
+
+
+
+// File format: a header, then the contents as written by the functions
+// below, all in native byte order
+static const char fileMagic[8] = {'C', 'D', 'T', 'I', 'V', 'F', 'P', 'Q'};
+static const uint32_t fileVersion = 1;
+
+
+template <typename T>
+static void writeValue(std::ostream& output, const T& value)
+{
+    output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+template <typename T>
+static void writeVector(std::ostream& output, const std::vector<T>& values)
+{
+    writeValue<uint64_t>(output, values.size());
+    output.write(reinterpret_cast<const char*>(values.data()),
+                 values.size() * sizeof(T));
+}
+
+
+template <typename T>
+static T readValue(std::istream& input)
+{
+    T value;
+    input.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+
+template <typename T>
+static std::vector<T> readVector(std::istream& input)
+{
+    std::vector<T> values(readValue<uint64_t>(input));
+    input.read(reinterpret_cast<char*>(values.data()),
+               values.size() * sizeof(T));
+    return values;
+}
+
+
+void DescriptorIndex::save(const std::string& filename) const
+{
+    std::ofstream output(filename, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("DescriptorIndex: could not open "
+                                 + filename);
+
+    output.write(fileMagic, sizeof(fileMagic));
+    writeValue(output, fileVersion);
+
+    for (uint64_t v: {numSamples_, ringBegin_, ringLength_,
+                      numLists_, numSubquantisers_, size_})
+        writeValue(output, v);
+    writeValue<uint8_t>(output, trained_);
+
+    writeVector(output, coarseCentroids_);
+    writeVector(output, subCentroids_);
+
+    for (size_t l = 0; l < numLists_; ++l) {
+        writeVector(output, listIds_[l]);
+        writeVector(output, listCodes_[l]);
+        writeVector(output, listRotations_[l]);
+    }
+
+    if (!output)
+        throw std::runtime_error("DescriptorIndex: could not write "
+                                 + filename);
+}
+
+
+DescriptorIndex DescriptorIndex::load(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("DescriptorIndex: could not open "
+                                 + filename);
+
+    char magic[sizeof(fileMagic)];
+    input.read(magic, sizeof(magic));
+
+    if (!input || !std::equal(magic, magic + sizeof(magic), fileMagic)
+               || readValue<uint32_t>(input) != fileVersion)
+        throw std::runtime_error("DescriptorIndex: " + filename
+                                  + " is not an index file this version "
+                                    "can read");
+
+    uint64_t header[6];
+    for (uint64_t& v: header)
+        v = readValue<uint64_t>(input);
+
+    DescriptorIndex index(header[0], header[1], header[2],
+                          header[3], header[4]);
+    index.size_ = header[5];
+    index.trained_ = readValue<uint8_t>(input);
+
+    index.coarseCentroids_ = readVector<float>(input);
+    index.subCentroids_ = readVector<float>(input);
+
+    for (size_t l = 0; l < index.numLists_; ++l) {
+        index.listIds_[l] = readVector<uint32_t>(input);
+        index.listCodes_[l] = readVector<uint8_t>(input);
+        index.listRotations_[l] = readVector<uint8_t>(input);
+    }
+
+    if (!input)
+        throw std::runtime_error("DescriptorIndex: " + filename
+                                  + " is truncated");
+
+    return index;
+}
+
+
+size_t DescriptorIndex::size() const
+{
+    return size_;
+}
+
+
+bool DescriptorIndex::isTrained() const
+{
+    return trained_;
+}
+
+
+size_t DescriptorIndex::getNumFloatsInDescriptor() const
+{
+    return numFloats_;
+}
+
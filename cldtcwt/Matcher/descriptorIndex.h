@@ -0,0 +1,123 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef DESCRIPTOR_INDEX_H
+#define DESCRIPTOR_INDEX_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "Matcher/polarMatcher.h"
+
+
+
+class DescriptorIndex {
+// Approximate nearest neighbour search over a large database of
+// descriptors, by product quantisation with an inverted file (IVF-PQ).
+//
+// Each descriptor is first rotated to a canonical orientation (see
+// canonicalRotation), so one entry covers every rotation.  The database is
+// split into numLists lists by a coarse k-means quantiser; within a list,
+// each descriptor is stored as its list's centroid plus a residual, the
+// residual split into numSubquantisers parts each coded as one byte (the
+// nearest of 256 centroids).  A query is compared only with the entries of
+// the numProbes lists with the nearest centroids, using tables of
+// distances to each part's centroids.
+//
+// Memory is numSubquantisers + 5 bytes per descriptor.  Descriptor ids
+// are their order of adding, from zero.
+
+public:
+
+    DescriptorIndex(const DescriptorIndex&) = default;
+
+    DescriptorIndex(size_t numSamples = 14,
+                    size_t ringBegin = 1,
+                    size_t ringLength = 12,
+                    size_t numLists = 1024,
+                    size_t numSubquantisers = 21);
+    // The descriptor layout is as for polarRotations.  numSubquantisers
+    // must divide the number of floats in each descriptor.  For around
+    // ten million descriptors, 4096 lists is more appropriate.
+
+    void train(const float* descriptors, size_t num,
+               unsigned int numIterations = 20,
+               unsigned int numThreads = 0,
+               unsigned int seed = 0);
+    // Learn the quantisers from a representative sample of descriptors (at
+    // least 256 and numLists; some tens of times more is better).  Must be
+    // done before adding.  numThreads = 0 means one per hardware thread.
+
+    void add(const float* descriptors, size_t num,
+             unsigned int numThreads = 0);
+    // Add descriptors to the database
+
+    std::vector<NearestNeighbours>
+    nearestNeighbours(const float* queries, size_t numQueries,
+                      size_t numProbes = 16,
+                      size_t numRotationProbes = 1,
+                      unsigned int numThreads = 0) const;
+    // Approximately the two nearest database entries to each query, as
+    // PolarMatcher::nearestNeighbours (so ratioTest can be applied).  The
+    // queries are shared between numThreads threads.  numRotationProbes
+    // also tries the query at the next best candidates for its canonical
+    // rotation, in case its orientation is ambiguous.
+
+    void save(const std::string& filename) const;
+    static DescriptorIndex load(const std::string& filename);
+    // Throw std::runtime_error if the file can't be used
+
+    size_t size() const;
+    bool isTrained() const;
+    size_t getNumFloatsInDescriptor() const;
+
+    int canonicalRotation(const float* descriptor) const;
+    // Index into polarRotations of the rotation that takes the descriptor
+    // to its canonical orientation: the one turning its energy most towards
+    // the first ring sample and the first subband.
+
+private:
+
+    size_t numSamples_, ringBegin_, ringLength_;
+    size_t numFloats_;
+    size_t numLists_, numSubquantisers_, subLength_;
+    static const size_t numSubcentroids_ = 256;
+
+    std::vector<PolarRotation> rotations_;
+
+    // numLists_ x numFloats_
+    std::vector<float> coarseCentroids_;
+
+    // numSubquantisers_ x numSubcentroids_ x subLength_
+    std::vector<float> subCentroids_;
+
+    // For each list, the ids of its entries, their codes (numSubquantisers_
+    // bytes each), and the canonical rotation each was stored at
+    std::vector<std::vector<uint32_t>> listIds_;
+    std::vector<std::vector<uint8_t>> listCodes_;
+    std::vector<std::vector<uint8_t>> listRotations_;
+
+    size_t size_ = 0;
+    bool trained_ = false;
+
+    std::vector<int> rotationsByScore(const float* descriptor) const;
+    // All rotations, from the best candidate for canonical to the worst
+
+    std::vector<float> rotate(const float* descriptor, int rotation) const;
+
+    size_t nearestList(const float* descriptor) const;
+
+    void encode(const float* residual, uint8_t* code) const;
+
+    // The nearest two found so far in a search
+    struct Candidates;
+
+    void search(const float* query, int queryRotation, size_t numProbes,
+                std::vector<float>& distanceTable,
+                Candidates& candidates) const;
+
+};
+
+
+#endif
+
@@ -0,0 +1,557 @@
+// Copyright (C) 2013 Timothy Gale
+#include "polarMatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POLAR_MATCHER_X86
+#include <immintrin.h>
+#endif
+
+
+std::vector<PolarRotation> polarRotations(size_t numSamples,
+                                          size_t ringBegin,
+                                          size_t ringLength)
+{
+    if (ringBegin + ringLength > numSamples)
+        throw std::logic_error("polarRotations: ring does not fit in the "
+                               "descriptor");
+
+    std::vector<PolarRotation> rotations;
+
+    // With no ring, there is only the identity
+    const size_t numSteps = std::max<size_t>(ringLength, 1);
+
+    for (size_t k = 0; k < numSteps; ++k) {
+
+        // Only rotations by a multiple of the 30 degrees between subbands
+        if ((12 * k) % numSteps != 0)
+            continue;
+
+        const size_t subbandShift = 12 * k / numSteps;
+
+        PolarRotation rotation;
+        rotation.steps = k;
+
+        for (size_t s = 0; s < numSamples; ++s) {
+
+            // The sample that ends up here
+            size_t sourceSample = s;
+            if (s >= ringBegin && s < ringBegin + ringLength)
+                sourceSample = ringBegin
+                             + (s - ringBegin + ringLength - k) % ringLength;
+
+            // Rotating moves subband n onto n - subbandShift, each time
+            // past the first turning it into the conjugate of the last
+            for (size_t n = 0; n < 6; ++n) {
+                rotation.source.push_back(sourceSample * 6
+                                          + (n + subbandShift) % 6);
+                rotation.conjugate.push_back(((n + subbandShift) / 6) % 2);
+            }
+        }
+
+        rotations.push_back(rotation);
+    }
+
+    return rotations;
+}
+
+
+std::string rotationTablesSource(const std::vector<PolarRotation>& rotations)
+{
+    std::ostringstream output;
+
+    output << "__constant int ROT_SOURCE[" << rotations.size() << "]["
+           << rotations[0].source.size() << "] = {\n";
+    for (const PolarRotation& rotation: rotations) {
+        output << "    {";
+        for (int s: rotation.source)
+            output << s << ", ";
+        output << "},\n";
+    }
+    output << "};\n";
+
+    output << "__constant int ROT_CONJ[" << rotations.size() << "]["
+           << rotations[0].conjugate.size() << "] = {\n";
+    for (const PolarRotation& rotation: rotations) {
+        output << "    {";
+        for (char c: rotation.conjugate)
+            output << int(c) << ", ";
+        output << "},\n";
+    }
+    output << "};\n";
+
+    return output.str();
+}
+
+
+std::vector<Match> ratioTest(const std::vector<NearestNeighbours>&
+                                nearestNeighbours,
+                             float ratio)
+{
+    std::vector<Match> matches;
+
+    for (size_t q = 0; q < nearestNeighbours.size(); ++q) {
+        const NearestNeighbours& nn = nearestNeighbours[q];
+
+        if (nn.distance < ratio * nn.secondDistance)
+            matches.push_back({q, nn.trainIdx, nn.rotation, nn.distance});
+    }
+
+    return matches;
+}
+
+
+
+// The inner loop: dot products of numRows rows (consecutive, each length
+// long) with a panel of training descriptors, stored transposed so that
+// element i of descriptor j is panel[i * width + j].  Result r * width + j
+// is the dot product of row r with descriptor j.  Working across
+// descriptors rather than along them avoids summing within vectors.
+// There is one per instruction set, each with its own panel width.
+typedef void (*DotsFunction)(const float* rows, size_t numRows,
+                             const float* panel, size_t length, float* out);
+
+struct DotsKernel {
+    DotsFunction function;
+    size_t width;
+};
+
+
+static const size_t scalarWidth = 8;
+
+static void dotsScalar(const float* rows, size_t numRows,
+                       const float* panel, size_t length, float* out)
+{
+    for (size_t r = 0; r < numRows; ++r) {
+        const float* row = rows + r * length;
+        float sums[scalarWidth] = {};
+
+        for (size_t i = 0; i < length; ++i)
+            for (size_t j = 0; j < scalarWidth; ++j)
+                sums[j] += row[i] * panel[i * scalarWidth + j];
+
+        std::copy(sums, sums + scalarWidth, out + r * scalarWidth);
+    }
+}
+
+
+#ifdef POLAR_MATCHER_X86
+
+// Each step takes four rows against two vectors' width of descriptors:
+// six loads for eight multiply-adds.
+
+static const size_t avx2Width = 16;
+
+__attribute__((target("avx2,fma")))
+static void dotsAVX2(const float* rows, size_t numRows,
+                     const float* panel, size_t length, float* out)
+{
+    size_t r = 0;
+
+    for (; r + 4 <= numRows; r += 4) {
+        const float* row = rows + r * length;
+
+        // Accumulators for row k, first and second half of the panel
+        __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps(),
+               acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps(),
+               acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps(),
+               acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+
+        for (size_t i = 0; i < length; ++i) {
+            const __m256 p0 = _mm256_loadu_ps(panel + i * avx2Width),
+                         p1 = _mm256_loadu_ps(panel + i * avx2Width + 8);
+
+            __m256 x = _mm256_broadcast_ss(row + i);
+            acc00 = _mm256_fmadd_ps(x, p0, acc00);
+            acc01 = _mm256_fmadd_ps(x, p1, acc01);
+
+            x = _mm256_broadcast_ss(row + length + i);
+            acc10 = _mm256_fmadd_ps(x, p0, acc10);
+            acc11 = _mm256_fmadd_ps(x, p1, acc11);
+
+            x = _mm256_broadcast_ss(row + 2 * length + i);
+            acc20 = _mm256_fmadd_ps(x, p0, acc20);
+            acc21 = _mm256_fmadd_ps(x, p1, acc21);
+
+            x = _mm256_broadcast_ss(row + 3 * length + i);
+            acc30 = _mm256_fmadd_ps(x, p0, acc30);
+            acc31 = _mm256_fmadd_ps(x, p1, acc31);
+        }
+
+        float* o = out + r * avx2Width;
+        _mm256_storeu_ps(o, acc00);
+        _mm256_storeu_ps(o + 8, acc01);
+        _mm256_storeu_ps(o + avx2Width, acc10);
+        _mm256_storeu_ps(o + avx2Width + 8, acc11);
+        _mm256_storeu_ps(o + 2 * avx2Width, acc20);
+        _mm256_storeu_ps(o + 2 * avx2Width + 8, acc21);
+        _mm256_storeu_ps(o + 3 * avx2Width, acc30);
+        _mm256_storeu_ps(o + 3 * avx2Width + 8, acc31);
+    }
+
+    for (; r < numRows; ++r) {
+        const float* row = rows + r * length;
+
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+
+        for (size_t i = 0; i < length; ++i) {
+            const __m256 x = _mm256_broadcast_ss(row + i);
+            acc0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(panel + i * avx2Width),
+                                   acc0);
+            acc1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(panel + i * avx2Width
+                                                            + 8),
+                                   acc1);
+        }
+
+        _mm256_storeu_ps(out + r * avx2Width, acc0);
+        _mm256_storeu_ps(out + r * avx2Width + 8, acc1);
+    }
+}
+
+
+static const size_t avx512Width = 32;
+
+__attribute__((target("avx512f")))
+static void dotsAVX512(const float* rows, size_t numRows,
+                       const float* panel, size_t length, float* out)
+{
+    size_t r = 0;
+
+    for (; r + 4 <= numRows; r += 4) {
+        const float* row = rows + r * length;
+
+        __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps(),
+               acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps(),
+               acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps(),
+               acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+
+        for (size_t i = 0; i < length; ++i) {
+            const __m512 p0 = _mm512_loadu_ps(panel + i * avx512Width),
+                         p1 = _mm512_loadu_ps(panel + i * avx512Width + 16);
+
+            __m512 x = _mm512_set1_ps(row[i]);
+            acc00 = _mm512_fmadd_ps(x, p0, acc00);
+            acc01 = _mm512_fmadd_ps(x, p1, acc01);
+
+            x = _mm512_set1_ps(row[length + i]);
+            acc10 = _mm512_fmadd_ps(x, p0, acc10);
+            acc11 = _mm512_fmadd_ps(x, p1, acc11);
+
+            x = _mm512_set1_ps(row[2 * length + i]);
+            acc20 = _mm512_fmadd_ps(x, p0, acc20);
+            acc21 = _mm512_fmadd_ps(x, p1, acc21);
+
+            x = _mm512_set1_ps(row[3 * length + i]);
+            acc30 = _mm512_fmadd_ps(x, p0, acc30);
+            acc31 = _mm512_fmadd_ps(x, p1, acc31);
+        }
+
+        float* o = out + r * avx512Width;
+        _mm512_storeu_ps(o, acc00);
+        _mm512_storeu_ps(o + 16, acc01);
+        _mm512_storeu_ps(o + avx512Width, acc10);
+        _mm512_storeu_ps(o + avx512Width + 16, acc11);
+        _mm512_storeu_ps(o + 2 * avx512Width, acc20);
+        _mm512_storeu_ps(o + 2 * avx512Width + 16, acc21);
+        _mm512_storeu_ps(o + 3 * avx512Width, acc30);
+        _mm512_storeu_ps(o + 3 * avx512Width + 16, acc31);
+    }
+
+    for (; r < numRows; ++r) {
+        const float* row = rows + r * length;
+
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+
+        for (size_t i = 0; i < length; ++i) {
+            const __m512 x = _mm512_set1_ps(row[i]);
+            acc0 = _mm512_fmadd_ps(x, _mm512_loadu_ps(panel 
+                                                      + i * avx512Width),
+                                   acc0);
+            acc1 = _mm512_fmadd_ps(x, _mm512_loadu_ps(panel 
+                                                      + i * avx512Width + 16),
+                                   acc1);
+        }
+
+        _mm512_storeu_ps(out + r * avx512Width, acc0);
+        _mm512_storeu_ps(out + r * avx512Width + 16, acc1);
+    }
+}
+
+#endif
+
+
+static DotsKernel dotsKernel(PolarMatcher::Instructions instructions)
+{
+    switch (instructions) {
+#ifdef POLAR_MATCHER_X86
+        case PolarMatcher::Instructions::AVX2:
+            return {dotsAVX2, avx2Width};
+        case PolarMatcher::Instructions::AVX512:
+            return {dotsAVX512, avx512Width};
+#endif
+        default:
+            return {dotsScalar, scalarWidth};
+    }
+}
+
+
+
+PolarMatcher::PolarMatcher(size_t numSamples,
+                           size_t ringBegin,
+                           size_t ringLength,
+                           unsigned int numThreads,
+                           Instructions instructions)
+ : numFloats_(numSamples * 6 * 2),
+   numThreads_(numThreads),
+   instructions_(instructions),
+   ringLength_(ringLength),
+   allRotations_(polarRotations(numSamples, ringBegin, ringLength))
+{
+    setMaxRotation(ringLength);
+
+    if (numThreads_ == 0)
+        numThreads_ = std::max(1u, std::thread::hardware_concurrency());
+
+    if (instructions_ == Instructions::Best) {
+        if (isSupported(Instructions::AVX512))
+            instructions_ = Instructions::AVX512;
+        else if (isSupported(Instructions::AVX2))
+            instructions_ = Instructions::AVX2;
+        else
+            instructions_ = Instructions::Scalar;
+    }
+
+    if (!isSupported(instructions_))
+        throw std::logic_error("PolarMatcher: instructions not supported "
+                               "by this processor");
+}
+
+
+void PolarMatcher::setMaxRotation(size_t steps)
+{
+    rotations_.clear();
+    rotationIndices_.clear();
+
+    for (size_t r = 0; r < allRotations_.size(); ++r) {
+        const size_t k = allRotations_[r].steps;
+        if (std::min(k, ringLength_ - k) <= steps) {
+            rotations_.push_back(allRotations_[r]);
+            rotationIndices_.push_back(r);
+        }
+    }
+}
+
+
+bool PolarMatcher::isSupported(Instructions instructions)
+{
+    switch (instructions) {
+        case Instructions::Best:
+        case Instructions::Scalar:
+            return true;
+#ifdef POLAR_MATCHER_X86
+        case Instructions::AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma");
+        case Instructions::AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+
+// Queries per block.  The rotated versions of a block are compared with
+// each panel of training descriptors in turn, so should stay in cache: 8
+// queries of 168 floats in 12 rotations are 64 kB.
+static const size_t queryBlockSize = 8;
+
+
+void PolarMatcher::matchBlock(const float* query, size_t numQuery,
+                              const std::vector<float>& panels,
+                              size_t numTrain,
+                              const std::vector<float>& trainNorms,
+                              std::vector<float>& rotated,
+                              std::vector<float>& dots,
+                              NearestNeighbours* output) const
+{
+    const size_t numRotations = rotations_.size();
+    const size_t numRows = numQuery * numRotations;
+
+    // Lay out every rotation of every query in the block, one per row
+    float queryNorms[queryBlockSize];
+
+    for (size_t q = 0; q < numQuery; ++q) {
+        const float* in = query + q * numFloats_;
+
+        queryNorms[q] = 0.f;
+        for (size_t i = 0; i < numFloats_; ++i)
+            queryNorms[q] += in[i] * in[i];
+
+        for (size_t r = 0; r < numRotations; ++r) {
+            float* out = &rotated[(q * numRotations + r) * numFloats_];
+            const PolarRotation& rotation = rotations_[r];
+
+            for (size_t c = 0; c < numFloats_ / 2; ++c) {
+                const float* v = in + 2 * rotation.source[c];
+                out[2*c] = v[0];
+                out[2*c+1] = rotation.conjugate[c]? -v[1] : v[1];
+            }
+        }
+
+        output[q] = {0, 0, std::numeric_limits<float>::infinity(),
+                           std::numeric_limits<float>::infinity()};
+    }
+
+    // Rotations only permute (and conjugate), so leave the norms alone:
+    // the distance is smallest for the biggest dot product
+    const DotsKernel kernel = dotsKernel(instructions_);
+    const size_t width = kernel.width;
+
+    for (size_t p = 0; p * width < numTrain; ++p) {
+
+        kernel.function(&rotated[0], numRows, &panels[p * numFloats_ * width],
+                        numFloats_, &dots[0]);
+
+        const size_t numInPanel = std::min(width, numTrain - p * width);
+
+        for (size_t q = 0; q < numQuery; ++q) {
+
+            NearestNeighbours& nn = output[q];
+
+            for (size_t j = 0; j < numInPanel; ++j) {
+
+                const size_t t = p * width + j;
+
+                // Best rotation for this training descriptor
+                size_t bestRotation = 0;
+                float maxDot = dots[q * numRotations * width + j];
+
+                for (size_t r = 1; r < numRotations; ++r) {
+                    const float d = dots[(q * numRotations + r) * width + j];
+                    if (d > maxDot) {
+                        maxDot = d;
+                        bestRotation = r;
+                    }
+                }
+
+                const float distance
+                    = std::max(queryNorms[q] + trainNorms[t] - 2 * maxDot,
+                               0.f);
+
+                if (distance < nn.distance) {
+                    nn.secondDistance = nn.distance;
+                    nn.distance = distance;
+                    nn.trainIdx = t;
+                    nn.rotation = rotationIndices_[bestRotation];
+                } else if (distance < nn.secondDistance)
+                    nn.secondDistance = distance;
+            }
+        }
+    }
+
+    // Squared distances until now
+    for (size_t q = 0; q < numQuery; ++q) {
+        output[q].distance = std::sqrt(output[q].distance);
+        output[q].secondDistance = std::sqrt(output[q].secondDistance);
+    }
+}
+
+
+std::vector<NearestNeighbours>
+PolarMatcher::nearestNeighbours(const float* query, size_t numQuery,
+                                const float* train, size_t numTrain) const
+{
+    std::vector<NearestNeighbours> result(numQuery);
+
+    // Transpose the training descriptors into panels for the inner loop
+    // (zero padded to a whole number), and find their norms
+    const size_t width = dotsKernel(instructions_).width;
+    const size_t numPanels = (numTrain + width - 1) / width;
+
+    std::vector<float> panels(numPanels * width * numFloats_, 0.f);
+    std::vector<float> trainNorms(numTrain);
+
+    for (size_t t = 0; t < numTrain; ++t) {
+        const float* v = train + t * numFloats_;
+        float* panel = &panels[(t / width) * width * numFloats_ + t % width];
+
+        trainNorms[t] = 0.f;
+        for (size_t i = 0; i < numFloats_; ++i) {
+            trainNorms[t] += v[i] * v[i];
+            panel[i * width] = v[i];
+        }
+    }
+
+    // Threads take blocks of queries until there are none left
+    const size_t numBlocks = (numQuery + queryBlockSize - 1) / queryBlockSize;
+    std::atomic<size_t> nextBlock(0);
+
+    auto work = [&] () {
+        std::vector<float>
+            rotated(queryBlockSize * rotations_.size() * numFloats_),
+            dots(queryBlockSize * rotations_.size() * width);
+
+        for (size_t b = nextBlock++; b < numBlocks; b = nextBlock++) {
+            const size_t begin = b * queryBlockSize,
+                         num = std::min(queryBlockSize, numQuery - begin);
+
+            matchBlock(query + begin * numFloats_, num,
+                       panels, numTrain, trainNorms,
+                       rotated, dots, &result[begin]);
+        }
+    };
+
+    const size_t numThreads = std::min<size_t>(numThreads_, numBlocks);
+
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < numThreads; ++n)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread& thread: threads)
+        thread.join();
+
+    return result;
+}
+
+
+std::vector<NearestNeighbours>
+PolarMatcher::nearestNeighbours(const std::vector<float>& query,
+                                const std::vector<float>& train) const
+{
+    return nearestNeighbours(query.data(), query.size() / numFloats_,
+                             train.data(), train.size() / numFloats_);
+}
+
+
+std::vector<Match>
+PolarMatcher::operator() (const std::vector<float>& query,
+                          const std::vector<float>& train,
+                          float ratio) const
+{
+    return ratioTest(nearestNeighbours(query, train), ratio);
+}
+
+
+size_t PolarMatcher::getNumFloatsInDescriptor() const
+{
+    return numFloats_;
+}
+
+
+PolarMatcher::Instructions PolarMatcher::instructions() const
+{
+    return instructions_;
+}
+
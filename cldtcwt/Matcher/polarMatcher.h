@@ -0,0 +1,138 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef POLAR_MATCHER_H
+#define POLAR_MATCHER_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+
+// Descriptors (as made by DescriptorExtracter) are complex samples of the
+// six subbands at points on a ring around the keypoint, plus points at the
+// centre.  Rotating the image by one step of the ring moves each ring
+// sample one place along, and each subband onto its neighbour 30 degrees
+// round (conjugated where that wraps past 180 degrees).  So descriptors
+// can be compared under rotation without resampling, by permuting one.
+
+struct PolarRotation {
+    // Component c (a complex number) of the rotated descriptor is
+    // component source[c] of the original, conjugated if conjugate[c]
+    int steps;
+    std::vector<int> source;
+    std::vector<char> conjugate;
+};
+
+
+std::vector<PolarRotation> polarRotations(size_t numSamples = 14,
+                                          size_t ringBegin = 1,
+                                          size_t ringLength = 12);
+// All the rotations that map the sampling pattern onto itself, for
+// descriptors of numSamples samples with a ring at samples ringBegin up to
+// ringBegin+ringLength (in order of increasing angle atan2(y, x)) and the
+// rest at the centre.  Rotations step round the ring, and only those that
+// are a whole number of 30 degrees are valid.  The first is no rotation.
+
+
+std::string rotationTablesSource(const std::vector<PolarRotation>& rotations);
+// OpenCL source defining constant tables ROT_SOURCE[r][c] and
+// ROT_CONJ[r][c], the source and conjugate of rotations[r]
+
+
+struct NearestNeighbours {
+    // The closest training descriptor to a query, under any rotation,
+    // and the distance to the next closest (infinity if none).  Rotation
+    // is the index into polarRotations of the rotation that was applied to
+    // the query.
+    unsigned int trainIdx;
+    int rotation;
+    float distance, secondDistance;
+};
+
+
+struct Match {
+    size_t queryIdx, trainIdx;
+    int rotation;
+    float distance;
+};
+
+
+std::vector<Match> ratioTest(const std::vector<NearestNeighbours>&
+                                nearestNeighbours,
+                             float ratio);
+// Matches for the queries whose nearest neighbour is closer than ratio
+// times the next nearest
+
+
+
+class PolarMatcher {
+// Brute force matching of descriptors on the CPU, trying every rotation of
+// each query against every training descriptor.  Distances are Euclidean,
+// and descriptors are packed one after another as floats.
+
+public:
+
+    enum class Instructions {
+        // Which vector instructions to use; Best picks the widest the
+        // processor supports
+        Best, Scalar, AVX2, AVX512
+    };
+
+    PolarMatcher(size_t numSamples = 14,
+                 size_t ringBegin = 1,
+                 size_t ringLength = 12,
+                 unsigned int numThreads = 0,
+                 Instructions instructions = Instructions::Best);
+    // numThreads - how many threads to split the queries between, or 0 for
+    // one per hardware thread
+
+    std::vector<NearestNeighbours>
+    nearestNeighbours(const float* query, size_t numQuery,
+                      const float* train, size_t numTrain) const;
+
+    std::vector<NearestNeighbours>
+    nearestNeighbours(const std::vector<float>& query,
+                      const std::vector<float>& train) const;
+
+    std::vector<Match>
+    operator() (const std::vector<float>& query,
+                const std::vector<float>& train,
+                float ratio = 0.8f) const;
+    // Matches passing the ratio test
+
+    void setMaxRotation(size_t steps);
+    // Only try rotations of up to steps round the ring either way, e.g.
+    // one for descriptors already rotated to their keypoints' orientations
+    // (see DescriptorExtracter), in case those were near a boundary.  The
+    // default is every rotation.
+
+    size_t getNumFloatsInDescriptor() const;
+    Instructions instructions() const;
+
+    static bool isSupported(Instructions instructions);
+    // Whether this processor can run the instructions
+
+private:
+
+    size_t numFloats_;
+    unsigned int numThreads_;
+    Instructions instructions_;
+
+    size_t ringLength_;
+    std::vector<PolarRotation> allRotations_;
+
+    // Those tried, and their indices in allRotations_
+    std::vector<PolarRotation> rotations_;
+    std::vector<int> rotationIndices_;
+
+    void matchBlock(const float* query, size_t numQuery,
+                    const std::vector<float>& panels, size_t numTrain,
+                    const std::vector<float>& trainNorms,
+                    std::vector<float>& rotated,
+                    std::vector<float>& dots,
+                    NearestNeighbours* output) const;
+
+};
+
+
+#endif
+
@@ -0,0 +1,150 @@
+// Copyright (C) 2013 Timothy Gale
+#include "backgroundWriter.h"
+
+#include <H5Cpp.h>
+#include <algorithm>
+#include <iostream>
+
+
+
+BackgroundWriter::BackgroundWriter(const std::string& name,
+                                   size_t maxUnfinished)
+ : name_(name), maxUnfinished_(std::max<size_t>(1, maxUnfinished))
+{
+    thread_ = std::thread(&BackgroundWriter::run, this);
+}
+
+
+BackgroundWriter::~BackgroundWriter()
+{
+    finish();
+}
+
+
+void BackgroundWriter::rethrow()
+{
+    // With mutex_ held.  Pass on (once) anything that went wrong in the
+    // writer.
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+
+bool BackgroundWriter::hasRoom() const
+{
+    // With mutex_ held
+    return queue_.size() + (writing_? 1 : 0) < maxUnfinished_;
+}
+
+
+void BackgroundWriter::check()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    rethrow();
+}
+
+
+void BackgroundWriter::waitForRoom()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    changed_.wait(lock, [&] { return hasRoom() || error_; });
+    rethrow();
+}
+
+
+void BackgroundWriter::submit(std::function<void ()> write)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    changed_.wait(lock, [&] { return hasRoom() || error_; });
+    rethrow();
+
+    queue_.push_back(std::move(write));
+    changed_.notify_all();
+}
+
+
+void BackgroundWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    changed_.wait(lock, [&] {
+        return (queue_.empty() && !writing_) || error_;
+    });
+    rethrow();
+}
+
+
+void BackgroundWriter::finish(std::function<void ()> lastWrite)
+{
+    if (!thread_.joinable())
+        return;
+
+    try {
+        if (lastWrite)
+            submit(std::move(lastWrite));
+
+        flush();
+    }
+    catch (H5::Exception& err) {
+        std::cerr << name_ << ": " << err.getDetailMsg() << std::endl;
+    }
+    catch (std::exception& err) {
+        std::cerr << name_ << ": " << err.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+
+    thread_.join();
+}
+
+
+void BackgroundWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+
+        changed_.wait(lock, [&] { return !queue_.empty() || stopping_; });
+
+        if (queue_.empty())
+            return;
+
+        std::function<void ()> write = std::move(queue_.front());
+        queue_.pop_front();
+        writing_ = true;
+
+        // Let more be submitted while this one is written
+        lock.unlock();
+        changed_.notify_all();
+
+        std::exception_ptr error;
+
+        try {
+            write();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        writing_ = false;
+
+        // Give up on anything still waiting, since the file no longer
+        // lines up
+        if (error) {
+            error_ = error;
+            queue_.clear();
+        }
+
+        changed_.notify_all();
+    }
+}
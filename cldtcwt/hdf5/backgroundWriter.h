@@ -0,0 +1,73 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef BACKGROUND_WRITER_H
+#define BACKGROUND_WRITER_H
+
+#include <deque>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+
+class BackgroundWriter {
+    // Runs writes one after another, in order, on a thread of its own,
+    // with a limited number unfinished at once (so memory stays bounded if
+    // the disk is slow).  If one goes wrong, those still waiting are
+    // dropped (the file no longer lining up), and the error is rethrown,
+    // once, by the next call.
+
+public:
+
+    BackgroundWriter(const std::string& name, size_t maxUnfinished);
+    // name - what to report errors as, once nothing is left to throw them
+    // to.
+    // maxUnfinished - writes that can be waiting or being written before
+    // submit blocks.
+
+    ~BackgroundWriter();
+    // Finishes, if not done already
+
+    BackgroundWriter(const BackgroundWriter&) = delete;
+    BackgroundWriter& operator = (const BackgroundWriter&) = delete;
+
+    void check();
+    // Rethrow anything that has gone wrong, without waiting
+
+    void waitForRoom();
+    // Wait until fewer than maxUnfinished writes are unfinished
+
+    void submit(std::function<void ()> write);
+    // Wait for room, and queue write
+
+    void flush();
+    // Wait until all the writes submitted are done
+
+    void finish(std::function<void ()> lastWrite = nullptr);
+    // Submit lastWrite (if any), wait for everything to be written, and
+    // stop the thread.  Errors are reported to std::cerr rather than
+    // thrown, for owners' destructors.
+
+private:
+
+    std::string name_;
+    size_t maxUnfinished_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+
+    std::deque<std::function<void ()>> queue_;
+    bool writing_ = false, stopping_ = false;
+    std::exception_ptr error_;
+
+    std::thread thread_;
+
+    bool hasRoom() const;
+    void rethrow();
+    void run();
+
+};
+
+
+#endif
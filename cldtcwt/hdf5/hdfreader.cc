@@ -0,0 +1,329 @@
+// Copyright (C) 2013 Timothy Gale
+#include "hdfreader.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+// Views on blocks
+
+HDFFrameRange::HDFFrameRange(std::shared_ptr<const Block> block,
+                             std::shared_ptr<const std::vector<hsize_t>>
+                                frames,
+                             size_t begin, size_t end,
+                             size_t keypointLength, size_t descriptorLength)
+ : block_(block), frames_(frames), begin_(begin), end_(end),
+   keypointLength_(keypointLength), descriptorLength_(descriptorLength)
+{
+}
+
+
+size_t HDFFrameRange::begin() const
+{
+    return begin_;
+}
+
+
+size_t HDFFrameRange::end() const
+{
+    return end_;
+}
+
+
+size_t HDFFrameRange::offset(size_t frame) const
+{
+    // Keypoints before the frame's first in the block
+    return (*frames_)[2 * frame] - block_->firstKeypoint;
+}
+
+
+size_t HDFFrameRange::numKeypoints() const
+{
+    if (begin_ == end_)
+        return 0;
+
+    return (*frames_)[2 * (end_-1)] + (*frames_)[2 * (end_-1) + 1]
+         - (*frames_)[2 * begin_];
+}
+
+
+const float* HDFFrameRange::keypoints() const
+{
+    return keypoints(begin_);
+}
+
+
+const float* HDFFrameRange::descriptors() const
+{
+    return descriptors(begin_);
+}
+
+
+size_t HDFFrameRange::numKeypoints(size_t frame) const
+{
+    return (*frames_)[2 * frame + 1];
+}
+
+
+const float* HDFFrameRange::keypoints(size_t frame) const
+{
+    return block_->keypoints.data() + offset(frame) * keypointLength_;
+}
+
+
+const float* HDFFrameRange::descriptors(size_t frame) const
+{
+    return block_->descriptors.data() + offset(frame) * descriptorLength_;
+}
+
+
+
+// The reader
+
+HDFReader::HDFReader(const std::string& filename, size_t blockFrames,
+                     size_t cacheBlocks)
+ : file_(H5std_string(filename.c_str()), H5F_ACC_RDONLY),
+   blockFrames_(std::max<size_t>(1, blockFrames)),
+   cacheBlocks_(std::max<size_t>(1, cacheBlocks))
+{
+    keypointsSet_ = file_.openDataSet("keypoints");
+    descriptorsSet_ = file_.openDataSet("descriptors");
+
+    hsize_t dims[2];
+    keypointsSet_.getSpace().getSimpleExtentDims(dims);
+    keypointLength_ = dims[1];
+
+    descriptorsSet_.getSpace().getSimpleExtentDims(dims);
+    descriptorLength_ = dims[1];
+
+    // The frames table is small enough to keep
+    H5::DataSet framesSet = file_.openDataSet("frames");
+    framesSet.getSpace().getSimpleExtentDims(dims);
+    numFrames_ = dims[0];
+
+    auto frames = std::make_shared<std::vector<hsize_t>>(2 * numFrames_);
+    if (numFrames_ > 0)
+        framesSet.read(&(*frames)[0], H5::PredType::NATIVE_HSIZE);
+    frames_ = frames;
+
+    thread_ = std::thread(&HDFReader::run, this);
+}
+
+
+HDFReader::~HDFReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+
+    thread_.join();
+}
+
+
+size_t HDFReader::numFrames() const
+{
+    return numFrames_;
+}
+
+
+size_t HDFReader::keypointLength() const
+{
+    return keypointLength_;
+}
+
+
+size_t HDFReader::descriptorLength() const
+{
+    return descriptorLength_;
+}
+
+
+std::shared_ptr<const HDFFrameRange::Block>
+    HDFReader::load(size_t firstFrame, size_t numFrames)
+{
+    // Read the frames' keypoints and descriptors with one hyperslab each
+    auto block = std::make_shared<HDFFrameRange::Block>();
+    block->firstFrame = firstFrame;
+    block->numFrames = numFrames;
+
+    const std::vector<hsize_t>& frames = *frames_;
+    const size_t last = firstFrame + numFrames - 1;
+
+    block->firstKeypoint = frames[2 * firstFrame];
+    const hsize_t numKeypoints = frames[2 * last] + frames[2 * last + 1]
+                               - block->firstKeypoint;
+
+    block->keypoints.resize(numKeypoints * keypointLength_);
+    block->descriptors.resize(numKeypoints * descriptorLength_);
+
+    if (numKeypoints == 0)
+        return block;
+
+    std::lock_guard<std::mutex> lock(hdfMutex_);
+
+    for (auto table: {std::make_pair(&keypointsSet_, &block->keypoints),
+                      std::make_pair(&descriptorsSet_,
+                                     &block->descriptors)}) {
+
+        H5::DataSpace fileSpace = table.first->getSpace();
+
+        hsize_t offset[2] = {block->firstKeypoint, 0},
+                count[2] = {numKeypoints,
+                            table.second->size() / numKeypoints};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+
+        H5::DataSpace memSpace(2, count);
+        table.first->read(&(*table.second)[0], H5::PredType::NATIVE_FLOAT,
+                          memSpace, fileSpace);
+    }
+
+    return block;
+}
+
+
+void HDFReader::store(size_t index,
+                      std::shared_ptr<const HDFFrameRange::Block> block)
+{
+    // Add a block to the cache, with mutex_ held, making it the most
+    // recently used and dropping the least if there are too many
+    cache_[index] = block;
+    recent_.remove(index);
+    recent_.push_front(index);
+
+    while (recent_.size() > cacheBlocks_) {
+        cache_.erase(recent_.back());
+        recent_.pop_back();
+    }
+}
+
+
+std::shared_ptr<const HDFFrameRange::Block> HDFReader::block(size_t index)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Wait for it if the background thread is already on it
+    changed_.wait(lock, [&] { return loading_.count(index) == 0; });
+
+    auto cached = cache_.find(index);
+    if (cached != cache_.end()) {
+        recent_.remove(index);
+        recent_.push_front(index);
+        return cached->second;
+    }
+
+    // Otherwise read it here (not holding mutex_, so the background
+    // thread can carry on with what it was asked)
+    queue_.erase(std::remove(queue_.begin(), queue_.end(), index),
+                 queue_.end());
+    loading_.insert(index);
+    lock.unlock();
+
+    const size_t first = index * blockFrames_;
+    std::shared_ptr<const HDFFrameRange::Block> result;
+
+    try {
+        result = load(first, std::min(blockFrames_, numFrames_ - first));
+    }
+    catch (...) {
+        lock.lock();
+        loading_.erase(index);
+        changed_.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    loading_.erase(index);
+    store(index, result);
+    changed_.notify_all();
+
+    return result;
+}
+
+
+HDFFrameRange HDFReader::read(size_t begin, size_t end)
+{
+    if (begin > end || end > numFrames_)
+        throw std::out_of_range("HDFReader: frames out of range");
+
+    if (begin == end)
+        return HDFFrameRange();
+
+    const size_t firstBlock = begin / blockFrames_,
+                 lastBlock = (end - 1) / blockFrames_;
+
+    // Read ahead for whoever is going through in order
+    prefetch(std::min((lastBlock + 1) * blockFrames_, numFrames_),
+             std::min((lastBlock + 2) * blockFrames_, numFrames_));
+
+    std::shared_ptr<const HDFFrameRange::Block> result
+        = (firstBlock == lastBlock)? block(firstBlock)
+                                   : load(begin, end - begin);
+
+    return HDFFrameRange(result, frames_, begin, end,
+                         keypointLength_, descriptorLength_);
+}
+
+
+void HDFReader::prefetch(size_t begin, size_t end)
+{
+    end = std::min(end, numFrames_);
+    if (begin >= end)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (size_t b = begin / blockFrames_; b <= (end - 1) / blockFrames_;
+                ++b)
+            if (cache_.count(b) == 0 && loading_.count(b) == 0
+                    && std::find(queue_.begin(), queue_.end(), b)
+                        == queue_.end())
+                queue_.push_back(b);
+
+        // Never ask for more than the cache will keep
+        while (queue_.size() > cacheBlocks_)
+            queue_.pop_front();
+    }
+
+    changed_.notify_all();
+}
+
+
+void HDFReader::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+
+        changed_.wait(lock, [&] { return !queue_.empty() || stopping_; });
+
+        if (stopping_)
+            return;
+
+        const size_t index = queue_.front();
+        queue_.pop_front();
+        loading_.insert(index);
+        lock.unlock();
+
+        // Leave any failure to be found (and thrown) by a read
+        std::shared_ptr<const HDFFrameRange::Block> result;
+        const size_t first = index * blockFrames_;
+
+        try {
+            result = load(first, std::min(blockFrames_, numFrames_ - first));
+        }
+        catch (...) {
+        }
+
+        lock.lock();
+        loading_.erase(index);
+        if (result)
+            store(index, result);
+
+        changed_.notify_all();
+    }
+}
+
+
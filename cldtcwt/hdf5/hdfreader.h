@@ -0,0 +1,140 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef HDFREADER_H
+#define HDFREADER_H
+
+
+#include <H5Cpp.h>
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+class HDFFrameRange {
+    // The keypoints and descriptors of a range of frames, read by
+    // HDFReader.  Points into the reader's cache (or a block of its own),
+    // which it keeps alive, so stays valid after the reader has moved on
+    // or gone.  Keypoints (and descriptors) of consecutive frames follow
+    // on from each other.
+
+public:
+
+    struct Block {
+        // Consecutive frames' keypoints and descriptors, as read
+        size_t firstFrame, numFrames;
+        hsize_t firstKeypoint;
+        std::vector<float> keypoints, descriptors;
+    };
+
+    HDFFrameRange() = default;
+    HDFFrameRange(std::shared_ptr<const Block> block,
+                  std::shared_ptr<const std::vector<hsize_t>> frames,
+                  size_t begin, size_t end,
+                  size_t keypointLength, size_t descriptorLength);
+
+    size_t begin() const;
+    size_t end() const;
+    // The frames covered
+
+    size_t numKeypoints() const;
+    const float* keypoints() const;
+    const float* descriptors() const;
+    // For all the frames in the range
+
+    size_t numKeypoints(size_t frame) const;
+    const float* keypoints(size_t frame) const;
+    const float* descriptors(size_t frame) const;
+    // For one frame in the range (numbered as in the file)
+
+private:
+
+    std::shared_ptr<const Block> block_;
+    std::shared_ptr<const std::vector<hsize_t>> frames_;
+    size_t begin_ = 0, end_ = 0;
+    size_t keypointLength_ = 0, descriptorLength_ = 0;
+
+    size_t offset(size_t frame) const;
+
+};
+
+
+class HDFReader {
+    // Reads the tables written by HDFWriter a range of frames at a time,
+    // using the frames table to find each range's keypoints and
+    // descriptors.  The file is read in blocks of frames, which are cached
+    // (least recently used going first) and can be read ahead by a
+    // background thread: the block after each one used is, and any
+    // others asked for with prefetch.
+
+public:
+
+    HDFReader(const std::string& filename, size_t blockFrames = 256,
+              size_t cacheBlocks = 16);
+    // blockFrames - frames read in each go.
+    // cacheBlocks - most blocks to keep.
+
+    ~HDFReader();
+
+    HDFReader(const HDFReader&) = delete;
+    HDFReader& operator = (const HDFReader&) = delete;
+
+    size_t numFrames() const;
+    size_t keypointLength() const;
+    size_t descriptorLength() const;
+
+    HDFFrameRange read(size_t begin, size_t end);
+    // Frames begin up to end.  Ranges within a block are views on the
+    // cache; others are read specially.  Throws std::out_of_range past
+    // the last frame, and H5::Exception if the file can't be read.
+
+    void prefetch(size_t begin, size_t end);
+    // Start reading the blocks covering frames begin up to end in the
+    // background, for a read to come
+
+private:
+
+    H5::H5File file_;
+    H5::DataSet keypointsSet_, descriptorsSet_;
+
+    std::shared_ptr<const std::vector<hsize_t>> frames_;
+    size_t numFrames_, keypointLength_, descriptorLength_;
+
+    size_t blockFrames_, cacheBlocks_;
+
+    // HDF5 isn't necessarily thread-safe, so one read at a time
+    std::mutex hdfMutex_;
+
+    // Protecting everything below
+    std::mutex mutex_;
+    std::condition_variable changed_;
+
+    std::map<size_t, std::shared_ptr<const HDFFrameRange::Block>> cache_;
+    std::list<size_t> recent_;
+    std::set<size_t> loading_;
+    std::deque<size_t> queue_;
+    bool stopping_ = false;
+
+    std::thread thread_;
+
+    std::shared_ptr<const HDFFrameRange::Block>
+        load(size_t firstFrame, size_t numFrames);
+
+    std::shared_ptr<const HDFFrameRange::Block> block(size_t index);
+
+    void store(size_t index,
+               std::shared_ptr<const HDFFrameRange::Block> block);
+
+    void run();
+
+};
+
+
+
+#endif
+
@@ -1,54 +1,81 @@
 // Copyright (C) 2013 Timothy Gale
 #include "hdfwriter.h"
+#include "backgroundWriter.h"
 
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
 
-HDFWriter::HDFWriter(std::string filename, size_t descriptorLength)
+
+// Registered ids of the filter plugins, and Blosc's code for LZ4
+static const H5Z_filter_t bloscFilter = 32001, lz4Filter = 32004,
+                          bitshuffleFilter = 32008;
+static const unsigned int bloscLZ4 = 1;
+
+
+static std::vector<H5Z_filter_t> filtersNeeded(const HDFWriterSettings&
+                                                    settings)
 {
-    file = H5::H5File(H5std_string(filename.c_str()), H5F_ACC_TRUNC);
+    std::vector<H5Z_filter_t> filters;
 
-    // Create the frames dataset (pairs of starting index, number of
-    // keypoints/descriptors)
-    H5::DSetCreatPropList framesCparms;
-    hsize_t chunkDims[] = {1024, 2};
-    framesCparms.setChunk(2, chunkDims);
+    // Blosc does its own shuffling
+    if (settings.compression == HDFCompression::Blosc)
+        return {bloscFilter};
 
-    const hsize_t framesDims[] = {0, 2};
-    const hsize_t framesMaxDims[] = {H5S_UNLIMITED, 2};
-    H5::DataSpace framesDataspace(2, framesDims, framesMaxDims);
+    if (settings.shuffle == HDFShuffle::Byte)
+        filters.push_back(H5Z_FILTER_SHUFFLE);
+    else if (settings.shuffle == HDFShuffle::Bit)
+        filters.push_back(bitshuffleFilter);
 
-    frames = file.createDataSet(H5std_string("frames"), 
-                                H5::PredType::STD_U64LE,
-                                framesDataspace,
-                                framesCparms);
+    if (settings.compression == HDFCompression::Deflate)
+        filters.push_back(H5Z_FILTER_DEFLATE);
+    else if (settings.compression == HDFCompression::LZ4)
+        filters.push_back(lz4Filter);
 
-    // Create the keypoints dataset (x, y, scale, weight)
-    H5::DSetCreatPropList keypointsCparms;
-    chunkDims[1] = 4;
-    keypointsCparms.setChunk(2, chunkDims);
+    return filters;
+}
 
-    const hsize_t keypointsDims[] = {0, 4};
-    const hsize_t keypointsMaxDims[] = {H5S_UNLIMITED, 4};
-    H5::DataSpace keypointsDataspace(2, keypointsDims, keypointsMaxDims);
 
-    keypoints = file.createDataSet(H5std_string("keypoints"), 
-                                   H5::PredType::NATIVE_FLOAT,
-                                   keypointsDataspace,
-                                   keypointsCparms);
+void setHDFFilters(H5::DSetCreatPropList& parms,
+                   const HDFWriterSettings& settings)
+{
+    // In the order filtersNeeded gives
+    const unsigned int level = std::max(0, 
+                                        std::min(9, 
+                                                 settings.compressionLevel));
 
-    // Create the descriptors dataset (descriptorLength elements)
-    H5::DSetCreatPropList descriptorsCparms;
-    chunkDims[1] = descriptorLength;
-    descriptorsCparms.setChunk(2, chunkDims);
+    for (H5Z_filter_t filter: filtersNeeded(settings))
+        switch (filter) {
 
-    const hsize_t descriptorsDims[] = {0, descriptorLength};
-    const hsize_t descriptorsMaxDims[] = {H5S_UNLIMITED, descriptorLength};
-    H5::DataSpace descriptorsDataspace(2, descriptorsDims, descriptorsMaxDims);
+            case H5Z_FILTER_SHUFFLE:
+                parms.setShuffle();
+                break;
 
-    descriptors = file.createDataSet(H5std_string("descriptors"), 
-                                   H5::PredType::NATIVE_FLOAT,
-                                   descriptorsDataspace,
-                                   descriptorsCparms);
-                                
+            case H5Z_FILTER_DEFLATE:
+                parms.setDeflate(level);
+                break;
+
+            case bloscFilter: {
+                // The first four are filled in by the filter.  Blosc's
+                // shuffle codes are HDFShuffle's.
+                const unsigned int values[] = {
+                    0, 0, 0, 0, level, 
+                    unsigned(settings.shuffle), bloscLZ4
+                };
+                parms.setFilter(filter, H5Z_FLAG_MANDATORY, 7, values);
+                break;
+            }
+
+            default: {
+                // LZ4 and bitshuffle with their default block sizes
+                const unsigned int values[] = {0, 0, 0, 0};
+                parms.setFilter(filter, H5Z_FLAG_MANDATORY,
+                                (filter == lz4Filter)? 1 : 4, values);
+                break;
+            }
+        }
 }
 
 
@@ -82,10 +109,223 @@ void appendRows(H5::DataSet dataset, size_t numRows,
 }
 
 
+
+class HDFWriter::Background {
+    // Collects appended frames into batches, and writes them out (each
+    // table extended once per batch) from a thread of its own
+
+public:
+
+    Background(H5::DataSet frames, H5::DataSet keypoints,
+               H5::DataSet descriptors,
+               size_t keypointLength, size_t descriptorLength,
+               const HDFWriterSettings& settings);
+
+    ~Background();
+
+    void append(size_t numKeypoints, const float* keypointsData,
+                const float* descriptorsData);
+
+    void flush();
+
+private:
+
+    struct Batch {
+        // Pairs of (first keypoint, number of keypoints) for each frame
+        std::vector<hsize_t> frames;
+        std::vector<float> keypoints, descriptors;
+    };
+
+    H5::DataSet frames_, keypoints_, descriptors_;
+    size_t keypointLength_, descriptorLength_;
+    HDFWriterSettings settings_;
+
+    std::mutex mutex_;
+
+    // Being collected
+    Batch batch_;
+
+    // Keypoints in the file plus those waiting to be written
+    hsize_t numKeypoints_ = 0;
+
+    BackgroundWriter writer_;
+
+    std::function<void ()> takeBatch();
+    void write(const Batch& batch);
+
+};
+
+
+HDFWriter::Background::Background(H5::DataSet frames, H5::DataSet keypoints,
+                                  H5::DataSet descriptors,
+                                  size_t keypointLength,
+                                  size_t descriptorLength,
+                                  const HDFWriterSettings& settings)
+ : frames_(frames), keypoints_(keypoints), descriptors_(descriptors),
+   keypointLength_(keypointLength), descriptorLength_(descriptorLength),
+   settings_(settings),
+   writer_("HDFWriter", settings.maxPendingBatches + 1)
+   // The batches waiting, and one being written
+{
+}
+
+
+HDFWriter::Background::~Background()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.finish(batch_.frames.empty()? nullptr : takeBatch());
+}
+
+
+std::function<void ()> HDFWriter::Background::takeBatch()
+{
+    // With mutex_ held: the batch being collected, to write, leaving an
+    // empty one to collect into
+    auto batch = std::make_shared<Batch>(std::move(batch_));
+    batch_ = Batch();
+
+    return [this, batch] { write(*batch); };
+}
+
+
+void HDFWriter::Background::append(size_t numKeypoints, 
+                                   const float* keypointsData,
+                                   const float* descriptorsData)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.check();
+
+    batch_.frames.insert(batch_.frames.end(), {numKeypoints_, numKeypoints});
+    batch_.keypoints.insert(batch_.keypoints.end(), keypointsData,
+                            keypointsData + numKeypoints * keypointLength_);
+    batch_.descriptors.insert(batch_.descriptors.end(), descriptorsData,
+                              descriptorsData
+                                + numKeypoints * descriptorLength_);
+    numKeypoints_ += numKeypoints;
+
+    const size_t numBytes = (batch_.keypoints.size() 
+                              + batch_.descriptors.size()) * sizeof(float);
+
+    if (batch_.frames.size() / 2 >= settings_.flushFrames
+            || numBytes >= settings_.flushBytes)
+        writer_.submit(takeBatch());
+}
+
+
+void HDFWriter::Background::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!batch_.frames.empty())
+        writer_.submit(takeBatch());
+
+    writer_.flush();
+}
+
+
+void HDFWriter::Background::write(const Batch& batch)
+{
+    // On the writer's thread
+    const size_t numKeypoints = batch.keypoints.size() / keypointLength_;
+
+    appendRows(frames_, batch.frames.size() / 2, &batch.frames[0],
+               H5::PredType::NATIVE_HSIZE);
+
+    if (numKeypoints > 0) {
+        appendRows(keypoints_, numKeypoints, &batch.keypoints[0],
+                   H5::PredType::NATIVE_FLOAT);
+        appendRows(descriptors_, numKeypoints, &batch.descriptors[0],
+                   H5::PredType::NATIVE_FLOAT);
+    }
+}
+
+
+
+HDFWriter::HDFWriter(std::string filename, size_t descriptorLength,
+                     size_t keypointLength,
+                     const HDFWriterSettings& settings)
+{
+    if (!filtersAvailable(settings))
+        throw std::runtime_error("HDFWriter: compression filters not "
+                                 "available");
+
+    file = H5::H5File(H5std_string(filename.c_str()), H5F_ACC_TRUNC);
+
+    // Chunk cache for each table
+    H5::DSetAccPropList accessParms;
+    if (settings.chunkCacheBytes > 0) {
+        // Slots should be a prime, about a hundred times the chunks held
+        const size_t numSlots = 10007;
+        accessParms.setChunkCache(numSlots, settings.chunkCacheBytes, 0.75);
+    }
+
+    // Create the frames dataset (pairs of starting index, number of
+    // keypoints/descriptors)
+    H5::DSetCreatPropList framesCparms;
+    hsize_t chunkDims[] = {settings.chunkRows, 2};
+    framesCparms.setChunk(2, chunkDims);
+    setHDFFilters(framesCparms, settings);
+
+    const hsize_t framesDims[] = {0, 2};
+    const hsize_t framesMaxDims[] = {H5S_UNLIMITED, 2};
+    H5::DataSpace framesDataspace(2, framesDims, framesMaxDims);
+
+    frames = file.createDataSet(H5std_string("frames"), 
+                                H5::PredType::STD_U64LE,
+                                framesDataspace,
+                                framesCparms,
+                                accessParms);
+
+    // Create the keypoints dataset (x, y, scale, weight, ...)
+    H5::DSetCreatPropList keypointsCparms;
+    chunkDims[1] = keypointLength;
+    keypointsCparms.setChunk(2, chunkDims);
+    setHDFFilters(keypointsCparms, settings);
+
+    const hsize_t keypointsDims[] = {0, keypointLength};
+    const hsize_t keypointsMaxDims[] = {H5S_UNLIMITED, keypointLength};
+    H5::DataSpace keypointsDataspace(2, keypointsDims, keypointsMaxDims);
+
+    keypoints = file.createDataSet(H5std_string("keypoints"), 
+                                   H5::PredType::NATIVE_FLOAT,
+                                   keypointsDataspace,
+                                   keypointsCparms,
+                                   accessParms);
+
+    // Create the descriptors dataset (descriptorLength elements)
+    H5::DSetCreatPropList descriptorsCparms;
+    chunkDims[1] = descriptorLength;
+    descriptorsCparms.setChunk(2, chunkDims);
+    setHDFFilters(descriptorsCparms, settings);
+
+    const hsize_t descriptorsDims[] = {0, descriptorLength};
+    const hsize_t descriptorsMaxDims[] = {H5S_UNLIMITED, descriptorLength};
+    H5::DataSpace descriptorsDataspace(2, descriptorsDims, descriptorsMaxDims);
+
+    descriptors = file.createDataSet(H5std_string("descriptors"), 
+                                   H5::PredType::NATIVE_FLOAT,
+                                   descriptorsDataspace,
+                                   descriptorsCparms,
+                                   accessParms);
+
+    if (settings.flushFrames > 0)
+        background_ = std::make_shared<Background>(frames, keypoints,
+                                                   descriptors,
+                                                   keypointLength,
+                                                   descriptorLength,
+                                                   settings);
+}
+
+
 void HDFWriter::append(size_t numKeypoints,
                        const float *keypointsData,
                        const float *descriptorsData) 
 {
+    if (background_) {
+        background_->append(numKeypoints, keypointsData, descriptorsData);
+        return;
+    }
+
     // Work out where the first keypoint will be
     hsize_t keypointDims[2];
     H5::DataSpace ds = keypoints.getSpace();
@@ -104,4 +344,22 @@ void HDFWriter::append(size_t numKeypoints,
 }
 
 
+bool HDFWriter::filtersAvailable(const HDFWriterSettings& settings)
+{
+    for (H5Z_filter_t filter: filtersNeeded(settings))
+        if (H5Zfilter_avail(filter) <= 0)
+            return false;
+
+    return true;
+}
+
+
+void HDFWriter::flush()
+{
+    if (background_)
+        background_->flush();
+    else if (file.getId() > 0)
+        file.flush(H5F_SCOPE_LOCAL);
+}
+
 
@@ -4,6 +4,60 @@
 
 
 #include <H5Cpp.h>
+#include <memory>
+#include <string>
+
+
+enum class HDFShuffle {
+    // Rearranging each chunk so the compressor sees like bytes (or bits)
+    // of the values together
+    None, Byte, Bit
+};
+
+
+enum class HDFCompression {
+    // Compression of each chunk.  LZ4 and Blosc need their filter plugins
+    // (see HDF5_PLUGIN_PATH), as does Bit shuffling without Blosc.
+    None, Deflate, LZ4, Blosc
+};
+
+
+struct HDFWriterSettings {
+    // How HDFWriter lays out and writes its tables
+
+    size_t flushFrames = 0;
+    // Frames to collect in memory before writing them out together, from
+    // a background thread.  Zero writes each frame as it is appended, on
+    // the caller's thread.  Unless HDF5 was built thread-safe, nothing
+    // else should use it while a buffering writer is open.
+
+    size_t flushBytes = 16 << 20;
+    // With buffering, write out sooner if the frames collected reach this
+
+    size_t maxPendingBatches = 2;
+    // With buffering, how many collected batches can wait for the writer
+    // before append blocks (so memory stays bounded if the disk is slow)
+
+    hsize_t chunkRows = 1024;
+    // Rows per chunk in each table
+
+    size_t chunkCacheBytes = 0;
+    // Size of each table's chunk cache; zero leaves HDF5's default
+
+    HDFShuffle shuffle = HDFShuffle::None;
+    HDFCompression compression = HDFCompression::None;
+
+    int compressionLevel = 4;
+    // From 0 (quickest) to 9 (smallest), for Deflate and Blosc
+};
+
+
+void setHDFFilters(H5::DSetCreatPropList& parms,
+                   const HDFWriterSettings& settings);
+// Add the shuffle and compression filters of settings to a table's
+// creation properties (for others writing HDF files)
+
+
 
 class HDFWriter {
     // Class to create and write to an HDF file
@@ -13,26 +67,44 @@ class HDFWriter {
     //      One row per frame, listing the starting keypoint (for the other two
     //      tables) and the number of keypoints.
     //   keypoints
-    //      One row per keypoint.  x, y, scale, keypoint strength.
+    //      One row per keypoint.  x, y, scale, keypoint strength, and any
+    //      more the keypoint locations have (e.g. orientation).
     //   descriptors
     //      One row per descriptor (lines up with the appropriate keypoint).
     //
+    // Copies share the same file (and writer thread, if any), which is
+    // flushed and closed when the last goes.
 
     H5::H5File file;
 
     H5::DataSet frames, keypoints, descriptors;
 
+    // Collects frames and writes them from its own thread, if buffering
+    class Background;
+    std::shared_ptr<Background> background_;
 
 public:
 
     HDFWriter() = default;
     HDFWriter(const HDFWriter&) = default;
 
-    HDFWriter(std::string filename, size_t descriptorLength);
+    HDFWriter(std::string filename, size_t descriptorLength,
+              size_t keypointLength = 4,
+              const HDFWriterSettings& settings = HDFWriterSettings());
+    //   Throws std::runtime_error if the filters asked for aren't
+    //   available
+
+    static bool filtersAvailable(const HDFWriterSettings& settings);
 
     void append(size_t numKeypoints, const float* keypoints,
                 const float* descriptors);
-    //   Appends adds an extra frame with associated keypoints
+    //   Appends adds an extra frame with associated keypoints.  With
+    //   buffering, the data is copied, so can be reused straight away.
+    //   Errors from the writer thread are rethrown by the next append or
+    //   flush.
+
+    void flush();
+    //   Wait until everything appended so far is in the file
 
 };
 
@@ -0,0 +1,447 @@
+// Copyright (C) 2013 Timothy Gale
+#include "subbandDump.h"
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+
+static const int numSubbands = 6;
+
+
+static H5::FloatType halfType()
+{
+    // IEEE 754 half precision, which HDF5 converts floats to and from
+    H5::FloatType type(H5::PredType::IEEE_F32LE);
+    type.setFields(15, 10, 5, 0, 10);
+    type.setSize(2);
+    type.setEbias(15);
+
+    return type;
+}
+
+
+static std::string levelName(const std::string& table, size_t level)
+{
+    return table + std::to_string(level);
+}
+
+
+static HDFWriterSettings filterSettings(const SubbandDumpSettings& settings)
+{
+    HDFWriterSettings filters;
+    filters.shuffle = settings.shuffle;
+    filters.compression = settings.compression;
+    filters.compressionLevel = settings.compressionLevel;
+
+    return filters;
+}
+
+
+
+// Writing
+
+SubbandDumpWriter::SubbandDumpWriter(cl::Context& context,
+                                     const std::string& filename,
+                                     const SubbandDumpSettings& settings)
+ : context_(context),
+   mapQueue_(context, context.getInfo<CL_CONTEXT_DEVICES>()[0]),
+   settings_(settings),
+   writer_("SubbandDumpWriter", settings.maxPendingFrames)
+{
+    if (!HDFWriter::filtersAvailable(filterSettings(settings)))
+        throw std::runtime_error("SubbandDumpWriter: compression filters "
+                                 "not available");
+
+    settings_.maxPendingFrames = std::max<size_t>(1,
+                                                  settings.maxPendingFrames);
+
+    file_ = H5::H5File(H5std_string(filename.c_str()), H5F_ACC_TRUNC);
+
+    const int format = int(settings.format);
+    file_.createAttribute("format", H5::PredType::NATIVE_INT,
+                          H5::DataSpace(H5S_SCALAR))
+         .write(H5::PredType::NATIVE_INT, &format);
+}
+
+
+SubbandDumpWriter::~SubbandDumpWriter()
+{
+    writer_.finish();
+
+    // Done with the pinned memory
+    for (Slot& slot: slots_)
+        for (size_t l = 0; l < slot.buffers.size(); ++l)
+            mapQueue_.enqueueUnmapMemObject(slot.buffers[l],
+                                            slot.values[l]);
+    mapQueue_.finish();
+}
+
+
+void SubbandDumpWriter::create(const DtcwtOutput& subbands)
+{
+    // Tables and pinned memory for the levels, from the first frame
+
+    const int startLevel = subbands.startLevel();
+    file_.createAttribute("startLevel", H5::PredType::NATIVE_INT,
+                          H5::DataSpace(H5S_SCALAR))
+         .write(H5::PredType::NATIVE_INT, &startLevel);
+
+    const HDFWriterSettings filters = filterSettings(settings_);
+
+    H5::DataType type = H5::PredType::NATIVE_FLOAT;
+    if (settings_.format == SubbandFormat::Half)
+        type = halfType();
+    else if (settings_.format == SubbandFormat::Char)
+        type = H5::PredType::STD_I8LE;
+
+    for (size_t n = 0; n < subbands.numLevels(); ++n) {
+
+        const Subbands& sb = subbands[n];
+
+        // Everything from the first value of the first subband to the
+        // last of the last
+        LevelLayout layout = {
+            sb.width(), sb.height(), sb.stride(), sb.step(), sb.pitch()
+        };
+        layout.numElements = layout.pitch * (numSubbands - 1)
+                           + layout.stride * (layout.height - 1)
+                           + layout.step * (layout.width - 1) + 1;
+        layouts_.push_back(layout);
+
+        const hsize_t dims[] = {0, numSubbands, sb.height(), sb.width(), 2};
+        const hsize_t maxDims[] = {H5S_UNLIMITED, numSubbands,
+                                   sb.height(), sb.width(), 2};
+        const hsize_t chunkDims[] = {1, 1, sb.height(), sb.width(), 2};
+
+        H5::DSetCreatPropList parms;
+        parms.setChunk(5, chunkDims);
+        setHDFFilters(parms, filters);
+
+        levels_.push_back(file_.createDataSet(levelName("level", n), type,
+                                              H5::DataSpace(5, dims,
+                                                            maxDims),
+                                              parms));
+
+        if (settings_.format == SubbandFormat::Char) {
+            const hsize_t scalesDims[] = {0, numSubbands};
+            const hsize_t scalesMaxDims[] = {H5S_UNLIMITED, numSubbands};
+            const hsize_t scalesChunkDims[] = {1024, numSubbands};
+
+            H5::DSetCreatPropList scalesParms;
+            scalesParms.setChunk(2, scalesChunkDims);
+
+            scales_.push_back(file_.createDataSet(
+                                levelName("scales", n),
+                                H5::PredType::NATIVE_FLOAT,
+                                H5::DataSpace(2, scalesDims, scalesMaxDims),
+                                scalesParms));
+        }
+    }
+
+    // Pinned memory to read back into, mapped once and for all
+    const cl_mem_flags pinnedFlags = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    const cl_map_flags mapFlags = CL_MAP_READ | CL_MAP_WRITE;
+
+    slots_.resize(settings_.maxPendingFrames);
+
+    for (size_t s = 0; s < slots_.size(); ++s) {
+        for (const LevelLayout& layout: layouts_) {
+            const size_t numBytes = layout.numElements
+                                  * sizeof(Complex<cl_float>);
+
+            cl::Buffer buffer(context_, pinnedFlags, numBytes);
+            slots_[s].buffers.push_back(buffer);
+            slots_[s].values.push_back(static_cast<Complex<cl_float>*>(
+                mapQueue_.enqueueMapBuffer(buffer, CL_TRUE, mapFlags,
+                                           0, numBytes)));
+        }
+    }
+}
+
+
+void SubbandDumpWriter::operator() (cl::CommandQueue& cq,
+                                    const DtcwtOutput& subbands,
+                                    const std::vector<cl::Event>& waitEvents,
+                                    cl::Event* doneEvent)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.check();
+
+    // Nothing is being written before the first frame, so the tables can
+    // be made here
+    if (layouts_.empty())
+        create(subbands);
+
+    if (subbands.numLevels() != layouts_.size())
+        throw std::logic_error("SubbandDumpWriter: frames have different "
+                               "numbers of levels");
+
+    for (size_t n = 0; n < layouts_.size(); ++n)
+        if (subbands[n].width() != layouts_[n].width
+                || subbands[n].height() != layouts_[n].height
+                || subbands[n].stride() != layouts_[n].stride
+                || subbands[n].step() != layouts_[n].step
+                || subbands[n].pitch() != layouts_[n].pitch)
+            throw std::logic_error("SubbandDumpWriter: frames have "
+                                   "different layouts");
+
+    // Wait for somewhere to read back into
+    writer_.waitForRoom();
+
+    const size_t index = nextSlot_;
+    nextSlot_ = (nextSlot_ + 1) % slots_.size();
+
+    Slot& slot = slots_[index];
+    slot.readDone.resize(layouts_.size());
+
+    for (size_t n = 0; n < layouts_.size(); ++n)
+        cq.enqueueReadBuffer(subbands[n].buffer(), CL_FALSE,
+                             subbands[n].start() * sizeof(Complex<cl_float>),
+                             layouts_[n].numElements
+                                * sizeof(Complex<cl_float>),
+                             slot.values[n], &waitEvents,
+                             &slot.readDone[n]);
+
+    // The queue is in order, so the last read is the last to finish
+    if (doneEvent != nullptr)
+        *doneEvent = slot.readDone.back();
+
+    writer_.submit([this, index] { write(slots_[index]); });
+}
+
+
+void SubbandDumpWriter::write(Slot& slot)
+{
+    // On the writer's thread: write out a frame once it is read back
+    cl::Event::waitForEvents(slot.readDone);
+
+    const hsize_t frame = numFrames_;
+
+    for (size_t n = 0; n < layouts_.size(); ++n) {
+
+        const LevelLayout& layout = layouts_[n];
+        const size_t numValues = layout.width * layout.height;
+
+        // Without the padding
+        std::vector<float> values;
+        values.reserve(numSubbands * numValues * 2);
+
+        for (int s = 0; s < numSubbands; ++s)
+            for (size_t y = 0; y < layout.height; ++y)
+                for (size_t x = 0; x < layout.width; ++x) {
+                    const Complex<cl_float>& v
+                        = slot.values[n][s * layout.pitch + y * layout.stride
+                                         + x * layout.step];
+                    values.push_back(v.real);
+                    values.push_back(v.imag);
+                }
+
+        H5::DataSet& dataset = levels_[n];
+
+        const hsize_t newDims[] = {frame + 1, numSubbands,
+                                   layout.height, layout.width, 2};
+        dataset.extend(newDims);
+
+        H5::DataSpace fileSpace = dataset.getSpace();
+        const hsize_t offset[] = {frame, 0, 0, 0, 0};
+        const hsize_t count[] = {1, numSubbands,
+                                 layout.height, layout.width, 2};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+        H5::DataSpace memSpace(5, count);
+
+        if (settings_.format != SubbandFormat::Char) {
+            // HDF5 converts to half itself
+            dataset.write(&values[0], H5::PredType::NATIVE_FLOAT,
+                          memSpace, fileSpace);
+            continue;
+        }
+
+        // Scale each subband to fill the range of a char
+        std::vector<float> scales(numSubbands);
+        std::vector<signed char> quantised(values.size());
+
+        for (int s = 0; s < numSubbands; ++s) {
+            const auto begin = values.begin() + s * numValues * 2,
+                       end = begin + numValues * 2;
+
+            float biggest = 0.f;
+            for (auto v = begin; v != end; ++v)
+                biggest = std::max(biggest, std::abs(*v));
+
+            scales[s] = (biggest > 0.f)? biggest / 127.f : 1.f;
+
+            for (auto v = begin; v != end; ++v)
+                quantised[v - values.begin()]
+                    = static_cast<signed char>(std::round(*v / scales[s]));
+        }
+
+        dataset.write(&quantised[0], H5::PredType::NATIVE_SCHAR,
+                      memSpace, fileSpace);
+
+        H5::DataSet& scalesSet = scales_[n];
+        const hsize_t newScalesDims[] = {frame + 1, numSubbands};
+        scalesSet.extend(newScalesDims);
+
+        H5::DataSpace scalesSpace = scalesSet.getSpace();
+        const hsize_t scalesOffset[] = {frame, 0},
+                      scalesCount[] = {1, numSubbands};
+        scalesSpace.selectHyperslab(H5S_SELECT_SET, scalesCount,
+                                    scalesOffset);
+        scalesSet.write(&scales[0], H5::PredType::NATIVE_FLOAT,
+                        H5::DataSpace(2, scalesCount), scalesSpace);
+    }
+
+    ++numFrames_;
+}
+
+
+void SubbandDumpWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    writer_.flush();
+    file_.flush(H5F_SCOPE_LOCAL);
+}
+
+
+
+// Reading
+
+SubbandDumpReader::SubbandDumpReader(const std::string& filename)
+ : file_(H5std_string(filename.c_str()), H5F_ACC_RDONLY)
+{
+    int format;
+    file_.openAttribute("format").read(H5::PredType::NATIVE_INT, &format);
+    format_ = SubbandFormat(format);
+
+    // Only there once a frame has been written
+    if (H5Aexists(file_.getId(), "startLevel") > 0) {
+        int startLevel;
+        file_.openAttribute("startLevel").read(H5::PredType::NATIVE_INT,
+                                               &startLevel);
+        startLevel_ = startLevel;
+    }
+
+    for (size_t n = 0;
+            H5Lexists(file_.getId(), levelName("level", n).c_str(),
+                      H5P_DEFAULT) > 0;
+            ++n) {
+
+        levels_.push_back(file_.openDataSet(levelName("level", n)));
+
+        hsize_t dims[5];
+        levels_.back().getSpace().getSimpleExtentDims(dims);
+        numFrames_ = dims[0];
+        heights_.push_back(dims[2]);
+        widths_.push_back(dims[3]);
+
+        if (format_ == SubbandFormat::Char)
+            scales_.push_back(file_.openDataSet(levelName("scales", n)));
+    }
+}
+
+
+size_t SubbandDumpReader::numFrames() const
+{
+    return numFrames_;
+}
+
+
+size_t SubbandDumpReader::numLevels() const
+{
+    return levels_.size();
+}
+
+
+size_t SubbandDumpReader::startLevel() const
+{
+    return startLevel_;
+}
+
+
+size_t SubbandDumpReader::width(size_t level) const
+{
+    return widths_[level];
+}
+
+
+size_t SubbandDumpReader::height(size_t level) const
+{
+    return heights_[level];
+}
+
+
+SubbandFormat SubbandDumpReader::format() const
+{
+    return format_;
+}
+
+
+void SubbandDumpReader::read(size_t frame, size_t level,
+                             Complex<cl_float>* output)
+{
+    if (frame >= numFrames_ || level >= levels_.size())
+        throw std::out_of_range("SubbandDumpReader: no such frame or level");
+
+    H5::DataSet& dataset = levels_[level];
+
+    H5::DataSpace fileSpace = dataset.getSpace();
+    const hsize_t offset[] = {frame, 0, 0, 0, 0};
+    const hsize_t count[] = {1, numSubbands,
+                             heights_[level], widths_[level], 2};
+    fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+    H5::DataSpace memSpace(5, count);
+
+    const size_t numValues = heights_[level] * widths_[level] * 2;
+    std::vector<float> values(numSubbands * numValues);
+
+    if (format_ != SubbandFormat::Char) {
+        dataset.read(&values[0], H5::PredType::NATIVE_FLOAT,
+                     memSpace, fileSpace);
+
+        for (size_t i = 0; i < values.size() / 2; ++i)
+            output[i] = {values[2*i], values[2*i+1]};
+        return;
+    }
+
+    std::vector<signed char> quantised(values.size());
+    dataset.read(&quantised[0], H5::PredType::NATIVE_SCHAR,
+                 memSpace, fileSpace);
+
+    float scales[numSubbands];
+    H5::DataSpace scalesSpace = scales_[level].getSpace();
+    const hsize_t scalesOffset[] = {frame, 0},
+                  scalesCount[] = {1, numSubbands};
+    scalesSpace.selectHyperslab(H5S_SELECT_SET, scalesCount, scalesOffset);
+    scales_[level].read(scales, H5::PredType::NATIVE_FLOAT,
+                        H5::DataSpace(2, scalesCount), scalesSpace);
+
+    for (size_t i = 0; i < values.size() / 2; ++i) {
+        const float scale = scales[2 * i / numValues];
+        output[i] = {quantised[2*i] * scale, quantised[2*i+1] * scale};
+    }
+}
+
+
+void SubbandDumpReader::read(cl::CommandQueue& cq, size_t frame,
+                             DtcwtOutput& subbands)
+{
+    if (subbands.numLevels() != levels_.size())
+        throw std::logic_error("SubbandDumpReader: output has the wrong "
+                               "number of levels");
+
+    std::vector<Complex<cl_float>> values;
+
+    for (size_t n = 0; n < levels_.size(); ++n) {
+        if (subbands[n].width() != widths_[n]
+                || subbands[n].height() != heights_[n])
+            throw std::logic_error("SubbandDumpReader: output is the wrong "
+                                   "size");
+
+        values.resize(numSubbands * widths_[n] * heights_[n]);
+        read(frame, n, &values[0]);
+        subbands[n].write(cq, &values[0]);
+    }
+}
+
@@ -0,0 +1,159 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef SUBBAND_DUMP_H
+#define SUBBAND_DUMP_H
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#include "CL/cl.hpp"
+
+#include <H5Cpp.h>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "DTCWT/dtcwt.h"
+#include "hdf5/hdfwriter.h"
+#include "hdf5/backgroundWriter.h"
+
+// Saving DTCWT outputs frame by frame, so experiments can reuse them
+// rather than transform again.  The HDF file has, for each level n of the
+// output (0 being the first saved):
+//
+//   level<n>
+//      frames x 6 x height x width x 2 (real, imaginary), chunked a subband
+//      of a frame at a time, as floats, halfs or chars
+//   scales<n>
+//      frames x 6, for chars only: what to multiply each subband's values
+//      by to recover them
+//
+// with attributes format (0, 1, 2 for Float, Half, Char) and startLevel
+// (the level of the tree level0 is) on the file.
+
+
+enum class SubbandFormat {
+    // How subband values are stored.  Char scales each subband of each
+    // frame by its own factor, so its largest component is 127.
+    Float, Half, Char
+};
+
+
+struct SubbandDumpSettings {
+
+    SubbandFormat format = SubbandFormat::Float;
+
+    HDFShuffle shuffle = HDFShuffle::None;
+    HDFCompression compression = HDFCompression::None;
+    int compressionLevel = 4;
+    // Filters, as for HDFWriterSettings
+
+    size_t maxPendingFrames = 2;
+    // Frames that can be reading back or waiting to be written at once,
+    // each with its own pinned buffers, before saving blocks
+};
+
+
+class SubbandDumpWriter {
+    // Reads DTCWT outputs back into pinned memory, and writes them from a
+    // thread of its own
+
+public:
+
+    SubbandDumpWriter(cl::Context& context, const std::string& filename,
+                      const SubbandDumpSettings& settings
+                        = SubbandDumpSettings());
+    // Throws std::runtime_error if the filters aren't available
+
+    ~SubbandDumpWriter();
+    // Waits for everything to be written
+
+    SubbandDumpWriter(const SubbandDumpWriter&) = delete;
+    SubbandDumpWriter& operator = (const SubbandDumpWriter&) = delete;
+
+    void operator() (cl::CommandQueue& cq, const DtcwtOutput& subbands,
+                     const std::vector<cl::Event>& waitEvents
+                        = std::vector<cl::Event>(),
+                     cl::Event* doneEvent = nullptr);
+    // Save another frame.  The readback starts after waitEvents, and
+    // doneEvent is when it finishes, after which the subbands can be
+    // overwritten.  All frames must have the same levels and sizes.
+    // Errors from the writer thread are rethrown by the next call or
+    // flush.
+
+    void flush();
+    // Wait until all the frames so far are in the file
+
+private:
+
+    struct Slot {
+        // Pinned memory for a frame's levels, mapped for good
+        std::vector<cl::Buffer> buffers;
+        std::vector<Complex<cl_float>*> values;
+        std::vector<cl::Event> readDone;
+    };
+
+    struct LevelLayout {
+        size_t width, height, stride, step, pitch;
+        size_t numElements;         // Read back, from the first value
+    };
+
+    cl::Context context_;
+    cl::CommandQueue mapQueue_;
+    SubbandDumpSettings settings_;
+
+    H5::H5File file_;
+    std::vector<H5::DataSet> levels_, scales_;
+    std::vector<LevelLayout> layouts_;
+    hsize_t numFrames_ = 0;
+
+    std::mutex mutex_;
+
+    // Used in turn: the writer finishes with frames in order, so when it
+    // has room, the next slot's last frame has been written
+    std::vector<Slot> slots_;
+    size_t nextSlot_ = 0;
+
+    BackgroundWriter writer_;
+
+    void create(const DtcwtOutput& subbands);
+    void write(Slot& slot);
+
+};
+
+
+class SubbandDumpReader {
+    // Reads back what SubbandDumpWriter saved
+
+public:
+
+    SubbandDumpReader(const std::string& filename);
+
+    size_t numFrames() const;
+    size_t numLevels() const;
+    size_t startLevel() const;
+    size_t width(size_t level) const;
+    size_t height(size_t level) const;
+    SubbandFormat format() const;
+
+    void read(size_t frame, size_t level, Complex<cl_float>* output);
+    // The values of a level of a frame, subband by subband, row by row,
+    // as Subbands::write takes them
+
+    void read(cl::CommandQueue& cq, size_t frame, DtcwtOutput& subbands);
+    // Upload a whole frame into a DTCWT output of the same sizes (e.g.
+    // from DtcwtTemps::createOutputs)
+
+private:
+
+    H5::H5File file_;
+    std::vector<H5::DataSet> levels_, scales_;
+    std::vector<hsize_t> widths_, heights_;
+    hsize_t numFrames_ = 0;
+    size_t startLevel_ = 0;
+    SubbandFormat format_ = SubbandFormat::Float;
+
+};
+
+
+#endif
+
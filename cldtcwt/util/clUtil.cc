@@ -11,6 +11,17 @@ int roundWGs(int l, int lWG)
 
 
 
+std::string positionIndexDefine(bool soaLayout)
+{
+    if (soaLayout)
+        return "#define SOA_LAYOUT\n"
+               "#define POS_IDX(i, c, n, len) ((c) * (n) + (i))\n";
+    else
+        return "#define POS_IDX(i, c, n, len) ((i) * (len) + (c))\n";
+}
+
+
+
 cl::Buffer createBuffer(cl::Context& context,
                         cl::CommandQueue& commandQueue, 
                         const std::vector<float>& data)
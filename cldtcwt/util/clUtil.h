@@ -10,6 +10,7 @@
 
 #include <vector>
 #include <array>
+#include <string>
 
 #include <stdexcept>
 
@@ -31,6 +32,12 @@ cl::size_t<numDims> makeCLSizeT(std::array<size_t, numDims> input)
 
 int roundWGs(int l, int lWG);
 
+std::string positionIndexDefine(bool soaLayout);
+// OpenCL source defining POS_IDX(i, c, n, len), the index of component c
+// of item i in a list of records len floats long with room for n items.
+// Records are either interleaved (x, y, ...) or, with soaLayout, each
+// component has its own array of n floats and SOA_LAYOUT is also defined.
+
 cl::Buffer createBuffer(cl::Context&, cl::CommandQueue&,
                         const std::vector<float>& data);
 
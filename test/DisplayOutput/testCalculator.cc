@@ -0,0 +1,131 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include "DisplayOutput/calculator.h"
+
+// Check that the keypoints read back by the Calculator are the ones left on
+// the device once everything is done, including the orientations, which
+// the descriptor extraction writes after the peak detector has finished.
+
+
+int main()
+{
+    const size_t width = 320, height = 240;
+    const int numFrames = 8;
+    const int orientationIdx = 4;
+    const float pi = 4 * std::atan(1.f);
+
+    size_t totalKeypoints = 0, numOriented = 0;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        Calculator calculator(context.context, context.devices[0],
+                              width, height);
+
+        const size_t numFloatsPerLocation
+                        = calculator.numFloatsPerKPLocation(),
+                     numFloatsPerDescriptor
+                        = calculator.numFloatsPerDescriptor();
+
+        ImageBuffer<cl_float> image {
+            context.context, CL_MEM_READ_WRITE,
+            width, height, 16, 32
+        };
+
+        for (int f = 0; f < numFrames; ++f) {
+
+            std::vector<cl_float> input(width * height);
+            for (auto& v: input)
+                v = std::rand() / float(RAND_MAX);
+            image.write(cq, &input[0]);
+            cq.finish();
+
+            calculator(image);
+            KeypointData data = calculator.readKeypoints().get();
+
+            // What is on the device once it has all finished
+            cl::Event::waitForEvents(calculator.keypointDescriptorEvents());
+
+            const std::vector<float>
+                locations = readBuffer<float>(cq,
+                                              calculator.keypointLocations()),
+                descriptors = readBuffer<float>(cq,
+                                            calculator.keypointDescriptors());
+
+            for (size_t n = 0; n < data.numKeypoints; ++n) {
+
+                for (size_t c = 0; c < numFloatsPerLocation; ++c) {
+                    const size_t i = n * numFloatsPerLocation + c;
+
+                    if (data.locations[i] != locations[i]) {
+                        std::cerr << "Frame " << f << ", keypoint " << n
+                                  << ": location component " << c
+                                  << " read back as " << data.locations[i]
+                                  << ", not " << locations[i] << std::endl;
+                        return -1;
+                    }
+                }
+
+                for (size_t c = 0; c < numFloatsPerDescriptor; ++c) {
+                    const size_t i = n * numFloatsPerDescriptor + c;
+
+                    if (data.descriptors[i] != descriptors[i]) {
+                        std::cerr << "Frame " << f << ", keypoint " << n
+                                  << ": descriptor component " << c
+                                  << " read back wrongly" << std::endl;
+                        return -1;
+                    }
+                }
+
+                const float orientation
+                    = data.locations[n * numFloatsPerLocation
+                                      + orientationIdx];
+
+                if (!(std::abs(orientation) <= pi)) {
+                    std::cerr << "Frame " << f << ", keypoint " << n
+                              << ": orientation " << orientation
+                              << " out of range" << std::endl;
+                    return -1;
+                }
+
+                if (orientation != 0.f)
+                    ++numOriented;
+            }
+
+            totalKeypoints += data.numKeypoints;
+        }
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    if (totalKeypoints == 0) {
+        std::cerr << "No keypoints found" << std::endl;
+        return -1;
+    }
+
+    if (numOriented == 0) {
+        std::cerr << "No orientations were read back" << std::endl;
+        return -1;
+    }
+
+    std::cout << totalKeypoints << " keypoints read back, "
+              << numOriented << " with orientations" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include "FlatFile/flatFile.h"
+#include "../keypointFrames.h"
+
+// Write frames of varying sizes (through a small buffer, so it fills many
+// times), with and without O_DIRECT, and check they map back as written.
+
+
+static const size_t keypointLength = 5, descriptorLength = 168;
+
+
+static bool check(const std::string& filename, size_t numFrames)
+{
+    FlatReader reader(filename);
+
+    if (reader.numFrames() != numFrames
+            || reader.keypointLength() != keypointLength
+            || reader.descriptorLength() != descriptorLength)
+        return false;
+
+    size_t total = 0;
+
+    for (size_t f = 0; f < numFrames; ++f) {
+
+        const size_t n = reader.numKeypoints(f);
+        if (reader.firstKeypoint(f) != total)
+            return false;
+
+        // Aligned for vector loads
+        if (reinterpret_cast<uintptr_t>(reader.keypoints(f)) % 64 != 0
+             || reinterpret_cast<uintptr_t>(reader.descriptors(f)) % 64 != 0)
+            return false;
+
+        if (!checkFrame(f, keypointLength, descriptorLength, n,
+                        reader.keypoints(f), reader.descriptors(f)))
+            return false;
+
+        total += n;
+    }
+
+    return reader.numKeypoints() == total;
+}
+
+
+
+int main()
+{
+    const size_t numFrames = 300;
+
+    try {
+
+        for (bool direct: {false, true}) {
+
+            {
+                FlatWriter writer("test.flat", descriptorLength,
+                                  keypointLength, direct, 16384);
+
+                std::vector<float> keypoints, descriptors;
+                for (size_t f = 0; f < numFrames; ++f) {
+                    makeFrame(f, keypointLength, descriptorLength,
+                              keypoints, descriptors);
+                    writer.append(frameNumKeypoints(f), keypoints.data(),
+                                  descriptors.data());
+                }
+
+                writer.close();
+            }
+
+            if (!check("test.flat", numFrames)) {
+                std::cerr << "Frames read back wrong" 
+                          << (direct? " (O_DIRECT)" : "") << std::endl;
+                return -1;
+            }
+        }
+
+    }
+    catch (std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
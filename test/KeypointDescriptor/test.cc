@@ -0,0 +1,511 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <complex>
+#include <cmath>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+
+#include "KeypointDescriptor/extractDescriptors.h"
+
+#include "Filter/imageBuffer.h"
+
+// Check the descriptor extraction against a double-precision version of
+// the straightforward method: derotate every subband sample by its absolute
+// position, interpolate, then rerotate by the absolute sampling position.
+
+typedef std::complex<double> Cd;
+
+// Subbands as [subband][y][x]
+typedef std::vector<std::vector<std::vector<Cd>>> SubbandsRef;
+
+
+static SubbandsRef randomSubbands(size_t width, size_t height)
+{
+    SubbandsRef sb(6, std::vector<std::vector<Cd>>(height,
+                                                   std::vector<Cd>(width)));
+
+    for (auto& s: sb)
+        for (auto& row: s)
+            for (auto& v: row)
+                v = Cd(2. * std::rand() / RAND_MAX - 1.,
+                       2. * std::rand() / RAND_MAX - 1.);
+
+    return sb;
+}
+
+
+static void cubicCoefficients(double x, double coeffs[4])
+{
+    coeffs[0] = -0.5 * (x+1)*(x+1)*(x+1) + 2.5 * (x+1)*(x+1) - 4 * (x+1) + 2;
+    coeffs[1] =  1.5 * (x  )*(x  )*(x  ) - 2.5 * (x  )*(x  )             + 1;
+    coeffs[2] =  1.5 * (1-x)*(1-x)*(1-x) - 2.5 * (1-x)*(1-x)             + 1;
+    coeffs[3] = -0.5 * (2-x)*(2-x)*(2-x) + 2.5 * (2-x)*(2-x) - 4 * (2-x) + 2;
+}
+
+
+static void referenceDescriptors(std::vector<Cd>& output,
+                                 const SubbandsRef& sb, double scale,
+                                 const std::vector<float>& locations,
+                                 size_t begin, size_t end,
+                                 const std::vector<Coord>& pattern,
+                                 size_t stride, size_t offset)
+{
+    const double pi = 4 * std::atan(1.);
+    const Cd j(0, 1);
+
+    const double angularFreq[6][2] = {
+        {-1, -3}, {-std::sqrt(5.), -std::sqrt(5.)}, {-3, -1},
+        {-3,  1}, {-std::sqrt(5.),  std::sqrt(5.)}, {-1,  3}
+    };
+    const Cd sbOffsets[6] = {Cd(0, 1), Cd(0, -1), Cd(0, 1),
+                             Cd(-1, 0), Cd(1, 0), Cd(-1, 0)};
+
+    const int height = sb[0].size(), width = sb[0][0].size();
+
+    for (size_t kp = begin; kp < end; ++kp) {
+
+        const double kpX = locations[4*kp] / scale + (width - 1) / 2.,
+                     kpY = locations[4*kp+1] / scale + (height - 1) / 2.;
+
+        for (size_t k = 0; k < pattern.size(); ++k) {
+
+            const double x = kpX + pattern[k].x, y = kpY + pattern[k].y;
+            const int ix = std::floor(x), iy = std::floor(y);
+
+            double cx[4], cy[4];
+            cubicCoefficients(x - ix, cx);
+            cubicCoefficients(y - iy, cy);
+
+            for (int n = 0; n < 6; ++n) {
+
+                const double wx = angularFreq[n][0] * pi / 2.15,
+                             wy = angularFreq[n][1] * pi / 2.15;
+
+                Cd result = 0;
+
+                for (int dy = 0; dy < 4; ++dy)
+                    for (int dx = 0; dx < 4; ++dx) {
+                        const int px = ix - 1 + dx, py = iy - 1 + dy;
+
+                        if (px < 0 || px >= width || py < 0 || py >= height)
+                            continue;
+
+                        result += cx[dx] * cy[dy] * sb[n][py][px] 
+                                * sbOffsets[n]
+                                * std::exp(-j * (wx * px + wy * py));
+                    }
+
+                output[n + 6 * (k + offset + stride * kp)] 
+                    = result * std::exp(j * (wx * x + wy * y));
+            }
+        }
+    }
+}
+
+
+static void uploadSubbands(cl::CommandQueue& cq, Subbands& result,
+                           const SubbandsRef& sb)
+{
+    std::vector<Complex<cl_float>> values;
+    for (auto& s: sb)
+        for (auto& row: s)
+            for (auto& v: row)
+                values.push_back({float(v.real()), float(v.imag())});
+
+    result.write(cq, &values[0]);
+}
+
+
+static Subbands uploadSubbands(cl::Context& context, cl::CommandQueue& cq,
+                               const SubbandsRef& sb)
+{
+    const size_t height = sb[0].size(), width = sb[0][0].size();
+
+    Subbands result(context, CL_MEM_READ_WRITE, width, height, 4, 8, 6);
+    uploadSubbands(cq, result, sb);
+
+    return result;
+}
+
+
+static void randomLocations(std::vector<float>& locations, size_t numKPs,
+                            size_t width, size_t height, float scale)
+{
+    // Keypoints (x, y, scale, strength) relative to the centre, anywhere
+    // more than a few pixels from the edge of the level
+    for (size_t n = 0; n < numKPs; ++n) {
+        locations.push_back(scale * (width / 2.f - 3) 
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(scale * (height / 2.f - 3)
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(scale);
+        locations.push_back(1.f);
+    }
+}
+
+
+static std::vector<float> toSoA(const std::vector<float>& locations,
+                                size_t posLength)
+{
+    // Records to separate arrays of each component, with no spare room
+    const size_t n = locations.size() / posLength;
+
+    std::vector<float> result(locations.size());
+    for (size_t i = 0; i < n; ++i)
+        for (size_t c = 0; c < posLength; ++c)
+            result[c*n + i] = locations[i*posLength + c];
+
+    return result;
+}
+
+
+static void appendRing(std::vector<Coord>& pattern, double radius,
+                       int numSamples)
+{
+    // As SamplingRing: evenly spaced from -180 degrees
+    const double pi = 4 * std::atan(1.);
+
+    for (int n = 0; n < numSamples; ++n) {
+        const double angle = -pi + 2 * pi * n / numSamples;
+        pattern.push_back({float(radius * std::cos(angle)),
+                           float(radius * std::sin(angle))});
+    }
+}
+
+
+static double maxDiscrepancy(const std::vector<Cd>& reference,
+                             const std::vector<float>& output)
+{
+    double biggestDiscrepancy = 0;
+    for (size_t n = 0; n < reference.size(); ++n)
+        biggestDiscrepancy = std::max(biggestDiscrepancy,
+            std::abs(reference[n] - Cd(output[2*n], output[2*n+1])));
+
+    return biggestDiscrepancy;
+}
+
+
+
+int main()
+{
+    const double pi = 4 * std::atan(1.);
+
+    // Same patterns as DescriptorExtracter uses
+    std::vector<Coord> finePattern = {{0, 0}};
+    for (int n = 0; n < 12; ++n)
+        finePattern.push_back({float(std::sin((9-n) / 12. * 2 * pi)),
+                               float(std::cos((9-n) / 12. * 2 * pi))});
+
+    std::vector<Coord> coarsePattern = {{0, 0}};
+
+    const size_t width = 64, height = 48;
+    const double fineScale = 4, coarseScale = 8;
+
+    SubbandsRef fineRef = randomSubbands(width, height),
+                coarseRef = randomSubbands(width / 2, height / 2);
+
+    // Keypoints including ones far from the centre (where absolute phases
+    // are large) and near the edge
+    std::vector<float> locations;
+    randomLocations(locations, 32, width, height, fineScale);
+    locations.insert(locations.end(), {0.f, 0.f, 4.f, 1.f});
+    locations.insert(locations.end(), {126.f, -94.f, 4.f, 1.f});
+
+    const size_t numKPs = locations.size() / 4;
+
+    std::vector<Cd> reference(numKPs * 14 * 6);
+    referenceDescriptors(reference, fineRef, fineScale, locations,
+                         0, numKPs, finePattern, 14, 0);
+    referenceDescriptors(reference, coarseRef, coarseScale, locations,
+                         0, numKPs, coarsePattern, 14, 13);
+
+    std::vector<float> gpuOutput;
+
+    // The same keypoints as separate arrays for each component, singly
+    // and over several levels
+    std::vector<float> soaGpuOutput, multiSoaGpuOutput;
+
+    // The same for several levels at once, from DTCWT outputs that share
+    // a buffer
+    const std::vector<float> scales = {4.f, 8.f, 16.f};
+    std::vector<SubbandsRef> levelRefs;
+    std::vector<float> multiLocations;
+    std::vector<cl_uint> multiKPOffsets = {0};
+    std::vector<Cd> multiReference;
+    std::vector<float> multiGpuOutput;
+
+    // The same keypoints again as points with their levels, in reverse
+    // (so the levels are mixed up), described without a list, plus points
+    // at levels there aren't (which should come out as zeros)
+    std::vector<Cd> pointReference;
+    std::vector<float> pointGpuOutput;
+
+    // A pattern of its own: more rings, and a wider one needing a bigger
+    // sampling window
+    const DescriptorPattern customPattern({
+        {0, 0, 1}, {0, 1, 8}, {0, 2, 16}, {1, 1, 6}
+    });
+
+    std::vector<Coord> customFine = {{0, 0}}, customCoarse;
+    appendRing(customFine, 1, 8);
+    appendRing(customFine, 2, 16);
+    appendRing(customCoarse, 1, 6);
+
+    const size_t customLength = customFine.size() + customCoarse.size();
+
+    std::vector<Cd> customReference(numKPs * customLength * 6);
+    referenceDescriptors(customReference, fineRef, fineScale, locations,
+                         0, numKPs, customFine, customLength, 0);
+    referenceDescriptors(customReference, coarseRef, coarseScale, locations,
+                         0, numKPs, customCoarse, customLength,
+                         customFine.size());
+
+    std::vector<float> customGpuOutput;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        DescriptorExtracter extracter(context.context, context.devices, 4);
+
+        Subbands fine = uploadSubbands(context.context, cq, fineRef),
+                 coarse = uploadSubbands(context.context, cq, coarseRef);
+
+        cl::Buffer locationsBuffer = createBuffer(context.context, cq,
+                                                  locations);
+
+        std::vector<cl_uint> kpOffsetsV = {0, cl_uint(numKPs)};
+        cl::Buffer kpOffsets = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            kpOffsetsV.size() * sizeof(cl_uint),
+            &kpOffsetsV[0]
+        };
+
+        cl::Buffer output = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numKPs * extracter.getNumFloatsInDescriptor() * sizeof(float)
+        };
+
+        extracter(cq, fine, fineScale, coarse, coarseScale,
+                      locationsBuffer, kpOffsets, 0, numKPs,
+                      output);
+
+        gpuOutput = readBuffer<float>(cq, output);
+
+
+        // Levels 2 to 4 of a 128 x 96 image
+        DtcwtTemps env(context.context, 128, 96, 2, 3);
+        DtcwtOutput out = env.createOutputs();
+
+        for (auto& level: out) {
+            levelRefs.push_back(randomSubbands(level.width(), 
+                                               level.height()));
+            uploadSubbands(cq, level, levelRefs.back());
+        }
+
+        // Keypoints in list levels 0 and 1
+        for (size_t l = 0; l < 2; ++l) {
+            randomLocations(multiLocations, 20 + 7*l, 
+                            out[l].width(), out[l].height(), scales[l]);
+            multiKPOffsets.push_back(multiLocations.size() / 4);
+        }
+
+        const size_t numMultiKPs = multiKPOffsets.back();
+
+        multiReference.resize(numMultiKPs * 14 * 6);
+        for (size_t l = 0; l < 2; ++l) {
+            referenceDescriptors(multiReference, levelRefs[l], scales[l], 
+                                 multiLocations, 
+                                 multiKPOffsets[l], multiKPOffsets[l+1],
+                                 finePattern, 14, 0);
+            referenceDescriptors(multiReference, levelRefs[l+1], 
+                                 scales[l+1], multiLocations, 
+                                 multiKPOffsets[l], multiKPOffsets[l+1],
+                                 coarsePattern, 14, 13);
+        }
+
+        cl::Buffer multiLocationsBuffer 
+            = createBuffer(context.context, cq, multiLocations);
+
+        cl::Buffer multiKPOffsetsBuffer = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            multiKPOffsets.size() * sizeof(cl_uint),
+            &multiKPOffsets[0]
+        };
+
+        cl::Buffer multiOutput = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numMultiKPs * extracter.getNumFloatsInDescriptor() 
+                * sizeof(float)
+        };
+
+        extracter(cq, out, scales, 
+                      multiLocationsBuffer, multiKPOffsetsBuffer, 0, 2,
+                      numMultiKPs, multiOutput);
+
+        multiGpuOutput = readBuffer<float>(cq, multiOutput);
+
+
+        std::vector<float> points;
+        for (size_t l = 2; l-- > 0; )
+            for (size_t n = multiKPOffsets[l+1]; n-- > multiKPOffsets[l]; ) {
+                points.insert(points.end(), {multiLocations[4*n],
+                                             multiLocations[4*n+1],
+                                             float(l), 1.f});
+                pointReference.insert(pointReference.end(),
+                                      &multiReference[n * 14 * 6],
+                                      &multiReference[(n+1) * 14 * 6]);
+            }
+
+        for (float l: {2.f, -1.f}) {
+            points.insert(points.end(), {multiLocations[0], multiLocations[1],
+                                         l, 1.f});
+            pointReference.insert(pointReference.end(), 14 * 6, Cd(0));
+        }
+
+        const size_t numPoints = points.size() / 4;
+
+        cl::Buffer pointsBuffer = createBuffer(context.context, cq, points);
+
+        cl::Buffer pointOutput = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numPoints * extracter.getNumFloatsInDescriptor() * sizeof(float)
+        };
+
+        extracter.describePoints(cq, out, scales, pointsBuffer, numPoints,
+                                 pointOutput);
+
+        pointGpuOutput = readBuffer<float>(cq, pointOutput);
+
+
+        DescriptorExtracter customExtracter(context.context, context.devices,
+                                            4, false,
+                                            DescriptorFormat::Float,
+                                            KeypointOrientation::Ignore,
+                                            customPattern);
+
+        if (customExtracter.getNumFloatsInDescriptor() 
+                != customLength * 6 * 2) {
+            std::cerr << "Wrong descriptor length for the custom pattern"
+                      << std::endl;
+            return -1;
+        }
+
+        cl::Buffer customOutput = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numKPs * customExtracter.getNumFloatsInDescriptor() 
+                * sizeof(float)
+        };
+
+        customExtracter(cq, fine, fineScale, coarse, coarseScale,
+                            locationsBuffer, kpOffsets, 0, numKPs,
+                            customOutput);
+
+        customGpuOutput = readBuffer<float>(cq, customOutput);
+
+
+        DescriptorExtracter soaExtracter(context.context, context.devices,
+                                         4, true);
+
+        cl::Buffer soaLocationsBuffer
+            = createBuffer(context.context, cq, toSoA(locations, 4));
+
+        soaExtracter(cq, fine, fineScale, coarse, coarseScale,
+                         soaLocationsBuffer, kpOffsets, 0, numKPs,
+                         output);
+
+        soaGpuOutput = readBuffer<float>(cq, output);
+
+        cl::Buffer multiSoALocationsBuffer
+            = createBuffer(context.context, cq, toSoA(multiLocations, 4));
+
+        soaExtracter(cq, out, scales,
+                         multiSoALocationsBuffer, multiKPOffsetsBuffer, 0, 2,
+                         numMultiKPs, multiOutput);
+
+        multiSoaGpuOutput = readBuffer<float>(cq, multiOutput);
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    // Compare
+    const double tolerance = 1.e-4;
+
+    double biggestDiscrepancy = maxDiscrepancy(reference, gpuOutput);
+
+    std::cout << "Largest discrepancy: " << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > tolerance) {
+        std::cerr << "Descriptors differ from reference" << std::endl;
+        return -1;
+    }
+
+    biggestDiscrepancy = maxDiscrepancy(multiReference, multiGpuOutput);
+
+    std::cout << "Largest discrepancy over several levels: " 
+              << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > tolerance) {
+        std::cerr << "Multi-level descriptors differ from reference" 
+                  << std::endl;
+        return -1;
+    }
+
+    biggestDiscrepancy = std::max(maxDiscrepancy(reference, soaGpuOutput),
+                                  maxDiscrepancy(multiReference,
+                                                 multiSoaGpuOutput));
+
+    std::cout << "Largest discrepancy with structure-of-arrays keypoints: "
+              << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > tolerance) {
+        std::cerr << "Structure-of-arrays descriptors differ from "
+                     "reference" << std::endl;
+        return -1;
+    }
+
+    biggestDiscrepancy = maxDiscrepancy(pointReference, pointGpuOutput);
+
+    std::cout << "Largest discrepancy at points: " 
+              << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > tolerance) {
+        std::cerr << "Descriptors at points differ from reference" 
+                  << std::endl;
+        return -1;
+    }
+
+    biggestDiscrepancy = maxDiscrepancy(customReference, customGpuOutput);
+
+    std::cout << "Largest discrepancy with a custom pattern: " 
+              << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > tolerance) {
+        std::cerr << "Custom pattern descriptors differ from reference" 
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
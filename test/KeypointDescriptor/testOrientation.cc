@@ -0,0 +1,201 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <complex>
+#include <cmath>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+
+#include "KeypointDescriptor/extractDescriptors.h"
+#include "Matcher/polarMatcher.h"
+
+#include "Filter/imageBuffer.h"
+
+// Check the orientations written to the positions against an estimate on
+// the host from the plain descriptors, and that derotated descriptors are
+// the plain ones rotated to cancel it.
+
+
+typedef std::complex<float> Complex64;
+
+
+static float estimateOrientation(const float* descriptor)
+{
+    // As the kernel: subband energies give the axis, the ring which way
+    // along it
+    const float pi = 4 * std::atan(1.f);
+    Complex64 axis = 0, ring = 0;
+
+    for (int k = 0; k < 13; ++k) {
+
+        float energy = 0;
+        for (int n = 0; n < 6; ++n) {
+            const float* v = descriptor + (k * 6 + n) * 2;
+            const float e = v[0] * v[0] + v[1] * v[1];
+
+            axis += e * std::polar(1.f, 2 * (75 - 30 * n) * pi / 180);
+            energy += e;
+        }
+
+        // Ring sample k-1 is at angle 30(9-(k-1)) degrees from the y axis
+        if (k > 0) {
+            const float a = (9 - (k - 1)) / 12.f * 2 * pi;
+            ring += energy * Complex64(std::sin(a), std::cos(a));
+        }
+    }
+
+    float angle = 0.5f * std::arg(axis);
+    if (std::real(ring * std::polar(1.f, -angle)) < 0)
+        angle += (angle > 0)? -pi : pi;
+
+    return angle;
+}
+
+
+
+int main()
+{
+    const size_t width = 64, height = 48;
+    const float fineScale = 4, coarseScale = 8;
+    const size_t numKPs = 200, posLength = 5;
+    const size_t descriptorLength = 14 * 6 * 2;
+
+    std::vector<Complex<cl_float>>
+        fineValues(width * height * 6), coarseValues(width * height / 4 * 6);
+
+    for (auto* values: {&fineValues, &coarseValues})
+        for (auto& v: *values)
+            v = {2.f * std::rand() / RAND_MAX - 1.f,
+                 2.f * std::rand() / RAND_MAX - 1.f};
+
+    // Keypoints (x, y, scale, strength, orientation) relative to the centre
+    std::vector<float> locations;
+    for (size_t n = 0; n < numKPs; ++n) {
+        locations.push_back(fineScale * (width / 2.f - 3)
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(fineScale * (height / 2.f - 3)
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(fineScale);
+        locations.push_back(1.f);
+        locations.push_back(0.f);
+    }
+
+    const KeypointOrientation modes[] = {
+        KeypointOrientation::Ignore, KeypointOrientation::Derotate
+    };
+
+    std::vector<float> descriptors[2], orientations;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        Subbands fine(context.context, CL_MEM_READ_WRITE,
+                      width, height, 4, 8, 6),
+                 coarse(context.context, CL_MEM_READ_WRITE,
+                        width / 2, height / 2, 4, 8, 6);
+
+        fine.write(cq, &fineValues[0]);
+        coarse.write(cq, &coarseValues[0]);
+
+        cl::Buffer locationsBuffer = createBuffer(context.context, cq,
+                                                  locations);
+
+        std::vector<cl_uint> kpOffsetsV = {0, cl_uint(numKPs)};
+        cl::Buffer kpOffsets = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            kpOffsetsV.size() * sizeof(cl_uint),
+            &kpOffsetsV[0]
+        };
+
+        cl::Buffer output = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numKPs * descriptorLength * sizeof(float)
+        };
+
+        for (int m = 0; m < 2; ++m) {
+
+            DescriptorExtracter extracter(context.context, context.devices,
+                                          posLength, false,
+                                          DescriptorFormat::Float,
+                                          modes[m]);
+
+            extracter(cq, fine, fineScale, coarse, coarseScale,
+                          locationsBuffer, kpOffsets, 0, numKPs,
+                          output);
+
+            descriptors[m] = readBuffer<float>(cq, output);
+        }
+
+        const std::vector<float> positions
+            = readBuffer<float>(cq, locationsBuffer);
+
+        for (size_t n = 0; n < numKPs; ++n)
+            orientations.push_back(positions[n * posLength + 4]);
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    const std::vector<PolarRotation> rotations = polarRotations();
+    const float pi = 4 * std::atan(1.f);
+
+    float biggestAngleError = 0, biggestError = 0;
+
+    for (size_t n = 0; n < numKPs; ++n) {
+
+        const float* plain = &descriptors[0][n * descriptorLength];
+        const float* derotated = &descriptors[1][n * descriptorLength];
+
+        const float expected = estimateOrientation(plain);
+        biggestAngleError = std::max(biggestAngleError,
+                                     std::abs(std::remainder(
+                                         orientations[n] - expected,
+                                         2 * pi)));
+
+        // Rotate by the device's orientation, in case the host's rounds
+        // the other way
+        const int steps = int(std::round(-orientations[n] * 6 / pi));
+        const PolarRotation& rotation = rotations[(steps + 12) % 12];
+
+        for (size_t c = 0; c < descriptorLength / 2; ++c) {
+            const float* v = plain + 2 * rotation.source[c];
+            const float im = rotation.conjugate[c]? -v[1] : v[1];
+
+            biggestError = std::max({biggestError,
+                                     std::abs(derotated[2*c] - v[0]),
+                                     std::abs(derotated[2*c+1] - im)});
+        }
+    }
+
+    std::cout << "Largest orientation error: " << biggestAngleError
+              << std::endl
+              << "Largest derotated descriptor error: " << biggestError
+              << std::endl;
+
+    if (biggestAngleError > 1.e-3f) {
+        std::cerr << "Orientations differ from the host's" << std::endl;
+        return -1;
+    }
+
+    if (biggestError > 1.e-5f) {
+        std::cerr << "Derotated descriptors are wrong" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,119 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+
+#include "KeypointDescriptor/ProjectDescriptors/projectDescriptors.h"
+
+// Check projecting descriptors on the device gives the same as on the
+// host, for all of them and for a range picked out by keypoint offsets.
+
+
+static float biggestDifference(const std::vector<float>& a,
+                               const std::vector<float>& b,
+                               size_t begin, size_t end)
+{
+    float result = 0;
+    for (size_t i = begin; i < end; ++i)
+        result = std::max(result, std::abs(a[i] - b[i]));
+    return result;
+}
+
+
+
+int main()
+{
+    const size_t inputLength = 168, outputLength = 32;
+    const size_t numDescriptors = 1000;
+
+    std::vector<float> descriptors(numDescriptors * inputLength);
+    for (float& v: descriptors)
+        v = 2.f * std::rand() / RAND_MAX - 1.f;
+
+    // One all zero, which should project to minus the mean
+    std::fill(&descriptors[0], &descriptors[inputLength], 0.f);
+
+    const DescriptorPCA pca = DescriptorPCA::train(&descriptors[0],
+                                                   numDescriptors,
+                                                   inputLength,
+                                                   outputLength, true);
+    const std::vector<float> expected = pca.project(&descriptors[0],
+                                                    numDescriptors);
+
+    // Only the second range from the offsets
+    const size_t begin = 300, end = 1000;
+
+    std::vector<float> all, range;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        ProjectDescriptors project(context.context, context.devices, pca);
+
+        cl::Buffer input = createBuffer(context.context, cq, descriptors);
+
+        std::vector<cl_uint> kpOffsetsV = {0, cl_uint(begin), cl_uint(end)};
+        cl::Buffer kpOffsets = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            kpOffsetsV.size() * sizeof(cl_uint),
+            &kpOffsetsV[0]
+        };
+
+        cl::Buffer output = createBuffer(context.context, cq,
+                                std::vector<float>(expected.size(), 0.f));
+
+        project(cq, input, numDescriptors, output);
+        all = readBuffer<float>(cq, output);
+
+        cl::Buffer rangeOutput = createBuffer(context.context, cq,
+                                    std::vector<float>(expected.size(), 0.f));
+
+        project(cq, input, kpOffsets, 1, 2, numDescriptors, rangeOutput);
+        range = readBuffer<float>(cq, rangeOutput);
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    // Whitened, so values are around one
+    const float tolerance = 1.e-3f;
+
+    const float allError = biggestDifference(all, expected, 0,
+                                             expected.size());
+    const float rangeError = biggestDifference(range, expected,
+                                               begin * outputLength,
+                                               end * outputLength);
+
+    std::cout << "Largest difference (all): " << allError << std::endl
+              << "Largest difference (range): " << rangeError << std::endl;
+
+    if (allError > tolerance || rangeError > tolerance) {
+        std::cerr << "Projections differ from the host's" << std::endl;
+        return -1;
+    }
+
+    // Nothing written outside the range
+    if (std::any_of(&range[0], &range[begin * outputLength],
+                    [] (float v) { return v != 0.f; })) {
+        std::cerr << "Projected descriptors outside the range" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,282 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+
+#include "KeypointDescriptor/extractDescriptors.h"
+
+#include "Filter/imageBuffer.h"
+
+// Check the quantised descriptor formats against the float one: each
+// component should be within the quantisation step, and matching
+// descriptors from noisy subbands to those from clean ones should find
+// (nearly) as many correct nearest neighbours.
+
+
+static std::vector<Complex<cl_float>> randomValues(size_t num)
+{
+    std::vector<Complex<cl_float>> values(num);
+
+    for (auto& v: values)
+        v = {2.f * std::rand() / RAND_MAX - 1.f,
+             2.f * std::rand() / RAND_MAX - 1.f};
+
+    return values;
+}
+
+
+static std::vector<Complex<cl_float>>
+    addNoise(std::vector<Complex<cl_float>> values, float amplitude)
+{
+    for (auto& v: values) {
+        v.real += amplitude * (2.f * std::rand() / RAND_MAX - 1.f);
+        v.imag += amplitude * (2.f * std::rand() / RAND_MAX - 1.f);
+    }
+
+    return values;
+}
+
+
+static float halfToFloat(cl_half h)
+{
+    // IEEE 754 half to float, including subnormals
+    const int exponent = (h >> 10) & 0x1f;
+    const int mantissa = h & 0x3ff;
+    const float sign = (h & 0x8000)? -1.f : 1.f;
+
+    if (exponent == 0)
+        return sign * std::ldexp(float(mantissa), -24);
+    if (exponent == 31)
+        return sign * std::numeric_limits<float>::infinity();
+
+    return sign * std::ldexp(float(mantissa | 0x400), exponent - 25);
+}
+
+
+static std::vector<float> dequantise(const std::vector<char>& raw,
+                                     const std::vector<float>& scales,
+                                     DescriptorFormat format,
+                                     size_t descriptorLength)
+{
+    std::vector<float> result(scales.size() * descriptorLength);
+
+    for (size_t n = 0; n < result.size(); ++n) {
+
+        const float scale = scales[n / descriptorLength];
+
+        if (format == DescriptorFormat::Half) {
+            cl_half h;
+            std::memcpy(&h, &raw[n * sizeof(cl_half)], sizeof(cl_half));
+            result[n] = scale * halfToFloat(h);
+        } else
+            result[n] = scale * static_cast<signed char>(raw[n]);
+    }
+
+    return result;
+}
+
+
+static float recall(const std::vector<float>& reference,
+                    const std::vector<float>& query,
+                    size_t descriptorLength)
+{
+    // Proportion of query descriptors whose nearest reference descriptor
+    // (in Euclidean distance) is the one for the same keypoint
+    const size_t numKPs = reference.size() / descriptorLength;
+    size_t numCorrect = 0;
+
+    for (size_t q = 0; q < numKPs; ++q) {
+
+        size_t best = 0;
+        float bestDist = std::numeric_limits<float>::infinity();
+
+        for (size_t r = 0; r < numKPs; ++r) {
+            float dist = 0;
+            for (size_t i = 0; i < descriptorLength; ++i) {
+                float d = query[q*descriptorLength + i]
+                        - reference[r*descriptorLength + i];
+                dist += d*d;
+            }
+
+            if (dist < bestDist) {
+                bestDist = dist;
+                best = r;
+            }
+        }
+
+        numCorrect += (best == q);
+    }
+
+    return float(numCorrect) / numKPs;
+}
+
+
+
+int main()
+{
+    const size_t width = 64, height = 48;
+    const float fineScale = 4, coarseScale = 8;
+    const size_t numKPs = 200;
+
+    // Noisy enough that the float descriptors don't all match
+    const float noiseAmplitude = 0.8f;
+
+    std::vector<Complex<cl_float>>
+        fineValues = randomValues(width * height * 6),
+        coarseValues = randomValues(width / 2 * height / 2 * 6);
+
+    // Keypoints (x, y, scale, strength) relative to the centre
+    std::vector<float> locations;
+    for (size_t n = 0; n < numKPs; ++n) {
+        locations.push_back(fineScale * (width / 2.f - 3)
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(fineScale * (height / 2.f - 3)
+                             * (2.f * std::rand() / RAND_MAX - 1.f));
+        locations.push_back(fineScale);
+        locations.push_back(1.f);
+    }
+
+    const DescriptorFormat formats[] = {
+        DescriptorFormat::Float, DescriptorFormat::Half, DescriptorFormat::Char
+    };
+    const char* formatNames[] = {"float", "half", "char"};
+
+    // Descriptors from [clean, noisy] subbands for each format, as floats
+    std::vector<float> descriptors[3][2];
+    size_t descriptorLength = 0;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        Subbands fine(context.context, CL_MEM_READ_WRITE,
+                      width, height, 4, 8, 6),
+                 coarse(context.context, CL_MEM_READ_WRITE,
+                        width / 2, height / 2, 4, 8, 6);
+
+        cl::Buffer locationsBuffer = createBuffer(context.context, cq,
+                                                  locations);
+
+        std::vector<cl_uint> kpOffsetsV = {0, cl_uint(numKPs)};
+        cl::Buffer kpOffsets = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            kpOffsetsV.size() * sizeof(cl_uint),
+            &kpOffsetsV[0]
+        };
+
+        cl::Buffer scales = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numKPs * sizeof(float)
+        };
+
+        for (int noisy = 0; noisy < 2; ++noisy) {
+
+            fine.write(cq, &(noisy? addNoise(fineValues, noiseAmplitude)
+                                  : fineValues)[0]);
+            coarse.write(cq, &(noisy? addNoise(coarseValues, noiseAmplitude)
+                                    : coarseValues)[0]);
+
+            for (int f = 0; f < 3; ++f) {
+
+                DescriptorExtracter extracter(context.context,
+                                              context.devices, 4,
+                                              false, formats[f]);
+                descriptorLength = extracter.getNumFloatsInDescriptor();
+
+                cl::Buffer output = {
+                    context.context,
+                    CL_MEM_READ_WRITE,
+                    numKPs * descriptorLength
+                        * extracter.getNumBytesPerElement()
+                };
+
+                extracter(cq, fine, fineScale, coarse, coarseScale,
+                              locationsBuffer, kpOffsets, 0, numKPs,
+                              output, &scales);
+
+                if (formats[f] == DescriptorFormat::Float)
+                    descriptors[f][noisy] = readBuffer<float>(cq, output);
+                else
+                    descriptors[f][noisy]
+                        = dequantise(readBuffer<char>(cq, output),
+                                     readBuffer<float>(cq, scales),
+                                     formats[f], descriptorLength);
+            }
+        }
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    // Quantisation error, relative to each descriptor's largest component.
+    // Rounding to nearest is within half a step: 2^-11 for half at the
+    // largest values, and 0.5/127 for char.
+    const float tolerances[] = {0.f, 1.f / 2048 + 1.e-6f, 0.5f / 127 + 1.e-6f};
+
+    for (int f = 1; f < 3; ++f) {
+
+        float biggestError = 0;
+
+        for (size_t kp = 0; kp < numKPs; ++kp) {
+
+            const float* reference = &descriptors[0][0][kp*descriptorLength];
+            const float* quantised = &descriptors[f][0][kp*descriptorLength];
+
+            float maxAbs = 0;
+            for (size_t i = 0; i < descriptorLength; ++i)
+                maxAbs = std::max(maxAbs, std::abs(reference[i]));
+
+            for (size_t i = 0; i < descriptorLength; ++i)
+                biggestError = std::max(biggestError,
+                                        std::abs(quantised[i] - reference[i])
+                                         / maxAbs);
+        }
+
+        std::cout << "Largest relative error (" << formatNames[f] << "): "
+                  << biggestError << std::endl;
+
+        if (biggestError > tolerances[f]) {
+            std::cerr << "Quantised descriptors differ from float ones"
+                      << std::endl;
+            return -1;
+        }
+    }
+
+    // Matching noisy to clean descriptors
+    const float floatRecall = recall(descriptors[0][0], descriptors[0][1],
+                                     descriptorLength);
+
+    for (int f = 0; f < 3; ++f) {
+
+        const float r = recall(descriptors[f][0], descriptors[f][1],
+                               descriptorLength);
+
+        std::cout << "Nearest neighbour recall (" << formatNames[f] << "): "
+                  << r << std::endl;
+
+        if (r < floatRecall - 0.05f) {
+            std::cerr << "Quantising loses too many matches" << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
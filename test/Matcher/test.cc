@@ -0,0 +1,158 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "Matcher/polarMatcher.h"
+
+// Check the CPU matcher finds rotated, noisy copies of descriptors, with
+// the right rotation, and that all instruction sets agree.
+
+
+static std::vector<float> rotate(const float* descriptor,
+                                 const PolarRotation& rotation)
+{
+    std::vector<float> result;
+
+    for (size_t c = 0; c < rotation.source.size(); ++c) {
+        const float* v = descriptor + 2 * rotation.source[c];
+        result.push_back(v[0]);
+        result.push_back(rotation.conjugate[c]? -v[1] : v[1]);
+    }
+
+    return result;
+}
+
+
+static float randomFloat()
+{
+    return 2.f * std::rand() / RAND_MAX - 1.f;
+}
+
+
+
+int main()
+{
+    const size_t numFloats = 14 * 6 * 2;
+    const std::vector<PolarRotation> rotations = polarRotations();
+
+    if (rotations.size() != 12) {
+        std::cerr << "Expected 12 rotations, not " << rotations.size()
+                  << std::endl;
+        return -1;
+    }
+
+    // Twelve steps of one should get back to the start
+    std::vector<float> original(numFloats);
+    std::generate(original.begin(), original.end(), randomFloat);
+
+    std::vector<float> rotated = original;
+    for (int n = 0; n < 12; ++n)
+        rotated = rotate(&rotated[0], rotations[1]);
+
+    if (rotated != original) {
+        std::cerr << "A full turn is not the identity" << std::endl;
+        return -1;
+    }
+
+    // Training descriptors, and queries that are rotated and noisy
+    // versions of the first few
+    const size_t numTrain = 500, numQuery = 200;
+
+    std::vector<float> train(numTrain * numFloats);
+    std::generate(train.begin(), train.end(), randomFloat);
+
+    std::vector<float> query;
+    std::vector<int> expectedRotations;
+
+    for (size_t q = 0; q < numQuery; ++q) {
+        const int k = std::rand() % 12;
+        std::vector<float> v = rotate(&train[q * numFloats], rotations[k]);
+
+        for (float& x: v)
+            x += 0.2f * randomFloat();
+
+        query.insert(query.end(), v.begin(), v.end());
+
+        // The rotation that undoes k steps
+        expectedRotations.push_back((12 - k) % 12);
+    }
+
+    std::vector<NearestNeighbours> reference;
+
+    const PolarMatcher::Instructions instructionSets[] = {
+        PolarMatcher::Instructions::Scalar,
+        PolarMatcher::Instructions::AVX2,
+        PolarMatcher::Instructions::AVX512
+    };
+    const char* instructionSetNames[] = {"scalar", "AVX2", "AVX-512"};
+
+    for (int i = 0; i < 3; ++i) {
+
+        const PolarMatcher::Instructions instructions = instructionSets[i];
+
+        if (!PolarMatcher::isSupported(instructions))
+            continue;
+
+        PolarMatcher matcher(14, 1, 12, 4, instructions);
+        std::vector<NearestNeighbours> nn 
+            = matcher.nearestNeighbours(query, train);
+
+        for (size_t q = 0; q < numQuery; ++q) {
+            if (nn[q].trainIdx != q 
+                    || nn[q].rotation != expectedRotations[q]) {
+                std::cerr << "Query " << q << " matched " << nn[q].trainIdx
+                          << " at rotation " << nn[q].rotation 
+                          << std::endl;
+                return -1;
+            }
+        }
+
+        if (reference.empty())
+            reference = nn;
+
+        float biggestDiscrepancy = 0;
+        for (size_t q = 0; q < numQuery; ++q)
+            biggestDiscrepancy 
+                = std::max({biggestDiscrepancy,
+                            std::abs(nn[q].distance - reference[q].distance),
+                            std::abs(nn[q].secondDistance
+                                      - reference[q].secondDistance)});
+
+        std::cout << "Largest discrepancy from scalar ("
+                  << instructionSetNames[i] << "): " << biggestDiscrepancy
+                  << std::endl;
+
+        if (biggestDiscrepancy > 1.e-3) {
+            std::cerr << "Distances differ between instruction sets" 
+                      << std::endl;
+            return -1;
+        }
+    }
+
+    // All should pass the ratio test, but unrelated descriptors shouldn't
+    PolarMatcher matcher;
+
+    if (matcher(query, train).size() != numQuery) {
+        std::cerr << "Ratio test rejected true matches" << std::endl;
+        return -1;
+    }
+
+    std::vector<float> unrelated(numQuery * numFloats);
+    std::generate(unrelated.begin(), unrelated.end(), randomFloat);
+
+    const size_t numFalseMatches = matcher(unrelated, train).size();
+    std::cout << "False matches: " << numFalseMatches << " of " << numQuery
+              << std::endl;
+
+    if (numFalseMatches > numQuery / 10) {
+        std::cerr << "Ratio test accepted too many false matches" 
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,114 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Matcher/descriptorIndex.h"
+
+// Check the approximate index finds rotated, noisy copies of descriptors
+// it holds (with the right rotation) most of the time, and survives being
+// saved and loaded.
+
+
+static float randomFloat()
+{
+    return 2.f * std::rand() / RAND_MAX - 1.f;
+}
+
+
+static double recall(const std::vector<NearestNeighbours>& nn,
+                     const std::vector<int>& expectedRotations)
+{
+    size_t numCorrect = 0;
+    for (size_t q = 0; q < nn.size(); ++q)
+        numCorrect += nn[q].trainIdx == q 
+                   && nn[q].rotation == expectedRotations[q];
+
+    return double(numCorrect) / nn.size();
+}
+
+
+
+int main()
+{
+    const size_t numFloats = 14 * 6 * 2;
+    const size_t numDatabase = 10000, numTrain = 5000, numQuery = 500;
+
+    const std::vector<PolarRotation> rotations = polarRotations();
+
+    std::vector<float> database(numDatabase * numFloats);
+    std::generate(database.begin(), database.end(), randomFloat);
+
+    // Queries are rotated, noisy versions of the first few
+    std::vector<float> query;
+    std::vector<int> expectedRotations;
+
+    for (size_t q = 0; q < numQuery; ++q) {
+        const int k = std::rand() % 12;
+        const PolarRotation& rotation = rotations[k];
+        const float* original = &database[q * numFloats];
+
+        for (size_t c = 0; c < rotation.source.size(); ++c) {
+            const float* v = original + 2 * rotation.source[c];
+            query.push_back(v[0] + 0.1f * randomFloat());
+            query.push_back((rotation.conjugate[c]? -v[1] : v[1])
+                             + 0.1f * randomFloat());
+        }
+
+        // The rotation that undoes k steps
+        expectedRotations.push_back((12 - k) % 12);
+    }
+
+    DescriptorIndex index(14, 1, 12, 64, 21);
+    index.train(&database[0], numTrain, 10);
+    index.add(&database[0], numDatabase);
+
+    if (index.size() != numDatabase) {
+        std::cerr << "Index has " << index.size() << " entries" << std::endl;
+        return -1;
+    }
+
+    const double recallCanonical 
+        = recall(index.nearestNeighbours(&query[0], numQuery, 16, 1),
+                 expectedRotations);
+    
+    // Random descriptors have no clear orientation, so the canonical
+    // rotation is often ambiguous; trying the next candidates recovers most
+    std::vector<NearestNeighbours> nn 
+        = index.nearestNeighbours(&query[0], numQuery, 16, 3);
+    const double recallProbed = recall(nn, expectedRotations);
+
+    std::cout << "Recall at canonical rotation: " << recallCanonical 
+              << std::endl
+              << "Recall trying three rotations: " << recallProbed
+              << std::endl;
+
+    if (recallProbed < 0.9) {
+        std::cerr << "Recall too low" << std::endl;
+        return -1;
+    }
+
+    // Should come back the same
+    const char* filename = "testIndex.idx";
+    index.save(filename);
+    DescriptorIndex loaded = DescriptorIndex::load(filename);
+    std::remove(filename);
+
+    std::vector<NearestNeighbours> nnLoaded
+        = loaded.nearestNeighbours(&query[0], numQuery, 16, 3);
+
+    for (size_t q = 0; q < numQuery; ++q)
+        if (nnLoaded[q].trainIdx != nn[q].trainIdx
+                || nnLoaded[q].rotation != nn[q].rotation
+                || nnLoaded[q].distance != nn[q].distance
+                || nnLoaded[q].secondDistance != nn[q].secondDistance) {
+            std::cerr << "Loaded index gives different results" 
+                      << std::endl;
+            return -1;
+        }
+
+    return 0;
+}
+
@@ -0,0 +1,121 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+
+#include "Matcher/polarMatcher.h"
+#include "Matcher/MatchDescriptors/matchDescriptors.h"
+
+// Check the device matcher against the CPU one
+
+
+static float randomFloat()
+{
+    return 2.f * std::rand() / RAND_MAX - 1.f;
+}
+
+
+
+int main()
+{
+    const size_t numFloats = 14 * 6 * 2;
+    const std::vector<PolarRotation> rotations = polarRotations();
+
+    // Training descriptors, and queries that are rotated, noisy versions of 
+    // some of them, then some that are unrelated
+    const size_t numTrain = 700, numQuery = 300, numRelated = 200;
+
+    std::vector<float> train(numTrain * numFloats);
+    std::generate(train.begin(), train.end(), randomFloat);
+
+    std::vector<float> query;
+
+    for (size_t q = 0; q < numRelated; ++q) {
+        const PolarRotation& rotation = rotations[std::rand() % 12];
+        const float* original = &train[q * numFloats];
+
+        for (size_t c = 0; c < rotation.source.size(); ++c) {
+            const float* v = original + 2 * rotation.source[c];
+            query.push_back(v[0] + 0.2f * randomFloat());
+            query.push_back((rotation.conjugate[c]? -v[1] : v[1])
+                             + 0.2f * randomFloat());
+        }
+    }
+
+    query.resize(numQuery * numFloats);
+    std::generate(query.begin() + numRelated * numFloats, query.end(),
+                  randomFloat);
+
+    std::vector<NearestNeighbours> reference 
+        = PolarMatcher(14, 1, 12, 0, PolarMatcher::Instructions::Scalar)
+            .nearestNeighbours(query, train);
+
+    std::vector<NearestNeighbours> result;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        MatchDescriptors matchDescriptors(context.context, context.devices);
+
+        cl::Buffer queryBuffer = createBuffer(context.context, cq, query),
+                   trainBuffer = createBuffer(context.context, cq, train);
+
+        cl::Buffer output = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numQuery * sizeof(NearestNeighbours)
+        };
+
+        matchDescriptors(cq, queryBuffer, numQuery, trainBuffer, numTrain,
+                         output);
+
+        result = readBuffer<NearestNeighbours>(cq, output);
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    float biggestDiscrepancy = 0;
+
+    for (size_t q = 0; q < numQuery; ++q) {
+
+        if (result[q].trainIdx != reference[q].trainIdx
+                || result[q].rotation != reference[q].rotation) {
+            std::cerr << "Query " << q << " matched " << result[q].trainIdx
+                      << " at rotation " << result[q].rotation 
+                      << " rather than " << reference[q].trainIdx 
+                      << " at " << reference[q].rotation << std::endl;
+            return -1;
+        }
+
+        biggestDiscrepancy 
+            = std::max({biggestDiscrepancy,
+                        std::abs(result[q].distance - reference[q].distance),
+                        std::abs(result[q].secondDistance
+                                  - reference[q].secondDistance)});
+    }
+
+    std::cout << "Largest discrepancy: " << biggestDiscrepancy << std::endl;
+
+    if (biggestDiscrepancy > 1.e-3) {
+        std::cerr << "Distances differ from the CPU matcher" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
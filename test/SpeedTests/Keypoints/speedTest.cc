@@ -115,7 +115,7 @@ Workings::Workings(cl::Context& context,
         maxNumKeypoints * descriptorSize
     },
 
-    descriptorsDone { sf.size() * 2 * (numLevels-1) }
+    descriptorsDone { sf.size() * (numLevels-1) }
 {
     
     // Create energy maps for each output level (other than the last,
@@ -181,12 +181,11 @@ void extractKeypoints(cl::CommandQueue& commandQueue,
                         // Start indices within list of the different 
                         // levels; which level to extract; what the maximum
                         // number of keypoints we could be asking for is.
-                workings.descriptors,
+                workings.descriptors, nullptr,
                 workings.peakDetectorResults.listDone(),
                         // The cumulative counts rely on everything else
                         // in the peak detector being done
-                &workings.descriptorsDone[l], &workings.descriptorsDone[l + workings.energyMaps.size()]
-                        // Wait for both coarse and fine to be done
+                &workings.descriptorsDone[l]
                 );
     }
 
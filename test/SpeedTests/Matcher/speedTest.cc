@@ -0,0 +1,141 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include "Matcher/polarMatcher.h"
+#include "Matcher/MatchDescriptors/matchDescriptors.h"
+
+#include <chrono>
+typedef std::chrono::duration<double>
+    DurationSeconds;
+
+#include <sstream>
+
+template <typename T>
+T readStr(const char* string)
+{
+    std::istringstream s(string);
+
+    T result;
+    s >> result;
+    return result;
+}
+
+
+template <typename Function>
+double timeRuns(size_t numIterations, Function f)
+{
+    // Average time taken per run of f, in ms
+    auto start = std::chrono::system_clock::now();
+
+    for (size_t n = 0; n < numIterations; ++n)
+        f();
+
+    auto end = std::chrono::system_clock::now();
+
+    return DurationSeconds(end - start).count() / numIterations * 1000;
+}
+
+
+static float randomFloat()
+{
+    return 2.f * std::rand() / RAND_MAX - 1.f;
+}
+
+
+int main(int argc, const char* argv[])
+{
+    // Time matching one frame's descriptors against another's, under all
+    // rotations, on the CPU with each instruction set and on the device.
+    // Defaults to 1000 against 1000, averaged over 20 runs.
+
+    size_t numQuery = 1000, numTrain = 1000, numIterations = 20;
+
+    // First and second arguments: number of query and training descriptors
+    if (argc > 2) {
+        numQuery = readStr<size_t>(argv[1]);
+        numTrain = readStr<size_t>(argv[2]);
+    }
+
+    // Third argument: number of iterations
+    if (argc > 3) {
+        numIterations = readStr<size_t>(argv[3]);
+    }
+
+    const size_t numFloats = 14 * 6 * 2;
+
+    std::vector<float> query(numQuery * numFloats), 
+                       train(numTrain * numFloats);
+    std::generate(query.begin(), query.end(), randomFloat);
+    std::generate(train.begin(), train.end(), randomFloat);
+
+    const PolarMatcher::Instructions instructionSets[] = {
+        PolarMatcher::Instructions::Scalar,
+        PolarMatcher::Instructions::AVX2,
+        PolarMatcher::Instructions::AVX512
+    };
+    const char* instructionSetNames[] = {"scalar", "AVX2", "AVX-512"};
+
+    for (int i = 0; i < 3; ++i) {
+
+        if (!PolarMatcher::isSupported(instructionSets[i]))
+            continue;
+
+        // One thread, then as many as there are
+        for (unsigned int numThreads: {1u, 0u}) {
+
+            PolarMatcher matcher(14, 1, 12, numThreads, instructionSets[i]);
+
+            double time = timeRuns(numIterations, [&] () {
+                matcher.nearestNeighbours(query, train);
+            });
+
+            std::cout << instructionSetNames[i] << ", "
+                      << (numThreads? "one thread" : "all threads") << ": "
+                      << time << " ms" << std::endl;
+        }
+    }
+
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        MatchDescriptors matchDescriptors(context.context, context.devices);
+
+        cl::Buffer queryBuffer = createBuffer(context.context, cq, query),
+                   trainBuffer = createBuffer(context.context, cq, train);
+
+        cl::Buffer output = {
+            context.context,
+            CL_MEM_READ_WRITE,
+            numQuery * sizeof(NearestNeighbours)
+        };
+
+        double time = timeRuns(numIterations, [&] () {
+            matchDescriptors(cq, queryBuffer, numQuery, 
+                             trainBuffer, numTrain, output);
+            cq.finish();
+        });
+
+        std::cout << "OpenCL: " << time << " ms" << std::endl;
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
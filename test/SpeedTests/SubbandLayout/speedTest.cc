@@ -0,0 +1,162 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include "DTCWT/dtcwt.h"
+#include "KeypointDetector/EnergyMaps/EnergyMap/energyMap.h"
+#include "KeypointDetector/EnergyMaps/CrossProduct/crossProduct.h"
+#include "KeypointDescriptor/extractDescriptors.h"
+
+#include <chrono>
+typedef std::chrono::duration<double>
+    DurationSeconds;
+
+#include <sstream>
+
+template <typename T>
+T readStr(const char* string)
+{
+    std::istringstream s(string);
+
+    T result;
+    s >> result;
+    return result;
+}
+
+
+template <typename Function>
+double timeRuns(cl::CommandQueue& cq, size_t numIterations, Function f)
+{
+    // Average time taken per run of f, in ms
+    auto start = std::chrono::system_clock::now();
+
+    for (size_t n = 0; n < numIterations; ++n)
+        f();
+
+    cq.finish();
+    auto end = std::chrono::system_clock::now();
+
+    return DurationSeconds(end - start).count() / numIterations * 1000;
+}
+
+
+int main(int argc, const char* argv[])
+{
+    // Compare the speed of the consumers of subbands that sample all six
+    // at each point, with the subbands stored as separate slices and
+    // interleaved pixel by pixel.  Defaults to a 720p image with 1000 
+    // keypoints, averaged over 1000 runs.
+
+    size_t width = 1280, height = 720, 
+           numKeypoints = 1000, numIterations = 1000;
+
+    // First and second arguments: width and height
+    if (argc > 2) {
+        width = readStr<size_t>(argv[1]);
+        height = readStr<size_t>(argv[2]);
+    }
+
+    // Third argument: number of keypoints
+    if (argc > 3) {
+        numKeypoints = readStr<size_t>(argv[3]);
+    }
+
+    // Fourth argument: number of iterations
+    if (argc > 4) {
+        numIterations = readStr<size_t>(argv[4]);
+    }
+
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        const int startLevel = 2, numLevels = 3;
+        const std::vector<float> scales = {4.f, 8.f, 16.f};
+
+        DtcwtTemps env {context.context, width, height, 
+                        startLevel, numLevels};
+
+        EnergyMap energyMap(context.context, context.devices);
+        CrossProductMap crossProductMap(context.context, context.devices);
+        DescriptorExtracter descriptorExtracter(context.context, 
+                                                context.devices, 4);
+
+        // Keypoints spread over the finest level, all in list level 0
+        std::vector<float> locations;
+        for (size_t n = 0; n < numKeypoints; ++n) {
+            locations.push_back(width * (std::rand() / float(RAND_MAX) 
+                                           - 0.5f));
+            locations.push_back(height * (std::rand() / float(RAND_MAX)
+                                           - 0.5f));
+            locations.push_back(scales[0]);
+            locations.push_back(1.f);
+        }
+
+        cl::Buffer locationsBuffer = createBuffer(context.context, cq,
+                                                  locations);
+
+        std::vector<cl_uint> kpOffsetsV = {0, cl_uint(numKeypoints)};
+        cl::Buffer kpOffsets = {
+            context.context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            kpOffsetsV.size() * sizeof(cl_uint),
+            &kpOffsetsV[0]
+        };
+
+        cl::Buffer descriptors = {
+            context.context, CL_MEM_READ_WRITE,
+            numKeypoints * descriptorExtracter.getNumFloatsInDescriptor()
+                * sizeof(float)
+        };
+
+        for (bool interleaved: {false, true}) {
+
+            DtcwtOutput out = env.createOutputs(interleaved);
+
+            cl::Image2D map = createImage2D(context.context, 
+                                            out[0].width(), 
+                                            out[0].height());
+
+            std::cout << (interleaved? "Interleaved" : "Separate slices")
+                      << ":" << std::endl;
+
+            std::cout << "EnergyMap: " 
+                << timeRuns(cq, numIterations, [&] () {
+                        energyMap(cq, out[0], map);
+                   })
+                << " ms" << std::endl;
+
+            std::cout << "CrossProductMap: " 
+                << timeRuns(cq, numIterations, [&] () {
+                        crossProductMap(cq, out[0], map);
+                   })
+                << " ms" << std::endl;
+
+            std::cout << "DescriptorExtracter: " 
+                << timeRuns(cq, numIterations, [&] () {
+                        descriptorExtracter(cq, out, scales,
+                                            locationsBuffer, kpOffsets, 
+                                            0, 1, numKeypoints, 
+                                            descriptors);
+                   })
+                << " ms" << std::endl;
+        }
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+    }
+                     
+    return 0;
+}
+
@@ -3,6 +3,24 @@
 #include <vector>
 #include <string>
 #include "hdf5/hdfwriter.h"
+#include "../keypointFrames.h"
+
+// Write some frames straight out and some through the background writer,
+// and check the buffered file reads back as written.
+
+
+static std::vector<float> readTable(H5::H5File& file, const std::string& name,
+                                    hsize_t dims[2])
+{
+    H5::DataSet dataset = file.openDataSet(name);
+    dataset.getSpace().getSimpleExtentDims(dims);
+
+    std::vector<float> values(dims[0] * dims[1]);
+    if (!values.empty())
+        dataset.read(&values[0], H5::PredType::NATIVE_FLOAT);
+
+    return values;
+}
 
 
 
@@ -17,6 +35,82 @@ int main()
     hwtest.append(2, &zeros[0], &zeros[0]);
     hwtest.append(1, &zeros[0], &zeros[0]);
 
+
+    // Frames of varying sizes (some empty), flushed in batches of 7 (and
+    // sooner if big), with small compressed chunks so the tables grow a lot
+    const size_t numFrames = 100, keypointLength = 5, descriptorLength = 12;
+
+    std::vector<float> allKeypoints, allDescriptors;
+    std::vector<hsize_t> allFrames;
+
+    try {
+
+        HDFWriterSettings settings;
+        settings.flushFrames = 7;
+        settings.flushBytes = 4096;
+        settings.chunkRows = 16;
+        settings.chunkCacheBytes = 1 << 20;
+        settings.shuffle = HDFShuffle::Byte;
+        settings.compression = HDFCompression::Deflate;
+
+        HDFWriter buffered("test3.h5", descriptorLength, keypointLength,
+                           settings);
+
+        for (size_t f = 0; f < numFrames; ++f) {
+
+            const size_t numKeypoints = frameNumKeypoints(f);
+
+            std::vector<float> keypoints, descriptors;
+            makeFrame(f, keypointLength, descriptorLength,
+                      keypoints, descriptors);
+
+            allFrames.push_back(allKeypoints.size() / keypointLength);
+            allFrames.push_back(numKeypoints);
+
+            allKeypoints.insert(allKeypoints.end(), 
+                                keypoints.begin(), keypoints.end());
+            allDescriptors.insert(allDescriptors.end(),
+                                  descriptors.begin(), descriptors.end());
+
+            // The writer has its own copy, so these can go now
+            buffered.append(numKeypoints, keypoints.data(), 
+                            descriptors.data());
+        }
+
+        buffered.flush();
+
+
+        H5::H5File file("test3.h5", H5F_ACC_RDONLY);
+        hsize_t dims[2];
+
+        H5::DataSet framesSet = file.openDataSet("frames");
+        framesSet.getSpace().getSimpleExtentDims(dims);
+        std::vector<hsize_t> frames(dims[0] * dims[1]);
+        framesSet.read(&frames[0], H5::PredType::NATIVE_HSIZE);
+
+        if (frames != allFrames) {
+            std::cerr << "Frames table is wrong" << std::endl;
+            return -1;
+        }
+
+        if (readTable(file, "keypoints", dims) != allKeypoints
+                || dims[1] != keypointLength) {
+            std::cerr << "Keypoints table is wrong" << std::endl;
+            return -1;
+        }
+
+        if (readTable(file, "descriptors", dims) != allDescriptors
+                || dims[1] != descriptorLength) {
+            std::cerr << "Descriptors table is wrong" << std::endl;
+            return -1;
+        }
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+
     return 0;
 }
 
@@ -0,0 +1,119 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include "hdf5/hdfwriter.h"
+#include "hdf5/hdfreader.h"
+#include "../keypointFrames.h"
+
+// Write frames of varying sizes, then read them back in ranges: in order,
+// at random, within blocks and across them, with and without prefetching.
+
+
+static const size_t keypointLength = 5, descriptorLength = 12;
+
+
+static bool checkRange(const HDFFrameRange& range)
+{
+    // Each frame's values are where they should be, in the range as a
+    // whole as well as frame by frame
+    const float* allKeypoints = range.keypoints();
+    const float* allDescriptors = range.descriptors();
+    size_t numKeypoints = 0;
+
+    for (size_t f = range.begin(); f < range.end(); ++f) {
+
+        const size_t n = range.numKeypoints(f);
+
+        if (!checkFrame(f, keypointLength, descriptorLength, n,
+                        range.keypoints(f), range.descriptors(f))
+             || !checkFrame(f, keypointLength, descriptorLength, n,
+                    allKeypoints + numKeypoints * keypointLength,
+                    allDescriptors + numKeypoints * descriptorLength))
+            return false;
+
+        numKeypoints += n;
+    }
+
+    return numKeypoints == range.numKeypoints();
+}
+
+
+
+int main()
+{
+    const size_t numFrames = 1000;
+
+    try {
+
+        {
+            HDFWriter writer("testReader.h5", descriptorLength,
+                             keypointLength);
+
+            std::vector<float> keypoints, descriptors;
+            for (size_t f = 0; f < numFrames; ++f) {
+                makeFrame(f, keypointLength, descriptorLength,
+                          keypoints, descriptors);
+                writer.append(frameNumKeypoints(f), keypoints.data(),
+                              descriptors.data());
+            }
+        }
+
+        HDFFrameRange kept;
+
+        {
+            // Small blocks and cache, so there is plenty of coming and going
+            HDFReader reader("testReader.h5", 64, 4);
+
+            if (reader.numFrames() != numFrames
+                    || reader.keypointLength() != keypointLength
+                    || reader.descriptorLength() != descriptorLength) {
+                std::cerr << "Wrong table sizes" << std::endl;
+                return -1;
+            }
+
+            // In order, a few frames at a time
+            for (size_t f = 0; f < numFrames; f += 10)
+                if (!checkRange(reader.read(f, std::min(f + 10, 
+                                                        numFrames)))) {
+                    std::cerr << "Sequential read wrong at frame " << f
+                              << std::endl;
+                    return -1;
+                }
+
+            // At random, some across blocks, some prefetched
+            for (int n = 0; n < 200; ++n) {
+                const size_t begin = std::rand() % numFrames;
+                const size_t end = std::min(numFrames, 
+                                            begin + std::rand() % 150);
+
+                if (n % 2)
+                    reader.prefetch(begin, end);
+
+                if (!checkRange(reader.read(begin, end))) {
+                    std::cerr << "Random read wrong from frame " << begin
+                              << " to " << end << std::endl;
+                    return -1;
+                }
+            }
+
+            kept = reader.read(100, 120);
+        }
+
+        // Views outlive the reader
+        if (!checkRange(kept)) {
+            std::cerr << "Range wrong after the reader has gone" 
+                      << std::endl;
+            return -1;
+        }
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
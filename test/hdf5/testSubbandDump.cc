@@ -0,0 +1,160 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include "DTCWT/dtcwt.h"
+#include "hdf5/subbandDump.h"
+
+// Save a few frames of DTCWT output in each format and read them back,
+// checking they come back within what the format can hold.
+
+
+typedef std::vector<std::vector<Complex<cl_float>>> FrameValues;
+
+
+static FrameValues randomFrame(const DtcwtOutput& out)
+{
+    // Values for each level, as Subbands::write takes them
+    FrameValues frame;
+
+    for (const Subbands& level: out) {
+        frame.push_back(std::vector<Complex<cl_float>>(
+                            6 * level.width() * level.height()));
+
+        for (auto& v: frame.back())
+            v = {2.f * std::rand() / RAND_MAX - 1.f,
+                 2.f * std::rand() / RAND_MAX - 1.f};
+    }
+
+    return frame;
+}
+
+
+static float maxError(const std::vector<Complex<cl_float>>& expected,
+                      const std::vector<Complex<cl_float>>& actual)
+{
+    float biggest = 0.f;
+    for (size_t n = 0; n < expected.size(); ++n)
+        biggest = std::max({biggest,
+                            std::abs(expected[n].real - actual[n].real),
+                            std::abs(expected[n].imag - actual[n].imag)});
+
+    return biggest;
+}
+
+
+
+int main()
+{
+    const size_t numFrames = 4;
+
+    // Values are up to 1, so the errors of each format are at most
+    const SubbandFormat formats[] = {
+        SubbandFormat::Float, SubbandFormat::Half, SubbandFormat::Char
+    };
+    const float tolerances[] = {0.f, 1.f / 2048, 0.5f / 127 + 1e-6f};
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        // Levels 2 to 4 of a 128 x 96 image
+        DtcwtTemps env(context.context, 128, 96, 2, 3);
+        DtcwtOutput out = env.createOutputs(), readOut = env.createOutputs();
+
+        for (int f = 0; f < 3; ++f) {
+
+            SubbandDumpSettings settings;
+            settings.format = formats[f];
+            settings.shuffle = HDFShuffle::Byte;
+            settings.compression = HDFCompression::Deflate;
+
+            std::vector<FrameValues> frames;
+
+            {
+                SubbandDumpWriter writer(context.context, 
+                                         "testSubbandDump.h5", settings);
+
+                for (size_t n = 0; n < numFrames; ++n) {
+
+                    frames.push_back(randomFrame(out));
+                    for (size_t l = 0; l < frames.back().size(); ++l)
+                        out[l].write(cq, &frames.back()[l][0]);
+
+                    // Not overwritten until it is read back
+                    cl::Event done;
+                    writer(cq, out, {}, &done);
+                    done.wait();
+                }
+            }
+
+            SubbandDumpReader reader("testSubbandDump.h5");
+
+            if (reader.numFrames() != numFrames 
+                    || reader.numLevels() != out.numLevels()
+                    || reader.startLevel() != out.startLevel()
+                    || reader.format() != formats[f]) {
+                std::cerr << "Wrong frames, levels or format" << std::endl;
+                return -1;
+            }
+
+            float biggestError = 0.f;
+
+            for (size_t n = 0; n < numFrames; ++n) {
+
+                reader.read(cq, n, readOut);
+
+                for (size_t l = 0; l < out.numLevels(); ++l) {
+                    // Straight from the file, and as uploaded
+                    std::vector<Complex<cl_float>> 
+                        values(frames[n][l].size()),
+                        uploaded(frames[n][l].size());
+
+                    reader.read(n, l, &values[0]);
+
+                    const size_t sliceSize = readOut[l].width() 
+                                           * readOut[l].height();
+                    for (int s = 0; s < 6; ++s)
+                        readOut[l].read(cq, &uploaded[s * sliceSize],
+                                        {}, s);
+
+                    biggestError = std::max({
+                        biggestError, maxError(frames[n][l], values),
+                        maxError(frames[n][l], uploaded)
+                    });
+                }
+            }
+
+            std::cout << "Format " << f << ": largest error " 
+                      << biggestError << std::endl;
+
+            if (biggestError > tolerances[f]) {
+                std::cerr << "Subbands read back wrong" << std::endl;
+                return -1;
+            }
+        }
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
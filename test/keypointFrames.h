@@ -0,0 +1,71 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef KEYPOINTFRAMES_H
+#define KEYPOINTFRAMES_H
+
+#include <vector>
+#include <cstddef>
+
+// Frames of keypoints and descriptors for the file format tests to write
+// and check.  The frames vary in size (some are empty), and each value
+// says which frame and element it is, so anything read back from the
+// wrong place shows.
+
+
+inline size_t frameNumKeypoints(size_t frame)
+{
+    return (frame * 7) % 23;
+}
+
+
+inline float keypointValue(size_t frame, size_t k)
+{
+    return frame + 0.001f * k;
+}
+
+
+inline float descriptorValue(size_t frame, size_t k)
+{
+    return -float(frame) - 0.001f * k;
+}
+
+
+inline void makeFrame(size_t frame,
+                      size_t keypointLength, size_t descriptorLength,
+                      std::vector<float>& keypoints,
+                      std::vector<float>& descriptors)
+{
+    // The keypoints and descriptors of frame, in place of any there were
+    const size_t numKeypoints = frameNumKeypoints(frame);
+
+    keypoints.clear();
+    for (size_t k = 0; k < numKeypoints * keypointLength; ++k)
+        keypoints.push_back(keypointValue(frame, k));
+
+    descriptors.clear();
+    for (size_t k = 0; k < numKeypoints * descriptorLength; ++k)
+        descriptors.push_back(descriptorValue(frame, k));
+}
+
+
+inline bool checkFrame(size_t frame,
+                       size_t keypointLength, size_t descriptorLength,
+                       size_t numKeypoints,
+                       const float* keypoints, const float* descriptors)
+{
+    // Whether frame was read back as made
+    if (numKeypoints != frameNumKeypoints(frame))
+        return false;
+
+    for (size_t k = 0; k < numKeypoints * keypointLength; ++k)
+        if (keypoints[k] != keypointValue(frame, k))
+            return false;
+
+    for (size_t k = 0; k < numKeypoints * descriptorLength; ++k)
+        if (descriptors[k] != descriptorValue(frame, k))
+            return false;
+
+    return true;
+}
+
+
+#endif
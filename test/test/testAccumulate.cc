@@ -59,6 +59,40 @@ int main()
     for (cl_uint n: cumSums)
         std::cout << n << std::endl;
 
+    // Now with lists that overflowed: room for {10, 5, 5, 5} of them
+    std::vector<cl_uint> maxCountsV = {10, 5, 5, 5};
+    cl::Buffer maxCounts = {
+        context.context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        maxCountsV.size() * sizeof(cl_uint),
+        &maxCountsV[0]
+    };
+
+    cl::Buffer stats = {
+        context.context,
+        CL_MEM_READ_WRITE,
+        3 * counts.size() * sizeof(cl_uint),
+        nullptr
+    };
+
+    accumulate(cq, countsInput, countsInput, maxCounts, 
+                   cumSumOutput, 14, stats);
+
+    std::vector<cl_uint> clampedCumSums = readBuffer<cl_uint>(cq, cumSumOutput);
+    std::vector<cl_uint> statsV = readBuffer<cl_uint>(cq, stats);
+
+    // (found, output, dropped) for each
+    std::vector<cl_uint> expectedStats = {12, 10, 2,
+                                           5,  4, 1,
+                                           1,  0, 1,
+                                           3,  0, 3};
+    std::vector<cl_uint> expectedCumSums = {0, 10, 14, 14, 14};
+
+    if (statsV != expectedStats || clampedCumSums != expectedCumSums) {
+        std::cerr << "Overflow statistics wrong" << std::endl;
+        return -1;
+    }
+
                      
     return 0;
 }
@@ -0,0 +1,163 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include <iomanip>
+
+
+#include "KeypointDetector/Bucket/bucket.h"
+
+
+static std::vector<std::tuple<float, float>> 
+    runBucket(cl::Context& context, cl::CommandQueue& cq, Bucket& bucket,
+              cl::Buffer& input, cl::Buffer& coarser, cl::Buffer& counts,
+              size_t maxPerCell, float cellSize, float radius,
+              bool soaLayout = false)
+{
+    // Run bucketing, and return the sorted positions that survive
+    const size_t posLen = 4;
+    const size_t maxLen = input.getInfo<CL_MEM_SIZE>() 
+                            / (posLen * sizeof(float));
+
+    cl::Buffer output = {
+        context,
+        CL_MEM_READ_WRITE,
+        maxLen * posLen * sizeof(float)
+    };
+
+    cl_uint zero = 0;
+    cl::Buffer outputCount = {
+        context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_uint),
+        &zero
+    };
+
+    bucket(cq, input, counts, 0, input, -1, coarser, 2,
+               maxPerCell, cellSize, radius,
+               output, outputCount, 0);
+
+    std::vector<cl_uint> n = readBuffer<cl_uint>(cq, outputCount);
+    std::vector<float> outputV = readBuffer<float>(cq, output);
+
+    std::vector<std::tuple<float, float>> result;
+    for (size_t i = 0; i < n[0]; ++i)
+        if (soaLayout)
+            result.emplace_back(outputV[i], outputV[maxLen + i]);
+        else
+            result.emplace_back(outputV[i*posLen], outputV[i*posLen + 1]);
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+
+int main()
+{
+
+    CLContext context;
+
+    // Ready the command queue on the first device to hand
+    cl::CommandQueue cq(context.context, context.devices[0]);
+
+    //-----------------------------------------------------------------
+    // Starting test code
+    
+    Bucket bucket(context.context, context.devices, 4);
+
+    // Candidates in (x, y, scale, strength) format
+    std::vector<float> inputV = {
+         1, 1, 4, 5,
+         2, 2, 4, 7,
+        15, 1, 4, 3,
+        -3, 1, 4, 2,
+        -4, 2, 4, 1,
+        16, 8, 4, 3
+    };
+
+    std::vector<float> coarserV = {
+         1, 1.5f, 8, 6,
+        30, 30,   8, 10
+    };
+
+    cl::Buffer input = createBuffer(context.context, cq, inputV);
+    cl::Buffer coarser = createBuffer(context.context, cq, coarserV);
+
+    // Counts for input, (absent) finer and coarser
+    std::vector<cl_uint> countsV = {6, 0, 2};
+    cl::Buffer counts = {
+        context.context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        countsV.size() * sizeof(cl_uint),
+        &countsV[0]
+    };
+
+    typedef std::vector<std::tuple<float, float>> Positions;
+
+    // One per 10x10 cell: ties go to the earlier in the list
+    Positions bucketed = runBucket(context.context, cq, bucket,
+                                   input, coarser, counts,
+                                   1, 10.f, 0.f);
+    Positions bucketedExpected = {
+        std::make_tuple(-3.f, 1.f),
+        std::make_tuple( 2.f, 2.f),
+        std::make_tuple(15.f, 1.f)
+    };
+
+    // Radius of one keypoint scale, including the coarser list
+    Positions suppressed = runBucket(context.context, cq, bucket,
+                                     input, coarser, counts,
+                                     0, 0.f, 1.f);
+    Positions suppressedExpected = {
+        std::make_tuple( 2.f, 2.f),
+        std::make_tuple(15.f, 1.f),
+        std::make_tuple(16.f, 8.f)
+    };
+
+    // The same again, with the lists as separate arrays per component
+    Bucket bucketSoA(context.context, context.devices, 4, true);
+
+    auto toSoA = [] (const std::vector<float>& v) {
+        std::vector<float> result(v.size());
+        const size_t n = v.size() / 4;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t c = 0; c < 4; ++c)
+                result[c*n + i] = v[i*4 + c];
+        return result;
+    };
+
+    cl::Buffer inputSoA = createBuffer(context.context, cq, toSoA(inputV));
+    cl::Buffer coarserSoA = createBuffer(context.context, cq, 
+                                         toSoA(coarserV));
+
+    Positions suppressedSoA = runBucket(context.context, cq, bucketSoA,
+                                        inputSoA, coarserSoA, counts,
+                                        0, 0.f, 1.f, true);
+
+    if (bucketed != bucketedExpected) {
+        std::cerr << "Bucketing kept the wrong peaks" << std::endl;
+        return -1;
+    }
+
+    if (suppressed != suppressedExpected) {
+        std::cerr << "Radius suppression kept the wrong peaks" << std::endl;
+        return -1;
+    }
+
+    if (suppressedSoA != suppressedExpected) {
+        std::cerr << "Radius suppression with separate arrays kept the "
+                     "wrong peaks" << std::endl;
+        return -1;
+    }
+                     
+    return 0;
+}
+
+
@@ -76,6 +76,37 @@ int main()
         std::cout << n << " ";
     std::cout << std::endl;
 
+
+    // The same lists as separate arrays for each component: the input has
+    // room for four items, the output for five
+    Concat concatSoA(context.context, context.devices, true);
+
+    auto toSoA = [] (const std::vector<float>& v, size_t len) {
+        std::vector<float> result(v.size());
+        const size_t n = v.size() / len;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t c = 0; c < len; ++c)
+                result[c*n + i] = v[i*len + c];
+        return result;
+    };
+
+    cl::Buffer valuesSoA = createBuffer(context.context, cq,
+                                        toSoA(valuesV, 2));
+    cl::Buffer outputSoA = {
+        context.context,
+        CL_MEM_READ_WRITE,
+        outputV.size() * sizeof(float)
+    };
+
+    concatSoA(cq, valuesSoA, outputSoA, cumCount, 0, 2);
+    concatSoA(cq, valuesSoA, outputSoA, cumCount, 1, 2);
+
+    if (readBuffer<float>(cq, outputSoA) != toSoA(outputV, 2)) {
+        std::cerr << "Structure-of-arrays concatenation differs" 
+                  << std::endl;
+        return -1;
+    }
+
                      
     return 0;
 }
@@ -11,11 +11,56 @@
 
 #include <iomanip>
 #include <stdexcept>
+#include <algorithm>
 
 
 #include "KeypointDetector/FindMax/findMax.h"
 
 
+static std::vector<std::vector<float>>
+    runFindMax(cl::Context& context, cl::CommandQueue& cq, FindMax& findMax,
+               cl::Image2D& inImage, cl::Image2D& zeroImg,
+               size_t maxNumOutputs, bool soaLayout)
+{
+    // Run the peak finding, and return the peaks found as records, sorted
+    // (since the order they are found in is up to the device)
+    const size_t posLen = findMax.getPosLength();
+
+    cl::Buffer outputs = {
+        context,
+        0,              // Flags
+        maxNumOutputs * posLen * sizeof(float) // Size to allocate
+    };
+
+    cl_uint zero = 0;
+    cl::Buffer numOutputs = {
+        context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_uint),
+        &zero
+    };
+
+    findMax(cq, inImage, 4.0,
+                zeroImg, 2.0,
+                zeroImg, 8.0, 
+                0.1f, 0.4f,
+                outputs, 
+                numOutputs, 0);
+
+    const size_t n = std::min<size_t>(maxNumOutputs,
+                                      readBuffer<cl_uint>(cq, numOutputs)[0]);
+    std::vector<float> outputV = readBuffer<float>(cq, outputs);
+
+    std::vector<std::vector<float>> result(n, std::vector<float>(posLen));
+    for (size_t i = 0; i < n; ++i)
+        for (size_t c = 0; c < posLen; ++c)
+            result[i][c] = soaLayout? outputV[c * maxNumOutputs + i]
+                                    : outputV[i * posLen + c];
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
 
 
 int main()
@@ -115,10 +160,24 @@ int main()
         }
 
 
+        // The same peaks as separate arrays for each component (with
+        // room for more than there are, so the arrays are spaced out)
+        FindMax findMaxSoA(context.context, context.devices, false, true);
+
+        if (runFindMax(context.context, cq, findMaxSoA, inImage, zeroImg,
+                       16, true)
+             != runFindMax(context.context, cq, findMax, inImage, zeroImg,
+                           16, false)) {
+            std::cerr << "Structure-of-arrays peaks differ" << std::endl;
+            return -1;
+        }
+
+
     }
     catch (cl::Error err) {
         std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
                   << std::endl;
+        return -1;
     }
                      
     return 0;
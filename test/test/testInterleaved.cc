@@ -0,0 +1,117 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "CL/cl.hpp"
+
+#include "util/clUtil.h"
+#include "DTCWT/dtcwt.h"
+#include "KeypointDetector/EnergyMaps/CrossProduct/crossProduct.h"
+
+
+// Check that storing the subbands interleaved gives the same subbands (and
+// energy maps from them) as storing them as separate slices
+
+std::vector<float> readImage2D(cl::CommandQueue& cq, cl::Image2D& image)
+{
+    const size_t width = image.getImageInfo<CL_IMAGE_WIDTH>(),
+                 height = image.getImageInfo<CL_IMAGE_HEIGHT>();
+
+    std::vector<float> output(width * height);
+    cq.enqueueReadImage(image, CL_TRUE, 
+                        makeCLSizeT<3>({0, 0, 0}), 
+                        makeCLSizeT<3>({width, height, 1}),
+                        0, 0, &output[0]);
+
+    return output;
+}
+
+
+int main()
+{
+    const size_t width = 160, height = 120;
+
+    try {
+
+        CLContext context;
+
+        // Ready the command queue on the first device to hand
+        cl::CommandQueue cq(context.context, context.devices[0]);
+
+        ImageBuffer<cl_float> inImage { 
+            context.context, CL_MEM_READ_WRITE,
+            width, height, 16, 32
+        };
+
+        std::vector<cl_float> input(width * height);
+        for (auto& v: input)
+            v = std::rand() / float(RAND_MAX);
+        inImage.write(cq, &input[0]);
+
+        Dtcwt dtcwt(context.context, context.devices);
+        CrossProductMap energyMap(context.context, context.devices);
+
+        DtcwtTemps env {context.context, width, height, 1, 4};
+
+        DtcwtOutput separate = env.createOutputs(false),
+                    interleaved = env.createOutputs(true);
+
+        dtcwt(cq, inImage, env, separate);
+        dtcwt(cq, inImage, env, interleaved);
+        cq.finish();
+
+        for (int l = 0; l < separate.numLevels(); ++l) {
+
+            const size_t sbWidth = separate[l].width(),
+                         sbHeight = separate[l].height();
+
+            // Subbands
+            for (int n = 0; n < 6; ++n) {
+                std::vector<Complex<cl_float>> 
+                    a(sbWidth * sbHeight), b(sbWidth * sbHeight);
+
+                separate[l].read(cq, &a[0], {}, n);
+                interleaved[l].read(cq, &b[0], {}, n);
+
+                for (size_t i = 0; i < a.size(); ++i)
+                    if (a[i].real != b[i].real || a[i].imag != b[i].imag) {
+                        std::cerr << "Level " << l << " subband " << n
+                                  << " differs when interleaved" 
+                                  << std::endl;
+                        return -1;
+                    }
+            }
+
+            // Energy maps
+            cl::Image2D mapA = createImage2D(context.context, 
+                                             sbWidth, sbHeight),
+                        mapB = createImage2D(context.context, 
+                                             sbWidth, sbHeight);
+
+            energyMap(cq, separate[l], mapA);
+            energyMap(cq, interleaved[l], mapB);
+
+            std::vector<float> a = readImage2D(cq, mapA),
+                               b = readImage2D(cq, mapB);
+
+            for (size_t i = 0; i < a.size(); ++i)
+                if (std::abs(a[i] - b[i]) > 1e-6f * (1.f + std::abs(a[i]))) {
+                    std::cerr << "Level " << l << " energy map differs "
+                              << "when interleaved" << std::endl;
+                    return -1;
+                }
+        }
+
+    }
+    catch (cl::Error err) {
+        std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -11,12 +11,50 @@
 #include <iomanip>
 
 #include <stdexcept>
+#include <algorithm>
 
 
 
 #include "KeypointDetector/peakDetector.h"
 
 
+typedef std::vector<std::tuple<float, float, float>> Peaks;
+
+
+static Peaks runPeakDetector(cl::Context& context, cl::CommandQueue& cq,
+                             const std::vector<cl::Device>& devices,
+                             bool scaleSpaceMax,
+                             const std::vector<cl::Image*>& maps,
+                             const std::vector<float>& scales)
+{
+    // Find the peaks in maps, and return them as (scale, x, y), sorted
+    // (since the order within a level is up to the device)
+    PeakDetector peakDetector(context, devices, scaleSpaceMax);
+
+    PeakDetectorResults results
+        = peakDetector.createResultsStructure(
+                        std::vector<size_t>(maps.size(), 10),
+                        10 * maps.size());
+
+    peakDetector(cq, maps, scales, 0.1f, 0.4f, results);
+    cq.finish();
+
+    const size_t numPeaks 
+        = readBuffer<cl_uint>(cq, results.cumCounts())[maps.size()];
+    const std::vector<float> list = readBuffer<float>(cq, results.list());
+    const size_t posLen = results.numFloatsPerPosition();
+
+    Peaks peaks;
+    for (size_t n = 0; n < numPeaks; ++n)
+        peaks.push_back(std::make_tuple(list[n * posLen + 2],
+                                        list[n * posLen + 0],
+                                        list[n * posLen + 1]));
+
+    std::sort(peaks.begin(), peaks.end());
+    return peaks;
+}
+
+
 
 
 int main()
@@ -37,7 +75,7 @@ int main()
         PeakDetectorResults results
             = peakDetector.createResultsStructure({20, 20}, 20);
 
-        const size_t posLen = 4;
+        const size_t posLen = peakDetector.getPosLength();
         // Number of floats in each position
 
         const int width = 20, height = 20;
@@ -94,10 +132,66 @@ int main()
 
         }
 
+
+        // Maps from two interleaved trees, listed tree by tree (so the
+        // neighbours in scale are not the neighbours in the list).  The
+        // same blob is at the centre of the scale 4 and scale 7 maps,
+        // stronger in the first, and there are lone blobs in the finest
+        // and coarsest maps.
+        const int size = 21, centre = 10;
+        const std::vector<float> scales = {4.f, 3.5f, 8.f, 7.f};
+
+        std::vector<std::vector<float>> mapData(scales.size(),
+                                        std::vector<float>(size * size, 0.f));
+        mapData[0][centre * size + centre] = 2.f;
+        mapData[3][centre * size + centre] = 1.f;
+        mapData[1][3 * size + 3] = 1.f;
+        mapData[2][17 * size + 17] = 1.f;
+
+        std::vector<cl::Image2D> mapImages;
+        for (auto& d: mapData) {
+            mapImages.emplace_back(context.context, CL_MEM_READ_WRITE,
+                                   cl::ImageFormat(CL_LUMINANCE, CL_FLOAT),
+                                   size, size, 0);
+            writeImage2D(cq, mapImages.back(), &d[0]);
+        }
+        cq.finish();
+
+        std::vector<cl::Image*> maps;
+        for (auto& m: mapImages)
+            maps.push_back(&m);
+
+        // Positions are relative to the image centre, in original image
+        // pixels
+        const Peaks scaleSpaceExpected = {
+            std::make_tuple(3.5f, 3.5f * (3 - centre), 3.5f * (3 - centre)),
+            std::make_tuple(4.f, 0.f, 0.f),
+            std::make_tuple(8.f, 8.f * (17 - centre), 8.f * (17 - centre))
+        };
+
+        Peaks allExpected = scaleSpaceExpected;
+        allExpected.push_back(std::make_tuple(7.f, 0.f, 0.f));
+        std::sort(allExpected.begin(), allExpected.end());
+
+        if (runPeakDetector(context.context, cq, context.devices, true,
+                            maps, scales) != scaleSpaceExpected) {
+            std::cerr << "Maxima over scale space kept the wrong peaks"
+                      << std::endl;
+            return -1;
+        }
+
+        if (runPeakDetector(context.context, cq, context.devices, false,
+                            maps, scales) != allExpected) {
+            std::cerr << "Maxima within each map kept the wrong peaks"
+                      << std::endl;
+            return -1;
+        }
+
     }
     catch (cl::Error err) {
         std::cerr << "Error: " << err.what() << "(" << err.err() << ")"
                   << std::endl;
+        return -1;
     }
                      
     return 0;
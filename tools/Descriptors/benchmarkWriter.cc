@@ -0,0 +1,176 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <H5Cpp.h>
+
+#include "hdf5/hdfwriter.h"
+
+// Writes the frames of an HDF file (as made by HDFWriter) out again with
+// each of a range of filter settings, reporting how fast each writes and
+// how well it compresses real keypoints and descriptors.
+
+
+struct Setting {
+    const char* name;
+    HDFShuffle shuffle;
+    HDFCompression compression;
+    int level;
+};
+
+
+static const Setting settings[] = {
+    {"none",                HDFShuffle::None, HDFCompression::None,    0},
+    {"deflate 1",           HDFShuffle::None, HDFCompression::Deflate, 1},
+    {"shuffle+deflate 1",   HDFShuffle::Byte, HDFCompression::Deflate, 1},
+    {"shuffle+deflate 4",   HDFShuffle::Byte, HDFCompression::Deflate, 4},
+    {"shuffle+deflate 9",   HDFShuffle::Byte, HDFCompression::Deflate, 9},
+    {"shuffle+lz4",         HDFShuffle::Byte, HDFCompression::LZ4,     0},
+    {"bitshuffle+lz4",      HDFShuffle::Bit,  HDFCompression::LZ4,     0},
+    {"blosc shuffle 5",     HDFShuffle::Byte, HDFCompression::Blosc,   5},
+    {"blosc bitshuffle 5",  HDFShuffle::Bit,  HDFCompression::Blosc,   5},
+};
+
+
+template<typename T>
+static std::vector<T> readTable(H5::H5File& file, const std::string& name,
+                                const H5::DataType& type, hsize_t dims[2],
+                                hsize_t maxRows)
+{
+    // Up to maxRows of a 2D table
+    H5::DataSet dataset = file.openDataSet(name);
+    H5::DataSpace fileSpace = dataset.getSpace();
+    fileSpace.getSimpleExtentDims(dims);
+
+    dims[0] = std::min(dims[0], maxRows);
+
+    std::vector<T> values(dims[0] * dims[1]);
+    if (values.empty())
+        return values;
+
+    const hsize_t offset[2] = {0, 0};
+    fileSpace.selectHyperslab(H5S_SELECT_SET, dims, offset);
+    H5::DataSpace memSpace(2, dims);
+
+    dataset.read(&values[0], type, memSpace, fileSpace);
+
+    return values;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " InputFilename.h5 ScratchFilename.h5 [MaxFrames]"
+                  << std::endl;
+        return -1;
+    }
+
+    const hsize_t maxFrames = (argc > 3)? std::atoi(argv[3]) : 1000;
+
+    try {
+
+        H5::Exception::dontPrint();
+
+        H5::H5File input(argv[1], H5F_ACC_RDONLY);
+
+        hsize_t framesDims[2], keypointsDims[2], descriptorsDims[2];
+
+        const std::vector<hsize_t> frames
+            = readTable<hsize_t>(input, "frames", 
+                                 H5::PredType::NATIVE_HSIZE,
+                                 framesDims, maxFrames);
+        const size_t numFrames = framesDims[0];
+
+        // Only as many keypoints as those frames reach
+        hsize_t numKeypoints = 0;
+        for (size_t f = 0; f < numFrames; ++f)
+            numKeypoints = std::max(numKeypoints, 
+                                    frames[2*f] + frames[2*f+1]);
+
+        const std::vector<float> keypoints
+            = readTable<float>(input, "keypoints", 
+                               H5::PredType::NATIVE_FLOAT,
+                               keypointsDims, numKeypoints);
+        const std::vector<float> descriptors
+            = readTable<float>(input, "descriptors", 
+                               H5::PredType::NATIVE_FLOAT,
+                               descriptorsDims, numKeypoints);
+
+        const size_t keypointLength = keypointsDims[1],
+                     descriptorLength = descriptorsDims[1];
+
+        const double rawBytes = double(numFrames) * 2 * sizeof(hsize_t)
+                              + (keypoints.size() + descriptors.size()) 
+                                  * sizeof(float);
+
+        std::cout << numFrames << " frames, " << numKeypoints 
+                  << " keypoints, " << rawBytes / 1e6 << " MB" << std::endl
+                  << std::left << std::setw(22) << "Setting"
+                  << std::setw(10) << "MB/s" << "Ratio" << std::endl;
+
+        for (const Setting& s: settings) {
+
+            HDFWriterSettings writerSettings;
+            writerSettings.flushFrames = 32;
+            writerSettings.shuffle = s.shuffle;
+            writerSettings.compression = s.compression;
+            writerSettings.compressionLevel = s.level;
+
+            std::cout << std::setw(22) << s.name;
+
+            if (!HDFWriter::filtersAvailable(writerSettings)) {
+                std::cout << "(not available)" << std::endl;
+                continue;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+
+            {
+                HDFWriter output(argv[2], descriptorLength, keypointLength,
+                                 writerSettings);
+
+                for (size_t f = 0; f < numFrames; ++f)
+                    output.append(frames[2*f+1],
+                                  keypoints.data()
+                                    + frames[2*f] * keypointLength,
+                                  descriptors.data()
+                                    + frames[2*f] * descriptorLength);
+
+                output.flush();
+            }
+
+            const std::chrono::duration<double> elapsed
+                = std::chrono::steady_clock::now() - start;
+
+            const double fileBytes 
+                = H5::H5File(argv[2], H5F_ACC_RDONLY).getFileSize();
+
+            std::cout << std::setw(10) << std::setprecision(4)
+                      << rawBytes / 1e6 / elapsed.count()
+                      << rawBytes / fileBytes << std::endl;
+        }
+
+        std::remove(argv[2]);
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,86 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include <H5Cpp.h>
+
+#include "Matcher/descriptorIndex.h"
+
+#include "descriptorFiles.h"
+
+// Builds a DescriptorIndex of all the descriptors in some HDF files (as made
+// by HDFWriter).  Ids in the index count through the descriptors of each
+// file in turn, in the order given.
+
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " OutputFilename.idx InputFilename.h5 [...]"
+                  << std::endl;
+        return -1;
+    }
+
+    const std::vector<std::string> inputs(argv + 2, argv + argc);
+
+    try {
+
+        H5::Exception::dontPrint();
+
+        const size_t descriptorLength
+            = DescriptorIndex().getNumFloatsInDescriptor();
+
+        const size_t total = countDescriptors(inputs, descriptorLength);
+
+        // Lists grow with the square root of the database; train on some
+        // tens of descriptors per list, spread evenly through the files
+        size_t numLists = 16;
+        while (numLists < std::sqrt(double(total)) && numLists < 4096)
+            numLists *= 2;
+
+        if (total < std::max<size_t>(256, numLists)) {
+            std::cerr << "Too few descriptors (" << total << ") to index"
+                      << std::endl;
+            return -1;
+        }
+
+        std::cout << total << " descriptors, " << numLists << " lists"
+                  << std::endl;
+
+        std::vector<float> sample
+            = sampleDescriptors(inputs, descriptorLength,
+                                std::max<size_t>(256, 40 * numLists));
+
+        DescriptorIndex index(14, 1, 12, numLists);
+
+        std::cout << "Training on " << sample.size() / descriptorLength
+                  << " descriptors" << std::endl;
+        index.train(&sample[0], sample.size() / descriptorLength, 10);
+        sample = std::vector<float>();
+
+        forEachDescriptorChunk(inputs, descriptorLength,
+                               [&] (const float* descriptors, size_t num) {
+                                   index.add(descriptors, num);
+                               });
+
+        index.save(argv[1]);
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,101 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include <H5Cpp.h>
+
+#include "hdf5/hdfreader.h"
+#include "hdf5/hdfwriter.h"
+#include "FlatFile/flatFile.h"
+
+// Converts keypoints and descriptors between HDF files (as made by
+// HDFWriter) and flat files (as made by FlatWriter), whichever way round
+// the input is: inputs ending in .h5 become flat files, anything else is
+// taken to be a flat file to make an HDF one of.
+
+
+static bool endsWith(const std::string& s, const std::string& ending)
+{
+    return s.size() >= ending.size()
+        && std::equal(ending.rbegin(), ending.rend(), s.rbegin());
+}
+
+
+static void hdfToFlat(const std::string& input, const std::string& output)
+{
+    HDFReader reader(input);
+    FlatWriter writer(output, reader.descriptorLength(),
+                      reader.keypointLength(), true);
+
+    // A block at a time, reading ahead
+    const size_t blockFrames = 256;
+
+    for (size_t begin = 0; begin < reader.numFrames(); 
+            begin += blockFrames) {
+
+        const HDFFrameRange range
+            = reader.read(begin, std::min(begin + blockFrames, 
+                                          reader.numFrames()));
+
+        for (size_t f = range.begin(); f < range.end(); ++f)
+            writer.append(range.numKeypoints(f), range.keypoints(f),
+                          range.descriptors(f));
+    }
+
+    writer.close();
+}
+
+
+static void flatToHDF(const std::string& input, const std::string& output)
+{
+    FlatReader reader(input);
+
+    HDFWriterSettings settings;
+    settings.flushFrames = 256;
+
+    HDFWriter writer(output, reader.descriptorLength(),
+                     reader.keypointLength(), settings);
+
+    for (size_t f = 0; f < reader.numFrames(); ++f)
+        writer.append(reader.numKeypoints(f), reader.keypoints(f),
+                      reader.descriptors(f));
+
+    writer.flush();
+}
+
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " InputFilename.h5 OutputFilename.flat" << std::endl
+                  << "       " << argv[0]
+                  << " InputFilename.flat OutputFilename.h5" << std::endl;
+        return -1;
+    }
+
+    try {
+
+        H5::Exception::dontPrint();
+
+        if (endsWith(argv[1], ".h5"))
+            hdfToFlat(argv[1], argv[2]);
+        else
+            flatToHDF(argv[1], argv[2]);
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
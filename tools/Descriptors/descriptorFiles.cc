@@ -0,0 +1,131 @@
+// Copyright (C) 2013 Timothy Gale
+#include "descriptorFiles.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <H5Cpp.h>
+
+
+static const size_t chunkSize = 65536;
+
+
+static H5::DataSet openDescriptors(const std::string& filename,
+                                   size_t descriptorLength,
+                                   hsize_t& numDescriptors)
+{
+    H5::H5File file(filename, H5F_ACC_RDONLY);
+    H5::DataSet descriptors = file.openDataSet("descriptors");
+
+    hsize_t dims[2];
+    descriptors.getSpace().getSimpleExtentDims(dims);
+
+    if (dims[1] != descriptorLength)
+        throw std::runtime_error(filename + ": descriptors are the wrong "
+                                 "length");
+
+    numDescriptors = dims[0];
+    return descriptors;
+}
+
+
+static void readRows(H5::DataSet& descriptors, hsize_t begin, hsize_t num,
+                     size_t descriptorLength, float* output)
+{
+    H5::DataSpace fileSpace = descriptors.getSpace();
+
+    hsize_t offset[2] = {begin, 0}, count[2] = {num, descriptorLength};
+    fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+
+    H5::DataSpace memSpace(2, count);
+    descriptors.read(output, H5::PredType::NATIVE_FLOAT, memSpace, fileSpace);
+}
+
+
+
+size_t countDescriptors(const std::vector<std::string>& filenames,
+                        size_t descriptorLength)
+{
+    size_t total = 0;
+
+    for (const std::string& filename: filenames) {
+        hsize_t num;
+        openDescriptors(filename, descriptorLength, num);
+        total += num;
+    }
+
+    return total;
+}
+
+
+std::vector<float> sampleDescriptors(const std::vector<std::string>& filenames,
+                                     size_t descriptorLength,
+                                     size_t numSample)
+{
+    const size_t total = countDescriptors(filenames, descriptorLength);
+    numSample = std::min(numSample, total);
+
+    std::vector<float> sample;
+    sample.reserve(numSample * descriptorLength);
+
+    if (numSample == 0)
+        return sample;
+
+    std::vector<float> chunk(chunkSize * descriptorLength);
+
+    // Take the first descriptor at or after each multiple of stride
+    const double stride = double(total) / numSample;
+    size_t position = 0;
+    double next = 0;
+
+    for (const std::string& filename: filenames) {
+        hsize_t num;
+        H5::DataSet descriptors = openDescriptors(filename, descriptorLength,
+                                                  num);
+
+        for (hsize_t begin = 0; begin < num; begin += chunkSize) {
+            const hsize_t n = std::min<hsize_t>(chunkSize, num - begin);
+
+            // Don't read chunks with nothing wanted in them
+            if (position + n <= next) {
+                position += n;
+                continue;
+            }
+
+            readRows(descriptors, begin, n, descriptorLength, &chunk[0]);
+
+            for (hsize_t r = 0; r < n; ++r, ++position)
+                if (position >= next
+                        && sample.size() < numSample * descriptorLength) {
+                    sample.insert(sample.end(),
+                                  &chunk[r * descriptorLength],
+                                  &chunk[(r + 1) * descriptorLength]);
+                    next += stride;
+                }
+        }
+    }
+
+    return sample;
+}
+
+
+void forEachDescriptorChunk(const std::vector<std::string>& filenames,
+                            size_t descriptorLength,
+                            std::function<void (const float* descriptors,
+                                                size_t num)> f)
+{
+    std::vector<float> chunk(chunkSize * descriptorLength);
+
+    for (const std::string& filename: filenames) {
+        hsize_t num;
+        H5::DataSet descriptors = openDescriptors(filename, descriptorLength,
+                                                  num);
+
+        for (hsize_t begin = 0; begin < num; begin += chunkSize) {
+            const hsize_t n = std::min<hsize_t>(chunkSize, num - begin);
+            readRows(descriptors, begin, n, descriptorLength, &chunk[0]);
+            f(&chunk[0], n);
+        }
+    }
+}
+
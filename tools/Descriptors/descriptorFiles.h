@@ -0,0 +1,34 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef DESCRIPTOR_FILES_H
+#define DESCRIPTOR_FILES_H
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstddef>
+
+// Reading the descriptors from HDF files made by HDFWriter, taking the
+// files in the order given as one long list.  All throw
+// std::runtime_error if the descriptors are not descriptorLength long, and
+// H5::Exception if a file can't be read.
+
+
+size_t countDescriptors(const std::vector<std::string>& filenames,
+                        size_t descriptorLength);
+
+
+std::vector<float> sampleDescriptors(const std::vector<std::string>& filenames,
+                                     size_t descriptorLength,
+                                     size_t numSample);
+// numSample descriptors (or all, if fewer), evenly spread through the files
+
+
+void forEachDescriptorChunk(const std::vector<std::string>& filenames,
+                            size_t descriptorLength,
+                            std::function<void (const float* descriptors,
+                                                size_t num)> f);
+// Call f on all the descriptors in turn, a chunk at a time
+
+
+#endif
+
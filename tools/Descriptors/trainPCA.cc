@@ -0,0 +1,74 @@
+// Copyright (C) 2013 Timothy Gale
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <H5Cpp.h>
+
+#include "KeypointDescriptor/ProjectDescriptors/descriptorPCA.h"
+
+#include "descriptorFiles.h"
+
+// Fits a DescriptorPCA to a sample of the descriptors in some HDF files (as
+// made by HDFWriter), for ProjectDescriptors.
+
+
+// Plenty for a basis of a few hundred dimensions
+static const size_t numSample = 200000;
+
+
+
+int main(int argc, char* argv[])
+{
+    // Inputs follow the flag, if there is one
+    const bool whiten = argc > 3 && std::string(argv[3]) == "-w";
+    const int firstInput = whiten? 4 : 3;
+
+    if (argc <= firstInput) {
+        std::cerr << "Usage: " << argv[0]
+                  << " OutputFilename.pca NumDimensions [-w]"
+                     " InputFilename.h5 [...]" << std::endl
+                  << "  -w  whiten the projections" << std::endl;
+        return -1;
+    }
+
+    const size_t numDimensions = std::atoi(argv[2]);
+
+    const std::vector<std::string> inputs(argv + firstInput, argv + argc);
+
+    try {
+
+        H5::Exception::dontPrint();
+
+        // Descriptor length from the first file
+        hsize_t dims[2];
+        H5::H5File(inputs.at(0), H5F_ACC_RDONLY)
+            .openDataSet("descriptors").getSpace()
+            .getSimpleExtentDims(dims);
+        const size_t descriptorLength = dims[1];
+
+        const std::vector<float> sample
+            = sampleDescriptors(inputs, descriptorLength, numSample);
+        const size_t num = sample.size() / descriptorLength;
+
+        std::cout << "Training on " << num << " descriptors of length "
+                  << descriptorLength << std::endl;
+
+        DescriptorPCA::train(&sample[0], num, descriptorLength, numDimensions,
+                             whiten).save(argv[1]);
+
+    }
+    catch (H5::Exception& err) {
+        std::cerr << "HDF error: " << err.getDetailMsg() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
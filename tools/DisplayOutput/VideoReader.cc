@@ -3,8 +3,11 @@
 
 #include <stdexcept>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <cstring>
+#include <cstdint>
+#include <cerrno>
 #include <iostream>
 #include <algorithm>
 
@@ -19,6 +22,13 @@ VideoReader::VideoReader(VideoReader&& m)
     // Transfer
     fd_ = m.fd_;
     numBuffers_ = m.numBuffers_;
+    memory_ = m.memory_;
+    bytesPerLine_ = m.bytesPerLine_;
+    imageSize_ = m.imageSize_;
+    dequeuedBufferIdxs_ = std::move(m.dequeuedBufferIdxs_);
+    buffers_ = std::move(m.buffers_);
+    pinnedBuffers_ = std::move(m.pinnedBuffers_);
+    cq_ = m.cq_;
 
     // Remove ownership from the other
     m.fd_ = -1;
@@ -27,12 +37,43 @@ VideoReader::VideoReader(VideoReader&& m)
 
 
 VideoReader::VideoReader(const char* filename, int width, int height)
+{
+    setFormat(filename, width, height);
+
+    if (!requestBuffers(V4L2_MEMORY_MMAP))
+        throw std::runtime_error("V4L2 failed requesting mmap streaming"
+                                 " (not supported)");
+
+    buffers_ = mmapBuffers(numBuffers_);
+}
+
+
+
+VideoReader::VideoReader(const char* filename, int width, int height,
+                         cl::Context& context, cl::CommandQueue& cq)
+{
+    setFormat(filename, width, height);
+    cq_ = cq;
+
+    // Fall back to the driver's buffers if it can't use ours
+    if (requestBuffers(V4L2_MEMORY_USERPTR))
+        buffers_ = pinBuffers(context, cq, numBuffers_);
+    else if (requestBuffers(V4L2_MEMORY_MMAP))
+        buffers_ = mmapBuffers(numBuffers_);
+    else
+        throw std::runtime_error("V4L2 failed requesting streaming"
+                                 " (not supported)");
+}
+
+
+
+void VideoReader::setFormat(const char* filename, int width, int height)
 {
     // Open the video device
     fd_ = v4l2_open(filename, O_RDWR | O_NONBLOCK);
 
     // Check it worked
-    if (fd_ == -1) 
+    if (fd_ == -1)
         throw std::runtime_error("Failed to open V4L2 device");
 
     // Create a clear format, to say what output we want
@@ -52,25 +93,51 @@ VideoReader::VideoReader(const char* filename, int width, int height)
      || (format.fmt.pix.pixelformat != V4L2_PIX_FMT_YVU420))
         throw std::logic_error("V4L2 did not match format requested");
 
-    // Set up for streaming with user pointers
+    // Rows may be padded out
+    bytesPerLine_ = std::max<size_t>(format.fmt.pix.bytesperline, width);
+    imageSize_ = format.fmt.pix.sizeimage;
+}
+
+
+
+bool VideoReader::requestBuffers(v4l2_memory memory)
+{
+    // Set up for streaming.  False if the driver doesn't support the
+    // kind of memory.
     v4l2_requestbuffers requestBuffers;
     memset(&requestBuffers, 0, sizeof(requestBuffers));
     requestBuffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    requestBuffers.memory = V4L2_MEMORY_MMAP;
+    requestBuffers.memory = memory;
     requestBuffers.count = 4;
 
     if (v4l2_ioctl(fd_, VIDIOC_REQBUFS, &requestBuffers) == -1) {
         if (errno == EINVAL)
-            throw std::runtime_error("V4L2 failed requesting mmap streaming"
-                                     " (not supported)");
+            return false;
 
-        throw std::runtime_error("V4L2 failed requesting mmap streaming");
+        throw std::runtime_error("V4L2 failed requesting streaming");
     }
 
+    memory_ = memory;
     numBuffers_ = requestBuffers.count;
     std::cout << "num buffers " << numBuffers_ << "\n";
 
-    activeMmaps_ = mmapBuffers(numBuffers_);
+    return true;
+}
+
+
+void VideoReader::releaseBuffers()
+{
+    // Have the driver let go of all the buffers
+    v4l2_requestbuffers requestBuffers;
+    memset(&requestBuffers, 0, sizeof(requestBuffers));
+    requestBuffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    requestBuffers.memory = memory_;
+    requestBuffers.count = 0;
+
+    if (v4l2_ioctl(fd_, VIDIOC_REQBUFS, &requestBuffers) == -1)
+        throw std::runtime_error("V4L2 failed releasing buffers");
+
+    numBuffers_ = 0;
 }
 
 
@@ -99,7 +166,8 @@ std::vector<VideoReaderBuffer> VideoReader::mmapBuffers(int numBuffers)
            v4l2_mmap(nullptr, buf.length,
                      PROT_READ | PROT_WRITE, MAP_SHARED,
                      fd_, buf.m.offset),
-           buf.length
+           buf.length,
+           bytesPerLine_
         };
 
         if (returnBuffer.start == MAP_FAILED)
@@ -111,43 +179,156 @@ std::vector<VideoReaderBuffer> VideoReader::mmapBuffers(int numBuffers)
     return mmaps;
 }
 
+
+std::vector<VideoReaderBuffer> VideoReader::pinBuffers(cl::Context& context,
+                                                       cl::CommandQueue& cq,
+                                                       int numBuffers)
+{
+    // Pinned memory for the driver to capture into, mapped once and for
+    // all, as the Calculator does for its readbacks.  Whole pages, since
+    // drivers generally pin user pointers a page at a time.
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t length = (imageSize_ + pageSize - 1) / pageSize * pageSize;
+
+    std::vector<VideoReaderBuffer> pinned;
+
+    for (int n = 0; n < numBuffers; ++n) {
+
+        cl::Buffer buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                          length);
+
+        void* start = cq.enqueueMapBuffer(buffer, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE,
+                                          0, length);
+
+        if (reinterpret_cast<uintptr_t>(start) % pageSize != 0)
+            throw std::runtime_error("Pinned OpenCL memory is not page "
+                                     "aligned");
+
+        pinnedBuffers_.push_back(buffer);
+        pinned.push_back({__u32(n), start, length, bytesPerLine_});
+    }
+
+    return pinned;
+}
+
+
+void VideoReader::unpinBuffers()
+{
+    // Unmap the pinned buffers, which go once the OpenCL objects do
+    for (size_t n = 0; n < pinnedBuffers_.size(); ++n)
+        cq_.enqueueUnmapMemObject(pinnedBuffers_[n], buffers_[n].start);
+
+    cq_.finish();
+    pinnedBuffers_.clear();
+}
+
+
 void VideoReader::unmmapBuffers(std::vector<VideoReaderBuffer>& buffers)
 {
     // Unmap the buffers
 
     // Unmap all their memory
-    for (const auto& m: buffers) 
+    for (const auto& m: buffers)
         v4l2_munmap(m.start, m.length);
 }
 
+
+void VideoReader::useDriverBuffers()
+{
+    // Give up on user pointers, and memory map the driver's buffers
+    releaseBuffers();
+    unpinBuffers();
+    buffers_.clear();
+
+    if (!requestBuffers(V4L2_MEMORY_MMAP))
+        throw std::runtime_error("V4L2 failed requesting mmap streaming"
+                                 " (not supported)");
+
+    buffers_ = mmapBuffers(numBuffers_);
+}
+
+
 VideoReader::~VideoReader()
 {
     if (fd_ != -1) {
-        unmmapBuffers(activeMmaps_);
+        // Make sure the driver has finished with the buffers (failing
+        // harmlessly if it was never streaming)
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        v4l2_ioctl(fd_, VIDIOC_STREAMOFF, &type);
+
+        if (memory_ == V4L2_MEMORY_MMAP)
+            unmmapBuffers(buffers_);
+        else {
+            try {
+                unpinBuffers();
+            }
+            catch (cl::Error& err) {
+                std::cerr << "VideoReader: unmapping pinned buffers: "
+                          << err.what() << ": " << err.err() << std::endl;
+            }
+        }
 
         v4l2_close(fd_);
     }
 }
 
 
+bool VideoReader::isPinned() const
+{
+    return memory_ == V4L2_MEMORY_USERPTR;
+}
 
-void VideoReader::startCapture()
+
+bool VideoReader::tryEnqueue(const VideoReaderBuffer& buffer)
 {
-    // Set going, and enqueue some buffers to go
-    for (int n = 0; n < numBuffers_; ++n) {
+    // Hand a buffer to the driver to capture into.  False if the driver
+    // won't take it.
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.index = buffer.idx;
+    buf.memory = memory_;
 
-        // Set up the buffer properties
-        v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.index = n;
-        buf.memory = V4L2_MEMORY_MMAP;
+    if (memory_ == V4L2_MEMORY_USERPTR) {
+        buf.m.userptr = reinterpret_cast<unsigned long>(buffer.start);
+        buf.length = buffer.length;
+    }
 
-        if (v4l2_ioctl(fd_, VIDIOC_QBUF, &buf) == -1)
-            throw std::runtime_error("V4L2 failed to enqueue buffer");
+    if (v4l2_ioctl(fd_, VIDIOC_QBUF, &buf) == -1) {
+        if (errno == EFAULT || errno == EINVAL)
+            return false;
 
+        throw std::runtime_error("V4L2 failed to enqueue buffer");
     }
 
+    return true;
+}
+
+
+void VideoReader::enqueue(const VideoReaderBuffer& buffer)
+{
+    if (!tryEnqueue(buffer))
+        throw std::runtime_error("V4L2 failed to enqueue buffer");
+}
+
+
+
+void VideoReader::startCapture()
+{
+    // Set going, and enqueue some buffers to go.  Some drivers accept user
+    // pointers when the buffers are requested, only to refuse them here:
+    // then use their own buffers instead.
+    for (const auto& b: buffers_)
+        if (!tryEnqueue(b)) {
+            if (memory_ != V4L2_MEMORY_USERPTR)
+                throw std::runtime_error("V4L2 failed to enqueue buffer");
+
+            useDriverBuffers();
+            startCapture();
+            return;
+        }
+
     v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     if (v4l2_ioctl(fd_, VIDIOC_STREAMON, &type) == -1)
         throw std::runtime_error("V4L2 failed to start streaming");
@@ -169,7 +350,7 @@ VideoReaderBuffer VideoReader::getFrame()
     v4l2_buffer buf;
     memset(&buf, 0, sizeof(buf));
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = memory_;
 
     int n = 0;
     // Wait for a buffer to become available
@@ -183,22 +364,15 @@ VideoReaderBuffer VideoReader::getFrame()
 
     dequeuedBufferIdxs_.push_back(buf.index);
 
-    return activeMmaps_[buf.index];
+    return buffers_[buf.index];
 }
 
 
 void VideoReader::returnBuffer(const VideoReaderBuffer& buffer)
 {
     // Enqueue the index
-    v4l2_buffer newBuf;
-    memset(&newBuf, 0, sizeof(newBuf));
-    newBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    newBuf.index = buffer.idx;
-    newBuf.memory = V4L2_MEMORY_MMAP;
+    enqueue(buffer);
 
-    if (v4l2_ioctl(fd_, VIDIOC_QBUF, &newBuf) == -1)
-        throw std::runtime_error("V4L2 failed to enqueue buffer");
-    
     auto pos = std::find(dequeuedBufferIdxs_.begin(),
                          dequeuedBufferIdxs_.end(),
                          buffer.idx);
@@ -211,18 +385,8 @@ void VideoReader::returnBuffer(const VideoReaderBuffer& buffer)
 void VideoReader::returnBuffers()
 {
     // Put them all back on the queue
-    for (int idx: dequeuedBufferIdxs_) {
-
-        // Enqueue the index
-        v4l2_buffer newBuf;
-        memset(&newBuf, 0, sizeof(newBuf));
-        newBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        newBuf.index = idx;
-        newBuf.memory = V4L2_MEMORY_MMAP;
-
-        if (v4l2_ioctl(fd_, VIDIOC_QBUF, &newBuf) == -1)
-            throw std::runtime_error("V4L2 failed to enqueue buffer");
-    }
+    for (int idx: dequeuedBufferIdxs_)
+        enqueue(buffers_[idx]);
 
     dequeuedBufferIdxs_.clear();
 }
@@ -6,19 +6,27 @@
 #include <linux/videodev2.h>
 #include <vector>
 
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#include "CL/cl.hpp"
+
 
 // Handy structure to return saying where the memory mapped region is
 struct VideoReaderBuffer {
     __u32 idx;
     void* start;
     size_t length;
+    size_t bytesPerLine;    // Of the luma plane, at the start
 };
 
 class VideoReader {
-    // Class for reading from the webcam.  The idea is that it should be 
-    // able to write into a user buffer.  If that user buffer happens to
-    // be memory mapped into a PBO of the graphics card, so much the 
-    // better...
+    // Class for reading from the webcam.  Given an OpenCL context, the
+    // driver captures straight into pinned OpenCL memory (user pointer
+    // streaming), so frames can be uploaded with no copying on the host;
+    // otherwise, or if the driver can't, it captures into the driver's
+    // own memory mapped buffers.  The vivid driver (modprobe vivid) makes
+    // a virtual device to try it with.
 
 private:
 
@@ -28,12 +36,31 @@ private:
     int numBuffers_ = 0;
     // Number of buffers the streaming has allocated
 
+    v4l2_memory memory_ = V4L2_MEMORY_MMAP;
+    // How the buffers are shared with the driver
+
+    size_t bytesPerLine_ = 0, imageSize_ = 0;
+
     std::vector<int> dequeuedBufferIdxs_;
-    std::vector<VideoReaderBuffer> activeMmaps_;
-    // List of the buffers we have already dequeued.
-    
+    std::vector<VideoReaderBuffer> buffers_;
+    // List of the buffers we have already dequeued, and all of them
+
+    std::vector<cl::Buffer> pinnedBuffers_;
+    cl::CommandQueue cq_;
+    // Behind the buffers, when user pointers, and what mapped them
+
+    void setFormat(const char* filename, int width, int height);
+    bool requestBuffers(v4l2_memory memory);
+    void releaseBuffers();
     std::vector<VideoReaderBuffer> mmapBuffers(int numBuffers);
+    std::vector<VideoReaderBuffer> pinBuffers(cl::Context& context,
+                                              cl::CommandQueue& cq,
+                                              int numBuffers);
+    void unpinBuffers();
     void unmmapBuffers(std::vector<VideoReaderBuffer>& buffers);
+    void useDriverBuffers();
+    bool tryEnqueue(const VideoReaderBuffer& buffer);
+    void enqueue(const VideoReaderBuffer& buffer);
 
 public:
 
@@ -41,21 +68,33 @@ public:
     VideoReader(VideoReader&&);
 
     VideoReader(const char* filename, int width, int height);
+
+    VideoReader(const char* filename, int width, int height,
+                cl::Context& context, cl::CommandQueue& cq);
+    // Capture into buffers allocated from context (CL_MEM_ALLOC_HOST_PTR)
+    // and mapped once with cq, if the driver supports user pointers.  cq
+    // is kept to unmap them.
+
     ~VideoReader();
 
+    bool isPinned() const;
+    // Whether frames are captured into pinned OpenCL memory
+
     void startCapture();
-    // Start streaming in
+    // Start streaming in.  If the driver refuses the pinned buffers only
+    // now, the driver's own are used instead (so isPinned() is then
+    // false).
 
     void stopCapture();
     // Start streaming in
-    
-    VideoReaderBuffer getFrame(); 
+
+    VideoReaderBuffer getFrame();
     // Return the memory-mapped region for a frame
 
     void returnBuffer(const VideoReaderBuffer&);
     // Return a buffer that has previously been dequeued, so that the driver
     // can start using them again
-    
+
     void returnBuffers();
     // Return buffers that have previously been dequeued, so that the driver
     // can start using them again
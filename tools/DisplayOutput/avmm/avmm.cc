@@ -338,7 +338,11 @@ namespace AV {
         if (classOwnsBuffer_)
             avpicture_free(reinterpret_cast<AVPicture*>(frame_));
 
+#if AVMM_REFCOUNTED_FRAMES
+        av_frame_free(&frame_);
+#else
         av_free(frame_);
+#endif
 
         // Acquire new ones
         frame_ = rval.frame_;
@@ -382,7 +386,12 @@ namespace AV {
         if (classOwnsBuffer_)
             avpicture_free(reinterpret_cast<AVPicture*>(frame_));
 
+#if AVMM_REFCOUNTED_FRAMES
+        // Also lets go of anything decoded into it
+        av_frame_free(&frame_);
+#else
         av_free(frame_);
+#endif
     }
 
 
@@ -467,6 +476,21 @@ namespace AV {
     }
 
 
+    bool Frame::isInterlaced() const
+    {
+        return frame_->interlaced_frame != 0;
+    }
+
+
+    void Frame::unreference()
+    {
+#if AVMM_REFCOUNTED_FRAMES
+        if (!classOwnsBuffer_)
+            av_frame_unref(frame_);
+#endif
+    }
+
+
     void Frame::writePPM() const
     {
         std::ofstream out("test.ppm");
@@ -485,6 +509,98 @@ namespace AV {
         
     }
 
+
+
+    bool hasLumaPlane(PixelFormat pixelFormat)
+    {
+        switch (pixelFormat) {
+            case PIX_FMT_GRAY8:
+            case PIX_FMT_YUV420P:
+            case PIX_FMT_YUV422P:
+            case PIX_FMT_YUV444P:
+            case PIX_FMT_YUV410P:
+            case PIX_FMT_YUV411P:
+            case PIX_FMT_YUV440P:
+            case PIX_FMT_YUVJ420P:
+            case PIX_FMT_YUVJ422P:
+            case PIX_FMT_YUVJ444P:
+            case PIX_FMT_YUVJ440P:
+            case PIX_FMT_YUVA420P:
+            case PIX_FMT_NV12:
+            case PIX_FMT_NV21:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+
+
+    struct FramePool::Shared {
+        int width, height;      // Zero for frames with no buffers
+        PixelFormat pixelFormat;
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Frame>> free;
+        size_t numAllocated;
+    };
+
+
+    FramePool::FramePool()
+     : FramePool(0, 0, PIX_FMT_NONE)
+    {
+    }
+
+
+    FramePool::FramePool(int width, int height, PixelFormat pixelFormat)
+     : shared_(std::make_shared<Shared>())
+    {
+        shared_->width = width;
+        shared_->height = height;
+        shared_->pixelFormat = pixelFormat;
+        shared_->numAllocated = 0;
+    }
+
+
+    std::shared_ptr<Frame> FramePool::acquire()
+    {
+        std::unique_ptr<Frame> frame;
+
+        {
+            std::lock_guard<std::mutex> lock(shared_->mutex);
+
+            if (!shared_->free.empty()) {
+                frame = std::move(shared_->free.back());
+                shared_->free.pop_back();
+            }
+            else
+                ++shared_->numAllocated;
+        }
+
+        if (!frame)
+            frame.reset((shared_->width == 0)?
+                            new Frame()
+                          : new Frame(shared_->width, shared_->height,
+                                      shared_->pixelFormat));
+
+        // Put it back rather than freeing it; holding on to the shared
+        // state keeps somewhere to put it back to
+        std::shared_ptr<Shared> shared = shared_;
+
+        return std::shared_ptr<Frame>(frame.release(), [shared] (Frame* f) {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->free.emplace_back(f);
+        });
+    }
+
+
+    size_t FramePool::numAllocated() const
+    {
+        std::lock_guard<std::mutex> lock(shared_->mutex);
+        return shared_->numAllocated;
+    }
+
 }
 
 
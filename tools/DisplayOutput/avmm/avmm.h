@@ -4,6 +4,9 @@
 
 #include <string>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 extern "C" struct AVFormatContext;
 extern "C" struct AVCodecContext;
@@ -15,6 +18,10 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+// From libavcodec 55, decoders can hand over their buffers reference
+// counted, so a decoded frame can be kept without copying
+#define AVMM_REFCOUNTED_FRAMES (LIBAVCODEC_VERSION_MAJOR >= 55)
+
 
 
 namespace AV {
@@ -81,6 +88,13 @@ namespace AV {
         void deinterlace();
         // Deinterlace the picture
 
+        bool isInterlaced() const;
+        // Whether the decoder marked the picture as interlaced
+
+        void unreference();
+        // Let go of any buffers a decoder handed over by reference, before
+        // decoding into the frame again
+
         // Temporary debugging output to tmp.ppm
         void writePPM() const;
 
@@ -90,6 +104,36 @@ namespace AV {
     };
 
 
+    bool hasLumaPlane(PixelFormat pixelFormat);
+    // Whether the first plane is full-size 8-bit luma, as for planar YUV
+    // and greyscale, so it can be used as a greyscale image as it is
+
+
+    class FramePool {
+    public:
+        FramePool();
+        // Frames with no buffers of their own, to decode into
+
+        FramePool(int width, int height, PixelFormat pixelFormat);
+        // Frames all of the one size and format
+
+        std::shared_ptr<Frame> acquire();
+        // A frame, reused from one released earlier where possible, and
+        // otherwise newly allocated.  It goes back to the pool when the
+        // last copy of the pointer goes; this may be after the pool has
+        // gone, and from any thread.
+
+        size_t numAllocated() const;
+        // How many frames have been allocated in all, which stops growing
+        // once as many are being released as acquired
+
+    private:
+        struct Shared;
+        std::shared_ptr<Shared> shared_;
+        // Shared with the frames handed out
+    };
+
+
     class CodecContext {
     public:
 
@@ -0,0 +1,106 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <cstddef>
+
+
+template <typename T>
+class SPSCQueue {
+    // A bounded queue for exactly one thread to push onto and one other to
+    // pop from, with no locks: each end only ever writes its own index, and
+    // publishes it after the element it covers.  Neither end waits; that is
+    // up to the caller.
+
+public:
+
+    SPSCQueue(size_t capacity);
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator = (const SPSCQueue&) = delete;
+
+    bool tryPush(T&& value);
+    // Producer only.  False (leaving value alone) if the queue is full.
+
+    bool tryPop(T& value);
+    // Consumer only.  False if the queue is empty.
+
+    bool empty() const;
+    // Consumer only
+
+    size_t capacity() const;
+
+private:
+
+    // One more slot than the capacity, so full and empty differ
+    std::vector<T> slots_;
+
+    // Kept on separate cache lines, so the two ends don't contend
+    char padding0_[64];
+    std::atomic<size_t> head_;      // Next to pop; written by the consumer
+    char padding1_[64];
+    std::atomic<size_t> tail_;      // Next to push; written by the producer
+    char padding2_[64];
+
+};
+
+
+template <typename T>
+SPSCQueue<T>::SPSCQueue(size_t capacity)
+ : slots_(capacity + 1), head_(0), tail_(0)
+{
+}
+
+
+template <typename T>
+bool SPSCQueue<T>::tryPush(T&& value)
+{
+    const size_t tail = tail_.load(std::memory_order_relaxed),
+                 next = (tail + 1) % slots_.size();
+
+    if (next == head_.load(std::memory_order_acquire))
+        return false;
+
+    slots_[tail] = std::move(value);
+    tail_.store(next, std::memory_order_release);
+
+    return true;
+}
+
+
+template <typename T>
+bool SPSCQueue<T>::tryPop(T& value)
+{
+    const size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire))
+        return false;
+
+    value = std::move(slots_[head]);
+    slots_[head] = T();     // Let go of anything it holds
+    head_.store((head + 1) % slots_.size(), std::memory_order_release);
+
+    return true;
+}
+
+
+template <typename T>
+bool SPSCQueue<T>::empty() const
+{
+    return head_.load(std::memory_order_relaxed)
+            == tail_.load(std::memory_order_acquire);
+}
+
+
+template <typename T>
+size_t SPSCQueue<T>::capacity() const
+{
+    return slots_.size() - 1;
+}
+
+
+#endif
+
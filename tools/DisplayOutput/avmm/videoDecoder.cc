@@ -0,0 +1,205 @@
+// Copyright (C) 2013 Timothy Gale
+#include "videoDecoder.h"
+
+#include <chrono>
+#include <algorithm>
+
+
+static void backOff(unsigned int& attempts)
+{
+    // Waiting on the lock-free queue: give up the processor for a while,
+    // then (when it has been a while) sleep, so an idle wait stays cheap
+    if (attempts++ < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+
+namespace AV {
+
+    VideoDecoder::VideoDecoder(const std::string& filename,
+                               PixelFormat pixelFormat,
+                               size_t queueLength, bool deinterlace)
+     : formatContext_(filename),
+       pixelFormat_(pixelFormat),
+       deinterlace_(deinterlace),
+       lumaDirect_(false),
+       queue_(std::max<size_t>(1, queueLength)),
+       finished_(false), stopping_(false)
+    {
+        formatContext_.findStreamInfo();
+
+        // Get which stream to read and the codec
+        AVCodec* codec;
+        stream_ = formatContext_.findBestStream(AVMEDIA_TYPE_VIDEO,
+                                                -1, -1, &codec);
+
+        // Open a decoding context with the codec
+        codecContext_ = formatContext_.getStreamCodecContext(stream_);
+#if AVMM_REFCOUNTED_FRAMES
+        // Frames keep the decoder's buffers for as long as they are used
+        codecContext_.get()->refcounted_frames = 1;
+#endif
+        codecContext_.open(codec);
+
+        // Planar YUV already has the greyscale image, as its luma plane
+        lumaDirect_ = AVMM_REFCOUNTED_FRAMES
+                        && pixelFormat_ == PIX_FMT_GRAY8
+                        && hasLumaPlane(codecContext_.pixelFormat());
+
+        swsContext_ = SWS::Context(codecContext_.width(),
+                                   codecContext_.height(),
+                                   codecContext_.pixelFormat(),
+                                   codecContext_.width(),
+                                   codecContext_.height(),
+                                   pixelFormat_,
+                                   SWS_POINT);
+
+        pool_ = FramePool(codecContext_.width(), codecContext_.height(),
+                          pixelFormat_);
+
+        thread_ = std::thread(&VideoDecoder::run, this);
+    }
+
+
+    VideoDecoder::~VideoDecoder()
+    {
+        stopping_ = true;
+        thread_.join();
+    }
+
+
+    int VideoDecoder::width() const
+    {
+        return codecContext_.width();
+    }
+
+
+    int VideoDecoder::height() const
+    {
+        return codecContext_.height();
+    }
+
+
+    PixelFormat VideoDecoder::pixelFormat() const
+    {
+        return pixelFormat_;
+    }
+
+
+    bool VideoDecoder::lumaDirect() const
+    {
+        return lumaDirect_;
+    }
+
+
+    bool VideoDecoder::tryNext(std::shared_ptr<Frame>& frame)
+    {
+        return queue_.tryPop(frame);
+    }
+
+
+    bool VideoDecoder::atEnd()
+    {
+        // Finished first: only then is an empty queue going to stay so
+        if (!finished_.load(std::memory_order_acquire) || !queue_.empty())
+            return false;
+
+        if (error_)
+            std::rethrow_exception(error_);
+
+        return true;
+    }
+
+
+    bool VideoDecoder::next(std::shared_ptr<Frame>& frame)
+    {
+        unsigned int attempts = 0;
+
+        while (!tryNext(frame)) {
+
+            if (atEnd())
+                return false;
+
+            backOff(attempts);
+        }
+
+        return true;
+    }
+
+
+    size_t VideoDecoder::numFramesAllocated() const
+    {
+        return decodePool_.numAllocated() + pool_.numAllocated();
+    }
+
+
+    void VideoDecoder::run()
+    {
+        try {
+            while (!stopping_) {
+
+                Packet packet;
+
+                // Check for end of file
+                if (formatContext_.readFrame(&packet))
+                    break;
+
+                if (packet.streamIndex() == stream_)
+                    decode(packet);
+            }
+
+            // Empty packets then give the frames the decoder is still
+            // holding (to reorder them, or on its other threads)
+            while (!stopping_ && decode(Packet()))
+                ;
+        }
+        catch (...) {
+            error_ = std::current_exception();
+        }
+
+        finished_.store(true, std::memory_order_release);
+    }
+
+
+    bool VideoDecoder::decode(const Packet& packet)
+    {
+        // Without reference counting, the decoder reuses its buffers, and
+        // so does this one frame from the pool
+        std::shared_ptr<Frame> decoded = decodePool_.acquire();
+        decoded->unreference();
+
+        if (!codecContext_.decodeVideo(&*decoded, packet))
+            return false;
+
+        const bool deinterlace = deinterlace_ && decoded->isInterlaced();
+
+        std::shared_ptr<Frame> frame;
+
+        if (lumaDirect_ && !deinterlace)
+            frame = decoded;
+        else {
+            // Deinterlacing is in place, so only on a copy: the decoder
+            // may still need its buffers for later frames
+            frame = pool_.acquire();
+            swsContext_.scale(&*frame, *decoded);
+
+            if (deinterlace)
+                frame->deinterlace();
+        }
+
+        // Wait for room
+        unsigned int attempts = 0;
+        while (!queue_.tryPush(std::move(frame))) {
+            if (stopping_)
+                break;
+
+            backOff(attempts);
+        }
+
+        return true;
+    }
+
+}
+
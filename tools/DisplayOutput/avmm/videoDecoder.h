@@ -0,0 +1,96 @@
+// Copyright (C) 2013 Timothy Gale
+#ifndef VIDEO_DECODER_H
+#define VIDEO_DECODER_H
+
+#include "avmm.h"
+#include "spscQueue.h"
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <exception>
+
+
+namespace AV {
+
+    class VideoDecoder {
+    public:
+
+        VideoDecoder(const std::string& filename, PixelFormat pixelFormat,
+                     size_t queueLength = 4, bool deinterlace = true);
+        // Open the best video stream of the file, and start decoding it
+        // on a thread of its own into frames of pixelFormat, at most
+        // queueLength ahead of whoever is taking them.  The frames come
+        // from a pool, so once they are being released as fast as they are
+        // taken, none are allocated.  Frames the decoder marks as
+        // interlaced are deinterlaced if asked.
+        //
+        // For greyscale (PIX_FMT_GRAY8) from planar YUV, where the decoder
+        // hands over its buffers (see lumaDirect), there is no conversion
+        // or copying: the frames are the decoder's own, in its format, and
+        // their first plane (getData and getLinesize) is the greyscale
+        // image.
+
+        ~VideoDecoder();
+        // Stop decoding; frames already taken are still valid
+
+        VideoDecoder(const VideoDecoder&) = delete;
+        VideoDecoder& operator = (const VideoDecoder&) = delete;
+
+        int width() const;
+        int height() const;
+        PixelFormat pixelFormat() const;
+        // Of the frames produced
+
+        bool lumaDirect() const;
+        // Whether frames are the decoder's own, with only their first
+        // plane to be used
+
+        bool tryNext(std::shared_ptr<Frame>& frame);
+        // Take the next frame if it has been decoded, without waiting.
+        // Only one thread may take frames.
+
+        bool atEnd();
+        // True once all the frames have been taken.  Rethrows whatever
+        // stopped the decoding early.
+
+        bool next(std::shared_ptr<Frame>& frame);
+        // Wait for the next frame.  False at the end of the video, or
+        // rethrows as atEnd.
+
+        size_t numFramesAllocated() const;
+        // By the pools (to decode and convert into) so far
+
+    private:
+
+        FormatContext formatContext_;
+        CodecContext codecContext_;
+        SWS::Context swsContext_;
+        int stream_;
+
+        PixelFormat pixelFormat_;
+        bool deinterlace_, lumaDirect_;
+
+        FramePool decodePool_;      // To decode into
+        FramePool pool_;            // To convert into
+        SPSCQueue<std::shared_ptr<Frame>> queue_;
+
+        // error_ is set before finished_, and only read after
+        std::atomic<bool> finished_, stopping_;
+        std::exception_ptr error_;
+
+        std::thread thread_;
+
+        void run();
+
+        bool decode(const Packet& packet);
+        // Decode a packet of the stream, queuing the picture (if any came
+        // out).  Returns whether there was one.
+    };
+
+}
+
+
+#endif
+
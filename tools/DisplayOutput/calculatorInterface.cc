@@ -80,10 +80,12 @@ CalculatorInterface::CalculatorInterface(cl::Context& context,
 
 #include <cstring>
 
-void CalculatorInterface::processImage(const void* data, size_t length)
+void CalculatorInterface::processImage(const void* data, size_t length,
+                                       size_t rowPitch)
 {
     // Upload using OpenCL, not copying the data into its own memory.  This
-    // means we can't use the data until the transfer is done.
+    // means we can't use the data until the transfer is done.  The rows
+    // can be spaced out, so a decoder's luma plane goes as it is.
     cq_.enqueueWriteImage(imageGreyscale_, 
                           // Don't block
                           CL_FALSE, 
@@ -91,7 +93,7 @@ void CalculatorInterface::processImage(const void* data, size_t length)
                           makeCLSizeT<3>({0, 0, 0}), 
                           makeCLSizeT<3>({width_, height_, 1}), 
                           // Stride and data pointer
-                          0, 0, data,
+                          rowPitch, 0, data,
                           nullptr, &imageGreyscaleDone_);
 
     imageToImageBuffer_(cq_, imageGreyscale_, bufferGreyscale_,
@@ -86,7 +86,10 @@ public:
                         const cl::Device& device,
                         int width, int height);
 
-    void processImage(const void* data, size_t length);
+    void processImage(const void* data, size_t length, size_t rowPitch = 0);
+    // Start on an 8-bit greyscale image, rowPitch bytes from the start of
+    // one row to the next (or width, if zero).  data must stay valid until
+    // isDone.
 
     bool isDone();
     void waitUntilDone();
@@ -23,8 +23,11 @@ std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context>
 typedef std::chrono::duration<double, std::milli>
     DurationMilliseconds;
 
-int main(void)
+int main(int argc, char* argv[])
 {
+    // The capture device, e.g. one made by the vivid driver for testing
+    const char* device = (argc > 1)? argv[1] : "/dev/video0";
+
     const size_t width = 1280, height = 720;
     //const size_t width = 640, height = 480;
     Viewer viewer(width, height);
@@ -50,9 +53,14 @@ int main(void)
     // Set up the keypoint transfer format
     viewer.setNumFloatsPerKeypoint(ci1.getNumFloatsPerKeypointLocation());
 
-    VideoReader videoReader("/dev/video0", width, height);
+    // Capture into pinned memory, so frames upload without a copy
+    cl::CommandQueue cq {context, devices[0]};
+    VideoReader videoReader(device, width, height, context, cq);
     videoReader.startCapture();
 
+    if (!videoReader.isPinned())
+        std::cout << "Capturing into the driver's buffers\n";
+
     auto prevTime = std::chrono::system_clock::now();
     int n = 0;
 
@@ -65,7 +73,8 @@ int main(void)
             VideoReaderBuffer buffer = videoReader.getFrame();
 
             // Set it being processed
-            ready.front()->processImage(buffer.start, buffer.length);
+            ready.front()->processImage(buffer.start, buffer.length,
+                                        buffer.bytesPerLine);
 
             // Transfer the calculator to the processing queue
             processing.push(std::make_pair(ready.front(), buffer));
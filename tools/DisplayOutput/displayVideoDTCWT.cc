@@ -8,6 +8,7 @@
 #include <GL/glx.h>
 
 #include "avmm/avmm.h"
+#include "avmm/videoDecoder.h"
 
 #include "hdf5/hdfwriter.h"
 
@@ -18,6 +19,7 @@
 #include <tuple>
 #include <stdexcept>
 #include <memory>
+#include <future>
 
 
 std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context> 
@@ -27,25 +29,19 @@ typedef std::chrono::duration<double, std::milli>
     DurationMilliseconds;
 
 
-void writeResults(cl::CommandQueue& cq, Calculator& cal, int numKeypoints,
-                  HDFWriter& output)
+void writeResults(std::queue<std::future<KeypointData>>& pending,
+                  HDFWriter& output, size_t maxPending)
 {
-    // Read the locations
-    std::vector<cl_float> locations(4*numKeypoints);
-    cq.enqueueReadBuffer(cal.keypointLocations(), CL_FALSE, 0, 
-                         sizeof(cl_float) * locations.size(), 
-                         &locations[0]);
-
-    // Read the descriptors
-    std::vector<cl_float> descriptors(2*6*14*numKeypoints);
-    cq.enqueueReadBuffer(cal.keypointDescriptors(), CL_FALSE, 0, 
-                         sizeof(cl_float) * descriptors.size(),
-                         &descriptors[0]);
-
-    // Write them all out, when ready
-    cq.finish();
-
-    output.append(numKeypoints, &locations[0], &descriptors[0]);
+    // Write out the oldest of the pending readbacks until there are no more
+    // than maxPending left.  Their memory is reused by the next readback
+    // from the same calculator, so they need writing before then.
+    while (pending.size() > maxPending) {
+
+        KeypointData data = pending.front().get();
+        pending.pop();
+
+        output.append(data.numKeypoints, data.locations, data.descriptors);
+    }
 }
 
 
@@ -62,31 +58,13 @@ int main(int argc, char* argv[])
 
     bool writeOutput = argc == 3;
 
-    // Initialise the video reader
-    AV::FormatContext formatContext {argv[1]};
-    formatContext.findStreamInfo();
-
-    // Get which stream to read and the codec
-    AVCodec* codec;
-    int stream = formatContext.findBestStream(AVMEDIA_TYPE_VIDEO, 
-                                              -1, -1, 
-                                              &codec);
-
-    // Open a decoding context with the codec
-    AV::CodecContext codecContext 
-        {formatContext.getStreamCodecContext(stream)};
-    codecContext.open(codec);
-
-    SWS::Context swsContext {
-        codecContext.width(), codecContext.height(),
-        codecContext.pixelFormat(),
-        codecContext.width(), codecContext.height(),
-        PIX_FMT_YUV422P,
-        SWS_POINT
-    };
+    // Decode the video on a thread of its own, a few frames ahead.  Only
+    // the greyscale is used, which for planar YUV is the luma plane as
+    // decoded, with no conversion.
+    AV::VideoDecoder decoder {argv[1], PIX_FMT_GRAY8};
 
-    const size_t width = codecContext.width(), 
-                 height = codecContext.height();
+    const size_t width = decoder.width(), 
+                 height = decoder.height();
     //const size_t width = 640, height = 480;
     Viewer viewer(width, height);
 
@@ -116,8 +94,18 @@ int main(int argc, char* argv[])
 
     HDFWriter fileOutput;
     
+    // Write a second or so of frames at a time, away from this thread
+    HDFWriterSettings fileSettings;
+    fileSettings.flushFrames = 32;
+
     if (writeOutput) 
-        fileOutput = HDFWriter(argv[2], 2*6*14);
+        fileOutput = HDFWriter(argv[2], 
+                        ci1.getCalculator().numFloatsPerDescriptor(),
+                        ci1.getNumFloatsPerKeypointLocation(),
+                        fileSettings);
+
+    // Keypoint readbacks that have not been written out yet
+    std::queue<std::future<KeypointData>> pendingWrites;
 
 
     auto prevTime = std::chrono::system_clock::now();
@@ -130,48 +118,26 @@ int main(int argc, char* argv[])
 
         if (!eof && !ready.empty()) {
             
-            // Acquire the new image
-
-            AV::Packet packet;
-
-            // Check for end of file
-            if (formatContext.readFrame(&packet)) {
-                eof = true;
-                continue;
-            }
+            // Take the next image, if it is ready yet
+            std::shared_ptr<AV::Frame> formattedFrame;
 
+            if (decoder.tryNext(formattedFrame)) {
 
-            if (packet.get()->stream_index == stream) {
+                // Set it being processed
+                ready.front()->processImage(formattedFrame->getData(),
+                                        formattedFrame->getLinesize() 
+                                         * formattedFrame->getHeight(),
+                                        formattedFrame->getLinesize());
 
-                AV::Frame frame;
+                // Transfer the calculator to the processing queue.  The
+                // frame goes back to the decoder's pool once it's done.
+                processing.push(std::make_pair(ready.front(), 
+                                               formattedFrame));
+                ready.pop();
 
-                if (codecContext.decodeVideo(&frame, packet)) {
-
-                    frame.deinterlace();
-
-                    std::shared_ptr<AV::Frame>
-                        formattedFrame {
-                            new AV::Frame {
-                                codecContext.width(), 
-                                codecContext.height(),
-                                PIX_FMT_YUV422P
-                            }
-                        };
-
-                    swsContext.scale(&*formattedFrame, frame);
-
-                    // Set it being processed
-                    ready.front()->processImage(formattedFrame->getData(),
-                                            formattedFrame->getWidth() 
-                                             * formattedFrame->getHeight());
-
-                    // Transfer the calculator to the processing queue
-                    processing.push(std::make_pair(ready.front(), 
-                                                   formattedFrame));
-                    ready.pop();
-
-                }
             }
+            else if (decoder.atEnd())
+                eof = true;
 
         }
 
@@ -195,9 +161,14 @@ int main(int argc, char* argv[])
                 viewer.setKeypointLocations(ci->getKeypointLocations(),
                                             numKPs);
 
-                // Write to file
-                if (writeOutput)
-                    writeResults(cq, ci->getCalculator(), numKPs, fileOutput);
+                // Write to file, without waiting on this frame's
+                // readback.  There are three calculators in rotation, so
+                // any older than the last two must be written before
+                // this one's next readback can start.
+                if (writeOutput) {
+                    writeResults(pendingWrites, fileOutput, 2);
+                    pendingWrites.push(ci->getCalculator().readKeypoints());
+                }
 
                 viewer.update();
 
@@ -228,6 +199,8 @@ int main(int argc, char* argv[])
             break;
     }
 
+    writeResults(pendingWrites, fileOutput, 0);
+
     return 0;
 }
 
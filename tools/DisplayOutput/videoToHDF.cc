@@ -0,0 +1,450 @@
+// Copyright (C) 2013 Timothy Gale
+//
+// Headless counterpart to displayVideoDTCWT: finds the keypoints and
+// descriptors in every frame of a video and writes them to an HDF file,
+// with no display and no OpenGL.  The stages run side by side:
+//
+//   decoder thread:    demuxing, decoding and (unless the luma plane can
+//                      be used as it is) conversion to greyscale
+//   main thread:       upload, and queuing the transform, detection and
+//                      description on whichever Calculator is free
+//   OpenCL callbacks:  reading the keypoints back
+//   collector thread:  handing the keypoints to the HDFWriter
+//   HDFWriter thread:  writing to the file
+//
+// Several Calculators are kept in flight, so the device always has the
+// next frame to get on with.
+
+#include "avmm/avmm.h"
+#include "avmm/videoDecoder.h"
+
+#include "DisplayOutput/calculator.h"
+#include "Filter/ImageToImageBuffer/imageToImageBuffer.h"
+#include "hdf5/hdfwriter.h"
+#include "util/clUtil.h"
+
+#include <chrono>
+#include <tuple>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+
+
+typedef std::chrono::steady_clock Clock;
+typedef std::chrono::duration<double, std::milli> DurationMilliseconds;
+
+
+struct Slot {
+    // A Calculator, with what it needs to take a greyscale frame
+
+    Slot(cl::Context& context, const cl::Device& device,
+         int width, int height);
+
+    Calculator calculator;
+    cl::CommandQueue cq;
+
+    ImageToImageBuffer imageToImageBuffer;
+    cl::Image2D image;
+    ImageBuffer<cl_float> buffer;
+};
+
+
+Slot::Slot(cl::Context& context, const cl::Device& device,
+           int width, int height)
+ : calculator(context, device, width, height),
+   cq(context, device),
+   imageToImageBuffer(context, {device}),
+   image(context, CL_MEM_READ_WRITE,
+         cl::ImageFormat(CL_LUMINANCE, CL_UNORM_INT8), width, height),
+   buffer(context, CL_MEM_READ_WRITE, width, height, 16, 32)
+{
+}
+
+
+
+struct InFlight {
+    Slot* slot;
+    std::shared_ptr<AV::Frame> frame;   // Kept until the upload is done
+    Clock::time_point submitted;
+    std::future<KeypointData> keypoints;
+};
+
+
+class Collector {
+    // Waits for the keypoints of each frame in turn, passes them to the
+    // writer, and then frees the Calculator for another frame
+
+public:
+
+    Collector(HDFWriter& output);
+    ~Collector();
+
+    Collector(const Collector&) = delete;
+    Collector& operator = (const Collector&) = delete;
+
+    void add(InFlight&& frame);
+
+    Slot* freeSlot();
+    // Waits for a Calculator that has finished.  Rethrows anything that
+    // went wrong with the readback or writing.
+
+    void release(Slot* slot);
+    // Make a Calculator available
+
+    void finish();
+    // Wait for everything added so far to be written
+
+    size_t numFrames();
+    size_t numKeypoints();
+    std::vector<double> latencies();
+    // Milliseconds from submitting to writing, for each frame
+    Clock::time_point doneTime(size_t frame);
+    // When frame (counting from zero) was written
+
+private:
+
+    HDFWriter& output_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<InFlight> queue_;
+    std::deque<Slot*> free_;
+    bool collecting_ = false, stopping_ = false;
+    std::exception_ptr error_;
+
+    size_t numKeypoints_ = 0;
+    std::vector<double> latencies_;
+    std::vector<Clock::time_point> done_;
+
+    std::thread thread_;
+
+    void rethrow();
+    void run();
+
+};
+
+
+Collector::Collector(HDFWriter& output)
+ : output_(output)
+{
+    thread_ = std::thread(&Collector::run, this);
+}
+
+
+Collector::~Collector()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+
+    thread_.join();
+}
+
+
+void Collector::rethrow()
+{
+    // With mutex_ held
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+
+void Collector::add(InFlight&& frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(frame));
+    }
+    changed_.notify_all();
+}
+
+
+void Collector::release(Slot* slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(slot);
+    }
+    changed_.notify_all();
+}
+
+
+Slot* Collector::freeSlot()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&] { return !free_.empty() || error_; });
+
+    rethrow();
+
+    Slot* slot = free_.front();
+    free_.pop_front();
+    return slot;
+}
+
+
+void Collector::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&] {
+        return (queue_.empty() && !collecting_) || error_;
+    });
+
+    rethrow();
+}
+
+
+size_t Collector::numFrames()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latencies_.size();
+}
+
+
+size_t Collector::numKeypoints()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return numKeypoints_;
+}
+
+
+std::vector<double> Collector::latencies()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latencies_;
+}
+
+
+Clock::time_point Collector::doneTime(size_t frame)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_.at(frame);
+}
+
+
+void Collector::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+
+        changed_.wait(lock, [&] { return !queue_.empty() || stopping_; });
+
+        if (queue_.empty())
+            return;
+
+        InFlight frame = std::move(queue_.front());
+        queue_.pop_front();
+        collecting_ = true;
+        lock.unlock();
+
+        // The readback's memory belongs to the Calculator, so it has to be
+        // appended (which copies it) before the Calculator is reused
+        size_t numKeypoints = 0;
+        std::exception_ptr error;
+
+        try {
+            KeypointData data = frame.keypoints.get();
+            output_.append(data.numKeypoints, data.locations,
+                           data.descriptors);
+            numKeypoints = data.numKeypoints;
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        lock.lock();
+        collecting_ = false;
+
+        if (error) {
+            if (!error_)
+                error_ = error;
+        }
+        else {
+            numKeypoints_ += numKeypoints;
+            latencies_.push_back(DurationMilliseconds(
+                                    now - frame.submitted).count());
+            done_.push_back(now);
+            free_.push_back(frame.slot);
+        }
+
+        changed_.notify_all();
+    }
+}
+
+
+
+std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context>
+    initOpenCL();
+
+
+int main(int argc, char* argv[])
+{
+    AV::registerAll();
+
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " VideoFilename OutputFilename.h5 [NumInFlight]"
+                  << std::endl;
+
+        return -1;
+    }
+
+    const size_t numInFlight = (argc > 3)?
+                                std::max(1, std::atoi(argv[3])) : 3;
+
+    try {
+
+        AV::VideoDecoder decoder(argv[1], PIX_FMT_GRAY8, 2 * numInFlight);
+
+        const int width = decoder.width(), height = decoder.height();
+
+        cl::Platform platform;
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        std::tie(platform, devices, context) = initOpenCL();
+
+        std::vector<std::unique_ptr<Slot>> slots;
+        for (size_t n = 0; n < numInFlight; ++n)
+            slots.emplace_back(new Slot(context, devices[0], width, height));
+
+        // Write a second or so of frames at a time, away from this thread
+        HDFWriterSettings fileSettings;
+        fileSettings.flushFrames = 32;
+
+        HDFWriter output(argv[2],
+                         slots[0]->calculator.numFloatsPerDescriptor(),
+                         slots[0]->calculator.numFloatsPerKPLocation(),
+                         fileSettings);
+
+        Collector collector(output);
+        for (auto& s: slots)
+            collector.release(s.get());
+
+        const Clock::time_point start = Clock::now();
+
+        std::shared_ptr<AV::Frame> decoded;
+        while (decoder.next(decoded)) {
+
+            Slot* slot = collector.freeSlot();
+
+            // Upload, not copying: the frame is kept with the keypoints
+            // until they are back, and so until the upload is done
+            const AV::Frame& frame = *decoded;
+            const Clock::time_point submitted = Clock::now();
+
+            cl::Event uploaded, converted;
+            slot->cq.enqueueWriteImage(slot->image, CL_FALSE,
+                                       makeCLSizeT<3>({0, 0, 0}),
+                                       makeCLSizeT<3>({size_t(width),
+                                                       size_t(height), 1}),
+                                       frame.getLinesize(), 0,
+                                       frame.getData(),
+                                       nullptr, &uploaded);
+
+            slot->imageToImageBuffer(slot->cq, slot->image, slot->buffer,
+                                     {uploaded}, &converted);
+            slot->cq.flush();
+
+            slot->calculator(slot->buffer, {converted});
+
+            InFlight inFlight;
+            inFlight.slot = slot;
+            inFlight.frame = decoded;
+            inFlight.submitted = submitted;
+            inFlight.keypoints = slot->calculator.readKeypoints();
+            collector.add(std::move(inFlight));
+        }
+
+        collector.finish();
+        output.flush();
+
+        const Clock::time_point end = Clock::now();
+
+        // Report
+        const size_t numFrames = collector.numFrames();
+        std::vector<double> latencies = collector.latencies();
+
+        std::cout << numFrames << " frames, "
+                  << collector.numKeypoints() << " keypoints, "
+                  << numInFlight << " in flight, "
+                  << decoder.numFramesAllocated() << " frames allocated\n";
+
+        if (numFrames > 0) {
+            std::cout << "Overall: "
+                      << numFrames / std::chrono::duration<double>
+                                        (end - start).count()
+                      << " fps\n";
+
+            // Steady state: leave out the frames that filled the pipeline
+            const size_t warmUp = std::min(numFrames - 1, 2 * numInFlight);
+            if (numFrames - warmUp > 1) {
+                const double seconds = std::chrono::duration<double>
+                    (collector.doneTime(numFrames - 1)
+                      - collector.doneTime(warmUp)).count();
+
+                std::cout << "Steady state: "
+                          << (numFrames - warmUp - 1) / seconds
+                          << " fps\n";
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+            double total = 0;
+            for (double l: latencies)
+                total += l;
+
+            std::cout << "Latency (submitted to written): mean "
+                      << total / numFrames << "ms, median "
+                      << latencies[numFrames / 2] << "ms, 95th percentile "
+                      << latencies[numFrames * 95 / 100] << "ms, max "
+                      << latencies.back() << "ms" << std::endl;
+        }
+
+    }
+    catch (cl::Error& err) {
+        std::cerr << err.what() << ": " << err.err() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context>
+    initOpenCL()
+{
+    // Get platform, devices, and a context with no OpenGL sharing
+
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    if (platforms.size() == 0)
+        throw std::runtime_error("No platforms!");
+
+    std::vector<cl::Device> devices;
+    platforms[0].getDevices(CL_DEVICE_TYPE_DEFAULT, &devices);
+
+    cl::Context context(devices);
+
+    return std::make_tuple(platforms[0], devices, context);
+}
@@ -0,0 +1,510 @@
+// Copyright (C) 2013 Timothy Gale
+//
+// Finds the keypoints and descriptors of a set of still images (e.g. a
+// directory of PNGs, JPEGs or EXRs), writing them to one HDF file, a frame
+// per image in the order given (directories sorted by name).  The OpenCL
+// pipeline is built once for each size of image rather than once per
+// image (keeping those of the few sizes used most recently), while a pool
+// of threads decodes the images ahead of it.
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "DisplayOutput/calculator.h"
+#include "Filter/ImageToImageBuffer/imageToImageBuffer.h"
+#include "hdf5/hdfwriter.h"
+#include "util/clUtil.h"
+
+#include <chrono>
+#include <tuple>
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <cctype>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static bool isDirectory(const std::string& path)
+{
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+
+static bool isImageFilename(std::string filename)
+{
+    const size_t dot = filename.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string extension = filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   ::tolower);
+
+    for (const char* e: {"png", "jpg", "jpeg", "exr", "tif", "tiff",
+                         "bmp", "pgm", "ppm"})
+        if (extension == e)
+            return true;
+
+    return false;
+}
+
+
+static std::vector<std::string> listImages(const std::string& directory)
+{
+    // The images in a directory, sorted by name
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        throw std::runtime_error("Can't read directory " + directory);
+
+    std::vector<std::string> filenames;
+    while (dirent* entry = readdir(dir))
+        if (isImageFilename(entry->d_name))
+            filenames.push_back(directory + "/" + entry->d_name);
+
+    closedir(dir);
+
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
+
+
+
+struct LoadedImage {
+    std::string filename;
+    cv::Mat pixels;     // Greyscale floats from 0 to 1; empty if unreadable
+};
+
+
+static cv::Mat loadImage(const std::string& filename)
+{
+    // Keeping 16-bit and float images' depth, and scaling to 0-1 as the
+    // video tools' 8-bit uploads are
+    cv::Mat image = cv::imread(filename, cv::IMREAD_GRAYSCALE
+                                         | cv::IMREAD_ANYDEPTH);
+    if (image.empty())
+        return image;
+
+    double scale = 1., offset = 0.;
+    switch (image.depth()) {
+        case CV_8U:  scale = 1. / 255.;    break;
+        case CV_16U: scale = 1. / 65535.;  break;
+
+        case CV_32F:
+        case CV_64F: {
+            // Floats (e.g. high dynamic range EXRs) have no fixed range:
+            // those not already within 0-1 are stretched to fill it
+            double minValue, maxValue;
+            cv::minMaxLoc(image, &minValue, &maxValue);
+
+            if (minValue < 0. || maxValue > 1.) {
+                scale = (maxValue > minValue)?
+                            1. / (maxValue - minValue) : 0.;
+                offset = -minValue * scale;
+            }
+            break;
+        }
+
+        default: break;
+    }
+
+    cv::Mat pixels;
+    image.convertTo(pixels, CV_32F, scale, offset);
+    return pixels;
+}
+
+
+
+class ImageReader {
+    // Decodes the images on a pool of threads, up to a limited number
+    // ahead, handing them out in order
+
+public:
+
+    ImageReader(const std::vector<std::string>& filenames,
+                size_t numThreads, size_t maxAhead);
+    ~ImageReader();
+
+    ImageReader(const ImageReader&) = delete;
+    ImageReader& operator = (const ImageReader&) = delete;
+
+    bool next(LoadedImage& image);
+    // Waits for the next image.  False once they have all been taken.
+
+private:
+
+    std::vector<std::string> filenames_;
+    size_t maxAhead_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::map<size_t, LoadedImage> loaded_;
+    size_t nextToLoad_ = 0, nextToTake_ = 0;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+
+    void run();
+
+};
+
+
+ImageReader::ImageReader(const std::vector<std::string>& filenames,
+                         size_t numThreads, size_t maxAhead)
+ : filenames_(filenames), maxAhead_(std::max<size_t>(1, maxAhead))
+{
+    for (size_t n = 0; n < std::max<size_t>(1, numThreads); ++n)
+        threads_.emplace_back(&ImageReader::run, this);
+}
+
+
+ImageReader::~ImageReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+
+    for (auto& t: threads_)
+        t.join();
+}
+
+
+bool ImageReader::next(LoadedImage& image)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (nextToTake_ == filenames_.size())
+        return false;
+
+    changed_.wait(lock, [&] { return loaded_.count(nextToTake_) != 0; });
+
+    auto loaded = loaded_.find(nextToTake_);
+    image = std::move(loaded->second);
+    loaded_.erase(loaded);
+    ++nextToTake_;
+
+    changed_.notify_all();
+    return true;
+}
+
+
+void ImageReader::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+
+        changed_.wait(lock, [&] {
+            return stopping_
+                || (nextToLoad_ < filenames_.size()
+                    && nextToLoad_ < nextToTake_ + maxAhead_);
+        });
+
+        if (stopping_)
+            return;
+
+        const size_t index = nextToLoad_++;
+        lock.unlock();
+
+        LoadedImage image;
+        image.filename = filenames_[index];
+
+        try {
+            image.pixels = loadImage(image.filename);
+        }
+        catch (cv::Exception&) {
+            // Treated as unreadable, below
+        }
+
+        lock.lock();
+        loaded_[index] = std::move(image);
+        changed_.notify_all();
+    }
+}
+
+
+
+struct Slot {
+    // A Calculator for one size of image, with what it needs to take a
+    // float image
+
+    Slot(cl::Context& context, const cl::Device& device,
+         int width, int height);
+
+    Calculator calculator;
+    cl::CommandQueue cq;
+
+    ImageToImageBuffer imageToImageBuffer;
+    cl::Image2D image;
+    ImageBuffer<cl_float> buffer;
+
+    bool busy = false;      // Until its keypoints have been written
+};
+
+
+Slot::Slot(cl::Context& context, const cl::Device& device,
+           int width, int height)
+ : calculator(context, device, width, height),
+   cq(context, device),
+   imageToImageBuffer(context, {device}),
+   image(context, CL_MEM_READ_WRITE,
+         cl::ImageFormat(CL_LUMINANCE, CL_FLOAT), width, height),
+   buffer(context, CL_MEM_READ_WRITE, width, height, 16, 32)
+{
+}
+
+
+struct SizeGroup {
+    // The Calculators for one size of image, used in turn
+    std::vector<std::unique_ptr<Slot>> slots;
+    size_t next = 0;
+    size_t lastUsed = 0;    // Image number it last took
+};
+
+typedef std::map<std::pair<int, int>, SizeGroup> SizeGroups;
+// By width and height
+
+
+struct Pending {
+    Slot* slot;             // Null if the image couldn't be read
+    cv::Mat pixels;         // Kept until the upload is done
+    std::future<KeypointData> keypoints;
+};
+
+
+static size_t writeOldest(std::deque<Pending>& pending, HDFWriter& output)
+{
+    // Write the oldest image's keypoints, freeing its Calculator; returns
+    // how many there were
+    Pending& p = pending.front();
+    size_t numKeypoints = 0;
+
+    if (p.slot != nullptr) {
+        KeypointData data = p.keypoints.get();
+        output.append(data.numKeypoints, data.locations, data.descriptors);
+        numKeypoints = data.numKeypoints;
+
+        p.slot->busy = false;
+    }
+    else
+        output.append(0, nullptr, nullptr);
+
+    pending.pop_front();
+    return numKeypoints;
+}
+
+
+std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context>
+    initOpenCL();
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " OutputFilename.h5 (ImageDirectory | ImageFilename)..."
+                  << std::endl;
+
+        return -1;
+    }
+
+    // Images kept in flight for each size, sizes with pipelines kept (the
+    // device memory of each being much the same as the video tools'), and
+    // threads to read them
+    const size_t numInFlight = 3;
+    const size_t maxNumGroups = 4;
+    const size_t numReaders
+        = std::max<size_t>(2, std::thread::hardware_concurrency());
+
+    try {
+
+        std::vector<std::string> filenames;
+        for (int n = 2; n < argc; ++n) {
+            if (isDirectory(argv[n])) {
+                std::vector<std::string> images = listImages(argv[n]);
+                filenames.insert(filenames.end(),
+                                 images.begin(), images.end());
+            }
+            else
+                filenames.push_back(argv[n]);
+        }
+
+        cl::Platform platform;
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        std::tie(platform, devices, context) = initOpenCL();
+
+        ImageReader reader(filenames, numReaders, 2 * numReaders);
+
+        // Created with the first Calculator, which knows the lengths.
+        // Unreadable images before then wait in pending, like the rest.
+        HDFWriter output;
+
+        HDFWriterSettings fileSettings;
+        fileSettings.flushFrames = 32;
+
+        SizeGroups groups;
+        std::deque<Pending> pending;
+
+        size_t numImages = 0, numUnreadable = 0, numKeypoints = 0;
+        size_t numBuilt = 0;
+        double setupSeconds = 0;
+
+        const Clock::time_point start = Clock::now();
+
+        LoadedImage loaded;
+        while (reader.next(loaded)) {
+
+            ++numImages;
+
+            if (loaded.pixels.empty()) {
+                // Still a frame, so frames and images stay in step
+                std::cerr << "Can't read " << loaded.filename << std::endl;
+                ++numUnreadable;
+
+                pending.push_back(Pending {nullptr, cv::Mat(), {}});
+                continue;
+            }
+
+            const int width = loaded.pixels.cols,
+                      height = loaded.pixels.rows;
+
+            const std::pair<int, int> size = std::make_pair(width, height);
+
+            // Not a size with pipelines: make room, by finishing with the
+            // size used longest ago, then build them
+            if (groups.count(size) == 0) {
+
+                if (groups.size() == maxNumGroups) {
+                    auto oldest = std::min_element(groups.begin(),
+                                                   groups.end(),
+                        [] (const SizeGroups::value_type& a,
+                            const SizeGroups::value_type& b) {
+                            return a.second.lastUsed < b.second.lastUsed;
+                        });
+
+                    for (auto& s: oldest->second.slots)
+                        while (s->busy)
+                            numKeypoints += writeOldest(pending, output);
+
+                    groups.erase(oldest);
+                }
+
+                const Clock::time_point setupStart = Clock::now();
+
+                SizeGroup& group = groups[size];
+                for (size_t n = 0; n < numInFlight; ++n)
+                    group.slots.emplace_back(new Slot(context, devices[0],
+                                                      width, height));
+
+                if (numBuilt == 0)
+                    output = HDFWriter(argv[1],
+                        group.slots[0]->calculator.numFloatsPerDescriptor(),
+                        group.slots[0]->calculator.numFloatsPerKPLocation(),
+                        fileSettings);
+
+                ++numBuilt;
+                setupSeconds += std::chrono::duration<double>
+                                    (Clock::now() - setupStart).count();
+            }
+
+            SizeGroup& group = groups[size];
+            group.lastUsed = numImages;
+
+            Slot* slot = group.slots[group.next].get();
+            group.next = (group.next + 1) % group.slots.size();
+
+            // Its last image has to be written before it can take another
+            while (slot->busy)
+                numKeypoints += writeOldest(pending, output);
+
+            // Upload, not copying: the pixels are kept until the keypoints
+            // are back, and so until the upload is done
+            cl::Event uploaded, converted;
+            slot->cq.enqueueWriteImage(slot->image, CL_FALSE,
+                                       makeCLSizeT<3>({0, 0, 0}),
+                                       makeCLSizeT<3>({size_t(width),
+                                                       size_t(height), 1}),
+                                       loaded.pixels.step, 0,
+                                       loaded.pixels.ptr(),
+                                       nullptr, &uploaded);
+
+            slot->imageToImageBuffer(slot->cq, slot->image, slot->buffer,
+                                     {uploaded}, &converted);
+            slot->cq.flush();
+
+            slot->calculator(slot->buffer, {converted});
+
+            slot->busy = true;
+            pending.push_back(Pending {slot, loaded.pixels,
+                                       slot->calculator.readKeypoints()});
+        }
+
+        if (numBuilt == 0)
+            throw std::runtime_error("None of the images could be read");
+
+        while (!pending.empty())
+            numKeypoints += writeOldest(pending, output);
+
+        output.flush();
+
+        const double seconds = std::chrono::duration<double>
+                                    (Clock::now() - start).count();
+
+        // Report
+        std::cout << numImages << " images (" << numUnreadable
+                  << " unreadable), " << numKeypoints << " keypoints\n"
+                  << numImages / seconds << " images/second ("
+                  << setupSeconds << "s building pipelines, "
+                  << numBuilt << " times)" << std::endl;
+
+    }
+    catch (cl::Error& err) {
+        std::cerr << err.what() << ": " << err.err() << std::endl;
+        return -1;
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+std::tuple<cl::Platform, std::vector<cl::Device>, cl::Context>
+    initOpenCL()
+{
+    // Get platform, devices, and a context
+
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    if (platforms.size() == 0)
+        throw std::runtime_error("No platforms!");
+
+    std::vector<cl::Device> devices;
+    platforms[0].getDevices(CL_DEVICE_TYPE_DEFAULT, &devices);
+
+    cl::Context context(devices);
+
+    return std::make_tuple(platforms[0], devices, context);
+}